@@ -0,0 +1,64 @@
+#
+# - FindBLOSC module
+# Module to find the c-blosc compression library.
+#
+# Usage of this module as follows:
+#   find_package(BLOSC)
+#
+# Variables used by this module, they can change the default behaviour and need
+# to be set before calling find_package:
+#
+#  BLOSC_ROOT_DIR  Set this variable to the root installation of blosc if the
+#                  module has problems finding the proper installation path.
+#
+# After running the find, the variables below will be defined:
+#   BLOSC_FOUND              System has blosc libs/headers
+#   BLOSC_INCLUDE_DIRS       The location of blosc headers
+#   BLOSC_LIBRARIES          The blosc libraries
+#
+
+message("\nLooking for blosc headers and libraries")
+
+if (BLOSC_ROOT_DIR)
+  message(STATUS "Root dir: ${BLOSC_ROOT_DIR}")
+endif()
+
+if (UNIX)
+  find_package(PkgConfig)
+  pkg_search_module(blosc_pkg blosc)
+endif()
+
+find_path(BLOSC_INCLUDE_DIRS
+  blosc.h
+  HINTS
+    ${BLOSC_ROOT_DIR}
+    ${blosc_pkg_INCLUDEDIR}
+  PATH_SUFFIXES
+    include
+  DOC
+    "Include Directory for blosc"
+  )
+
+find_library(BLOSC_LIBRARIES
+  NAMES
+    blosc
+  HINTS
+    ${BLOSC_ROOT_DIR}
+    ${BLOSC_ROOT_DIR}/lib
+    ${blosc_pkg_LIBDIR}
+  )
+
+include(FindPackageHandleStandardArgs)
+
+find_package_handle_standard_args(BLOSC
+    DEFAULT_MSG
+    BLOSC_LIBRARIES
+    BLOSC_INCLUDE_DIRS
+)
+
+mark_as_advanced(BLOSC_LIBRARIES BLOSC_INCLUDE_DIRS)
+
+if (BLOSC_FOUND)
+  message(STATUS "Include directories: ${BLOSC_INCLUDE_DIRS}")
+  message(STATUS "Libraries: ${BLOSC_LIBRARIES}")
+endif ()
@@ -25,6 +25,13 @@ enum XspressState {
 
 #define XSP_MASK_END_OF_FRAME    ((u_int64_t)1<<59)     // Mask for End of Frame Marker.
 
+// HGT64 list mode event words, following the header word of each packet
+#define XSP_HGT64_EVENT_GET_ENERGY(x)  (((x)>>0)&0xFFFF)           // Get energy (ADC) value of an event
+#define XSP_HGT64_EVENT_GET_TIME(x)    (((x)>>16)&0xFFFFFFFFFFULL) // Get 40 bit time stamp of an event
+#define XSP_HGT64_EVENT_GET_FLAGS(x)   (((x)>>56)&0xF)             // Get flag bits of an event (includes end of frame)
+#define XSP_HGT64_EVENT_GET_CHAN(x)    (((x)>>60)&0xF)             // Get channel number of an event
+#define XSP_HGT64_MAX_CHANNELS   16                     // Channels addressable by the 4 bit channel field
+
 
 #define XSP_TRAILER_LWORDS       2
 #define XSP_10GTX_SOF            0x80000000
@@ -0,0 +1,380 @@
+/*
+ * XspressMetrics.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Diamond Light Source
+ */
+
+#ifndef XSPRESS_METRICS_H
+#define XSPRESS_METRICS_H
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include <log4cxx/logger.h>
+
+// Period at which the metrics server checks for shutdown while idle
+#define XSP_METRICS_POLL_MS 200
+// Address the metrics servers listen on unless configured otherwise
+#define XSP_METRICS_DEFAULT_ADDRESS "127.0.0.1"
+// Maximum size of an HTTP request read by the metrics server
+#define XSP_METRICS_MAX_REQUEST 4096
+// Timeout for reading an HTTP request
+#define XSP_METRICS_RECV_TIMEOUT_S 1
+
+#define XSP_METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+namespace Xspress
+{
+
+/**
+ * Bucket bounds in seconds suitable for per-stage processing latencies.
+ */
+inline std::vector<double> xspress_latency_buckets()
+{
+  double bounds[] = {0.00001, 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0};
+  return std::vector<double>(bounds, bounds + sizeof(bounds) / sizeof(bounds[0]));
+}
+
+/**
+ * Fixed bucket histogram for OpenMetrics export.
+ *
+ * Observations and copies are locked so a histogram can be filled by a
+ * processing thread and copied out by the thread rendering the metrics.
+ */
+class XspressMetricsHistogram
+{
+public:
+  XspressMetricsHistogram(const std::vector<double>& bounds = xspress_latency_buckets()) :
+    bounds_(bounds),
+    counts_(bounds.size() + 1, 0),
+    sum_(0.0),
+    count_(0)
+  {
+  }
+
+  XspressMetricsHistogram(const XspressMetricsHistogram& other)
+  {
+    boost::lock_guard<boost::mutex> lock(other.mutex_);
+    bounds_ = other.bounds_;
+    counts_ = other.counts_;
+    sum_ = other.sum_;
+    count_ = other.count_;
+  }
+
+  XspressMetricsHistogram& operator=(const XspressMetricsHistogram& other)
+  {
+    if (this != &other){
+      XspressMetricsHistogram copy(other);
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      bounds_.swap(copy.bounds_);
+      counts_.swap(copy.counts_);
+      sum_ = copy.sum_;
+      count_ = copy.count_;
+    }
+    return *this;
+  }
+
+  void observe(double value)
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    size_t bucket = 0;
+    while (bucket < bounds_.size() && value > bounds_[bucket]){
+      bucket++;
+    }
+    counts_[bucket]++;
+    sum_ += value;
+    count_++;
+  }
+
+  /** Upper bounds of the buckets, excluding +Inf */
+  std::vector<double> bounds_;
+  /** Non-cumulative count of observations in each bucket, the last is +Inf */
+  std::vector<uint64_t> counts_;
+  /** Sum of all observations */
+  double sum_;
+  /** Number of observations */
+  uint64_t count_;
+
+private:
+  mutable boost::mutex mutex_;
+};
+
+/**
+ * Builds an OpenMetrics text exposition.
+ *
+ * Metric names passed in should not include the _total suffix of counters,
+ * this is appended to the sample name as the format requires.
+ */
+class XspressMetricsWriter
+{
+public:
+  XspressMetricsWriter(const std::string& prefix) :
+    prefix_(prefix)
+  {
+  }
+
+  template<typename T>
+  void counter(const std::string& name, const std::string& help, T value)
+  {
+    family(name, "counter", help);
+    out_ << prefix_ << name << "_total " << value << "\n";
+  }
+
+  template<typename T>
+  void gauge(const std::string& name, const std::string& help, T value)
+  {
+    family(name, "gauge", help);
+    out_ << prefix_ << name << " " << value << "\n";
+  }
+
+  /**
+   * Write one gauge sample per element, labelled with the element index.
+   */
+  template<typename T>
+  void gauge(const std::string& name, const std::string& help, const std::string& label,
+             const std::vector<T>& values)
+  {
+    family(name, "gauge", help);
+    for (size_t index = 0; index < values.size(); index++){
+      out_ << prefix_ << name << "{" << label << "=\"" << index << "\"} " << values[index] << "\n";
+    }
+  }
+
+  template<typename T>
+  void counter(const std::string& name, const std::string& help, const std::string& label,
+               const std::vector<T>& values)
+  {
+    family(name, "counter", help);
+    for (size_t index = 0; index < values.size(); index++){
+      out_ << prefix_ << name << "_total{" << label << "=\"" << index << "\"} " << values[index] << "\n";
+    }
+  }
+
+  void histogram(const std::string& name, const std::string& help, const XspressMetricsHistogram& histogram)
+  {
+    XspressMetricsHistogram copy(histogram);
+    family(name, "histogram", help);
+    uint64_t cumulative = 0;
+    for (size_t index = 0; index < copy.bounds_.size(); index++){
+      cumulative += copy.counts_[index];
+      out_ << prefix_ << name << "_bucket{le=\"" << copy.bounds_[index] << "\"} " << cumulative << "\n";
+    }
+    out_ << prefix_ << name << "_bucket{le=\"+Inf\"} " << copy.count_ << "\n";
+    out_ << prefix_ << name << "_sum " << copy.sum_ << "\n";
+    out_ << prefix_ << name << "_count " << copy.count_ << "\n";
+  }
+
+  std::string str()
+  {
+    return out_.str() + "# EOF\n";
+  }
+
+private:
+  void family(const std::string& name, const std::string& type, const std::string& help)
+  {
+    out_ << "# TYPE " << prefix_ << name << " " << type << "\n";
+    out_ << "# HELP " << prefix_ << name << " " << help << "\n";
+  }
+
+  /** Prefix applied to all metric names */
+  std::string prefix_;
+  /** Exposition text */
+  std::ostringstream out_;
+};
+
+/**
+ * Minimal HTTP server exposing OpenMetrics text from a background thread.
+ *
+ * Each request is answered by calling the provider function and returning
+ * the text it renders, so the provider must be safe to call from the server
+ * thread. Requests are served one at a time and the connection is closed
+ * after each response, which is all a metrics scraper (or curl) needs.
+ */
+class XspressMetricsServer
+{
+public:
+  XspressMetricsServer() :
+    logger_(log4cxx::Logger::getLogger("Xspress.XspressMetricsServer")),
+    thread_(0),
+    running_(false),
+    listen_fd_(-1),
+    port_(0),
+    address_(XSP_METRICS_DEFAULT_ADDRESS)
+  {
+  }
+
+  ~XspressMetricsServer()
+  {
+    stop();
+  }
+
+  /**
+   * Start serving metrics on the given port and address. The loopback
+   * address is used by default so that metrics are only exposed beyond the
+   * host when an address is configured explicitly.
+   *
+   * \param[in] port - TCP port to listen on, 0 stops the server.
+   * \param[in] provider - function rendering the current metrics text.
+   * \param[in] address - IPv4 address to listen on, 0.0.0.0 for all interfaces.
+   * \return true if the server is listening.
+   */
+  bool start(int port, boost::function<std::string()> provider,
+             const std::string& address = XSP_METRICS_DEFAULT_ADDRESS)
+  {
+    if (port == port_ && address == address_ && thread_){
+      return true;
+    }
+    stop();
+    if (port <= 0){
+      return false;
+    }
+    struct in_addr listen_addr;
+    if (::inet_pton(AF_INET, address.c_str(), &listen_addr) != 1){
+      LOG4CXX_ERROR(logger_, "Invalid metrics listen address " << address);
+      return false;
+    }
+    address_ = address;
+
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0){
+      LOG4CXX_ERROR(logger_, "Could not create metrics socket: " << strerror(errno));
+      return false;
+    }
+    int reuse = 1;
+    ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr = listen_addr;
+    server.sin_port = htons(port);
+    if (::bind(listen_fd_, (struct sockaddr *)&server, sizeof(server)) < 0 ||
+        ::listen(listen_fd_, 4) < 0){
+      LOG4CXX_ERROR(logger_, "Could not listen for metrics on " << address_ << ":" << port << ": " << strerror(errno));
+      ::close(listen_fd_);
+      listen_fd_ = -1;
+      return false;
+    }
+
+    provider_ = provider;
+    port_ = port;
+    running_ = true;
+    thread_ = new boost::thread(&XspressMetricsServer::serve, this);
+    LOG4CXX_INFO(logger_, "Serving metrics on " << address_ << ":" << port_);
+    return true;
+  }
+
+  void stop()
+  {
+    if (thread_){
+      running_ = false;
+      thread_->join();
+      delete thread_;
+      thread_ = 0;
+    }
+    if (listen_fd_ >= 0){
+      ::close(listen_fd_);
+      listen_fd_ = -1;
+    }
+    port_ = 0;
+  }
+
+  int get_port()
+  {
+    return port_;
+  }
+
+private:
+  void serve()
+  {
+    while (running_){
+      struct pollfd pfd;
+      pfd.fd = listen_fd_;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if (::poll(&pfd, 1, XSP_METRICS_POLL_MS) <= 0){
+        continue;
+      }
+      int client = ::accept(listen_fd_, 0, 0);
+      if (client >= 0){
+        respond(client);
+        ::close(client);
+      }
+    }
+  }
+
+  void respond(int client)
+  {
+    struct timeval timeout;
+    timeout.tv_sec = XSP_METRICS_RECV_TIMEOUT_S;
+    timeout.tv_usec = 0;
+    ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Read up to the end of the request headers, any body is ignored
+    std::string request;
+    char buffer[512];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < XSP_METRICS_MAX_REQUEST){
+      ssize_t bytes = ::recv(client, buffer, sizeof(buffer), 0);
+      if (bytes <= 0){
+        break;
+      }
+      request.append(buffer, bytes);
+    }
+
+    std::string status = "404 Not Found";
+    std::string body = "Not found\n";
+    std::string content_type = "text/plain";
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0){
+      status = "200 OK";
+      body = provider_();
+      content_type = XSP_METRICS_CONTENT_TYPE;
+    }
+
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << "\r\n"
+             << "Content-Type: " << content_type << "\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+    std::string text = response.str();
+    size_t sent = 0;
+    while (sent < text.size()){
+      ssize_t bytes = ::send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+      if (bytes <= 0){
+        break;
+      }
+      sent += bytes;
+    }
+  }
+
+  /** Pointer to the logging facility */
+  log4cxx::LoggerPtr                logger_;
+  /** Function rendering the metrics text */
+  boost::function<std::string()>    provider_;
+  /** Server thread */
+  boost::thread                     *thread_;
+  /** Server thread running flag */
+  boost::atomic<bool>               running_;
+  /** Listening socket */
+  int                               listen_fd_;
+  /** Port being served, 0 if stopped */
+  int                               port_;
+  /** Address served */
+  std::string                       address_;
+};
+
+} /* namespace Xspress */
+
+#endif /* XSPRESS_METRICS_H */
@@ -17,6 +17,22 @@
 #define XSP3_DTC_IWRO                       6
 #define XSP3_DTC_IWRG                       7
 
+#define XSP_MCA_ENCODING_DENSE              0
+#define XSP_MCA_ENCODING_SPARSE             1
+
+/**
+ * Header of each MCA frame sent from the DAQ to the frame receiver.
+ *
+ * The header is followed by the scalars, dtc factors and input estimates,
+ * then the MCA data. With dense encoding the MCA data is the full
+ * num_channels x num_aux x num_energy_bins array of uint32. With sparse
+ * encoding it is mca_entries (index, value) uint32 pairs, where index is
+ * the position of a non-zero bin within the dense array.
+ *
+ * Frames of a queued acquisition are numbered continuously across its
+ * segments, segment_offset is the frame number of the first frame of the
+ * segment. A single acquisition is segment 0 with an offset of 0.
+ */
 typedef struct
 {
   uint32_t frame_number;
@@ -25,8 +41,36 @@ typedef struct
   uint32_t num_channels;
   uint32_t num_scalars;
   uint32_t first_channel;
+  uint32_t mca_encoding;
+  uint32_t mca_entries;
+  uint32_t segment;
+  uint32_t segment_offset;
   //double dead_time_energy;
   //double clock_period;
 } FrameHeader;
 
+#define XSP_META_BLOCK_VERSION              2
+
+/**
+ * Header of the packed scalar meta data message published once per block.
+ *
+ * The header is followed by four arrays sized by frame_capacity, of which
+ * only the first num_frames rows are valid:
+ *   dtc factors (double, num_channels per frame)
+ *   input estimates (double, num_channels per frame)
+ *   scalars (uint32, num_scalars per channel, capacity allows for 9 per channel)
+ *   fill mask (uint8, one per frame, 0 if the frame was never received)
+ */
+typedef struct
+{
+  uint32_t version;
+  uint32_t rank;
+  uint32_t frame_id;
+  uint32_t num_frames;
+  uint32_t frame_capacity;
+  uint32_t first_channel;
+  uint32_t num_channels;
+  uint32_t num_scalars;
+} MetaBlockHeader;
+
 #endif //_XSPRESS3DEFINITIONS_EPICS_H
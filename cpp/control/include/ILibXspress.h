@@ -70,9 +70,13 @@ namespace Xspress
 class ILibXspress
 {
 public:
+  ILibXspress();
+  virtual ~ILibXspress();
   virtual std::string getVersionString() = 0;
   void setErrorString(const std::string& error);
   std::string getErrorString();
+  void set_parallel_setup(bool parallel);
+  bool get_parallel_setup();
   virtual void checkErrorCode(const std::string& prefix, int code) = 0;
   virtual void checkErrorCode(const std::string& prefix, int code, bool add_xsp_error) = 0;
 
@@ -136,7 +140,8 @@ public:
                        std::vector<double>& dtc_in_window_off,
                        std::vector<double>& dtc_in_window_grad,
                        std::vector<double>& dtc_in_window_rate_off,
-                       std::vector<double>& dtc_in_window_rate_grad) = 0;
+                       std::vector<double>& dtc_in_window_rate_grad,
+                       const std::vector<bool>& channels) = 0;
   virtual int setTriggerMode(int frames,
                      double exposure_time,
                      double clock_period,
@@ -191,6 +196,10 @@ public:
   protected:
     /** Last error string description */
     std::string                   error_string_;
+    /** Protects the error string, which may be set from per-card setup threads */
+    boost::mutex                  error_mutex_;
+    /** Run per-channel setup on each card concurrently where the library permits, off by default */
+    bool                          parallel_setup_;
     /** Pointer to the logging facility */
     log4cxx::LoggerPtr            logger_;
 
@@ -101,7 +101,8 @@ public:
                        std::vector<double>& dtc_in_window_off,
                        std::vector<double>& dtc_in_window_grad,
                        std::vector<double>& dtc_in_window_rate_off,
-                       std::vector<double>& dtc_in_window_rate_grad);
+                       std::vector<double>& dtc_in_window_rate_grad,
+                       const std::vector<bool>& channels);
   int mapTimeFrameSource(Xsp3Timing *api_mode,
                          int *api_itfg_mode,
                          int trigger_mode,
@@ -10,6 +10,7 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/function.hpp>
 
 #include <log4cxx/logger.h>
 #include <log4cxx/basicconfigurator.h>
@@ -137,7 +138,8 @@ public:
                        std::vector<double>& dtc_in_window_off,
                        std::vector<double>& dtc_in_window_grad,
                        std::vector<double>& dtc_in_window_rate_off,
-                       std::vector<double>& dtc_in_window_rate_grad);
+                       std::vector<double>& dtc_in_window_rate_grad,
+                       const std::vector<bool>& channels);
   int mapTimeFrameSource(Xsp3Timing *api_mode,
                          int *api_itfg_mode,
                          int trigger_mode,
@@ -197,6 +199,21 @@ public:
 
 
 private:
+  int run_per_card(const std::string& phase, int max_channels, boost::function<int(int)> channel_fn);
+  static void run_card_channels(boost::function<int(int)> channel_fn,
+                                const std::vector<int>& channels,
+                                int& status);
+  int format_run_channel(int chan, int aux_mode);
+  int read_sca_channel(int chan,
+                       std::vector<uint32_t>& sca5_low,
+                       std::vector<uint32_t>& sca5_high,
+                       std::vector<uint32_t>& sca6_low,
+                       std::vector<uint32_t>& sca6_high,
+                       std::vector<uint32_t>& sca4_threshold);
+  int read_dtc_channel(int chan,
+                       std::vector<int>& dtc_flags,
+                       std::vector<std::vector<double> >& dtcd);
+
   /** Handle used by the libxspress library */
   int                           xsp_handle_;
   /** String representation of trigger modes */
@@ -21,6 +21,8 @@
 #include "IpcChannel.h"
 #include "IpcMessage.h"
 #include "XspressDetector.h"
+#include "XspressTelemetry.h"
+#include "XspressMetrics.h"
 
 using namespace log4cxx;
 using namespace log4cxx::helpers;
@@ -28,9 +30,49 @@ using namespace log4cxx::helpers;
 #define NUMBER_OF_SCALARS 9
 #define NUMBER_OF_TEMPERATURES 6
 
+#define DEFAULT_STATUS_REFRESH_MS 100
+#define MIN_STATUS_REFRESH_MS 10
+
+// In-process endpoint used by the DAQ control thread to wake the reactor when a segment is read out
+#define SEGMENT_WAKE_ENDPOINT "inproc://xspress_segment_wake"
+
+#define DEFAULT_TELEMETRY_PERIOD_MS 100
+#define MIN_TELEMETRY_PERIOD_MS 10
+
+// Groups of status parameters that are cached and rebuilt independently
+#define STATUS_GROUP_STATE 0
+#define STATUS_GROUP_CARDS 1
+#define STATUS_GROUP_LIVE 2
+#define STATUS_GROUP_TEMPERATURE 3
+#define STATUS_GROUP_COUNT 4
+
 namespace Xspress
 {
 
+/**
+ * A cached group of status parameters.
+ *
+ * The group holds a message containing its parameters, built the last time
+ * its values changed, and the generation at which that happened.
+ */
+class XspressStatusGroup
+{
+public:
+  XspressStatusGroup();
+  bool changed(const std::vector<double>& values, const std::string& text);
+
+  /** Message holding the status parameters of the group */
+  boost::shared_ptr<OdinData::IpcMessage> message_;
+  /** Generation at which the group last changed */
+  uint64_t generation_;
+
+private:
+  /** Numeric values the group was built from */
+  std::vector<double> values_;
+  /** String values the group was built from */
+  std::string text_;
+};
+
 /**
  * The XspressController class has overall responsibility for management of the
  * core and wrapper classes present within the XspressController application.
@@ -46,15 +88,28 @@ public:
   virtual ~XspressController();
   void setError(const std::string& error);
   void handleCtrlChannel();
-  void provideStatus(OdinData::IpcMessage& reply);
+  void provideStatus(OdinData::IpcMessage& reply, uint64_t since = 0);
+  void refreshStatus();
+  void handleSegmentWake();
+  void notifySegmentComplete();
+  void setStatusRefresh(unsigned int period_ms);
+  void publishTelemetry();
+  void setTelemetryPeriod(unsigned int period_ms);
+  void renderMetrics();
+  std::string provideMetrics();
   void provideVersion(OdinData::IpcMessage& reply);
   void provideAPIVersion(OdinData::IpcMessage& reply);
   void configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply);
   void configureApp(OdinData::IpcMessage& config, OdinData::IpcMessage& reply);
   void configureXsp(OdinData::IpcMessage& config, OdinData::IpcMessage& reply);
+  bool readScaArray(OdinData::IpcMessage& config,
+                    const std::string& param,
+                    const std::string& description,
+                    std::vector<uint32_t>& values);
+  int readSegments(OdinData::IpcMessage& config, std::vector<XspressAcqSegment>& segments);
   void configureDAQ(OdinData::IpcMessage& config, OdinData::IpcMessage& reply);
   void configureCommand(OdinData::IpcMessage& config, OdinData::IpcMessage& reply);
-  void requestConfiguration(OdinData::IpcMessage& reply);
+  void requestConfiguration(OdinData::IpcMessage& reply, uint64_t status_since = 0);
   void resetStatistics(OdinData::IpcMessage& reply);
   void run();
   void waitForShutdown();
@@ -72,6 +127,15 @@ private:
   static const std::string CONFIG_APP_DEBUG;
   /** Configuration constant for control socket endpoint **/
   static const std::string CONFIG_APP_CTRL_ENDPOINT;
+  /** Configuration constant for the status refresh period in ms **/
+  static const std::string CONFIG_APP_STATUS_REFRESH;
+  /** Configuration constant for the telemetry publisher endpoint **/
+  static const std::string CONFIG_APP_TELEMETRY_ENDPOINT;
+  /** Configuration constant for the telemetry publishing period in ms **/
+  static const std::string CONFIG_APP_TELEMETRY_PERIOD;
+  /** Configuration constant for the OpenMetrics port, 0 disables **/
+  static const std::string CONFIG_APP_METRICS_PORT;
+  static const std::string CONFIG_APP_METRICS_ADDRESS;
 
   /** Configuration constants for parameters **/
   static const std::string CONFIG_XSP;
@@ -93,7 +157,12 @@ private:
   static const std::string CONFIG_XSP_DEBOUNCE;
   static const std::string CONFIG_XSP_EXPOSURE_TIME;
   static const std::string CONFIG_XSP_FRAMES;
+  static const std::string CONFIG_XSP_CONTINUOUS;
   static const std::string CONFIG_XSP_MODE;
+  static const std::string CONFIG_XSP_FRAMES_SAMPLE_PERIOD;
+  static const std::string CONFIG_XSP_TEMP_SAMPLE_PERIOD;
+  static const std::string CONFIG_XSP_PARALLEL_SETUP;
+  static const std::string CONFIG_XSP_SETTINGS_CACHE;
   static const std::string CONFIG_XSP_SCA5_LOW;
   static const std::string CONFIG_XSP_SCA5_HIGH;
   static const std::string CONFIG_XSP_SCA6_LOW;
@@ -124,6 +193,7 @@ private:
   static const std::string CONFIG_DAQ;
   static const std::string CONFIG_DAQ_ENABLED;
   static const std::string CONFIG_DAQ_ZMQ_ENDPOINTS;
+  static const std::string CONFIG_DAQ_SPARSE_THRESHOLD;
 
   /** Configuration constants for commands **/
   static const std::string CONFIG_CMD;
@@ -134,6 +204,9 @@ private:
   static const std::string CONFIG_CMD_START;
   static const std::string CONFIG_CMD_STOP;
   static const std::string CONFIG_CMD_TRIGGER;
+  static const std::string CONFIG_CMD_REARM;
+  static const std::string CONFIG_CMD_QUEUE;
+  static const std::string CONFIG_SEGMENT_ACQ_ID;
 
   static const std::string CONFIG_XSP_MODE_MCA;
   static const std::string CONFIG_XSP_MODE_LIST;
@@ -150,6 +223,22 @@ private:
   static const std::string STATUS_CARDS_CONNECTED;
   static const std::string STATUS_CHANNEL_FRAMES;
   static const std::string STATUS_FEM_DROPPED_FRAMES;
+  static const std::string STATUS_SPARSE_FRAMES;
+  static const std::string STATUS_ARM_LATENCY;
+  static const std::string STATUS_ARM_PREPARED;
+  static const std::string STATUS_CONFIGURE_LATENCY;
+  static const std::string STATUS_CONNECT_TIME_COLD;
+  static const std::string STATUS_CONNECT_TIME_WARM;
+  static const std::string STATUS_QUEUE_SEGMENT;
+  static const std::string STATUS_QUEUE_PENDING;
+  static const std::string STATUS_SEGMENT_ACQ_ID;
+  static const std::string STATUS_SEGMENT_DEAD_TIME;
+  static const std::string STATUS_FRAME_RATE;
+  static const std::string STATUS_DATA_RATE;
+  static const std::string STATUS_BUFFER_HEADROOM;
+  static const std::string STATUS_MIN_BUFFER_HEADROOM;
+  static const std::string STATUS_GENERATION;
+  static const std::string STATUS_SINCE;
 
   static const std::string STATUS_LIVE_SCALAR[NUMBER_OF_SCALARS];
   static const std::string STATUS_LIVE_DTC;
@@ -159,8 +248,11 @@ private:
 
   void setupControlInterface(const std::string& ctrlEndpointString);
   void closeControlInterface();
+  void setupTelemetryInterface(const std::string& endpoint);
+  void closeTelemetryInterface();
   void runIpcService(void);
   void tickTimer(void);
+  void storeStatusGroup(int group, boost::shared_ptr<OdinData::IpcMessage> msg);
 
   /** Pointer to the logging facility */
   log4cxx::LoggerPtr                                              logger_;
@@ -176,6 +268,14 @@ private:
   bool                                                            threadInitError_;
   /** Have we successfully shutdown */
   bool                                                            shutdown_;
+  /** Cached status groups, only rebuilt when their values change */
+  XspressStatusGroup                                              status_groups_[STATUS_GROUP_COUNT];
+  /** Generation of the most recent status change */
+  uint64_t                                                        status_generation_;
+  /** Period at which the cached status is refreshed */
+  unsigned int                                                    status_refresh_ms_;
+  /** Reactor timer ID of the status refresh timer */
+  int                                                             status_timer_id_;
   /** Main thread used for control message handling */
   boost::thread                                                   ctrlThread_;
   /** Store for any messages occurring during thread initialisation */
@@ -188,12 +288,40 @@ private:
   OdinData::IpcContext&                                           ipc_context_;
   /** IpcChannel for control messages */
   OdinData::IpcChannel                                            ctrlChannel_;
+  /** End point for published telemetry, empty if telemetry is disabled */
+  std::string                                                     telemetryEndpoint_;
+  /** IpcChannel for published telemetry */
+  OdinData::IpcChannel                                            telemetryChannel_;
+  /** IpcChannel registered on the reactor to receive segment wake messages */
+  OdinData::IpcChannel                                            segmentWakeRecvChannel_;
+  /** IpcChannel used by the DAQ control thread to send segment wake messages */
+  OdinData::IpcChannel                                            segmentWakeSendChannel_;
+  /** Period at which telemetry is published */
+  unsigned int                                                    telemetry_period_ms_;
+  /** Reactor timer ID of the telemetry timer */
+  int                                                             telemetry_timer_id_;
+  /** Sequence number of the next telemetry message */
+  uint64_t                                                        telemetry_sequence_;
   /** The Xspress hardware wrapper object */
   boost::shared_ptr<XspressDetector>                              xsp_;
   /** Error string */
   std::string                                                     error_;
   /** State string */
   std::string                                                     state_;
+  /** Time taken to apply the last configuration in us */
+  uint32_t                                                        configure_latency_us_;
+  /** Time taken by the last connection that read back all settings in ms */
+  uint32_t                                                        connect_time_cold_ms_;
+  /** Time taken by the last connection that used the settings cache in ms */
+  uint32_t                                                        connect_time_warm_ms_;
+  /** Mutex protecting the rendered metrics text */
+  boost::mutex                                                    metrics_mutex_;
+  /** Metrics text, rendered on each status refresh */
+  std::string                                                     metrics_text_;
+  /** Address the metrics server listens on */
+  std::string                                                     metrics_address_;
+  /** Server exposing the metrics text, declared last so it stops first */
+  XspressMetricsServer                                            metrics_server_;
 };
 
 } /* namespace Xspress */
@@ -10,6 +10,7 @@
 
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/function.hpp>
 
 #include <log4cxx/logger.h>
 #include <log4cxx/basicconfigurator.h>
@@ -21,6 +22,7 @@
 #include "WorkQueue.h"
 #include "logging.h"
 #include "LibXspressWrapper.h"
+#include "XspressMetrics.h"
 
 using namespace log4cxx;
 using namespace log4cxx::helpers;
@@ -64,15 +66,29 @@ public:
   std::vector<double> read_live_dtc();
   std::vector<double> read_live_inp_est();
   void set_num_aux_data(uint32_t num_aux_data);
+  void set_sparse_threshold(double threshold);
+  double get_sparse_threshold();
+  uint32_t get_sparse_frames();
+  uint32_t get_backlog_frames();
+  uint32_t get_batch_latency_us();
+  uint32_t get_max_batch_latency_us();
+  uint64_t get_bytes_sent();
+  double get_frame_rate();
+  double get_data_rate();
+  double get_buffer_headroom();
+  double get_min_buffer_headroom();
+  Xspress::XspressMetricsHistogram get_batch_latency_histogram();
   boost::shared_ptr<XspressDAQTask> create_task(uint32_t type);
   boost::shared_ptr<XspressDAQTask> create_task(uint32_t type, uint32_t value1);
   boost::shared_ptr<XspressDAQTask> create_task(uint32_t type, uint32_t value1, uint32_t value2);
-  void startAcquisition(uint32_t frames);
+  void set_segment_callback(boost::function<void(bool)> callback);
+  void startAcquisition(uint32_t frames, bool validate=true, uint32_t frame_offset=0, uint32_t segment=0);
   void stopAcquisition();
   bool getAcqRunning();
   bool getAcqFailed();
   uint32_t getFramesRead();
   void controlTask();
+  void update_rates(int32_t frames);
   void workTask(boost::shared_ptr<WorkQueue<boost::shared_ptr<XspressDAQTask> > > queue,
                 int index,
                 int channel_index,
@@ -109,6 +125,14 @@ private:
 
   /** Buffer length value */
   uint32_t                      buffer_length_;
+  /** Have the histogram dimensions been validated and buffer_length_ calculated */
+  bool                          dims_validated_;
+  /** Frame number of the first frame of the current segment */
+  uint32_t                      frame_offset_;
+  /** Index of the current segment of a queued acquisition */
+  uint32_t                      segment_;
+  /** Called from the control thread when each acquisition completes or is aborted */
+  boost::function<void(bool)>   segment_callback_;
   /** Are we waiting for an acquisition to start */
   bool waiting_for_acq_;
   /** Is the DAQ thread running an acquisition */
@@ -117,6 +141,33 @@ private:
   uint32_t no_of_frames_;
   /** Has an acquisition failed */
   bool acq_failed_;
+  /** Fraction of non-zero bins below which MCA frames are sent sparse, 0 disables */
+  double sparse_threshold_;
+  /** Number of frames sent sparse in the current acquisition, protected by data_mutex_ */
+  uint32_t sparse_frames_;
+  /** Number of frames waiting in the circular buffer when the last batch was dispatched */
+  uint32_t backlog_frames_;
+  /** Time taken by the workers to process the last batch of frames in us */
+  uint32_t batch_latency_us_;
+  /** Longest batch processing time in the current acquisition in us */
+  uint32_t max_batch_latency_us_;
+  /** Total number of bytes sent by the worker threads */
+  uint64_t bytes_sent_;
+  /** Distribution of batch processing times in seconds */
+  Xspress::XspressMetricsHistogram batch_latency_hist_;
+  /** Start of the current throughput measurement window */
+  boost::posix_time::ptime      rate_window_start_;
+  /** Frames read and bytes sent at the start of the throughput window */
+  int32_t                       rate_window_frames_;
+  uint64_t                      rate_window_bytes_;
+  /** Frames read per second over the last throughput window */
+  double                        frame_rate_;
+  /** Bytes sent per second over the last throughput window */
+  double                        data_rate_;
+  /** Fraction of the circular buffer free at the last dispatch */
+  double                        buffer_headroom_;
+  /** Smallest fraction of the circular buffer free in the current acquisition */
+  double                        min_buffer_headroom_;
 
   /** Live scalar values */
   std::vector<uint32_t>         live_scalar_0_;
@@ -8,8 +8,11 @@
 #ifndef XspressDetector_H_
 #define XspressDetector_H_
 
+#include <deque>
+
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
 
 #include <log4cxx/logger.h>
 #include <log4cxx/basicconfigurator.h>
@@ -34,9 +37,30 @@ using namespace log4cxx::helpers;
 
 #define DEFAULT_MAX_CHANNELS 8
 
+#define DEFAULT_FRAMES_SAMPLE_PERIOD_MS 200
+#define DEFAULT_TEMPERATURE_SAMPLE_PERIOD_MS 5000
+#define MIN_SAMPLE_PERIOD_MS 50
+
 namespace Xspress
 {
 
+/**
+ * One segment of a queued acquisition, also used to hold the acquisition
+ * settings the detector is armed with.
+ */
+class XspressAcqSegment
+{
+public:
+  /** Number of frames */
+  int frames_;
+  /** Exposure time */
+  double exposure_time_;
+  /** Trigger mode */
+  int trigger_mode_;
+  /** Acquisition ID of the segment */
+  std::string acq_id_;
+};
+
 /**
  * The XspressDetector class provides an OO implementation based around the C
  * libxspress library.  This class is designed to abstract specific libxspress
@@ -68,9 +92,17 @@ public:
   int readSCAParams();
   int readDTCParams();
   void readFemStatus();
+  void readFemFrameCounters();
+  void readFemTemperatures();
+  void startStatusSampling();
+  void stopStatusSampling();
   int writeDTCParams();
   int setTriggerMode();
   int startAcquisition();
+  int rearmAcquisition();
+  int queueAcquisition(const std::vector<XspressAcqSegment>& segments);
+  void armPendingSegment();
+  void setSegmentNotify(boost::function<void()> notify);
   int stopAcquisition();
   int sendSoftwareTrigger();
   void reconnectRequired();
@@ -99,6 +131,11 @@ public:
   bool getXspUseResgrades();
   void setXspRunFlags(int flags);
   int getXspRunFlags();
+  void setXspParallelSetup(bool parallel);
+  bool getXspParallelSetup();
+  void setXspSettingsCache(bool enable);
+  bool getXspSettingsCache();
+  bool getXspSettingsCacheHit();
   void setXspDTCEnergy(double energy);
   double getXspDTCEnergy();
   void setXspTriggerMode(int mode);
@@ -113,10 +150,44 @@ public:
   double getXspExposureTime();
   void setXspFrames(int frames);
   int getXspFrames();
+  void setXspContinuous(bool continuous);
+  bool getXspContinuous();
   void setXspMode(const std::string& mode);
   std::string getXspMode();
   void setXspDAQEndpoints(std::vector<std::string> endpoints);
   std::vector<std::string> getXspDAQEndpoints();
+  void setXspDAQSparseThreshold(double threshold);
+  double getXspDAQSparseThreshold();
+  uint32_t getXspDAQSparseFrames();
+  uint32_t getXspDAQBacklogFrames();
+  uint32_t getXspDAQBatchLatency();
+  uint32_t getXspDAQMaxBatchLatency();
+  uint64_t getXspDAQBytesSent();
+  double getXspDAQFrameRate();
+  double getXspDAQDataRate();
+  double getXspDAQBufferHeadroom();
+  double getXspDAQMinBufferHeadroom();
+  XspressMetricsHistogram getXspDAQBatchLatencyHistogram();
+  uint64_t getXspHwWrites();
+  uint64_t getXspHwWritesSkipped();
+  uint32_t getXspArmLatency();
+  uint64_t getXspRearms();
+  bool getXspArmPrepared();
+  XspressMetricsHistogram getXspArmLatencyHistogram();
+  uint32_t getXspQueueSegment();
+  uint32_t getXspQueuePending();
+  std::string getXspSegmentAcqId();
+  uint32_t getXspSegmentDeadTime();
+  XspressMetricsHistogram getXspSegmentDeadTimeHistogram();
+  void setXspFramesSamplePeriod(int period_ms);
+  int getXspFramesSamplePeriod();
+  void setXspTemperatureSamplePeriod(int period_ms);
+  int getXspTemperatureSamplePeriod();
+  int setScaParams(const std::vector<uint32_t>& sca5_low_limit,
+                   const std::vector<uint32_t>& sca5_high_limit,
+                   const std::vector<uint32_t>& sca6_low_limit,
+                   const std::vector<uint32_t>& sca6_high_limit,
+                   const std::vector<uint32_t>& sca4_thresholds);
   int setSca5LowLimits(std::vector<uint32_t> sca5_low_limit);
   std::vector<uint32_t> getSca5LowLimits();
   int setSca5HighLimits(std::vector<uint32_t> sca5_high_limit);
@@ -155,6 +226,26 @@ public:
   std::vector<bool> getCardsConnected();
   
 private:
+  void statusSamplingTask();
+  int armAcquisition(bool rearm);
+  int armDetector(bool rearm, const XspressAcqSegment& settings);
+  int armSegment(bool rearm);
+  void segmentComplete(bool completed);
+  XspressAcqSegment configuredSettings();
+  int setTriggerMode(const XspressAcqSegment& settings);
+  bool triggerModePrepared(const XspressAcqSegment& settings);
+  void invalidateArmState();
+  void logPhaseTime(const std::string& phase, boost::posix_time::ptime& phase_start);
+  int checkScaDimension(const std::vector<uint32_t>& values,
+                        const std::vector<uint32_t>& current,
+                        const std::string& name);
+  std::vector<double> dtcChannelParams(int chan);
+  void recordDTCParams();
+  uint64_t settingsCacheKey();
+  std::string settingsCachePath();
+  bool loadSettingsCache(uint64_t key);
+  void saveSettingsCache(uint64_t key);
+
   /** libxspress wrapper object */
   boost::shared_ptr<ILibXspress>  detector_;
   /** Pointer to DAQ object */
@@ -197,6 +288,10 @@ private:
   int                           xsp_num_aux_data_;
   /** Number of auxiliary data items */
   int                           xsp_run_flags_;
+  /** Use the settings cache to skip reading back unchanged parameters on connect */
+  bool                          xsp_settings_cache_;
+  /** Were the parameters of the last restore taken from the settings cache */
+  bool                          settings_cache_hit_;
   /** Have the DTC params been updated */
   bool                          xsp_dtc_params_updated_;
   /** DTC energy */
@@ -215,10 +310,14 @@ private:
   double                        xsp_exposure_time_;
   /** Number of frames */
   int                           xsp_frames_;
+  /** Stream frames over the circular buffer until stopped */
+  bool                          xsp_continuous_;
   /** Mode of operation */
   std::string                   xsp_mode_;
   /** DAQ endpoints */
   std::vector<std::string>      xsp_daq_endpoints_;
+  /** Fraction of non-zero bins below which the DAQ sends sparse MCA frames */
+  double                        xsp_daq_sparse_threshold_;
   
   /** Number of frames read out by each channel */
   std::vector<int32_t>          xsp_status_frames_;
@@ -251,6 +350,13 @@ private:
   std::vector<double>           xsp_dtc_in_window_grad_;
   std::vector<double>           xsp_dtc_in_window_rate_off_;
   std::vector<double>           xsp_dtc_in_window_rate_grad_;
+  /** DTC parameters last read from or written to each channel of the hardware */
+  std::vector<std::vector<double> > hw_dtc_params_;
+
+  /** Number of per-channel hardware writes issued by configuration */
+  uint64_t                      hw_writes_;
+  /** Number of per-channel hardware writes skipped as the value was unchanged */
+  uint64_t                      hw_writes_skipped_;
 
   std::vector<std::pair <int, int> > cardChanMap;
 
@@ -259,10 +365,65 @@ private:
 
   /** Last error string description */
   std::string                   error_string_;
+  /** Protects the error string, which is also set by the sampling thread */
+  boost::mutex                  error_mutex_;
 
   /** StartAcquisition mutex for locking */
   boost::mutex                  start_acq_mutex_;
 
+  /** Serialises every call to the hardware library, taken before start_acq_mutex_ */
+  boost::recursive_mutex        hw_mutex_;
+  /** Protects the sampled status snapshot */
+  boost::mutex                  status_mutex_;
+  /** Status sampling thread */
+  boost::thread                 *sample_thread_;
+  /** Status sampling thread running flag */
+  boost::atomic<bool>           sampling_;
+  /** Period between frame and dropped frame counter reads in ms */
+  int                           frames_sample_period_ms_;
+  /** Period between temperature reads in ms */
+  int                           temperature_sample_period_ms_;
+
+  /** Have the trigger settings below been written to the hardware */
+  bool                          armed_valid_;
+  /** Trigger settings last written to the hardware */
+  int                           armed_frames_;
+  double                        armed_exposure_time_;
+  double                        armed_clock_period_;
+  int                           armed_trigger_mode_;
+  int                           armed_debounce_;
+  int                           armed_invert_f0_;
+  int                           armed_invert_veto_;
+  /** Time taken by the last arm or re-arm in us */
+  uint32_t                      arm_latency_us_;
+  /** Number of arms that re-used the prepared trigger settings */
+  uint64_t                      rearms_;
+  /** Distribution of arm times in seconds */
+  XspressMetricsHistogram       arm_latency_hist_;
+
+  /** Segments of a queued acquisition still to be armed, protected by start_acq_mutex_ */
+  std::deque<XspressAcqSegment> acq_queue_;
+  /** Set by the DAQ control thread when a segment with more queued behind it has been read out */
+  bool                          segment_pending_;
+  /** Whether the pending segment read every frame */
+  bool                          segment_completed_;
+  /** Time the pending segment was read out */
+  boost::posix_time::ptime      segment_end_;
+  /** Called from the DAQ control thread once a segment is pending, protected by start_acq_mutex_ */
+  boost::function<void()>       segment_notify_;
+  /** Settings the detector is currently armed with, kept apart from the configured settings */
+  XspressAcqSegment             active_settings_;
+  /** Index of the segment currently armed */
+  uint32_t                      queue_segment_;
+  /** Frame number of the first frame of the segment currently armed */
+  uint32_t                      queue_frame_offset_;
+  /** Acquisition ID of the segment currently armed */
+  std::string                   queue_acq_id_;
+  /** Time between the end of the last segment and the next being armed in us */
+  uint32_t                      segment_dead_time_us_;
+  /** Distribution of inter-segment dead times in seconds */
+  XspressMetricsHistogram       segment_dead_time_hist_;
+
 };
 
 } /* namespace Xspress */
@@ -0,0 +1,58 @@
+/*
+ * XspressTelemetry.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Diamond Light Source
+ */
+
+#ifndef XspressTelemetry_H_
+#define XspressTelemetry_H_
+
+#include <stdint.h>
+
+/**
+ * Binary telemetry messages published by the xspress controller.
+ *
+ * Each message is a single ZeroMQ frame made up of an XspressTelemetryHeader
+ * followed by num_sections sections. Each section is an
+ * XspressTelemetrySection descriptor followed immediately by count elements
+ * of the given element type. All values are in host (little endian) byte
+ * order and the structures are packed.
+ */
+
+#define XSP_TELEMETRY_MAGIC   0x54505358  // "XSPT"
+#define XSP_TELEMETRY_VERSION 1
+
+// Element types
+#define XSP_TELEMETRY_INT32   0
+#define XSP_TELEMETRY_UINT32  1
+#define XSP_TELEMETRY_FLOAT32 2
+#define XSP_TELEMETRY_FLOAT64 3
+
+// Section identifiers
+#define XSP_TELEMETRY_STATE              0   // uint32 [connected, acquiring, frames_read]
+#define XSP_TELEMETRY_CHANNEL_FRAMES     1   // int32 per channel
+#define XSP_TELEMETRY_FEM_DROPPED_FRAMES 2   // int32 per card
+#define XSP_TELEMETRY_DAQ                3   // uint32 [backlog_frames, batch_latency_us, max_batch_latency_us, sparse_frames]
+#define XSP_TELEMETRY_LIVE_DTC           4   // float64 per channel
+#define XSP_TELEMETRY_LIVE_INP_EST       5   // float64 per channel
+#define XSP_TELEMETRY_LIVE_SCALAR        16  // uint32 per channel, scalar N is 16+N
+#define XSP_TELEMETRY_TEMPERATURE        32  // float32 per card, temperature N is 32+N
+
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t num_sections;
+  uint64_t sequence;
+  uint64_t timestamp_us;
+} __attribute__((packed)) XspressTelemetryHeader;
+
+typedef struct
+{
+  uint16_t id;
+  uint16_t type;
+  uint32_t count;
+} __attribute__((packed)) XspressTelemetrySection;
+
+#endif /* XspressTelemetry_H_ */
@@ -24,16 +24,42 @@ const int ILibXspress::runFlag_MCA_SPECTRA_ = 0;
 const int ILibXspress::runFlag_SCALERS_ONLY_ = 1;
 const int ILibXspress::runFlag_PLAYB_MCA_SPECTRA_ = 2;
 
+ILibXspress::ILibXspress() :
+    parallel_setup_(false)
+{
+}
+
+ILibXspress::~ILibXspress()
+{
+}
+
 void ILibXspress::setErrorString(const std::string& error)
 {
   LOG4CXX_ERROR(logger_, error);
+  boost::lock_guard<boost::mutex> lock(error_mutex_);
   error_string_ = error;
 }
 
 std::string ILibXspress::getErrorString()
 {
+  boost::lock_guard<boost::mutex> lock(error_mutex_);
   return error_string_;
 }
 
+/**
+ * Enable or disable concurrent per-card setup.
+ *
+ * \param[in] parallel - true to set up the channels of each card from its own thread.
+ */
+void ILibXspress::set_parallel_setup(bool parallel)
+{
+  parallel_setup_ = parallel;
+}
+
+bool ILibXspress::get_parallel_setup()
+{
+  return parallel_setup_;
+}
+
 
 } /* namespace Xspress */
@@ -492,7 +492,8 @@ int LibXspressSimulator::write_dtc_params(int max_channels,
                                         std::vector<double>& dtc_in_window_off,
                                         std::vector<double>& dtc_in_window_grad,
                                         std::vector<double>& dtc_in_window_rate_off,
-                                        std::vector<double>& dtc_in_window_rate_grad)
+                                        std::vector<double>& dtc_in_window_rate_grad,
+                                        const std::vector<bool>& channels)
 {
   int status = XSP_STATUS_OK;
   int xsp_status = 0;
@@ -507,8 +508,11 @@ int LibXspressSimulator::write_dtc_params(int max_channels,
   double xsp_dtc_in_window_rate_grad = 0.0;
 
   LOG4CXX_DEBUG_LEVEL(1, logger_, "[SIM] Xspress wrapper calling xsp3_setDeadtimeCorrectionParameters2");
-  /*
   for (int chan = 0; chan < max_channels; chan++) {
+    // Only write the selected channels, an empty selection writes them all
+    if (!channels.empty() && (chan >= channels.size() || !channels[chan])) {
+      continue;
+    }
     xsp_dtc_flags = dtc_flags[chan];
     xsp_dtc_all_event_off = dtc_all_event_off[chan];
     xsp_dtc_all_event_grad = dtc_all_event_grad[chan];
@@ -519,6 +523,13 @@ int LibXspressSimulator::write_dtc_params(int max_channels,
     xsp_dtc_in_window_rate_off = dtc_in_window_rate_off[chan];
     xsp_dtc_in_window_rate_grad = dtc_in_window_rate_grad[chan];
 
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "[SIM] Channel " << chan <<
+                                    " Dead Time Correction Params: Flags: " << xsp_dtc_flags <<
+                                    ", All Event Grad: " << xsp_dtc_all_event_grad <<
+                                    ", All Event Off: " << xsp_dtc_all_event_off <<
+                                    ", In Win Off: " << xsp_dtc_in_window_off <<
+                                    ", In Win Grad: " << xsp_dtc_in_window_grad);
+    /*
     xsp_status = xsp3_setDeadtimeCorrectionParameters2(xsp_handle_,
                                                        chan,
                                                        xsp_dtc_flags,
@@ -534,8 +545,8 @@ int LibXspressSimulator::write_dtc_params(int max_channels,
       checkErrorCode("xsp3_setDeadtimeCorrectionParameters", xsp_status);
       status = XSP_STATUS_ERROR;
     }
+    */
   }
-  */
   return status;
 }
 
@@ -6,7 +6,9 @@
  */
 
 #include <stdio.h>
+#include <map>
 #include "dirent.h"
+#include <boost/bind.hpp>
 
 #include "LibXspressWrapper.h"
 #include "DebugLevelLogger.h"
@@ -255,30 +257,106 @@ int LibXspressWrapper::restore_settings(const std::string& restore_path)
 
 int LibXspressWrapper::setup_format_run_mode(bool list_mode, bool use_resgrades, int max_channels, int& num_aux_data)
 {
-  int status = XSP_STATUS_OK;
-  int xsp_status = 0;
   LOG4CXX_DEBUG_LEVEL(1, logger_, "Xspress wrapper setting up list mode, resgrades and calling xsp3_format_run");
-  for (int chan = 0; chan < max_channels; chan++) {
-    int aux_mode = 0;
-    num_aux_data = 1;
-    if (list_mode){
-      aux_mode |= XSP3_FORMAT_AUX1_MODE_TIMESTAMPED;
+  int aux_mode = 0;
+  num_aux_data = 1;
+  if (list_mode){
+    aux_mode |= XSP3_FORMAT_AUX1_MODE_TIMESTAMPED;
+  }
+  if (use_resgrades){
+    num_aux_data = N_RESGRADES;
+    aux_mode |= XSP3_FORMAT_RES_MODE_MINDIV8;
+  }
+  return run_per_card("xsp3_format_run", max_channels,
+                      boost::bind(&LibXspressWrapper::format_run_channel, this, _1, aux_mode));
+}
+
+int LibXspressWrapper::format_run_channel(int chan, int aux_mode)
+{
+  int status = XSP_STATUS_OK;
+  int xsp_status = xsp3_format_run(xsp_handle_, chan, aux_mode, 0, 0, 0, 0, 12);
+  if (xsp_status < XSP3_OK) {
+    checkErrorCode("xsp3_format_run", xsp_status);
+    status = XSP_STATUS_ERROR;
+  } else {
+    LOG4CXX_INFO(logger_, "Channel: " << chan << ", Number of time frames configured: " << xsp_status);
+  }
+  return status;
+}
+
+/**
+ * Run a per-channel setup function over all channels.
+ *
+ * Channels are grouped by the card (libxspress path) that they belong to.
+ * When parallel setup is enabled and there is more than one card, each card
+ * has its channels set up in order from its own thread, so that the network
+ * round trips to different cards overlap. Calls to any one card are never
+ * made concurrently.
+ *
+ * \param[in] phase - name of the setup phase for logging.
+ * \param[in] max_channels - number of channels to set up.
+ * \param[in] channel_fn - function setting up a single channel, returning a status.
+ * \return XSP_STATUS_OK if every channel was set up.
+ */
+int LibXspressWrapper::run_per_card(const std::string& phase, int max_channels, boost::function<int(int)> channel_fn)
+{
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  // Group the channels by card
+  std::map<int, std::vector<int> > card_channels;
+  bool resolved = true;
+  for (int chan = 0; chan < max_channels && resolved; chan++) {
+    int path = 0;
+    int chan_index = 0;
+    if (xsp3_resolve_path(xsp_handle_, chan, &path, &chan_index) < XSP3_OK) {
+      resolved = false;
+    } else {
+      card_channels[path].push_back(chan);
     }
-    if (use_resgrades){
-      num_aux_data = N_RESGRADES;
-      aux_mode |= XSP3_FORMAT_RES_MODE_MINDIV8;
+  }
+
+  int status = XSP_STATUS_OK;
+  if (!parallel_setup_ || !resolved || card_channels.size() < 2) {
+    for (int chan = 0; chan < max_channels; chan++) {
+      status |= channel_fn(chan);
     }
-    xsp_status = xsp3_format_run(xsp_handle_, chan, aux_mode, 0, 0, 0, 0, 12);
-    if (xsp_status < XSP3_OK) {
-      checkErrorCode("xsp3_format_run", xsp_status);
-      status = XSP_STATUS_ERROR;
-    } else {
-      LOG4CXX_INFO(logger_, "Channel: " << chan << ", Number of time frames configured: " << xsp_status);
+  } else {
+    std::vector<int> card_status(card_channels.size(), XSP_STATUS_OK);
+    boost::thread_group threads;
+    int card = 0;
+    std::map<int, std::vector<int> >::iterator iter;
+    for (iter = card_channels.begin(); iter != card_channels.end(); ++iter, ++card) {
+      threads.create_thread(boost::bind(&LibXspressWrapper::run_card_channels, channel_fn,
+                                        boost::cref(iter->second), boost::ref(card_status[card])));
+    }
+    threads.join_all();
+    for (card = 0; card < card_status.size(); card++) {
+      status |= card_status[card];
     }
   }
+
+  LOG4CXX_INFO(logger_, phase << " completed for " << max_channels << " channels on " << card_channels.size() <<
+                        " cards in " << (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds() << "ms" <<
+                        (parallel_setup_ && card_channels.size() > 1 ? " (parallel)" : ""));
   return status;
 }
 
+/**
+ * Set up a list of channels in order, used as the body of a per-card thread.
+ *
+ * \param[in] channel_fn - function setting up a single channel, returning a status.
+ * \param[in] channels - channels to set up.
+ * \param[out] status - combined status of the channels.
+ */
+void LibXspressWrapper::run_card_channels(boost::function<int(int)> channel_fn,
+                                          const std::vector<int>& channels,
+                                          int& status)
+{
+  for (size_t index = 0; index < channels.size(); index++) {
+    status |= channel_fn(channels[index]);
+  }
+}
+
 int LibXspressWrapper::set_run_flags(int run_flags)
 {
   int status = XSP_STATUS_OK;
@@ -350,51 +428,63 @@ int LibXspressWrapper::read_sca_params(int max_channels,
                                        std::vector<uint32_t>& sca6_high,
                                        std::vector<uint32_t>& sca4_threshold
                                        )
+{
+  LOG4CXX_DEBUG_LEVEL(1, logger_, "Xspress wrapper calling xsp3_get_window and xsp3_get_good_thres");
+
+  // Size the arrays up front so that each channel can be filled in independently
+  sca5_low.assign(max_channels, 0);
+  sca5_high.assign(max_channels, 0);
+  sca6_low.assign(max_channels, 0);
+  sca6_high.assign(max_channels, 0);
+  sca4_threshold.assign(max_channels, 0);
+
+  return run_per_card("xsp3_get_window", max_channels,
+                      boost::bind(&LibXspressWrapper::read_sca_channel, this, _1,
+                                  boost::ref(sca5_low), boost::ref(sca5_high),
+                                  boost::ref(sca6_low), boost::ref(sca6_high),
+                                  boost::ref(sca4_threshold)));
+}
+
+int LibXspressWrapper::read_sca_channel(int chan,
+                                        std::vector<uint32_t>& sca5_low,
+                                        std::vector<uint32_t>& sca5_high,
+                                        std::vector<uint32_t>& sca6_low,
+                                        std::vector<uint32_t>& sca6_high,
+                                        std::vector<uint32_t>& sca4_threshold)
 {
   int status = XSP_STATUS_OK;
   int xsp_status = 0;
   uint32_t xsp_sca_param1 = 0;
   uint32_t xsp_sca_param2 = 0;
 
-  LOG4CXX_DEBUG_LEVEL(1, logger_, "Xspress wrapper calling xsp3_get_window and xsp3_get_good_thres");
-
-  // Clear the arrays
-  sca5_low.clear();
-  sca5_high.clear();
-  sca6_low.clear();
-  sca6_high.clear();
-  sca4_threshold.clear();
-
-  for (int chan = 0; chan < max_channels; ++chan) {
-    //SCA 5 window limits
-    xsp_status = xsp3_get_window(xsp_handle_, chan, 0, &xsp_sca_param1, &xsp_sca_param2);
-    if (xsp_status < XSP3_OK) {
-      checkErrorCode("xsp3_get_window", xsp_status);
-      status = XSP_STATUS_ERROR;
-    } else {
-      LOG4CXX_DEBUG_LEVEL(1, logger_, "Read back SCA5 window limits: " << xsp_sca_param1 << ", " << xsp_sca_param2);
-      sca5_low.push_back(xsp_sca_param1);
-      sca5_high.push_back(xsp_sca_param2);
-    }
-    //SCA 6 window limits
-    xsp_status = xsp3_get_window(xsp_handle_, chan, 1, &xsp_sca_param1, &xsp_sca_param2);
-    if (xsp_status < XSP3_OK) {
-      checkErrorCode("xsp3_get_window", xsp_status);
-      status = XSP_STATUS_ERROR;
-    } else {
-      LOG4CXX_DEBUG_LEVEL(1, logger_, "Read back SCA6 window limits: " << xsp_sca_param1 << ", " << xsp_sca_param2);
-      sca6_low.push_back(xsp_sca_param1);
-      sca6_high.push_back(xsp_sca_param2);
-    }
-    //SCA 4 threshold limit
-    xsp_status = xsp3_get_good_thres(xsp_handle_, chan, &xsp_sca_param1);
-    if (xsp_status < XSP3_OK) {
-      checkErrorCode("xsp3_get_good thres", xsp_status);
-      status = XSP_STATUS_ERROR;
-    } else {
-      LOG4CXX_DEBUG_LEVEL(1, logger_, "Read back SCA4 threshold limit: " << xsp_sca_param1);
-      sca4_threshold.push_back(xsp_sca_param1);
-    }
+  //SCA 5 window limits
+  xsp_status = xsp3_get_window(xsp_handle_, chan, 0, &xsp_sca_param1, &xsp_sca_param2);
+  if (xsp_status < XSP3_OK) {
+    checkErrorCode("xsp3_get_window", xsp_status);
+    status = XSP_STATUS_ERROR;
+  } else {
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "Read back SCA5 window limits: " << xsp_sca_param1 << ", " << xsp_sca_param2);
+    sca5_low[chan] = xsp_sca_param1;
+    sca5_high[chan] = xsp_sca_param2;
+  }
+  //SCA 6 window limits
+  xsp_status = xsp3_get_window(xsp_handle_, chan, 1, &xsp_sca_param1, &xsp_sca_param2);
+  if (xsp_status < XSP3_OK) {
+    checkErrorCode("xsp3_get_window", xsp_status);
+    status = XSP_STATUS_ERROR;
+  } else {
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "Read back SCA6 window limits: " << xsp_sca_param1 << ", " << xsp_sca_param2);
+    sca6_low[chan] = xsp_sca_param1;
+    sca6_high[chan] = xsp_sca_param2;
+  }
+  //SCA 4 threshold limit
+  xsp_status = xsp3_get_good_thres(xsp_handle_, chan, &xsp_sca_param1);
+  if (xsp_status < XSP3_OK) {
+    checkErrorCode("xsp3_get_good thres", xsp_status);
+    status = XSP_STATUS_ERROR;
+  } else {
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "Read back SCA4 threshold limit: " << xsp_sca_param1);
+    sca4_threshold[chan] = xsp_sca_param1;
   }
   return status;
 }
@@ -533,6 +623,39 @@ int LibXspressWrapper::read_dtc_params(int max_channels,
                                        std::vector<double>& dtc_in_window_grad,
                                        std::vector<double>& dtc_in_window_rate_off,
                                        std::vector<double>& dtc_in_window_rate_grad)
+{
+  LOG4CXX_DEBUG_LEVEL(1, logger_, "Xspress wrapper calling xsp3_getDeadtimeCorrectionParameters2");
+
+  // Size the arrays up front so that each channel can be filled in independently
+  std::vector<std::vector<double> > dtcd(XSP3_NUM_DTC_FLOAT_PARAMS, std::vector<double>(max_channels, 0.0));
+  dtc_flags.assign(max_channels, 0);
+
+  int status = run_per_card("xsp3_getDeadtimeCorrectionParameters2", max_channels,
+                            boost::bind(&LibXspressWrapper::read_dtc_channel, this, _1,
+                                        boost::ref(dtc_flags), boost::ref(dtcd)));
+
+  dtc_all_event_off.swap(dtcd[XSP3_DTC_AEO]);
+  dtc_all_event_grad.swap(dtcd[XSP3_DTC_AEG]);
+  dtc_all_event_rate_off.swap(dtcd[XSP3_DTC_AERO]);
+  dtc_all_event_rate_grad.swap(dtcd[XSP3_DTC_AERG]);
+  dtc_in_window_off.swap(dtcd[XSP3_DTC_IWO]);
+  dtc_in_window_grad.swap(dtcd[XSP3_DTC_IWG]);
+  dtc_in_window_rate_off.swap(dtcd[XSP3_DTC_IWRO]);
+  dtc_in_window_rate_grad.swap(dtcd[XSP3_DTC_IWRG]);
+  return status;
+}
+
+/**
+ * Read the DTC parameters of a single channel.
+ *
+ * \param[in] chan - channel index.
+ * \param[out] dtc_flags - DTC flags indexed by channel.
+ * \param[out] dtcd - DTC float parameters indexed by XSP3_DTC_* and then channel.
+ * \return XSP_STATUS_OK if the parameters were read.
+ */
+int LibXspressWrapper::read_dtc_channel(int chan,
+                                        std::vector<int>& dtc_flags,
+                                        std::vector<std::vector<double> >& dtcd)
 {
   int status = XSP_STATUS_OK;
   int xsp_status = 0;
@@ -546,52 +669,37 @@ int LibXspressWrapper::read_dtc_params(int max_channels,
   double xsp_dtc_in_window_rate_off = 0.0;
   double xsp_dtc_in_window_rate_grad = 0.0;
 
-  LOG4CXX_DEBUG_LEVEL(1, logger_, "Xspress wrapper calling xsp3_getDeadtimeCorrectionParameters2");
-
-  // Clear the arrays
-  dtc_flags.clear();
-  dtc_all_event_off.clear();
-  dtc_all_event_grad.clear();
-  dtc_all_event_rate_off.clear();
-  dtc_all_event_rate_grad.clear();
-  dtc_in_window_off.clear();
-  dtc_in_window_grad.clear();
-  dtc_in_window_rate_off.clear();
-  dtc_in_window_rate_grad.clear();
-
-  for (int chan = 0; chan < max_channels; chan++) {
-    xsp_status = xsp3_getDeadtimeCorrectionParameters2(xsp_handle_,
-                                                       chan,
-                                                       &xsp_dtc_flags,
-                                                       &xsp_dtc_all_event_off,
-                                                       &xsp_dtc_all_event_grad,
-                                                       &xsp_dtc_all_event_rate_off,
-                                                       &xsp_dtc_all_event_rate_grad,
-                                                       &xsp_dtc_in_window_off,
-                                                       &xsp_dtc_in_window_grad,
-                                                       &xsp_dtc_in_window_rate_off,
-                                                       &xsp_dtc_in_window_rate_grad);
-    if (xsp_status < XSP3_OK){
-      checkErrorCode("xsp3_getDeadtimeCorrectionParameters", xsp_status);
-      status = XSP_STATUS_ERROR;
-    } else {
-      LOG4CXX_DEBUG_LEVEL(1, logger_, "Channel " << chan <<
-                                      " Dead Time Correction Params: Flags: " << xsp_dtc_flags <<
-                                      ", All Event Grad: " << xsp_dtc_all_event_grad <<
-                                      ", All Event Off: " << xsp_dtc_all_event_off <<
-                                      ", In Win Off: " << xsp_dtc_in_window_off <<
-                                      ", In Win Grad: " << xsp_dtc_in_window_grad);
-
-      dtc_flags.push_back(xsp_dtc_flags);
-      dtc_all_event_off.push_back(xsp_dtc_all_event_off);
-      dtc_all_event_grad.push_back(xsp_dtc_all_event_grad);
-      dtc_all_event_rate_off.push_back(xsp_dtc_all_event_rate_off);
-      dtc_all_event_rate_grad.push_back(xsp_dtc_all_event_rate_grad);
-      dtc_in_window_off.push_back(xsp_dtc_in_window_off);
-      dtc_in_window_grad.push_back(xsp_dtc_in_window_grad);
-      dtc_in_window_rate_off.push_back(xsp_dtc_in_window_rate_off);
-      dtc_in_window_rate_grad.push_back(xsp_dtc_in_window_rate_grad);
-    }
+  xsp_status = xsp3_getDeadtimeCorrectionParameters2(xsp_handle_,
+                                                     chan,
+                                                     &xsp_dtc_flags,
+                                                     &xsp_dtc_all_event_off,
+                                                     &xsp_dtc_all_event_grad,
+                                                     &xsp_dtc_all_event_rate_off,
+                                                     &xsp_dtc_all_event_rate_grad,
+                                                     &xsp_dtc_in_window_off,
+                                                     &xsp_dtc_in_window_grad,
+                                                     &xsp_dtc_in_window_rate_off,
+                                                     &xsp_dtc_in_window_rate_grad);
+  if (xsp_status < XSP3_OK){
+    checkErrorCode("xsp3_getDeadtimeCorrectionParameters", xsp_status);
+    status = XSP_STATUS_ERROR;
+  } else {
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "Channel " << chan <<
+                                    " Dead Time Correction Params: Flags: " << xsp_dtc_flags <<
+                                    ", All Event Grad: " << xsp_dtc_all_event_grad <<
+                                    ", All Event Off: " << xsp_dtc_all_event_off <<
+                                    ", In Win Off: " << xsp_dtc_in_window_off <<
+                                    ", In Win Grad: " << xsp_dtc_in_window_grad);
+
+    dtc_flags[chan] = xsp_dtc_flags;
+    dtcd[XSP3_DTC_AEO][chan] = xsp_dtc_all_event_off;
+    dtcd[XSP3_DTC_AEG][chan] = xsp_dtc_all_event_grad;
+    dtcd[XSP3_DTC_AERO][chan] = xsp_dtc_all_event_rate_off;
+    dtcd[XSP3_DTC_AERG][chan] = xsp_dtc_all_event_rate_grad;
+    dtcd[XSP3_DTC_IWO][chan] = xsp_dtc_in_window_off;
+    dtcd[XSP3_DTC_IWG][chan] = xsp_dtc_in_window_grad;
+    dtcd[XSP3_DTC_IWRO][chan] = xsp_dtc_in_window_rate_off;
+    dtcd[XSP3_DTC_IWRG][chan] = xsp_dtc_in_window_rate_grad;
   }
   return status;
 }
@@ -698,7 +806,8 @@ int LibXspressWrapper::write_dtc_params(int max_channels,
                                         std::vector<double>& dtc_in_window_off,
                                         std::vector<double>& dtc_in_window_grad,
                                         std::vector<double>& dtc_in_window_rate_off,
-                                        std::vector<double>& dtc_in_window_rate_grad)
+                                        std::vector<double>& dtc_in_window_rate_grad,
+                                        const std::vector<bool>& channels)
 {
   int status = XSP_STATUS_OK;
   int xsp_status = 0;
@@ -714,6 +823,10 @@ int LibXspressWrapper::write_dtc_params(int max_channels,
 
   LOG4CXX_DEBUG_LEVEL(1, logger_, "Xspress wrapper calling xsp3_setDeadtimeCorrectionParameters2");
   for (int chan = 0; chan < max_channels; chan++) {
+    // Only write the selected channels, an empty selection writes them all
+    if (!channels.empty() && (chan >= channels.size() || !channels[chan])) {
+      continue;
+    }
     xsp_dtc_flags = dtc_flags[chan];
     xsp_dtc_all_event_off = dtc_all_event_off[chan];
     xsp_dtc_all_event_grad = dtc_all_event_grad[chan];
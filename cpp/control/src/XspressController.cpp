@@ -6,6 +6,8 @@
  */
 
 #include <stdio.h>
+#include <algorithm>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "XspressController.h"
 #include "DebugLevelLogger.h"
@@ -26,6 +28,11 @@ const std::string XspressController::CONFIG_APP                       = "app";
 const std::string XspressController::CONFIG_APP_SHUTDOWN              = "shutdown";
 const std::string XspressController::CONFIG_APP_DEBUG                 = "debug_level";
 const std::string XspressController::CONFIG_APP_CTRL_ENDPOINT         = "ctrl_endpoint";
+const std::string XspressController::CONFIG_APP_STATUS_REFRESH         = "status_refresh";
+const std::string XspressController::CONFIG_APP_TELEMETRY_ENDPOINT     = "telemetry_endpoint";
+const std::string XspressController::CONFIG_APP_TELEMETRY_PERIOD       = "telemetry_period";
+const std::string XspressController::CONFIG_APP_METRICS_PORT           = "metrics_port";
+const std::string XspressController::CONFIG_APP_METRICS_ADDRESS        = "metrics_address";
 
 const std::string XspressController::CONFIG_XSP                       = "config";
 const std::string XspressController::CONFIG_XSP_NUM_CARDS             = "num_cards";
@@ -46,7 +53,12 @@ const std::string XspressController::CONFIG_XSP_INVERT_VETO           = "invert_
 const std::string XspressController::CONFIG_XSP_DEBOUNCE              = "debounce";
 const std::string XspressController::CONFIG_XSP_EXPOSURE_TIME         = "exposure_time";
 const std::string XspressController::CONFIG_XSP_FRAMES                = "num_images";
+const std::string XspressController::CONFIG_XSP_CONTINUOUS            = "continuous";
 const std::string XspressController::CONFIG_XSP_MODE                  = "mode";
+const std::string XspressController::CONFIG_XSP_FRAMES_SAMPLE_PERIOD  = "frames_sample_period";
+const std::string XspressController::CONFIG_XSP_TEMP_SAMPLE_PERIOD    = "temperature_sample_period";
+const std::string XspressController::CONFIG_XSP_PARALLEL_SETUP        = "parallel_setup";
+const std::string XspressController::CONFIG_XSP_SETTINGS_CACHE        = "settings_cache";
 const std::string XspressController::CONFIG_XSP_SCA5_LOW              = "sca5_low_lim";
 const std::string XspressController::CONFIG_XSP_SCA5_HIGH             = "sca5_high_lim";
 const std::string XspressController::CONFIG_XSP_SCA6_LOW              = "sca6_low_lim";
@@ -66,6 +78,7 @@ const std::string XspressController::CONFIG_XSP_DTC_IN_WIN_RATE_GRAD  = "dtc_in_
 const std::string XspressController::CONFIG_DAQ                       = "daq";
 const std::string XspressController::CONFIG_DAQ_ENABLED               = "enabled";
 const std::string XspressController::CONFIG_DAQ_ZMQ_ENDPOINTS         = "endpoints";
+const std::string XspressController::CONFIG_DAQ_SPARSE_THRESHOLD       = "sparse_threshold";
 
 const std::string XspressController::CONFIG_CMD                       = "command";
 const std::string XspressController::CONFIG_CMD_CONNECT               = "connect";
@@ -75,6 +88,9 @@ const std::string XspressController::CONFIG_CMD_RESTORE               = "restore
 const std::string XspressController::CONFIG_CMD_START                 = "start";
 const std::string XspressController::CONFIG_CMD_STOP                  = "stop";
 const std::string XspressController::CONFIG_CMD_TRIGGER               = "trigger";
+const std::string XspressController::CONFIG_CMD_REARM                 = "rearm";
+const std::string XspressController::CONFIG_CMD_QUEUE                 = "queue";
+const std::string XspressController::CONFIG_SEGMENT_ACQ_ID            = "acq_id";
 
 const std::string XspressController::CONFIG_XSP_MODE_MCA              = XSP_MODE_MCA;
 const std::string XspressController::CONFIG_XSP_MODE_LIST             = XSP_MODE_LIST;
@@ -91,6 +107,22 @@ const std::string XspressController::STATUS_CHANNELS_CONNECTED        = "num_ch_
 const std::string XspressController::STATUS_CARDS_CONNECTED           = "cards_connected";
 const std::string XspressController::STATUS_CHANNEL_FRAMES            = "ch_frames_acquired";
 const std::string XspressController::STATUS_FEM_DROPPED_FRAMES        = "fem_dropped_frames";
+const std::string XspressController::STATUS_SPARSE_FRAMES             = "sparse_frames";
+const std::string XspressController::STATUS_ARM_LATENCY               = "arm_latency";
+const std::string XspressController::STATUS_ARM_PREPARED              = "arm_prepared";
+const std::string XspressController::STATUS_CONFIGURE_LATENCY         = "configure_latency";
+const std::string XspressController::STATUS_CONNECT_TIME_COLD         = "connect_time_cold";
+const std::string XspressController::STATUS_CONNECT_TIME_WARM         = "connect_time_warm";
+const std::string XspressController::STATUS_QUEUE_SEGMENT             = "queue_segment";
+const std::string XspressController::STATUS_QUEUE_PENDING             = "queue_pending";
+const std::string XspressController::STATUS_SEGMENT_ACQ_ID            = "segment_acq_id";
+const std::string XspressController::STATUS_SEGMENT_DEAD_TIME         = "segment_dead_time";
+const std::string XspressController::STATUS_FRAME_RATE                = "frame_rate";
+const std::string XspressController::STATUS_DATA_RATE                 = "data_rate";
+const std::string XspressController::STATUS_BUFFER_HEADROOM           = "buffer_headroom";
+const std::string XspressController::STATUS_MIN_BUFFER_HEADROOM       = "min_buffer_headroom";
+const std::string XspressController::STATUS_GENERATION                = "generation";
+const std::string XspressController::STATUS_SINCE                     = "status_since";
 const std::string XspressController::STATUS_LIVE_SCALAR[]             = {"scalar_0",
                                                                          "scalar_1",
                                                                          "scalar_2",
@@ -122,12 +154,26 @@ XspressController::XspressController(bool simulation) :
     threadRunning_(false),
     threadInitError_(false),
     shutdown_(false),
+    status_generation_(0),
+    status_refresh_ms_(DEFAULT_STATUS_REFRESH_MS),
+    status_timer_id_(-1),
     ipc_context_(OdinData::IpcContext::Instance(1)),
     ctrlThread_(boost::bind(&XspressController::runIpcService, this)),
     ctrlChannelEndpoint_(""),
     ctrlChannel_(ZMQ_ROUTER),
+    telemetryEndpoint_(""),
+    telemetryChannel_(ZMQ_PUB),
+    segmentWakeRecvChannel_(ZMQ_PAIR),
+    segmentWakeSendChannel_(ZMQ_PAIR),
+    telemetry_period_ms_(DEFAULT_TELEMETRY_PERIOD_MS),
+    telemetry_timer_id_(-1),
+    telemetry_sequence_(0),
     error_(""),
-    state_("")
+    state_(""),
+    configure_latency_us_(0),
+    connect_time_cold_ms_(0),
+    connect_time_warm_ms_(0),
+    metrics_address_(XSP_METRICS_DEFAULT_ADDRESS)
 {
   OdinData::configure_logging_mdc(OdinData::app_path.c_str());
   LOG4CXX_DEBUG_LEVEL(1, logger_, "Constructing XspressController");
@@ -144,6 +190,13 @@ XspressController::XspressController(bool simulation) :
       throw std::runtime_error(threadInitMsg_);
     }
   }
+
+  // Wake the reactor as soon as the DAQ reads out a queued segment so that the
+  // next is armed straight away, rather than on the next status refresh
+  segmentWakeRecvChannel_.bind(SEGMENT_WAKE_ENDPOINT);
+  segmentWakeSendChannel_.connect(SEGMENT_WAKE_ENDPOINT);
+  reactor_->register_channel(segmentWakeRecvChannel_, boost::bind(&XspressController::handleSegmentWake, this));
+  xsp_->setSegmentNotify(boost::bind(&XspressController::notifySegmentComplete, this));
 }
 
 /**
@@ -207,7 +260,12 @@ void XspressController::handleCtrlChannel()
     else if ((ctrlMsg.get_msg_type() == OdinData::IpcMessage::MsgTypeCmd) &&
              (ctrlMsg.get_msg_val() == OdinData::IpcMessage::MsgValCmdRequestConfiguration)) {
         replyMsg.set_msg_type(OdinData::IpcMessage::MsgTypeAck);
-        this->requestConfiguration(replyMsg);
+        // Clients may ask for only the status that changed since a previous reply
+        uint64_t since = 0;
+        if (ctrlMsg.has_param(XspressController::STATUS_SINCE)){
+          since = ctrlMsg.get_param<uint64_t>(XspressController::STATUS_SINCE);
+        }
+        this->requestConfiguration(replyMsg, since);
         LOG4CXX_DEBUG_LEVEL(3, logger_, "Control thread reply message (request configuration): "
                                << replyMsg.encode());
     }
@@ -253,112 +311,340 @@ void XspressController::handleCtrlChannel()
 /** Provide status information to requesting clients.
  *
  * This is called in response to a status request from a connected client. The reply to the
- * request is populated with status information from the shared memory controller and all the
- * plugins currently loaded, and with any error messages currently stored.
+ * request is populated from the cached status groups, which are rebuilt by refreshStatus
+ * only when their values change, so a request does not rebuild the status tree.
  *
  * @param[in,out] reply - response IPC message to be populated with status parameters
+ * @param[in] since - only include groups that changed after this generation, 0 for all groups
+ */
+void XspressController::provideStatus(OdinData::IpcMessage& reply, uint64_t since)
+{
+  // Make sure the cache has been built at least once
+  if (status_generation_ == 0){
+    refreshStatus();
+  }
+  for (int index = 0; index < STATUS_GROUP_COUNT; index++){
+    if (status_groups_[index].generation_ > since){
+      reply.update(*status_groups_[index].message_);
+    }
+  }
+  reply.set_param(XspressController::STATUS + "/" +
+    XspressController::STATUS_GENERATION, status_generation_);
+}
+
+/** Handle a segment wake message sent by notifySegmentComplete.
+ *
+ * Runs on the reactor thread and arms the next segment of a queued acquisition.
  */
-void XspressController::provideStatus(OdinData::IpcMessage& reply)
+void XspressController::handleSegmentWake()
 {
+  segmentWakeRecvChannel_.recv();
+  if (xsp_){
+    xsp_->armPendingSegment();
+  }
+}
+
+/** Called from the DAQ control thread when a queued segment has been read out.
+ *
+ * Sends a wake message to the reactor, which arms the next segment.
+ */
+void XspressController::notifySegmentComplete()
+{
+  segmentWakeSendChannel_.send("segment");
+}
+
+/** Rebuild any status groups whose values have changed.
+ *
+ * The values are read from the detector and compared against those the cached
+ * group was built from. Only the groups that differ are rebuilt, and each
+ * rebuilt group is stamped with a new generation number.
+ */
+void XspressController::refreshStatus()
+{
+  // The refresh timer can fire before the detector object has been created
+  if (!xsp_){
+    return;
+  }
+  // Fallback for arming the next segment of a queued acquisition in case a
+  // segment wake message was missed, this returns at once if none is pending
+  xsp_->armPendingSegment();
+
   // Check the acquisition failed state
   if (xsp_->getXspAcqFailed()){
     setError(xsp_->getErrorString());
   }
-  // Return the current error status
-  reply.set_param(XspressController::STATUS + "/" +
-    XspressController::STATUS_ERROR, error_);
-  // Return the current state
-  reply.set_param(XspressController::STATUS + "/" +
-    XspressController::STATUS_STATE, state_);
-  // Check if we are connected to the hardware
-  reply.set_param(XspressController::STATUS + "/" +
-    XspressController::STATUS_CONNECTED, xsp_->checkConnected());
-  // Check if we need to perform a reconnection to the hardware
-  reply.set_param(XspressController::STATUS + "/" +
-    XspressController::STATUS_RECONNECT_REQUIRED, xsp_->getReconnectStatus());
-  // Clients expect the acq complete status, which is the inverse of the acquiring method
-  reply.set_param(XspressController::STATUS + "/" +
-    XspressController::STATUS_ACQ_COMPLETE, !xsp_->getXspAcquiring());
-  // Number of frames read for current acquisition
-  reply.set_param(XspressController::STATUS + "/" +
-    XspressController::STATUS_FRAMES, xsp_->getXspFramesRead());
-  // Number of channels connected per card
+
+  // Error, state and acquisition progress
+  bool connected = xsp_->checkConnected();
+  bool reconnect = xsp_->getReconnectStatus();
+  bool acq_complete = !xsp_->getXspAcquiring();
+  int32_t frames = xsp_->getXspFramesRead();
+  uint32_t sparse_frames = xsp_->getXspDAQSparseFrames();
+  uint32_t arm_latency = xsp_->getXspArmLatency();
+  bool arm_prepared = xsp_->getXspArmPrepared();
+  uint32_t queue_segment = xsp_->getXspQueueSegment();
+  uint32_t queue_pending = xsp_->getXspQueuePending();
+  std::string segment_acq_id = xsp_->getXspSegmentAcqId();
+  uint32_t segment_dead_time = xsp_->getXspSegmentDeadTime();
+  double frame_rate = xsp_->getXspDAQFrameRate();
+  double data_rate = xsp_->getXspDAQDataRate();
+  double buffer_headroom = xsp_->getXspDAQBufferHeadroom();
+  double min_buffer_headroom = xsp_->getXspDAQMinBufferHeadroom();
+  std::vector<double> values;
+  values.push_back(connected);
+  values.push_back(reconnect);
+  values.push_back(acq_complete);
+  values.push_back(frames);
+  values.push_back(sparse_frames);
+  values.push_back(arm_latency);
+  values.push_back(arm_prepared);
+  values.push_back(configure_latency_us_);
+  values.push_back(connect_time_cold_ms_);
+  values.push_back(connect_time_warm_ms_);
+  values.push_back(queue_segment);
+  values.push_back(queue_pending);
+  values.push_back(segment_dead_time);
+  values.push_back(frame_rate);
+  values.push_back(data_rate);
+  values.push_back(buffer_headroom);
+  values.push_back(min_buffer_headroom);
+  if (status_groups_[STATUS_GROUP_STATE].changed(values, error_ + "\n" + state_ + "\n" + segment_acq_id)){
+    boost::shared_ptr<OdinData::IpcMessage> msg(new OdinData::IpcMessage());
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_ERROR, error_);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_STATE, state_);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_CONNECTED, connected);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_RECONNECT_REQUIRED, reconnect);
+    // Clients expect the acq complete status, which is the inverse of the acquiring method
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_ACQ_COMPLETE, acq_complete);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_FRAMES, frames);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_SPARSE_FRAMES, sparse_frames);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_ARM_LATENCY, arm_latency);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_ARM_PREPARED, arm_prepared);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_CONFIGURE_LATENCY, configure_latency_us_);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_CONNECT_TIME_COLD, connect_time_cold_ms_);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_CONNECT_TIME_WARM, connect_time_warm_ms_);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_QUEUE_SEGMENT, queue_segment);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_QUEUE_PENDING, queue_pending);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_SEGMENT_ACQ_ID, segment_acq_id);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_SEGMENT_DEAD_TIME, segment_dead_time);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_FRAME_RATE, frame_rate);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_DATA_RATE, data_rate);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_BUFFER_HEADROOM, buffer_headroom);
+    msg->set_param(XspressController::STATUS + "/" + XspressController::STATUS_MIN_BUFFER_HEADROOM, min_buffer_headroom);
+    storeStatusGroup(STATUS_GROUP_STATE, msg);
+  }
+
+  // Channels and cards connected, frames read and dropped per FEM
   std::vector<int32_t> ch_con = xsp_->getChannelsConnected();
-  for (int index = 0; index < ch_con.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_CHANNELS_CONNECTED + "[]", ch_con[index]);
-  }
-  // Cards connected status
   std::vector<bool> cards_con = xsp_->getCardsConnected();
-  for (int index = 0; index < cards_con.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_CARDS_CONNECTED + "[]", (int32_t)cards_con[index]);
-  }
-  // Number of frames per FEM
   std::vector<int32_t> ch_frames = xsp_->getXspFEMFramesRead();
-  for (int index = 0; index < ch_frames.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_CHANNEL_FRAMES + "[]", ch_frames[index]);
-  }
-  // Number of dropped frames per FEM
   std::vector<int32_t> dropped_frames = xsp_->getXspFEMDroppedFrames();
-  for (int index = 0; index < dropped_frames.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_FEM_DROPPED_FRAMES + "[]", dropped_frames[index]);
+  values.clear();
+  values.insert(values.end(), ch_con.begin(), ch_con.end());
+  values.push_back(-1);
+  values.insert(values.end(), cards_con.begin(), cards_con.end());
+  values.push_back(-1);
+  values.insert(values.end(), ch_frames.begin(), ch_frames.end());
+  values.push_back(-1);
+  values.insert(values.end(), dropped_frames.begin(), dropped_frames.end());
+  if (status_groups_[STATUS_GROUP_CARDS].changed(values, "")){
+    boost::shared_ptr<OdinData::IpcMessage> msg(new OdinData::IpcMessage());
+    for (int index = 0; index < ch_con.size(); index++){
+      msg->set_param(XspressController::STATUS + "/" +
+                     XspressController::STATUS_CHANNELS_CONNECTED + "[]", ch_con[index]);
+    }
+    for (int index = 0; index < cards_con.size(); index++){
+      msg->set_param(XspressController::STATUS + "/" +
+                     XspressController::STATUS_CARDS_CONNECTED + "[]", (int32_t)cards_con[index]);
+    }
+    for (int index = 0; index < ch_frames.size(); index++){
+      msg->set_param(XspressController::STATUS + "/" +
+                     XspressController::STATUS_CHANNEL_FRAMES + "[]", ch_frames[index]);
+    }
+    for (int index = 0; index < dropped_frames.size(); index++){
+      msg->set_param(XspressController::STATUS + "/" +
+                     XspressController::STATUS_FEM_DROPPED_FRAMES + "[]", dropped_frames[index]);
+    }
+    storeStatusGroup(STATUS_GROUP_CARDS, msg);
   }
 
-  // Live scalar values from latest MCA
+  // Live scalars, DTC factors and input estimates from latest MCA
+  std::vector<uint32_t> live_scalars[NUMBER_OF_SCALARS];
+  values.clear();
   for (int sc_index = 0; sc_index < NUMBER_OF_SCALARS; sc_index++){
-    std::vector<uint32_t> live_scalars = xsp_->getLiveScalars(sc_index);
-    for (int index = 0; index < live_scalars.size(); index++){
-      reply.set_param(XspressController::STATUS + "/" +
-                      XspressController::STATUS_LIVE_SCALAR[sc_index] + "[]", live_scalars[index]);
-    }
+    live_scalars[sc_index] = xsp_->getLiveScalars(sc_index);
+    values.insert(values.end(), live_scalars[sc_index].begin(), live_scalars[sc_index].end());
+    values.push_back(-1);
   }
-  // Live DTC factors from latest MCA
   std::vector<double> live_dtc = xsp_->getLiveDtcFactors();
-  for (int index = 0; index < live_dtc.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_LIVE_DTC + "[]", live_dtc[index]);
-  }
-  // Live input estimates from latest MCA
   std::vector<double> live_inp_est = xsp_->getLiveInpEst();
-  for (int index = 0; index < live_inp_est.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_LIVE_INP_EST + "[]", live_inp_est[index]);
+  values.insert(values.end(), live_dtc.begin(), live_dtc.end());
+  values.push_back(-1);
+  values.insert(values.end(), live_inp_est.begin(), live_inp_est.end());
+  if (status_groups_[STATUS_GROUP_LIVE].changed(values, "")){
+    boost::shared_ptr<OdinData::IpcMessage> msg(new OdinData::IpcMessage());
+    for (int sc_index = 0; sc_index < NUMBER_OF_SCALARS; sc_index++){
+      for (int index = 0; index < live_scalars[sc_index].size(); index++){
+        msg->set_param(XspressController::STATUS + "/" +
+                       XspressController::STATUS_LIVE_SCALAR[sc_index] + "[]", live_scalars[sc_index][index]);
+      }
+    }
+    for (int index = 0; index < live_dtc.size(); index++){
+      msg->set_param(XspressController::STATUS + "/" +
+                     XspressController::STATUS_LIVE_DTC + "[]", live_dtc[index]);
+    }
+    for (int index = 0; index < live_inp_est.size(); index++){
+      msg->set_param(XspressController::STATUS + "/" +
+                     XspressController::STATUS_LIVE_INP_EST + "[]", live_inp_est[index]);
+    }
+    storeStatusGroup(STATUS_GROUP_LIVE, msg);
   }
 
   // Temperatures
-  std::vector<float> temp_0 = xsp_->getTemperature0();
-  for (int index = 0; index < temp_0.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_TEMPERATURE[0] + "[]", (double)temp_0[index]);
-  }
-  std::vector<float> temp_1 = xsp_->getTemperature1();
-  for (int index = 0; index < temp_1.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_TEMPERATURE[1] + "[]", (double)temp_1[index]);
-  }
-  std::vector<float> temp_2 = xsp_->getTemperature2();
-  for (int index = 0; index < temp_2.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_TEMPERATURE[2] + "[]", (double)temp_2[index]);
-  }
-  std::vector<float> temp_3 = xsp_->getTemperature3();
-  for (int index = 0; index < temp_3.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_TEMPERATURE[3] + "[]", (double)temp_3[index]);
-  }
-  std::vector<float> temp_4 = xsp_->getTemperature4();
-  for (int index = 0; index < temp_4.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_TEMPERATURE[4] + "[]", (double)temp_4[index]);
-  }
-  std::vector<float> temp_5 = xsp_->getTemperature5();
-  for (int index = 0; index < temp_5.size(); index++){
-    reply.set_param(XspressController::STATUS + "/" +
-                    XspressController::STATUS_TEMPERATURE[5] + "[]", (double)temp_5[index]);
+  std::vector<float> temps[NUMBER_OF_TEMPERATURES];
+  temps[0] = xsp_->getTemperature0();
+  temps[1] = xsp_->getTemperature1();
+  temps[2] = xsp_->getTemperature2();
+  temps[3] = xsp_->getTemperature3();
+  temps[4] = xsp_->getTemperature4();
+  temps[5] = xsp_->getTemperature5();
+  values.clear();
+  for (int t_index = 0; t_index < NUMBER_OF_TEMPERATURES; t_index++){
+    values.insert(values.end(), temps[t_index].begin(), temps[t_index].end());
+    values.push_back(-1);
+  }
+  if (status_groups_[STATUS_GROUP_TEMPERATURE].changed(values, "")){
+    boost::shared_ptr<OdinData::IpcMessage> msg(new OdinData::IpcMessage());
+    for (int t_index = 0; t_index < NUMBER_OF_TEMPERATURES; t_index++){
+      for (int index = 0; index < temps[t_index].size(); index++){
+        msg->set_param(XspressController::STATUS + "/" +
+                       XspressController::STATUS_TEMPERATURE[t_index] + "[]", (double)temps[t_index][index]);
+      }
+    }
+    storeStatusGroup(STATUS_GROUP_TEMPERATURE, msg);
+  }
+
+  // Keep the metrics text current while it is being served
+  if (metrics_server_.get_port() > 0){
+    renderMetrics();
+  }
+}
+
+/** Replace a cached status group and stamp it with a new generation.
+ *
+ * @param[in] group - index of the status group.
+ * @param[in] msg - message holding the rebuilt status parameters of the group.
+ */
+void XspressController::storeStatusGroup(int group, boost::shared_ptr<OdinData::IpcMessage> msg)
+{
+  status_generation_++;
+  status_groups_[group].message_ = msg;
+  status_groups_[group].generation_ = status_generation_;
+  LOG4CXX_DEBUG_LEVEL(4, logger_, "Status group " << group << " updated to generation " << status_generation_);
+}
+
+/** Render the OpenMetrics text for this application.
+ *
+ * This is called on the reactor thread at each status refresh so that the
+ * metrics server thread never touches the detector objects directly.
+ */
+void XspressController::renderMetrics()
+{
+  XspressMetricsWriter writer("xspress_control_");
+  writer.gauge("connected", "Connected to the Xspress hardware", (int)xsp_->checkConnected());
+  writer.gauge("acquiring", "Acquisition in progress", (int)xsp_->getXspAcquiring());
+  writer.gauge("frames_read", "Frames read out in the current acquisition", xsp_->getXspFramesRead());
+  writer.gauge("channel_frames", "Frames read out by each channel", "channel", xsp_->getXspFEMFramesRead());
+  writer.gauge("dropped_frames", "Frames dropped by each card", "card", xsp_->getXspFEMDroppedFrames());
+  writer.counter("daq_bytes_sent", "Bytes sent by the DAQ worker threads", xsp_->getXspDAQBytesSent());
+  writer.gauge("daq_sparse_frames", "Frames sent sparse encoded in the current acquisition", xsp_->getXspDAQSparseFrames());
+  writer.gauge("daq_backlog_frames", "Frames waiting in the circular buffer at the last dispatch", xsp_->getXspDAQBacklogFrames());
+  writer.gauge("daq_frame_rate", "Frames read per second over the last second of acquisition", xsp_->getXspDAQFrameRate());
+  writer.gauge("daq_data_rate_bytes", "Bytes sent per second over the last second of acquisition", xsp_->getXspDAQDataRate());
+  writer.gauge("daq_buffer_headroom", "Fraction of the circular buffer free at the last dispatch", xsp_->getXspDAQBufferHeadroom());
+  writer.gauge("daq_min_buffer_headroom", "Smallest fraction of the circular buffer free in the current acquisition",
+               xsp_->getXspDAQMinBufferHeadroom());
+  writer.histogram("daq_batch_seconds", "Time the DAQ workers take to process each batch of frames",
+                   xsp_->getXspDAQBatchLatencyHistogram());
+  writer.histogram("arm_seconds", "Time taken to arm or re-arm the detector", xsp_->getXspArmLatencyHistogram());
+  writer.counter("rearms", "Arms that re-used the prepared trigger settings", xsp_->getXspRearms());
+  writer.histogram("segment_dead_seconds", "Time between the end of a queued segment and the next being armed",
+                   xsp_->getXspSegmentDeadTimeHistogram());
+  writer.counter("hw_writes", "Per-channel hardware writes issued by configuration", xsp_->getXspHwWrites());
+  writer.counter("hw_writes_skipped", "Per-channel hardware writes skipped as unchanged", xsp_->getXspHwWritesSkipped());
+  writer.gauge("configure_seconds", "Time taken to apply the last configuration", configure_latency_us_ / 1000000.0);
+  writer.gauge("connect_cold_seconds", "Time taken by the last connection that read back all settings",
+               connect_time_cold_ms_ / 1000.0);
+  writer.gauge("connect_warm_seconds", "Time taken by the last connection that used the settings cache",
+               connect_time_warm_ms_ / 1000.0);
+  std::vector<float> temperatures[NUMBER_OF_TEMPERATURES] = {
+    xsp_->getTemperature0(), xsp_->getTemperature1(), xsp_->getTemperature2(),
+    xsp_->getTemperature3(), xsp_->getTemperature4(), xsp_->getTemperature5()
+  };
+  for (int index = 0; index < NUMBER_OF_TEMPERATURES; index++){
+    std::stringstream name;
+    name << "temperature_" << index << "_celsius";
+    writer.gauge(name.str(), "Card temperature sensor reading", "card", temperatures[index]);
+  }
+
+  boost::lock_guard<boost::mutex> lock(metrics_mutex_);
+  metrics_text_ = writer.str();
+}
+
+/** Provide the most recently rendered metrics text.
+ *
+ * Called from the metrics server thread.
+ *
+ * @return OpenMetrics text exposition.
+ */
+std::string XspressController::provideMetrics()
+{
+  boost::lock_guard<boost::mutex> lock(metrics_mutex_);
+  return metrics_text_;
+}
+
+/** Set the period at which the cached status is refreshed.
+ *
+ * The status timer is re-registered with the reactor, this must be called
+ * from the reactor thread.
+ *
+ * @param[in] period_ms - refresh period in milliseconds.
+ */
+void XspressController::setStatusRefresh(unsigned int period_ms)
+{
+  status_refresh_ms_ = std::max(period_ms, (unsigned int)MIN_STATUS_REFRESH_MS);
+  if (reactor_){
+    if (status_timer_id_ >= 0){
+      reactor_->remove_timer(status_timer_id_);
+    }
+    status_timer_id_ = reactor_->register_timer(status_refresh_ms_, 0,
+                                                boost::bind(&XspressController::refreshStatus, this));
   }
+  LOG4CXX_DEBUG_LEVEL(1, logger_, "Status refresh period set to " << status_refresh_ms_ << "ms");
+}
+
+XspressStatusGroup::XspressStatusGroup() :
+  generation_(0)
+{
+  message_ = boost::shared_ptr<OdinData::IpcMessage>(new OdinData::IpcMessage());
+}
+
+/** Check whether the values of a status group have changed.
+ *
+ * The new values are stored, ready for the next check.
+ *
+ * @param[in] values - numeric values the group is built from.
+ * @param[in] text - string values the group is built from.
+ * @return true if the values differ from the previous check.
+ */
+bool XspressStatusGroup::changed(const std::vector<double>& values, const std::string& text)
+{
+  if (generation_ > 0 && values == values_ && text == text_){
+    return false;
+  }
+  values_ = values;
+  text_ = text;
+  return true;
 }
 
 /** Provide version information to requesting clients.
@@ -406,6 +692,7 @@ void XspressController::provideAPIVersion(OdinData::IpcMessage& reply)
 void XspressController::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply)
 {
   LOG4CXX_DEBUG_LEVEL(1, logger_, "Configuration submitted: " << config.encode());
+  boost::posix_time::ptime configure_start = boost::posix_time::microsec_clock::universal_time();
   // First clear out any existing error message
   setError("");
   // Reset any failed acquisition error messages
@@ -435,6 +722,11 @@ void XspressController::configure(OdinData::IpcMessage& config, OdinData::IpcMes
     this->configureCommand(cmdConfig, reply);
   }
 
+  configure_latency_us_ = (boost::posix_time::microsec_clock::universal_time() - configure_start).total_microseconds();
+  LOG4CXX_DEBUG_LEVEL(1, logger_, "Configuration applied in " << configure_latency_us_ << "us");
+
+  // Configuration and commands can change the status, so refresh it straight away
+  refreshStatus();
 }
 
 /**
@@ -457,6 +749,48 @@ void XspressController::configureApp(OdinData::IpcMessage& config, OdinData::Ipc
     LOG4CXX_DEBUG_LEVEL(1, logger_, "Setting control end point to  " << endpoint);
     this->setupControlInterface(endpoint);
   }
+
+  if (config.has_param(XspressController::CONFIG_APP_STATUS_REFRESH)) {
+    unsigned int refresh = config.get_param<unsigned int>(XspressController::CONFIG_APP_STATUS_REFRESH);
+    this->setStatusRefresh(refresh);
+  }
+
+  if (config.has_param(XspressController::CONFIG_APP_TELEMETRY_PERIOD)) {
+    unsigned int period = config.get_param<unsigned int>(XspressController::CONFIG_APP_TELEMETRY_PERIOD);
+    this->setTelemetryPeriod(period);
+  }
+
+  if (config.has_param(XspressController::CONFIG_APP_TELEMETRY_ENDPOINT)) {
+    std::string endpoint = config.get_param<std::string>(XspressController::CONFIG_APP_TELEMETRY_ENDPOINT);
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "Setting telemetry end point to  " << endpoint);
+    this->setupTelemetryInterface(endpoint);
+  }
+
+  if (config.has_param(XspressController::CONFIG_APP_METRICS_ADDRESS)) {
+    metrics_address_ = config.get_param<std::string>(XspressController::CONFIG_APP_METRICS_ADDRESS);
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "Setting metrics address to  " << metrics_address_);
+  }
+
+  // A change of address restarts the server on its current port
+  if (config.has_param(XspressController::CONFIG_APP_METRICS_PORT) ||
+      config.has_param(XspressController::CONFIG_APP_METRICS_ADDRESS)) {
+    int port = metrics_server_.get_port();
+    if (config.has_param(XspressController::CONFIG_APP_METRICS_PORT)) {
+      port = config.get_param<int>(XspressController::CONFIG_APP_METRICS_PORT);
+      LOG4CXX_DEBUG_LEVEL(1, logger_, "Setting metrics port to  " << port);
+    }
+    if (port > 0){
+      this->renderMetrics();
+      if (!metrics_server_.start(port, boost::bind(&XspressController::provideMetrics, this), metrics_address_)){
+        std::stringstream ss;
+        ss << "Could not serve metrics on " << metrics_address_ << ":" << port;
+        reply.set_nack(ss.str());
+        setError(ss.str());
+      }
+    } else {
+      metrics_server_.stop();
+    }
+  }
 }
 
 /**
@@ -539,6 +873,20 @@ void XspressController::configureXsp(OdinData::IpcMessage& config, OdinData::Ipc
     xsp_->setXspUseResgrades(use_resgrades);
   }
 
+  // Check for the per-card parallel setup flag
+  if (config.has_param(XspressController::CONFIG_XSP_PARALLEL_SETUP)) {
+    bool parallel = config.get_param<bool>(XspressController::CONFIG_XSP_PARALLEL_SETUP);
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "parallel_setup set to  " << parallel);
+    xsp_->setXspParallelSetup(parallel);
+  }
+
+  // Check for the settings cache flag
+  if (config.has_param(XspressController::CONFIG_XSP_SETTINGS_CACHE)) {
+    bool settings_cache = config.get_param<bool>(XspressController::CONFIG_XSP_SETTINGS_CACHE);
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "settings_cache set to  " << settings_cache);
+    xsp_->setXspSettingsCache(settings_cache);
+  }
+
   // Check for run flags parameter
   if (config.has_param(XspressController::CONFIG_XSP_RUN_FLAGS)) {
     int run_flags = config.get_param<int>(XspressController::CONFIG_XSP_RUN_FLAGS);
@@ -595,6 +943,27 @@ void XspressController::configureXsp(OdinData::IpcMessage& config, OdinData::Ipc
     xsp_->setXspFrames(frames);
   }
 
+  // Check for the continuous acquisition parameter
+  if (config.has_param(XspressController::CONFIG_XSP_CONTINUOUS)) {
+    bool continuous = config.get_param<bool>(XspressController::CONFIG_XSP_CONTINUOUS);
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "continuous set to  " << continuous);
+    xsp_->setXspContinuous(continuous);
+  }
+
+  // Check for the frame counter sampling period
+  if (config.has_param(XspressController::CONFIG_XSP_FRAMES_SAMPLE_PERIOD)) {
+    int period = config.get_param<int>(XspressController::CONFIG_XSP_FRAMES_SAMPLE_PERIOD);
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "frames_sample_period set to  " << period);
+    xsp_->setXspFramesSamplePeriod(period);
+  }
+
+  // Check for the temperature sampling period
+  if (config.has_param(XspressController::CONFIG_XSP_TEMP_SAMPLE_PERIOD)) {
+    int period = config.get_param<int>(XspressController::CONFIG_XSP_TEMP_SAMPLE_PERIOD);
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "temperature_sample_period set to  " << period);
+    xsp_->setXspTemperatureSamplePeriod(period);
+  }
+
   // Check for mode parameter
   if (config.has_param(XspressController::CONFIG_XSP_MODE)) {
     std::string mode = config.get_param<std::string>(XspressController::CONFIG_XSP_MODE);
@@ -610,18 +979,21 @@ void XspressController::configureXsp(OdinData::IpcMessage& config, OdinData::Ipc
     }
   }
 
-  // Check for sc5 low limit array parameter
-  if (config.has_param(XspressController::CONFIG_XSP_SCA5_LOW)){
-    const rapidjson::Value& val = config.get_param<const rapidjson::Value&>(XspressController::CONFIG_XSP_SCA5_LOW);
-    // Create the vector of limits
-    std::vector<uint32_t> sca5low;
-    for (rapidjson::SizeType i = 0; i < val.Size(); i++) {
-      const rapidjson::Value& ll = val[i];
-      uint32_t ival = ll.GetInt();
-      LOG4CXX_DEBUG_LEVEL(0, logger_, "Setting Scalar 5 low limit [" << i << "] = " << ival);
-      sca5low.push_back(ival);
-    }
-    status = xsp_->setSca5LowLimits(sca5low);
+  // Collect any SCA limit and threshold arrays so that they are written to
+  // the hardware together, each channel window being written at most once
+  std::vector<uint32_t> sca5low;
+  std::vector<uint32_t> sca5high;
+  std::vector<uint32_t> sca6low;
+  std::vector<uint32_t> sca6high;
+  std::vector<uint32_t> sca4t;
+  bool sca_update = false;
+  sca_update |= readScaArray(config, XspressController::CONFIG_XSP_SCA5_LOW, "Scalar 5 low limit", sca5low);
+  sca_update |= readScaArray(config, XspressController::CONFIG_XSP_SCA5_HIGH, "Scalar 5 high limit", sca5high);
+  sca_update |= readScaArray(config, XspressController::CONFIG_XSP_SCA6_LOW, "Scalar 6 low limit", sca6low);
+  sca_update |= readScaArray(config, XspressController::CONFIG_XSP_SCA6_HIGH, "Scalar 6 high limit", sca6high);
+  sca_update |= readScaArray(config, XspressController::CONFIG_XSP_SCA4_THRESH, "Scalar 4 threshold", sca4t);
+  if (sca_update){
+    status = xsp_->setScaParams(sca5low, sca5high, sca6low, sca6high, sca4t);
     if (status != XSP_STATUS_OK){
       // Command failed, return error with any error string
       reply.set_nack(xsp_->getErrorString());
@@ -629,82 +1001,83 @@ void XspressController::configureXsp(OdinData::IpcMessage& config, OdinData::Ipc
     }
   }
 
-  // Check for sc5 high limit array parameter
-  if (config.has_param(XspressController::CONFIG_XSP_SCA5_HIGH)){
-    const rapidjson::Value& val = config.get_param<const rapidjson::Value&>(XspressController::CONFIG_XSP_SCA5_HIGH);
-    // Create the vector of limits
-    std::vector<uint32_t> sca5high;
-    for (rapidjson::SizeType i = 0; i < val.Size(); i++) {
-      const rapidjson::Value& hl = val[i];
-      uint32_t ival = hl.GetInt();
-      LOG4CXX_DEBUG_LEVEL(0, logger_, "Setting Scalar 5 high limit [" << i << "] = " << ival);
-      sca5high.push_back(ival);
-    }
-    status = xsp_->setSca5HighLimits(sca5high);
-    if (status != XSP_STATUS_OK){
-      // Command failed, return error with any error string
-      reply.set_nack(xsp_->getErrorString());
-      setError(xsp_->getErrorString());
-    }
-  }
+}
 
-  // Check for sc6 low limit array parameter
-  if (config.has_param(XspressController::CONFIG_XSP_SCA6_LOW)){
-    const rapidjson::Value& val = config.get_param<const rapidjson::Value&>(XspressController::CONFIG_XSP_SCA6_LOW);
-    // Create the vector of limits
-    std::vector<uint32_t> sca6low;
-    for (rapidjson::SizeType i = 0; i < val.Size(); i++) {
-      const rapidjson::Value& ll = val[i];
-      uint32_t ival = ll.GetInt();
-      LOG4CXX_DEBUG_LEVEL(0, logger_, "Setting Scalar 6 low limit [" << i << "] = " << ival);
-      sca6low.push_back(ival);
-    }
-    status = xsp_->setSca6LowLimits(sca6low);
-    if (status != XSP_STATUS_OK){
-      // Command failed, return error with any error string
-      reply.set_nack(xsp_->getErrorString());
-      setError(xsp_->getErrorString());
-    }
+/**
+ * Read an array of SCA limits or thresholds from a configuration message.
+ *
+ * \param[in] config - IpcMessage containing configuration data.
+ * \param[in] param - name of the array parameter.
+ * \param[in] description - description of the values for logging.
+ * \param[out] values - the values read.
+ * \return true if the parameter was present.
+ */
+bool XspressController::readScaArray(OdinData::IpcMessage& config,
+                                     const std::string& param,
+                                     const std::string& description,
+                                     std::vector<uint32_t>& values)
+{
+  if (!config.has_param(param)){
+    return false;
   }
+  const rapidjson::Value& val = config.get_param<const rapidjson::Value&>(param);
+  for (rapidjson::SizeType i = 0; i < val.Size(); i++) {
+    uint32_t ival = val[i].GetInt();
+    LOG4CXX_DEBUG_LEVEL(0, logger_, "Setting " << description << " [" << i << "] = " << ival);
+    values.push_back(ival);
+  }
+  return true;
+}
 
-  // Check for sc6 high limit array parameter
-  if (config.has_param(XspressController::CONFIG_XSP_SCA6_HIGH)){
-    const rapidjson::Value& val = config.get_param<const rapidjson::Value&>(XspressController::CONFIG_XSP_SCA6_HIGH);
-    // Create the vector of limits
-    std::vector<uint32_t> sca6high;
-    for (rapidjson::SizeType i = 0; i < val.Size(); i++) {
-      const rapidjson::Value& hl = val[i];
-      uint32_t ival = hl.GetInt();
-      LOG4CXX_DEBUG_LEVEL(0, logger_, "Setting Scalar 6 high limit [" << i << "] = " << ival);
-      sca6high.push_back(ival);
+/**
+ * Read the segments of a queued acquisition from a command message.
+ *
+ * Each segment is an object which may set num_images, exposure_time,
+ * trigger_mode and acq_id, any not set are taken from the current
+ * configuration.
+ *
+ * \param[in] config - IpcMessage containing the queue command.
+ * \param[out] segments - the segments read.
+ * \return XSP_STATUS_OK if every segment was valid.
+ */
+int XspressController::readSegments(OdinData::IpcMessage& config, std::vector<XspressAcqSegment>& segments)
+{
+  const rapidjson::Value& val = config.get_param<const rapidjson::Value&>(XspressController::CONFIG_CMD_QUEUE);
+  if (!val.IsArray()){
+    xsp_->setErrorString("Queue command requires an array of segments");
+    return XSP_STATUS_ERROR;
+  }
+  for (rapidjson::SizeType i = 0; i < val.Size(); i++) {
+    if (!val[i].IsObject()){
+      xsp_->setErrorString("Each queued segment must be an object");
+      return XSP_STATUS_ERROR;
     }
-    status = xsp_->setSca6HighLimits(sca6high);
-    if (status != XSP_STATUS_OK){
-      // Command failed, return error with any error string
-      reply.set_nack(xsp_->getErrorString());
-      setError(xsp_->getErrorString());
+    XspressAcqSegment segment;
+    segment.frames_ = xsp_->getXspFrames();
+    segment.exposure_time_ = xsp_->getXspExposureTime();
+    segment.trigger_mode_ = xsp_->getXspTriggerMode();
+    const char *frames = XspressController::CONFIG_XSP_FRAMES.c_str();
+    const char *exposure_time = XspressController::CONFIG_XSP_EXPOSURE_TIME.c_str();
+    const char *trigger_mode = XspressController::CONFIG_XSP_TRIGGER_MODE.c_str();
+    const char *acq_id = XspressController::CONFIG_SEGMENT_ACQ_ID.c_str();
+    if (val[i].HasMember(frames) && val[i][frames].IsInt()){
+      segment.frames_ = val[i][frames].GetInt();
     }
-  }
-
-  // Check for sc6 high limit array parameter
-  if (config.has_param(XspressController::CONFIG_XSP_SCA4_THRESH)){
-    const rapidjson::Value& val = config.get_param<const rapidjson::Value&>(XspressController::CONFIG_XSP_SCA4_THRESH);
-    // Create the vector of limits
-    std::vector<uint32_t> sca4t;
-    for (rapidjson::SizeType i = 0; i < val.Size(); i++) {
-      const rapidjson::Value& th = val[i];
-      uint32_t ival = th.GetInt();
-      LOG4CXX_DEBUG_LEVEL(0, logger_, "Setting Scalar 4 threshold [" << i << "] = " << ival);
-      sca4t.push_back(ival);
+    if (val[i].HasMember(exposure_time) && val[i][exposure_time].IsNumber()){
+      segment.exposure_time_ = val[i][exposure_time].GetDouble();
     }
-    status = xsp_->setSca4Thresholds(sca4t);
-    if (status != XSP_STATUS_OK){
-      // Command failed, return error with any error string
-      reply.set_nack(xsp_->getErrorString());
-      setError(xsp_->getErrorString());
+    if (val[i].HasMember(trigger_mode) && val[i][trigger_mode].IsInt()){
+      segment.trigger_mode_ = val[i][trigger_mode].GetInt();
+    }
+    if (val[i].HasMember(acq_id) && val[i][acq_id].IsString()){
+      segment.acq_id_ = val[i][acq_id].GetString();
     }
+    LOG4CXX_DEBUG_LEVEL(0, logger_, "Queued segment [" << i << "] " << segment.frames_ << " frames of " <<
+                                    segment.exposure_time_ << "s, trigger mode " << segment.trigger_mode_ <<
+                                    " [" << segment.acq_id_ << "]");
+    segments.push_back(segment);
   }
-
+  return XSP_STATUS_OK;
 }
 
 /**
@@ -729,6 +1102,13 @@ void XspressController::configureDAQ(OdinData::IpcMessage& config, OdinData::Ipc
     xsp_->setXspDAQEndpoints(eps);
   }
 
+  // Check for the density threshold below which MCA frames are sent sparse
+  if (config.has_param(XspressController::CONFIG_DAQ_SPARSE_THRESHOLD)){
+    double threshold = config.get_param<double>(XspressController::CONFIG_DAQ_SPARSE_THRESHOLD);
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "Setting DAQ sparse threshold to " << threshold);
+    xsp_->setXspDAQSparseThreshold(threshold);
+  }
+
   // Check if DAQ is to be enabled
   if (config.has_param(XspressController::CONFIG_DAQ_ENABLED)){
     bool enable_daq = config.get_param<bool>(XspressController::CONFIG_DAQ_ENABLED);
@@ -750,6 +1130,7 @@ void XspressController::configureCommand(OdinData::IpcMessage& config, OdinData:
   // Check for a connect command
   if (config.has_param(XspressController::CONFIG_CMD_CONNECT)){
     LOG4CXX_DEBUG_LEVEL(1, logger_, "connect command executing");
+    boost::posix_time::ptime connect_start = boost::posix_time::microsec_clock::universal_time();
     // Attempt connection to the hardware
     int status = xsp_->connect();
     if (status != XSP_STATUS_OK){
@@ -774,6 +1155,14 @@ void XspressController::configureCommand(OdinData::IpcMessage& config, OdinData:
       // Command failed, return error with any error string
       reply.set_nack(xsp_->getErrorString());
       setError(xsp_->getErrorString());
+    } else {
+      // Record the connection time, warm if the settings cache was used
+      uint32_t connect_ms = (boost::posix_time::microsec_clock::universal_time() - connect_start).total_milliseconds();
+      if (xsp_->getXspSettingsCacheHit()){
+        connect_time_warm_ms_ = connect_ms;
+      } else {
+        connect_time_cold_ms_ = connect_ms;
+      }
     }
   }
 
@@ -801,6 +1190,34 @@ void XspressController::configureCommand(OdinData::IpcMessage& config, OdinData:
     }
   }
 
+  // Check for a re-arm command
+  if (config.has_param(XspressController::CONFIG_CMD_REARM)){
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "re-arm command executing");
+    // Attempt to re-arm with the prepared settings
+    int status = xsp_->rearmAcquisition();
+    if (status != XSP_STATUS_OK){
+      // Command failed, return error with any error string
+      reply.set_nack(xsp_->getErrorString());
+      setError(xsp_->getErrorString());
+    }
+  }
+
+  // Check for a queued acquisition command
+  if (config.has_param(XspressController::CONFIG_CMD_QUEUE)){
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "queue acquisition command executing");
+    std::vector<XspressAcqSegment> segments;
+    int status = readSegments(config, segments);
+    if (status == XSP_STATUS_OK){
+      // Attempt to start the queued acquisition
+      status = xsp_->queueAcquisition(segments);
+    }
+    if (status != XSP_STATUS_OK){
+      // Command failed, return error with any error string
+      reply.set_nack(xsp_->getErrorString());
+      setError(xsp_->getErrorString());
+    }
+  }
+
   // Check for a stop acquisition command
   if (config.has_param(XspressController::CONFIG_CMD_STOP)){
     LOG4CXX_DEBUG_LEVEL(1, logger_, "stop acquisition command executing");
@@ -833,8 +1250,9 @@ void XspressController::configureCommand(OdinData::IpcMessage& config, OdinData:
  * also sent a request for its configuration.
  *
  * \param[out] reply - Response IpcMessage with the current configuration.
+ * \param[in] status_since - only include status groups changed after this generation, 0 for all.
  */
-void XspressController::requestConfiguration(OdinData::IpcMessage& reply)
+void XspressController::requestConfiguration(OdinData::IpcMessage& reply, uint64_t status_since)
 {
   LOG4CXX_DEBUG_LEVEL(3, logger_, "Request for configuration made");
 
@@ -843,6 +1261,16 @@ void XspressController::requestConfiguration(OdinData::IpcMessage& reply)
                   XspressController::CONFIG_APP_DEBUG, debug_level);
   reply.set_param(XspressController::CONFIG_APP + "/" +
                   XspressController::CONFIG_APP_CTRL_ENDPOINT, ctrlChannelEndpoint_);
+  reply.set_param(XspressController::CONFIG_APP + "/" +
+                  XspressController::CONFIG_APP_STATUS_REFRESH, status_refresh_ms_);
+  reply.set_param(XspressController::CONFIG_APP + "/" +
+                  XspressController::CONFIG_APP_TELEMETRY_ENDPOINT, telemetryEndpoint_);
+  reply.set_param(XspressController::CONFIG_APP + "/" +
+                  XspressController::CONFIG_APP_TELEMETRY_PERIOD, telemetry_period_ms_);
+  reply.set_param(XspressController::CONFIG_APP + "/" +
+                  XspressController::CONFIG_APP_METRICS_PORT, metrics_server_.get_port());
+  reply.set_param(XspressController::CONFIG_APP + "/" +
+                  XspressController::CONFIG_APP_METRICS_ADDRESS, metrics_address_);
   // Add Xspress configuration parameter values to the reply
   reply.set_param(XspressController::CONFIG_XSP + "/" +
                   XspressController::CONFIG_XSP_NUM_CARDS, xsp_->getXspNumCards());
@@ -864,6 +1292,10 @@ void XspressController::requestConfiguration(OdinData::IpcMessage& reply)
                   XspressController::CONFIG_XSP_CONFIG_SAVE_PATH, xsp_->getXspConfigSavePath());
   reply.set_param(XspressController::CONFIG_XSP + "/" +
                   XspressController::CONFIG_XSP_USE_RESGRADES, xsp_->getXspUseResgrades());
+  reply.set_param(XspressController::CONFIG_XSP + "/" +
+                  XspressController::CONFIG_XSP_PARALLEL_SETUP, xsp_->getXspParallelSetup());
+  reply.set_param(XspressController::CONFIG_XSP + "/" +
+                  XspressController::CONFIG_XSP_SETTINGS_CACHE, xsp_->getXspSettingsCache());
   reply.set_param(XspressController::CONFIG_XSP + "/" +
                   XspressController::CONFIG_XSP_RUN_FLAGS, xsp_->getXspRunFlags());
   reply.set_param(XspressController::CONFIG_XSP + "/" +
@@ -880,8 +1312,14 @@ void XspressController::requestConfiguration(OdinData::IpcMessage& reply)
                   XspressController::CONFIG_XSP_EXPOSURE_TIME, xsp_->getXspExposureTime());
   reply.set_param(XspressController::CONFIG_XSP + "/" +
                   XspressController::CONFIG_XSP_FRAMES, xsp_->getXspFrames());
+  reply.set_param(XspressController::CONFIG_XSP + "/" +
+                  XspressController::CONFIG_XSP_CONTINUOUS, xsp_->getXspContinuous());
   reply.set_param(XspressController::CONFIG_XSP + "/" +
                   XspressController::CONFIG_XSP_MODE, xsp_->getXspMode());
+  reply.set_param(XspressController::CONFIG_XSP + "/" +
+                  XspressController::CONFIG_XSP_FRAMES_SAMPLE_PERIOD, xsp_->getXspFramesSamplePeriod());
+  reply.set_param(XspressController::CONFIG_XSP + "/" +
+                  XspressController::CONFIG_XSP_TEMP_SAMPLE_PERIOD, xsp_->getXspTemperatureSamplePeriod());
 
   std::vector<uint32_t> sca5ll = xsp_->getSca5LowLimits();
   for (int index = 0; index < sca5ll.size(); index++){
@@ -967,7 +1405,9 @@ void XspressController::requestConfiguration(OdinData::IpcMessage& reply)
     reply.set_param(XspressController::CONFIG_DAQ + "/" +
                     XspressController::CONFIG_DAQ_ZMQ_ENDPOINTS + "[]", eps[index]);
   }
-  provideStatus(reply);
+  reply.set_param(XspressController::CONFIG_DAQ + "/" +
+                  XspressController::CONFIG_DAQ_SPARSE_THRESHOLD, xsp_->getXspDAQSparseThreshold());
+  provideStatus(reply, status_since);
   provideVersion(reply);
   provideAPIVersion(reply);
 }
@@ -1002,8 +1442,18 @@ void XspressController::shutdown() {
     LOG4CXX_DEBUG_LEVEL(1, logger_, "Stopping Xspress Controller IPCReactor");
     reactor_->stop();
 
-    // Close control IPC channel
+    // Stop segment wake messages before closing their channels
+    xsp_->setSegmentNotify(boost::function<void()>());
+    reactor_->remove_channel(segmentWakeRecvChannel_);
+    segmentWakeRecvChannel_.close();
+    segmentWakeSendChannel_.close();
+
+    // Close control and telemetry IPC channels
     closeControlInterface();
+    closeTelemetryInterface();
+
+    // Stop serving metrics
+    metrics_server_.stop();
 
     shutdown_ = true;
     LOG4CXX_INFO(logger_, "Shutting Down");
@@ -1061,6 +1511,158 @@ void XspressController::closeControlInterface()
   }
 }
 
+/** Set up the telemetry interface.
+ *
+ * This method binds the telemetry publisher IpcChannel to the provided
+ * endpoint and starts the telemetry timer. Subscribers receive one binary
+ * telemetry message (see XspressTelemetry.h) every telemetry period.
+ *
+ * \param[in] endpoint - Name of the telemetry endpoint.
+ */
+void XspressController::setupTelemetryInterface(const std::string& endpoint)
+{
+  if (endpoint == telemetryEndpoint_){
+    return;
+  }
+  if (telemetryEndpoint_ != ""){
+    LOG4CXX_ERROR(logger_, "Telemetry already published on " << telemetryEndpoint_);
+    return;
+  }
+  try {
+    LOG4CXX_DEBUG_LEVEL(1, logger_, "Binding telemetry channel to endpoint: " << endpoint);
+    telemetryChannel_.bind(endpoint.c_str());
+    telemetryEndpoint_ = endpoint;
+  }
+  catch (zmq::error_t& e) {
+    LOG4CXX_ERROR(logger_, "Telemetry channel bind to endpoint " << endpoint << " failed: " << e.what());
+    return;
+  }
+  setTelemetryPeriod(telemetry_period_ms_);
+}
+
+/** Close the telemetry interface.
+ */
+void XspressController::closeTelemetryInterface()
+{
+  if (telemetryEndpoint_ != ""){
+    try {
+      LOG4CXX_DEBUG_LEVEL(1, logger_, "Closing telemetry endpoint socket.");
+      telemetryChannel_.close();
+    }
+    catch (zmq::error_t& e) {
+      throw std::runtime_error(e.what());
+    }
+    telemetryEndpoint_ = "";
+  }
+}
+
+/** Set the period at which telemetry is published.
+ *
+ * The telemetry timer is only registered once a telemetry endpoint has been
+ * bound; this must be called from the reactor thread.
+ *
+ * \param[in] period_ms - telemetry period in ms.
+ */
+void XspressController::setTelemetryPeriod(unsigned int period_ms)
+{
+  telemetry_period_ms_ = std::max(period_ms, (unsigned int)MIN_TELEMETRY_PERIOD_MS);
+  if (reactor_ && telemetryEndpoint_ != ""){
+    if (telemetry_timer_id_ >= 0){
+      reactor_->remove_timer(telemetry_timer_id_);
+    }
+    telemetry_timer_id_ = reactor_->register_timer(telemetry_period_ms_, 0,
+                                                   boost::bind(&XspressController::publishTelemetry, this));
+  }
+  LOG4CXX_DEBUG_LEVEL(1, logger_, "Telemetry period set to " << telemetry_period_ms_ << "ms");
+}
+
+/** Append a telemetry section to a message buffer.
+ *
+ * \param[in,out] buffer - telemetry message buffer.
+ * \param[in] id - section identifier.
+ * \param[in] type - element type of the section.
+ * \param[in] values - section values.
+ * \param[in,out] num_sections - count of sections in the message.
+ */
+template<typename T>
+static void add_telemetry_section(std::vector<char>& buffer, uint16_t id, uint16_t type,
+                                  const std::vector<T>& values, uint16_t& num_sections)
+{
+  XspressTelemetrySection section;
+  section.id = id;
+  section.type = type;
+  section.count = values.size();
+  const char *section_ptr = reinterpret_cast<const char *>(&section);
+  buffer.insert(buffer.end(), section_ptr, section_ptr + sizeof(section));
+  if (!values.empty()){
+    const char *values_ptr = reinterpret_cast<const char *>(&values[0]);
+    buffer.insert(buffer.end(), values_ptr, values_ptr + values.size() * sizeof(T));
+  }
+  num_sections++;
+}
+
+/** Publish a telemetry message on the telemetry channel.
+ *
+ * The values are taken from the detector status snapshots, so publishing
+ * never waits on the hardware.
+ */
+void XspressController::publishTelemetry()
+{
+  if (!xsp_ || telemetryEndpoint_ == ""){
+    return;
+  }
+
+  std::vector<char> buffer(sizeof(XspressTelemetryHeader));
+  uint16_t num_sections = 0;
+
+  std::vector<uint32_t> state;
+  state.push_back(xsp_->checkConnected());
+  state.push_back(xsp_->getXspAcquiring());
+  state.push_back(xsp_->getXspFramesRead());
+  add_telemetry_section(buffer, XSP_TELEMETRY_STATE, XSP_TELEMETRY_UINT32, state, num_sections);
+
+  add_telemetry_section(buffer, XSP_TELEMETRY_CHANNEL_FRAMES, XSP_TELEMETRY_INT32,
+                        xsp_->getXspFEMFramesRead(), num_sections);
+  add_telemetry_section(buffer, XSP_TELEMETRY_FEM_DROPPED_FRAMES, XSP_TELEMETRY_INT32,
+                        xsp_->getXspFEMDroppedFrames(), num_sections);
+
+  std::vector<uint32_t> daq;
+  daq.push_back(xsp_->getXspDAQBacklogFrames());
+  daq.push_back(xsp_->getXspDAQBatchLatency());
+  daq.push_back(xsp_->getXspDAQMaxBatchLatency());
+  daq.push_back(xsp_->getXspDAQSparseFrames());
+  add_telemetry_section(buffer, XSP_TELEMETRY_DAQ, XSP_TELEMETRY_UINT32, daq, num_sections);
+
+  add_telemetry_section(buffer, XSP_TELEMETRY_LIVE_DTC, XSP_TELEMETRY_FLOAT64,
+                        xsp_->getLiveDtcFactors(), num_sections);
+  add_telemetry_section(buffer, XSP_TELEMETRY_LIVE_INP_EST, XSP_TELEMETRY_FLOAT64,
+                        xsp_->getLiveInpEst(), num_sections);
+  for (int index = 0; index < NUMBER_OF_SCALARS; index++){
+    add_telemetry_section(buffer, XSP_TELEMETRY_LIVE_SCALAR + index, XSP_TELEMETRY_UINT32,
+                          xsp_->getLiveScalars(index), num_sections);
+  }
+
+  std::vector<float> temperatures[NUMBER_OF_TEMPERATURES] = {
+    xsp_->getTemperature0(), xsp_->getTemperature1(), xsp_->getTemperature2(),
+    xsp_->getTemperature3(), xsp_->getTemperature4(), xsp_->getTemperature5()
+  };
+  for (int index = 0; index < NUMBER_OF_TEMPERATURES; index++){
+    add_telemetry_section(buffer, XSP_TELEMETRY_TEMPERATURE + index, XSP_TELEMETRY_FLOAT32,
+                          temperatures[index], num_sections);
+  }
+
+  boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+  XspressTelemetryHeader *header = reinterpret_cast<XspressTelemetryHeader *>(&buffer[0]);
+  header->magic = XSP_TELEMETRY_MAGIC;
+  header->version = XSP_TELEMETRY_VERSION;
+  header->num_sections = num_sections;
+  header->sequence = telemetry_sequence_++;
+  header->timestamp_us = (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds();
+
+  telemetryChannel_.send(buffer.size(), &buffer[0]);
+  LOG4CXX_DEBUG_LEVEL(4, logger_, "Published telemetry message " << header->sequence << " of " << buffer.size() << " bytes");
+}
+
 /** Start the Ipc service running.
  *
  * Sets up a tick timer and runs the Ipc reactor.
@@ -1079,6 +1681,9 @@ void XspressController::runIpcService(void)
   // Add the tick timer to the reactor
   int tick_timer_id = reactor_->register_timer(1000, 0, boost::bind(&XspressController::tickTimer, this));
 
+  // Add the status refresh timer to the reactor
+  status_timer_id_ = reactor_->register_timer(status_refresh_ms_, 0, boost::bind(&XspressController::refreshStatus, this));
+
   // Set thread state to running, allows constructor to return
   threadRunning_ = true;
 
@@ -1099,9 +1704,6 @@ void XspressController::tickTimer(void)
   {
     LOG4CXX_DEBUG_LEVEL(1, logger_, "IPC thread terminate detected in timer");
     reactor_->stop();
-  } else {
-    // We will read the FEM status in this timer execution
-    xsp_->readFemStatus();
   }
 }
 
@@ -6,11 +6,19 @@
  */
 
 #include <stdio.h>
+#include <algorithm>
 
 #include "XspressDAQ.h"
 #include "DebugLevelLogger.h"
+#include "xspress3Definitions.h"
 
-#define HEADER_ITEMS 6
+#define HEADER_ITEMS 10
+
+// Sparse encoding only pays off while the (index, value) pairs are smaller than the dense data
+#define MAX_SPARSE_THRESHOLD 0.5
+
+// Period over which the sustained frame and data rates are measured
+#define RATE_WINDOW_US 1000000
 
 void free_frame(void *data, void *hint)
 {
@@ -28,11 +36,27 @@ XspressDAQ::XspressDAQ(boost::shared_ptr<ILibXspress> detector_ptr,
                        uint32_t num_channels,
                        uint32_t num_spectra,
                        std::vector<std::string> endpoints):
+    logger_(log4cxx::Logger::getLogger("Xspress.XspressDAQ")),
+    buffer_length_(0),
+    dims_validated_(false),
+    frame_offset_(0),
+    segment_(0),
     waiting_for_acq_(true),
     acq_running_(false),
     no_of_frames_(0),
     acq_failed_(false),
-    logger_(log4cxx::Logger::getLogger("Xspress.XspressDAQ"))
+    sparse_threshold_(0.0),
+    sparse_frames_(0),
+    backlog_frames_(0),
+    batch_latency_us_(0),
+    max_batch_latency_us_(0),
+    bytes_sent_(0),
+    rate_window_frames_(0),
+    rate_window_bytes_(0),
+    frame_rate_(0.0),
+    data_rate_(0.0),
+    buffer_headroom_(1.0),
+    min_buffer_headroom_(1.0)
 {
   OdinData::configure_logging_mdc(OdinData::app_path.c_str());
   LOG4CXX_DEBUG_LEVEL(1, logger_, "Constructing XspressDAQ");
@@ -166,6 +190,97 @@ std::vector<double> XspressDAQ::read_live_inp_est()
 void XspressDAQ::set_num_aux_data(uint32_t num_aux_data)
 {
     num_aux_data_ = num_aux_data;
+    // The buffer length depends upon the aux data so must be recalculated
+    dims_validated_ = false;
+}
+
+/**
+ * Set the bin density below which MCA frames are sent sparse encoded.
+ *
+ * \param[in] threshold - fraction of non-zero bins, 0 to always send dense frames.
+ */
+void XspressDAQ::set_sparse_threshold(double threshold)
+{
+  sparse_threshold_ = std::max(0.0, std::min(threshold, MAX_SPARSE_THRESHOLD));
+  LOG4CXX_INFO(logger_, "Sparse MCA threshold set to " << sparse_threshold_);
+}
+
+double XspressDAQ::get_sparse_threshold()
+{
+  return sparse_threshold_;
+}
+
+uint32_t XspressDAQ::get_sparse_frames()
+{
+  boost::lock_guard<boost::mutex> lock(data_mutex_);
+  return sparse_frames_;
+}
+
+uint32_t XspressDAQ::get_backlog_frames()
+{
+  return backlog_frames_;
+}
+
+uint32_t XspressDAQ::get_batch_latency_us()
+{
+  return batch_latency_us_;
+}
+
+uint32_t XspressDAQ::get_max_batch_latency_us()
+{
+  return max_batch_latency_us_;
+}
+
+uint64_t XspressDAQ::get_bytes_sent()
+{
+  boost::lock_guard<boost::mutex> lock(data_mutex_);
+  return bytes_sent_;
+}
+
+Xspress::XspressMetricsHistogram XspressDAQ::get_batch_latency_histogram()
+{
+  return batch_latency_hist_;
+}
+
+double XspressDAQ::get_frame_rate()
+{
+  return frame_rate_;
+}
+
+double XspressDAQ::get_data_rate()
+{
+  return data_rate_;
+}
+
+double XspressDAQ::get_buffer_headroom()
+{
+  return buffer_headroom_;
+}
+
+double XspressDAQ::get_min_buffer_headroom()
+{
+  return min_buffer_headroom_;
+}
+
+/**
+ * Update the sustained frame and data rates once the current measurement
+ * window has elapsed. Called from the control thread on every pass of the
+ * acquisition loop, so the rates fall to zero when frames stop arriving.
+ *
+ * \param[in] frames - total number of frames read in the acquisition.
+ */
+void XspressDAQ::update_rates(int32_t frames)
+{
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  int64_t window_us = (now - rate_window_start_).total_microseconds();
+  if (window_us >= RATE_WINDOW_US){
+    uint64_t bytes = get_bytes_sent();
+    frame_rate_ = (frames - rate_window_frames_) * 1000000.0 / window_us;
+    data_rate_ = (bytes - rate_window_bytes_) * 1000000.0 / window_us;
+    rate_window_start_ = now;
+    rate_window_frames_ = frames;
+    rate_window_bytes_ = bytes;
+  }
 }
 
 boost::shared_ptr<XspressDAQTask> XspressDAQ::create_task(uint32_t type)
@@ -187,14 +302,54 @@ boost::shared_ptr<XspressDAQTask> XspressDAQ::create_task(uint32_t type, uint32_
   return task;
 }
 
-void XspressDAQ::startAcquisition(uint32_t frames)
+/**
+ * Set the function called from the control thread at the end of each
+ * acquisition, with true if all of the expected frames were read. This is
+ * used to arm the next segment of a queued acquisition without waiting for
+ * a client to notice the acquisition has completed.
+ *
+ * \param[in] callback - function to call.
+ */
+void XspressDAQ::set_segment_callback(boost::function<void(bool)> callback)
 {
+  segment_callback_ = callback;
+}
+
+/**
+ * Prime the control thread for a new acquisition.
+ *
+ * \param[in] frames - number of frames expected, 0 to read frames until stopped.
+ * \param[in] validate - re-validate the histogram dimensions even if they are
+ * unchanged since the last acquisition, false when re-arming.
+ * \param[in] frame_offset - added to the frame numbers sent downstream, so that
+ * the segments of a queued acquisition are numbered continuously.
+ * \param[in] segment - index of the segment of a queued acquisition.
+ */
+void XspressDAQ::startAcquisition(uint32_t frames, bool validate, uint32_t frame_offset, uint32_t segment)
+{
+  // The workers are idle until the start task is queued so may read these freely
+  frame_offset_ = frame_offset;
+  segment_ = segment;
   // Set the acquisition running flag to true
   acq_running_ = true;
   // Set the number of frames read out to 0
   no_of_frames_ = 0;
+  {
+    boost::lock_guard<boost::mutex> lock(data_mutex_);
+    sparse_frames_ = 0;
+  }
+  backlog_frames_ = 0;
+  batch_latency_us_ = 0;
+  max_batch_latency_us_ = 0;
+  frame_rate_ = 0.0;
+  data_rate_ = 0.0;
+  buffer_headroom_ = 1.0;
+  min_buffer_headroom_ = 1.0;
+  rate_window_start_ = boost::posix_time::microsec_clock::universal_time();
+  rate_window_frames_ = 0;
+  rate_window_bytes_ = get_bytes_sent();
   // Load the start task into the ctrl queue
-  ctrl_queue_->add(create_task(DAQ_TASK_TYPE_START, frames), true);
+  ctrl_queue_->add(create_task(DAQ_TASK_TYPE_START, frames, validate), true);
 }
 
 void XspressDAQ::stopAcquisition()
@@ -234,27 +389,57 @@ void XspressDAQ::controlTask()
     waiting_for_acq_ = false;
     acq_failed_ = false;
     if (task->type_ == DAQ_TASK_TYPE_START){
+      // A frame count of 0 streams continuously over the circular buffer until stopped
       int32_t total_frames = task->value1_;
-      LOG4CXX_INFO(logger_, "DAQ ctrl thread started with [" << total_frames << "] frames");
-
-      // Validate the histogram dimensions
-      detector_->validate_histogram_dims(num_spectra_,
-                                         num_aux_data_,
-                                         0,
-                                         num_channels_,
-                                         &buffer_length_);
+      bool continuous = (total_frames == 0);
+      if (continuous){
+        LOG4CXX_INFO(logger_, "DAQ ctrl thread started in continuous mode");
+      } else {
+        LOG4CXX_INFO(logger_, "DAQ ctrl thread started with [" << total_frames << "] frames");
+      }
 
-      LOG4CXX_INFO(logger_, "Buffer length calculated: [" << buffer_length_ << "]");
+      // Validate the histogram dimensions, unless re-arming with unchanged dimensions
+      if (task->value2_ || !dims_validated_){
+        int status = detector_->validate_histogram_dims(num_spectra_,
+                                                        num_aux_data_,
+                                                        0,
+                                                        num_channels_,
+                                                        &buffer_length_);
+        dims_validated_ = (status == XSP_STATUS_OK);
+        LOG4CXX_INFO(logger_, "Buffer length calculated: [" << buffer_length_ << "]");
+      } else {
+        LOG4CXX_DEBUG_LEVEL(1, logger_, "Re-using validated buffer length: [" << buffer_length_ << "]");
+      }
 
 
       int32_t num_frames = 0;
       int32_t frames_read = 0;
-      while ((num_frames < total_frames) && acq_running_){
+      while ((continuous || num_frames < total_frames) && acq_running_){
         int status = detector_->get_num_frames_read(&num_frames);
         if (status == XSP_STATUS_OK){
           uint32_t frames_to_read = num_frames - frames_read;
-          if (frames_to_read > 0){
+          if (buffer_length_ > 0 && frames_to_read > buffer_length_){
+            // The hardware has wrapped the circular buffer over frames that were
+            // never read out, so the data still held in it is not what it claims
+            std::stringstream err;
+            err << "Circular buffer overrun: " << frames_to_read << " frames to read with a buffer of " <<
+                   buffer_length_ << " frames, " << (frames_to_read - buffer_length_) << " frames lost";
+            LOG4CXX_ERROR(logger_, err.str() << " - Aborting acquisition");
+            detector_->setErrorString(err.str());
+            backlog_frames_ = frames_to_read;
+            buffer_headroom_ = 0.0;
+            min_buffer_headroom_ = 0.0;
+            acq_failed_ = true;
+            acq_running_ = false;
+            detector_->histogram_stop(0);
+          } else if (frames_to_read > 0){
             LOG4CXX_DEBUG_LEVEL(3, logger_, "Current frames to read: " << frames_read << " - " << num_frames-1);
+            backlog_frames_ = frames_to_read;
+            if (buffer_length_ > 0){
+              buffer_headroom_ = 1.0 - (double)frames_to_read / buffer_length_;
+              min_buffer_headroom_ = std::min(min_buffer_headroom_, buffer_headroom_);
+            }
+            boost::posix_time::ptime batch_start = boost::posix_time::microsec_clock::universal_time();
             // Notify the worker threads to process the frames
             std::vector<boost::shared_ptr<WorkQueue<boost::shared_ptr<XspressDAQTask> > > >::iterator iter;
             for (iter = work_queues_.begin(); iter != work_queues_.end(); ++iter){
@@ -265,6 +450,9 @@ void XspressDAQ::controlTask()
             for (int index = 0; index < num_threads_; index++){
               done_queue_->remove();
             }
+            batch_latency_us_ = (boost::posix_time::microsec_clock::universal_time() - batch_start).total_microseconds();
+            max_batch_latency_us_ = std::max(max_batch_latency_us_, batch_latency_us_);
+            batch_latency_hist_.observe(batch_latency_us_ / 1000000.0);
             // Once all worker threads have completed notify the circular buffer
             status = detector_->histogram_circ_ack(0, frames_read, frames_to_read, num_channels_);
             LOG4CXX_DEBUG_LEVEL(3, logger_, "Ack circular buffer [status=" << status << "] frames_read[" << frames_read << "] frames_to_read[" << frames_to_read << "]");
@@ -276,6 +464,7 @@ void XspressDAQ::controlTask()
               // We need to wait for some frames
               sleep(0.001);
           }
+          update_rates(num_frames);
         } else {
           LOG4CXX_ERROR(logger_, "Error: " << detector_->getErrorString() << " - Aborting acquisition");
           acq_failed_ = true;
@@ -285,8 +474,13 @@ void XspressDAQ::controlTask()
         }
       }
       LOG4CXX_INFO(logger_, "DAQ thread completed, read " << frames_read << " frames");
+      bool completed = !acq_failed_ && frames_read >= total_frames;
       // Reset the acquisition running flag to false
       acq_running_ = false;
+      // Hand over to the next segment of a queued acquisition, if any
+      if (segment_callback_){
+        segment_callback_(completed);
+      }
     }
     if (task->type_ == DAQ_TASK_TYPE_SHUTDOWN){
       // Signal shutdown to all of the worker threads
@@ -319,6 +513,9 @@ void XspressDAQ::workTask(boost::shared_ptr<WorkQueue<boost::shared_ptr<XspressD
   zmq::socket_t *data_socket = new zmq::socket_t(*context_, ZMQ_PUSH);
   data_socket->bind(endpoint.c_str());
 
+  // Scratch space for building sparse (index, value) pairs
+  std::vector<uint32_t> sparse_pairs;
+
   bool executing = true;
   while (executing){
     boost::shared_ptr<XspressDAQTask> task = queue->remove();
@@ -335,6 +532,8 @@ void XspressDAQ::workTask(boost::shared_ptr<WorkQueue<boost::shared_ptr<XspressD
         uint32_t dtc_size = num_channels * sizeof(double);
         uint32_t inp_est_size = num_channels * sizeof(double);
         uint32_t frame_size = header_size + data_size + scalar_size + dtc_size + inp_est_size;
+        uint64_t batch_bytes = 0;
+        uint32_t batch_sparse = 0;
 
         LOG4CXX_DEBUG_LEVEL(4, logger_, "workTask[" << index << "] => Num scalars: [" << num_scalars << "] scalar_size: [" << scalar_size << "]");
         LOG4CXX_DEBUG_LEVEL(4, logger_, "workTask[" << index << "] => Calculated frame size: [" << frame_size << "]");
@@ -345,6 +544,10 @@ void XspressDAQ::workTask(boost::shared_ptr<WorkQueue<boost::shared_ptr<XspressD
         // when it is read to do so.  Therefore we will perform a single frame allocation and 1 memcpy,
         // and then we can safely let ZMQ free that memory block at any time.
 
+        uint32_t num_bins = data_size / sizeof(uint32_t);
+        uint32_t max_sparse_entries = (uint32_t)(num_bins * sparse_threshold_);
+        sparse_pairs.resize(max_sparse_entries * 2);
+
         for (int current_frame = 0; current_frame < frames_to_read; current_frame++){
           // Allocation of memory:
           // 1 x uint32 => Frame number
@@ -353,7 +556,12 @@ void XspressDAQ::workTask(boost::shared_ptr<WorkQueue<boost::shared_ptr<XspressD
           // 1 x uint32 => Num channels
           // 1 x uint32 => Num scalars
           // 1 x uint32 => First channel index
+          // 1 x uint32 => MCA encoding
+          // 1 x uint32 => Number of sparse MCA entries
+          // 1 x uint32 => Segment index
+          // 1 x uint32 => Segment frame offset
           // Frame data [num_spectra x num_channels x num_aux_data x uint32]
+          // or sparse [entries x (index, value) uint32 pairs]
           unsigned char *base_ptr;
           uint32_t *frame_ptr = (uint32_t *)malloc(frame_size);
           uint32_t *h_ptr = frame_ptr;
@@ -371,12 +579,16 @@ void XspressDAQ::workTask(boost::shared_ptr<WorkQueue<boost::shared_ptr<XspressD
           uint32_t *d_ptr = (uint32_t *)base_ptr;
 
           // Fill in the header data items
-          h_ptr[0] = frames_read + current_frame;
+          h_ptr[0] = frame_offset_ + frames_read + current_frame;
           h_ptr[1] = num_spectra_;
           h_ptr[2] = num_aux_data_;
           h_ptr[3] = num_channels;
           h_ptr[4] = num_scalars;
           h_ptr[5] = channel_index;
+          h_ptr[6] = XSP_MCA_ENCODING_DENSE;
+          h_ptr[7] = 0;
+          h_ptr[8] = segment_;
+          h_ptr[9] = frame_offset_;
 
           // Perform the single frame memcpy
           status = detector_->histogram_memcpy(d_ptr,
@@ -429,12 +641,50 @@ void XspressDAQ::workTask(boost::shared_ptr<WorkQueue<boost::shared_ptr<XspressD
             }
           }
 
+          // Replace low density spectra with (index, value) pairs, the message is
+          // then truncated so only the pairs are sent
+          uint32_t send_size = frame_size;
+          if (max_sparse_entries > 0){
+            uint32_t entries = 0;
+            for (uint32_t bin = 0; bin < num_bins && entries < max_sparse_entries; bin++){
+              if (d_ptr[bin] != 0){
+                sparse_pairs[entries * 2] = bin;
+                sparse_pairs[(entries * 2) + 1] = d_ptr[bin];
+                entries++;
+              }
+            }
+            // The scan stops early once the threshold is reached, so check the
+            // final bin was reached before committing to the sparse encoding
+            bool sparse = entries < max_sparse_entries;
+            if (!sparse && entries == max_sparse_entries){
+              sparse = true;
+              uint32_t last_bin = entries > 0 ? sparse_pairs[(entries - 1) * 2] + 1 : 0;
+              for (uint32_t bin = last_bin; bin < num_bins; bin++){
+                if (d_ptr[bin] != 0){
+                  sparse = false;
+                  break;
+                }
+              }
+            }
+            if (sparse){
+              memcpy(d_ptr, &sparse_pairs[0], entries * 2 * sizeof(uint32_t));
+              h_ptr[6] = XSP_MCA_ENCODING_SPARSE;
+              h_ptr[7] = entries;
+              send_size = frame_size - data_size + (entries * 2 * sizeof(uint32_t));
+              batch_sparse++;
+            }
+          }
+
           LOG4CXX_DEBUG_LEVEL(4, logger_, "workTask[" << index << "] => sending ZMQ message");
           // Construct the ZMQ message wrapper and send the frame
-          zmq::message_t frame_data(frame_ptr, frame_size, free_frame);
+          zmq::message_t frame_data(frame_ptr, send_size, free_frame);
           data_socket->send(frame_data, 0);
+          batch_bytes += send_size;
           LOG4CXX_DEBUG_LEVEL(4, logger_, "workTask[" << index << "] => message sent");
         }
+        boost::lock_guard<boost::mutex> lock(data_mutex_);
+        bytes_sent_ += batch_bytes;
+        sparse_frames_ += batch_sparse;
       }
       // Notify we have completed the task
       done_queue_->add(create_task(DAQ_TASK_TYPE_COMPLETE), true);
@@ -6,15 +6,62 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
 #include "dirent.h"
+#include <boost/bind.hpp>
 
 #include "XspressDetector.h"
 #include "DebugLevelLogger.h"
 
 #define SHM_FILE_PATH "/dev/shm/xsp3_scalers0"
 
+// Settings cache file, written next to the config save directory
+#define SETTINGS_CACHE_SUFFIX  ".settings_cache"
+#define SETTINGS_CACHE_MAGIC   0x58535043
+#define SETTINGS_CACHE_VERSION 1
+// 64 bit FNV-1a hash used to key the settings cache
+#define FNV_OFFSET_BASIS       14695981039346656037ULL
+#define FNV_PRIME              1099511628211ULL
+
 namespace Xspress
 {
+/** Header of the settings cache file */
+struct SettingsCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t channels;
+};
+
+static uint64_t fnv1a(uint64_t hash, const char *data, size_t length)
+{
+  for (size_t index = 0; index < length; index++){
+    hash ^= static_cast<unsigned char>(data[index]);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+template <typename T>
+static void writeCacheVector(std::ofstream& file, const std::vector<T>& values)
+{
+  if (!values.empty()){
+    file.write(reinterpret_cast<const char *>(&values[0]), values.size() * sizeof(T));
+  }
+}
+
+template <typename T>
+static void readCacheVector(std::ifstream& file, std::vector<T>& values, size_t size)
+{
+  values.assign(size, T());
+  if (size > 0){
+    file.read(reinterpret_cast<char *>(&values[0]), size * sizeof(T));
+  }
+}
+
 /** Construct a new XspressDetector class.
  *
  * The constructor sets up logging used within the class, and initialises
@@ -38,6 +85,8 @@ XspressDetector::XspressDetector(bool simulation) :
     xsp_use_resgrades_(false),
     xsp_num_aux_data_(1),
     xsp_run_flags_(0),
+    xsp_settings_cache_(true),
+    settings_cache_hit_(false),
     xsp_dtc_params_updated_(false),
     xsp_dtc_energy_(0.0),
     xsp_clock_period_(0),
@@ -47,7 +96,31 @@ XspressDetector::XspressDetector(bool simulation) :
     xsp_debounce_(0),
     xsp_exposure_time_(1.0),
     xsp_frames_(1),
-    xsp_mode_(XSP_MODE_MCA)
+    xsp_continuous_(false),
+    xsp_mode_(XSP_MODE_MCA),
+    xsp_daq_sparse_threshold_(0.0),
+    hw_writes_(0),
+    hw_writes_skipped_(0),
+    sample_thread_(0),
+    sampling_(false),
+    frames_sample_period_ms_(DEFAULT_FRAMES_SAMPLE_PERIOD_MS),
+    temperature_sample_period_ms_(DEFAULT_TEMPERATURE_SAMPLE_PERIOD_MS),
+    armed_valid_(false),
+    armed_frames_(0),
+    armed_exposure_time_(0.0),
+    armed_clock_period_(0.0),
+    armed_trigger_mode_(0),
+    armed_debounce_(0),
+    armed_invert_f0_(0),
+    armed_invert_veto_(0),
+    arm_latency_us_(0),
+    rearms_(0),
+    segment_pending_(false),
+    segment_completed_(false),
+    queue_segment_(0),
+    queue_frame_offset_(0),
+    queue_acq_id_(""),
+    segment_dead_time_us_(0)
 {
   OdinData::configure_logging_mdc(OdinData::app_path.c_str());
   LOG4CXX_INFO(logger_, "Constructing XspressDetector");
@@ -64,6 +137,11 @@ XspressDetector::XspressDetector(bool simulation) :
   // scalar and dtc parameters.
   setXspMaxChannels(DEFAULT_MAX_CHANNELS);
   setXspMcaChannels(DEFAULT_MAX_CHANNELS);
+  active_settings_ = configuredSettings();
+
+  // Hardware status is sampled from its own thread so that status requests
+  // never wait on the (slow) I2C reads
+  startStatusSampling();
 }
 
 /** Destructor for XspressDetector class.
@@ -71,23 +149,26 @@ XspressDetector::XspressDetector(bool simulation) :
  */
 XspressDetector::~XspressDetector()
 {
-
+  stopStatusSampling();
 }
 
 void XspressDetector::setErrorString(const std::string& error)
 {
   LOG4CXX_ERROR(logger_, error);
+  boost::lock_guard<boost::mutex> lock(error_mutex_);
   error_string_ = error;
 }
 
 std::string XspressDetector::getErrorString()
 {
+  boost::lock_guard<boost::mutex> lock(error_mutex_);
   return error_string_;
 }
 
 std::string XspressDetector::getVersionString()
 {
   std::string version = "Not connected";
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
   if (connected_){
     version = detector_->getVersionString();
   }
@@ -96,8 +177,13 @@ std::string XspressDetector::getVersionString()
 
 int XspressDetector::connect()
 {
+  boost::lock_guard<boost::recursive_mutex> lock(hw_mutex_);
   int status = XSP_STATUS_OK;
   if (!connected_){
+    boost::posix_time::ptime phase_start = boost::posix_time::microsec_clock::universal_time();
+    // Nothing is known about the state of the hardware until it is configured
+    invalidateArmState();
+    hw_dtc_params_.clear();
     // Check the mode and then connect accordingly
     if (xsp_mode_ == XSP_MODE_MCA){
       status = connect_mca_mode();
@@ -107,6 +193,7 @@ int XspressDetector::connect()
       setErrorString("Invalid connection mode, could not connect: " + xsp_mode_);
       status = XSP_STATUS_ERROR;
     }
+    logPhaseTime("connect", phase_start);
   } else {
     setErrorString("Xspress already connected, disconnect first");
     status = XSP_STATUS_ERROR;
@@ -179,11 +266,20 @@ bool XspressDetector::checkConnected()
 
 int XspressDetector::disconnect()
 {
+  boost::lock_guard<boost::recursive_mutex> lock(hw_mutex_);
   int status = XSP_STATUS_OK;
   if (unlink(SHM_FILE_PATH) < 0){
     LOG4CXX_ERROR(logger_, "Could not unlink the shared memory file " << SHM_FILE_PATH);
   }
 
+  invalidateArmState();
+  hw_dtc_params_.clear();
+  {
+    // Nothing further can be armed once disconnected
+    boost::lock_guard<boost::mutex> acq_lock(start_acq_mutex_);
+    acq_queue_.clear();
+    segment_pending_ = false;
+  }
   if (checkConnected()){
     status = detector_->close_connection();
     if (status == XSP_STATUS_OK){
@@ -202,6 +298,7 @@ int XspressDetector::disconnect()
 
 int XspressDetector::setupChannels()
 {
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
   int status = XSP_STATUS_OK;
   if (checkConnected()){
     status = detector_->check_connected_channels(cards_connected_, channels_connected_);
@@ -221,6 +318,9 @@ int XspressDetector::enableDAQ()
       daq_ = boost::shared_ptr<XspressDAQ>(new XspressDAQ(detector_, xsp_max_channels_, xsp_max_spectra_, xsp_daq_endpoints_));
       // Setup DAQ object with num_aux_data
       daq_->set_num_aux_data(xsp_num_aux_data_);
+      daq_->set_sparse_threshold(xsp_daq_sparse_threshold_);
+      // The DAQ control thread flags each completed segment, the next is armed from the controller
+      daq_->set_segment_callback(boost::bind(&XspressDetector::segmentComplete, this, _1));
     } else {
       LOG4CXX_ERROR(logger_, "Cannot set up DAQ as no endpoints have been specified");
       status = XSP_STATUS_ERROR;
@@ -268,6 +368,7 @@ int XspressDetector::checkSaveDir(const std::string& dir_name)
  */
 int XspressDetector::saveSettings()
 {
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
   int status = XSP_STATUS_OK;
   LOG4CXX_INFO(logger_, "Saving Xspress settings.");
 
@@ -288,8 +389,13 @@ int XspressDetector::saveSettings()
 
 int XspressDetector::restoreSettings()
 {
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
   int status = XSP_STATUS_OK;
   int xsp_status = 0;
+  // Restoring overwrites the trigger settings, they are re-applied below
+  invalidateArmState();
+  boost::posix_time::ptime restore_start = boost::posix_time::microsec_clock::universal_time();
+  boost::posix_time::ptime phase_start = restore_start;
   if (!connected_){
     setErrorString("Cannot restore settings, not connected");
     status = XSP_STATUS_ERROR;
@@ -302,6 +408,7 @@ int XspressDetector::restoreSettings()
       LOG4CXX_INFO(logger_, "Restored Xspress configuration");
     }
   }
+  logPhaseTime("restore_settings", phase_start);
 
   // Set up resgrades
   bool list_mode = false;
@@ -322,6 +429,7 @@ int XspressDetector::restoreSettings()
       setErrorString(detector_->getErrorString());
     }
   }
+  logPhaseTime("setup_format_run_mode", phase_start);
 
   // Apply run flags parameter
   if (status == XSP_STATUS_OK){
@@ -330,21 +438,39 @@ int XspressDetector::restoreSettings()
       setErrorString(detector_->getErrorString());
     }
   }
+  logPhaseTime("set_run_flags", phase_start);
+
+  // The SCA and DTC parameters are taken from the settings cache when
+  // neither the settings files nor the firmware have changed
+  uint64_t cache_key = 0;
+  settings_cache_hit_ = false;
+  if (status == XSP_STATUS_OK && xsp_settings_cache_){
+    cache_key = settingsCacheKey();
+    settings_cache_hit_ = loadSettingsCache(cache_key);
+    logPhaseTime("load_settings_cache", phase_start);
+  }
 
   // Read existing SCA params
-  if (status == XSP_STATUS_OK){
+  if (status == XSP_STATUS_OK && !settings_cache_hit_){
     status = readSCAParams();
     if (status != XSP_STATUS_OK){
       setErrorString(detector_->getErrorString());
     }
+    logPhaseTime("read_sca_params", phase_start);
   }
 
   // Read the DTC parameters
-  if (status == XSP_STATUS_OK){
+  if (status == XSP_STATUS_OK && !settings_cache_hit_){
     status = readDTCParams();
     if (status != XSP_STATUS_OK){
       setErrorString(detector_->getErrorString());
     }
+    logPhaseTime("read_dtc_params", phase_start);
+  }
+
+  // Record the freshly read parameters for the next connection
+  if (status == XSP_STATUS_OK && !settings_cache_hit_ && cache_key != 0){
+    saveSettingsCache(cache_key);
   }
 
   // We ensure here that DTC energy is set between application restart and frame acquisition
@@ -354,6 +480,7 @@ int XspressDetector::restoreSettings()
       setErrorString(detector_->getErrorString());
     }
   }
+  logPhaseTime("set_dtc_energy", phase_start);
 
   // Read the clock period
   if (status == XSP_STATUS_OK){
@@ -363,6 +490,8 @@ int XspressDetector::restoreSettings()
     }
   }
 
+  logPhaseTime("get_clock_period", phase_start);
+
   // Set the reconnect flag if something has gone wrong with this configuration
   reconnect_required_ = (status != XSP_STATUS_OK);
 
@@ -374,6 +503,8 @@ int XspressDetector::restoreSettings()
     }
   }
 
+  logPhaseTime("set_trigger_mode", phase_start);
+
   // And finally trigger mux mode
   if (status == XSP_STATUS_OK){
     status = detector_->set_trigger_input(list_mode);
@@ -381,16 +512,237 @@ int XspressDetector::restoreSettings()
       setErrorString(detector_->getErrorString());
     }
   }
+  logPhaseTime("set_trigger_input", phase_start);
 
+  LOG4CXX_INFO(logger_, "Restore completed in " <<
+                        (boost::posix_time::microsec_clock::universal_time() - restore_start).total_milliseconds() << "ms" <<
+                        (settings_cache_hit_ ? " (settings cache hit)" : ""));
   return status;
 }
 
+/**
+ * Log the time taken by a phase of connection or restore.
+ *
+ * \param[in] phase - name of the phase.
+ * \param[in,out] phase_start - start time of the phase, reset to now for the next phase.
+ */
+void XspressDetector::logPhaseTime(const std::string& phase, boost::posix_time::ptime& phase_start)
+{
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  LOG4CXX_INFO(logger_, "Phase " << phase << " took " << (now - phase_start).total_milliseconds() << "ms");
+  phase_start = now;
+}
+
+/**
+ * Compute the key of the settings cache.
+ *
+ * The key is a hash of the name and content of every file in the settings
+ * directory, the firmware revision and the number of channels.
+ *
+ * \return the key, or 0 if the settings directory cannot be read.
+ */
+uint64_t XspressDetector::settingsCacheKey()
+{
+  std::vector<std::string> names;
+  struct dirent *d = NULL;
+  DIR *dir = opendir(xsp_config_path_.c_str());
+  if (dir == NULL){
+    LOG4CXX_WARN(logger_, "Cannot open settings directory " << xsp_config_path_ << ", settings cache disabled");
+    return 0;
+  }
+  while ((d = readdir(dir)) != NULL){
+    std::string name(d->d_name);
+    if (name != "." && name != ".."){
+      names.push_back(name);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+
+  uint64_t hash = FNV_OFFSET_BASIS;
+  char buffer[4096];
+  std::vector<std::string>::iterator iter;
+  for (iter = names.begin(); iter != names.end(); ++iter){
+    hash = fnv1a(hash, iter->c_str(), iter->size() + 1);
+    std::ifstream file((xsp_config_path_ + "/" + *iter).c_str(), std::ios::binary);
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0){
+      hash = fnv1a(hash, buffer, file.gcount());
+    }
+  }
+  std::string revision;
+  {
+    boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+    revision = detector_->getVersionString();
+  }
+  hash = fnv1a(hash, revision.c_str(), revision.size() + 1);
+  hash = fnv1a(hash, reinterpret_cast<const char *>(&xsp_mca_channels_), sizeof(xsp_mca_channels_));
+  // 0 is reserved for no key
+  if (hash == 0){
+    hash = 1;
+  }
+  return hash;
+}
+
+/**
+ * Path of the settings cache, alongside the config save directory so that
+ * the directory itself stays free for saved settings.
+ *
+ * \return the path, or an empty string if no config save path is set.
+ */
+std::string XspressDetector::settingsCachePath()
+{
+  std::string path = xsp_config_save_path_;
+  while (path.size() > 1 && path[path.size() - 1] == '/'){
+    path.erase(path.size() - 1);
+  }
+  if (path == ""){
+    return path;
+  }
+  return path + SETTINGS_CACHE_SUFFIX;
+}
+
+/**
+ * Load the SCA and DTC parameters from the settings cache.
+ *
+ * The cache is only used if its key matches and the parameters of the first
+ * channel match those held by the hardware.
+ *
+ * \param[in] key - settings cache key of the current settings.
+ * \return true if the parameters were loaded from the cache.
+ */
+bool XspressDetector::loadSettingsCache(uint64_t key)
+{
+  std::string path = settingsCachePath();
+  if (key == 0 || path == ""){
+    return false;
+  }
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file){
+    LOG4CXX_INFO(logger_, "No settings cache found at " << path);
+    return false;
+  }
+  SettingsCacheHeader header;
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file || header.magic != SETTINGS_CACHE_MAGIC || header.version != SETTINGS_CACHE_VERSION ||
+      header.channels != xsp_mca_channels_ || header.channels == 0){
+    LOG4CXX_INFO(logger_, "Settings cache " << path << " is invalid, ignoring");
+    return false;
+  }
+  if (header.key != key){
+    LOG4CXX_INFO(logger_, "Settings or firmware have changed since the settings cache was written");
+    return false;
+  }
+
+  size_t channels = header.channels;
+  std::vector<uint32_t> sca[5];
+  for (int index = 0; index < 5; index++){
+    readCacheVector(file, sca[index], channels);
+  }
+  std::vector<int> dtc_flags;
+  readCacheVector(file, dtc_flags, channels);
+  std::vector<double> dtc[8];
+  for (int index = 0; index < 8; index++){
+    readCacheVector(file, dtc[index], channels);
+  }
+  if (!file){
+    LOG4CXX_INFO(logger_, "Settings cache " << path << " is truncated, ignoring");
+    return false;
+  }
+
+  // Verify against the first channel of the hardware before trusting the rest
+  std::vector<uint32_t> hw_sca[5];
+  std::vector<int> hw_dtc_flags;
+  std::vector<double> hw_dtc[8];
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+  int status = detector_->read_sca_params(1, hw_sca[0], hw_sca[1], hw_sca[2], hw_sca[3], hw_sca[4]);
+  if (status == XSP_STATUS_OK){
+    status = detector_->read_dtc_params(1, hw_dtc_flags, hw_dtc[0], hw_dtc[1], hw_dtc[2], hw_dtc[3],
+                                        hw_dtc[4], hw_dtc[5], hw_dtc[6], hw_dtc[7]);
+  }
+  bool verified = (status == XSP_STATUS_OK && !hw_dtc_flags.empty() && hw_dtc_flags[0] == dtc_flags[0]);
+  for (int index = 0; verified && index < 5; index++){
+    verified = (!hw_sca[index].empty() && hw_sca[index][0] == sca[index][0]);
+  }
+  for (int index = 0; verified && index < 8; index++){
+    verified = (!hw_dtc[index].empty() && hw_dtc[index][0] == dtc[index][0]);
+  }
+  if (!verified){
+    LOG4CXX_INFO(logger_, "Settings cache does not match the hardware, reading back all channels");
+    return false;
+  }
+
+  xsp_chan_sca5_low_lim_.swap(sca[0]);
+  xsp_chan_sca5_high_lim_.swap(sca[1]);
+  xsp_chan_sca6_low_lim_.swap(sca[2]);
+  xsp_chan_sca6_high_lim_.swap(sca[3]);
+  xsp_chan_sca4_threshold_.swap(sca[4]);
+  xsp_dtc_flags_.swap(dtc_flags);
+  xsp_dtc_all_event_off_.swap(dtc[0]);
+  xsp_dtc_all_event_grad_.swap(dtc[1]);
+  xsp_dtc_all_event_rate_off_.swap(dtc[2]);
+  xsp_dtc_all_event_rate_grad_.swap(dtc[3]);
+  xsp_dtc_in_window_off_.swap(dtc[4]);
+  xsp_dtc_in_window_grad_.swap(dtc[5]);
+  xsp_dtc_in_window_rate_off_.swap(dtc[6]);
+  xsp_dtc_in_window_rate_grad_.swap(dtc[7]);
+  recordDTCParams();
+  LOG4CXX_INFO(logger_, "Loaded SCA and DTC parameters from settings cache " << path);
+  return true;
+}
+
+/**
+ * Write the SCA and DTC parameters just read from the hardware to the
+ * settings cache. Failure is not an error, the next connection reads the
+ * parameters back from the hardware again.
+ *
+ * \param[in] key - settings cache key of the current settings.
+ */
+void XspressDetector::saveSettingsCache(uint64_t key)
+{
+  std::string path = settingsCachePath();
+  if (path == ""){
+    return;
+  }
+  SettingsCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SETTINGS_CACHE_MAGIC;
+  header.version = SETTINGS_CACHE_VERSION;
+  header.key = key;
+  header.channels = xsp_mca_channels_;
+
+  // Write to a temporary file and rename so that a partial cache is never read
+  std::string temp_path = path + ".tmp";
+  std::ofstream file(temp_path.c_str(), std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  writeCacheVector(file, xsp_chan_sca5_low_lim_);
+  writeCacheVector(file, xsp_chan_sca5_high_lim_);
+  writeCacheVector(file, xsp_chan_sca6_low_lim_);
+  writeCacheVector(file, xsp_chan_sca6_high_lim_);
+  writeCacheVector(file, xsp_chan_sca4_threshold_);
+  writeCacheVector(file, xsp_dtc_flags_);
+  writeCacheVector(file, xsp_dtc_all_event_off_);
+  writeCacheVector(file, xsp_dtc_all_event_grad_);
+  writeCacheVector(file, xsp_dtc_all_event_rate_off_);
+  writeCacheVector(file, xsp_dtc_all_event_rate_grad_);
+  writeCacheVector(file, xsp_dtc_in_window_off_);
+  writeCacheVector(file, xsp_dtc_in_window_grad_);
+  writeCacheVector(file, xsp_dtc_in_window_rate_off_);
+  writeCacheVector(file, xsp_dtc_in_window_rate_grad_);
+  file.close();
+  if (!file || rename(temp_path.c_str(), path.c_str()) != 0){
+    LOG4CXX_WARN(logger_, "Could not write settings cache " << path);
+    unlink(temp_path.c_str());
+  } else {
+    LOG4CXX_INFO(logger_, "Wrote settings cache " << path);
+  }
+}
+
 /**
  * Read the SCA window limits (for SCA 5 and 6) and threshold for SCA 4, for each channel.
  */
 int XspressDetector::readSCAParams()
 {
-
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
   return detector_->read_sca_params(xsp_mca_channels_,
                                    xsp_chan_sca5_low_lim_,
                                    xsp_chan_sca5_high_lim_,
@@ -400,92 +752,414 @@ int XspressDetector::readSCAParams()
                                    );
 }
 
+/**
+ * Read all of the FEM status items immediately.
+ */
 void XspressDetector::readFemStatus()
 {
-  int status = XSP_STATUS_OK;
+  readFemFrameCounters();
+  readFemTemperatures();
+}
 
-  if (checkConnected()){
-    // number of frames read out for each channel
-    status = detector_->read_frames(xsp_mca_channels_, xsp_status_frames_);
-    if (status != XSP_STATUS_OK){
-      setErrorString("Cannot read frame counters");
+/**
+ * Read the frame and dropped frame counters from the hardware.
+ *
+ * The counters are read into local vectors with only the hardware lock held
+ * and then swapped into the status snapshot, so that readers of the snapshot
+ * are never held up by the hardware.
+ */
+void XspressDetector::readFemFrameCounters()
+{
+  std::vector<int32_t> frames;
+  std::vector<int32_t> dropped_frames;
+  int mca_channels = 0;
+  {
+    boost::lock_guard<boost::mutex> lock(status_mutex_);
+    mca_channels = xsp_mca_channels_;
+    frames.resize(xsp_status_frames_.size());
+    dropped_frames.resize(xsp_status_dropped_frames_.size());
+  }
+
+  int frames_status = XSP_STATUS_OK;
+  int dropped_status = XSP_STATUS_OK;
+  {
+    boost::lock_guard<boost::recursive_mutex> lock(hw_mutex_);
+    if (!checkConnected()){
+      return;
     }
+    // number of frames read out for each channel
+    frames_status = detector_->read_frames(mca_channels, frames);
     // read dropped frames
-    status = detector_->read_dropped_frames(xsp_status_dropped_frames_);
-    if (status != XSP_STATUS_OK){
-      setErrorString("Cannot read dropped frame counters");
+    dropped_status = detector_->read_dropped_frames(dropped_frames);
+  }
+
+  {
+    boost::lock_guard<boost::mutex> lock(status_mutex_);
+    // Only publish if the snapshot has not been resized while reading
+    if (frames_status == XSP_STATUS_OK && frames.size() == xsp_status_frames_.size()){
+      xsp_status_frames_.swap(frames);
+    }
+    if (dropped_status == XSP_STATUS_OK && dropped_frames.size() == xsp_status_dropped_frames_.size()){
+      xsp_status_dropped_frames_.swap(dropped_frames);
     }
+  }
 
-    // read temperatures
-    status = detector_->read_temperatures(xsp_status_temperature_0_,
-                                         xsp_status_temperature_1_,
-                                         xsp_status_temperature_2_,
-                                         xsp_status_temperature_3_,
-                                         xsp_status_temperature_4_,
-                                         xsp_status_temperature_5_);
-    if (status != XSP_STATUS_OK){
-      setErrorString("Cannot read temperatures");
+  if (frames_status != XSP_STATUS_OK){
+    setErrorString("Cannot read frame counters");
+  }
+  if (dropped_status != XSP_STATUS_OK){
+    setErrorString("Cannot read dropped frame counters");
+  }
+}
+
+/**
+ * Read the card temperatures from the hardware.
+ *
+ * The temperatures are I2C reads and are by far the slowest status items, so
+ * they are read into local vectors and swapped into the status snapshot.
+ */
+void XspressDetector::readFemTemperatures()
+{
+  std::vector<float> t0, t1, t2, t3, t4, t5;
+  {
+    boost::lock_guard<boost::mutex> lock(status_mutex_);
+    t0.resize(xsp_num_cards_);
+    t1.resize(xsp_num_cards_);
+    t2.resize(xsp_num_cards_);
+    t3.resize(xsp_num_cards_);
+    t4.resize(xsp_num_cards_);
+    t5.resize(xsp_num_cards_);
+  }
+
+  int status = XSP_STATUS_OK;
+  {
+    boost::lock_guard<boost::recursive_mutex> lock(hw_mutex_);
+    if (!checkConnected()){
+      return;
     }
+    status = detector_->read_temperatures(t0, t1, t2, t3, t4, t5);
+  }
+
+  if (status != XSP_STATUS_OK){
+    setErrorString("Cannot read temperatures");
+    return;
+  }
+
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
+  if (t0.size() == xsp_num_cards_){
+    xsp_status_temperature_0_.swap(t0);
+    xsp_status_temperature_1_.swap(t1);
+    xsp_status_temperature_2_.swap(t2);
+    xsp_status_temperature_3_.swap(t3);
+    xsp_status_temperature_4_.swap(t4);
+    xsp_status_temperature_5_.swap(t5);
   }
 }
 
+/**
+ * Start the hardware status sampling thread.
+ */
+void XspressDetector::startStatusSampling()
+{
+  if (!sample_thread_){
+    sampling_ = true;
+    sample_thread_ = new boost::thread(&XspressDetector::statusSamplingTask, this);
+  }
+}
+
+/**
+ * Stop the hardware status sampling thread and wait for it to exit.
+ */
+void XspressDetector::stopStatusSampling()
+{
+  if (sample_thread_){
+    sampling_ = false;
+    sample_thread_->join();
+    delete sample_thread_;
+    sample_thread_ = 0;
+  }
+}
+
+/**
+ * Status sampling thread.
+ *
+ * Each status item is read at its own period; the frame counters change
+ * quickly during an acquisition whereas the temperatures only need
+ * occasional updates and are expensive to read.
+ */
+void XspressDetector::statusSamplingTask()
+{
+  LOG4CXX_INFO(logger_, "Starting status sampling task with ID [" << boost::this_thread::get_id() << "]");
+  boost::posix_time::ptime last_frames;
+  boost::posix_time::ptime last_temperature;
+  while (sampling_){
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    if (last_frames.is_not_a_date_time() ||
+        (now - last_frames).total_milliseconds() >= frames_sample_period_ms_){
+      readFemFrameCounters();
+      last_frames = now;
+    }
+    if (last_temperature.is_not_a_date_time() ||
+        (now - last_temperature).total_milliseconds() >= temperature_sample_period_ms_){
+      readFemTemperatures();
+      last_temperature = now;
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(MIN_SAMPLE_PERIOD_MS));
+  }
+  LOG4CXX_INFO(logger_, "Status sampling task exiting");
+}
+
 /**
  * Read the dead time correction (DTC) parameters for each channel.
  */
 int XspressDetector::readDTCParams()
 {
-  return detector_->read_dtc_params(xsp_mca_channels_,
-                                   xsp_dtc_flags_,
-                                   xsp_dtc_all_event_off_,
-                                   xsp_dtc_all_event_grad_,
-                                   xsp_dtc_all_event_rate_off_,
-                                   xsp_dtc_all_event_rate_grad_,
-                                   xsp_dtc_in_window_off_,
-                                   xsp_dtc_in_window_grad_,
-                                   xsp_dtc_in_window_rate_off_,
-                                   xsp_dtc_in_window_rate_grad_);
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+  int status = detector_->read_dtc_params(xsp_mca_channels_,
+                                         xsp_dtc_flags_,
+                                         xsp_dtc_all_event_off_,
+                                         xsp_dtc_all_event_grad_,
+                                         xsp_dtc_all_event_rate_off_,
+                                         xsp_dtc_all_event_rate_grad_,
+                                         xsp_dtc_in_window_off_,
+                                         xsp_dtc_in_window_grad_,
+                                         xsp_dtc_in_window_rate_off_,
+                                         xsp_dtc_in_window_rate_grad_);
+  if (status == XSP_STATUS_OK){
+    recordDTCParams();
+  } else {
+    hw_dtc_params_.clear();
+  }
+  return status;
 }
 
 /**
  * Write new dead time correction (DTC) parameters for each channel.
+ *
+ * Only the channels whose parameters differ from those last read from or
+ * written to the hardware are written.
  */
 int XspressDetector::writeDTCParams()
 {
-  return detector_->write_dtc_params(xsp_mca_channels_,
-                                    xsp_dtc_flags_,
-                                    xsp_dtc_all_event_off_,
-                                    xsp_dtc_all_event_grad_,
-                                    xsp_dtc_all_event_rate_off_,
-                                    xsp_dtc_all_event_rate_grad_,
-                                    xsp_dtc_in_window_off_,
-                                    xsp_dtc_in_window_grad_,
-                                    xsp_dtc_in_window_rate_off_,
-                                    xsp_dtc_in_window_rate_grad_);
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+  int status = XSP_STATUS_OK;
+  std::vector<bool> channels(xsp_mca_channels_, true);
+  int changed = xsp_mca_channels_;
+  if (hw_dtc_params_.size() == xsp_mca_channels_){
+    changed = 0;
+    for (int chan = 0; chan < xsp_mca_channels_; chan++){
+      channels[chan] = (dtcChannelParams(chan) != hw_dtc_params_[chan]);
+      if (channels[chan]){
+        changed++;
+      }
+    }
+  }
+  hw_writes_ += changed;
+  hw_writes_skipped_ += xsp_mca_channels_ - changed;
+  LOG4CXX_DEBUG_LEVEL(1, logger_, "Writing DTC parameters for " << changed << " of " << xsp_mca_channels_ << " channels");
+  if (changed > 0){
+    status = detector_->write_dtc_params(xsp_mca_channels_,
+                                        xsp_dtc_flags_,
+                                        xsp_dtc_all_event_off_,
+                                        xsp_dtc_all_event_grad_,
+                                        xsp_dtc_all_event_rate_off_,
+                                        xsp_dtc_all_event_rate_grad_,
+                                        xsp_dtc_in_window_off_,
+                                        xsp_dtc_in_window_grad_,
+                                        xsp_dtc_in_window_rate_off_,
+                                        xsp_dtc_in_window_rate_grad_,
+                                        channels);
+    if (status == XSP_STATUS_OK){
+      recordDTCParams();
+    } else {
+      // The hardware state is unknown, write every channel next time
+      hw_dtc_params_.clear();
+    }
+  }
+  return status;
+}
+
+/**
+ * Collect the DTC parameters of a single channel for comparison.
+ *
+ * \param[in] chan - channel index.
+ * \return flags followed by the eight correction parameters.
+ */
+std::vector<double> XspressDetector::dtcChannelParams(int chan)
+{
+  std::vector<double> params;
+  params.push_back(xsp_dtc_flags_[chan]);
+  params.push_back(xsp_dtc_all_event_off_[chan]);
+  params.push_back(xsp_dtc_all_event_grad_[chan]);
+  params.push_back(xsp_dtc_all_event_rate_off_[chan]);
+  params.push_back(xsp_dtc_all_event_rate_grad_[chan]);
+  params.push_back(xsp_dtc_in_window_off_[chan]);
+  params.push_back(xsp_dtc_in_window_grad_[chan]);
+  params.push_back(xsp_dtc_in_window_rate_off_[chan]);
+  params.push_back(xsp_dtc_in_window_rate_grad_[chan]);
+  return params;
+}
+
+/**
+ * Record the current DTC parameters as those held by the hardware.
+ */
+void XspressDetector::recordDTCParams()
+{
+  hw_dtc_params_.resize(xsp_mca_channels_);
+  for (int chan = 0; chan < xsp_mca_channels_; chan++){
+    hw_dtc_params_[chan] = dtcChannelParams(chan);
+  }
 }
 
 int XspressDetector::setTriggerMode()
 {
-  return detector_->setTriggerMode(xsp_frames_,
-                                  xsp_exposure_time_,
-                                  xsp_clock_period_,
-                                  xsp_trigger_mode_,
-                                  xsp_debounce_,
-                                  xsp_invert_f0_,
-                                  xsp_invert_veto_);
+  return setTriggerMode(configuredSettings());
+}
+
+/**
+ * Collect the configured frames, exposure time and trigger mode as a set of
+ * acquisition settings.
+ *
+ * \return the configured settings.
+ */
+XspressAcqSegment XspressDetector::configuredSettings()
+{
+  XspressAcqSegment settings;
+  settings.frames_ = xsp_frames_;
+  settings.exposure_time_ = xsp_exposure_time_;
+  settings.trigger_mode_ = xsp_trigger_mode_;
+  settings.acq_id_ = "";
+  return settings;
+}
+
+/**
+ * Write the trigger settings to the hardware.
+ *
+ * \param[in] settings - frames, exposure time and trigger mode to write.
+ * \return XSP_STATUS_OK if the settings were written.
+ */
+int XspressDetector::setTriggerMode(const XspressAcqSegment& settings)
+{
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+  int status = detector_->setTriggerMode(settings.frames_,
+                                        settings.exposure_time_,
+                                        xsp_clock_period_,
+                                        settings.trigger_mode_,
+                                        xsp_debounce_,
+                                        xsp_invert_f0_,
+                                        xsp_invert_veto_);
+  if (status == XSP_STATUS_OK){
+    // Record what the hardware now holds so that a re-arm can skip this call
+    armed_frames_ = settings.frames_;
+    armed_exposure_time_ = settings.exposure_time_;
+    armed_clock_period_ = xsp_clock_period_;
+    armed_trigger_mode_ = settings.trigger_mode_;
+    armed_debounce_ = xsp_debounce_;
+    armed_invert_f0_ = xsp_invert_f0_;
+    armed_invert_veto_ = xsp_invert_veto_;
+    armed_valid_ = true;
+  } else {
+    armed_valid_ = false;
+  }
+  return status;
+}
+
+/**
+ * Check whether the trigger settings held by the hardware match the settings
+ * to be armed, in which case an arm does not need to write them again.
+ *
+ * \param[in] settings - frames, exposure time and trigger mode to be armed.
+ * \return true if the trigger settings are unchanged since they were written.
+ */
+bool XspressDetector::triggerModePrepared(const XspressAcqSegment& settings)
+{
+  return armed_valid_ &&
+         armed_frames_ == settings.frames_ &&
+         armed_exposure_time_ == settings.exposure_time_ &&
+         armed_clock_period_ == xsp_clock_period_ &&
+         armed_trigger_mode_ == settings.trigger_mode_ &&
+         armed_debounce_ == xsp_debounce_ &&
+         armed_invert_f0_ == xsp_invert_f0_ &&
+         armed_invert_veto_ == xsp_invert_veto_;
 }
 
+/**
+ * Forget the trigger settings recorded as written to the hardware, forcing
+ * the next arm to write them.
+ */
+void XspressDetector::invalidateArmState()
+{
+  armed_valid_ = false;
+}
+
+/**
+ * Arm the detector for an acquisition, writing the trigger settings and
+ * validating the DAQ histogram dimensions.
+ *
+ * \return XSP_STATUS_OK if the detector is armed.
+ */
 int XspressDetector::startAcquisition()
 {
-  int status = XSP_STATUS_OK;
-  // Check we are connected to the hardware
-  LOG4CXX_INFO(logger_, "Arming detector for data collection");
+  return armAcquisition(false);
+}
+
+/**
+ * Arm the detector for a further acquisition with the prepared settings.
+ *
+ * The trigger settings are only written and the DAQ histogram dimensions
+ * only validated if they have changed since the last arm, leaving the
+ * minimum number of hardware calls between acquisitions of a step scan.
+ *
+ * \return XSP_STATUS_OK if the detector is armed.
+ */
+int XspressDetector::rearmAcquisition()
+{
+  return armAcquisition(true);
+}
 
+int XspressDetector::armAcquisition(bool rearm)
+{
+  // The hardware lock is always taken before the start acquisition lock
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
   // Lock the start acquisition mutex
   boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
 
+  // A single acquisition replaces anything left in the queue
+  acq_queue_.clear();
+  segment_pending_ = false;
+  queue_segment_ = 0;
+  queue_frame_offset_ = 0;
+  queue_acq_id_ = "";
+  return armDetector(rearm, configuredSettings());
+}
+
+/**
+ * Arm the detector with the given settings. The start acquisition mutex
+ * must be held by the caller.
+ *
+ * \param[in] rearm - skip the trigger setup if it is unchanged.
+ * \param[in] settings - frames, exposure time and trigger mode to arm with.
+ * \return XSP_STATUS_OK if the detector is armed.
+ */
+int XspressDetector::armDetector(bool rearm, const XspressAcqSegment& settings)
+{
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+  int status = XSP_STATUS_OK;
+  boost::posix_time::ptime arm_start = boost::posix_time::microsec_clock::universal_time();
+  // Check we are connected to the hardware
+  LOG4CXX_INFO(logger_, (rearm ? "Re-arming" : "Arming") << " detector for data collection");
+
   if (checkConnected()){
-    // Set the trigger mode
-    status = setTriggerMode();
+    if (rearm && triggerModePrepared(settings)){
+      LOG4CXX_DEBUG_LEVEL(1, logger_, "Trigger settings unchanged, skipping trigger mode setup");
+      rearms_++;
+    } else {
+      // Set the trigger mode
+      status = setTriggerMode(settings);
+      if (status != XSP_STATUS_OK){
+        setErrorString(detector_->getErrorString());
+      }
+    }
   } else {
     setErrorString("Cannot start acquisition as we are not connected");
     status = XSP_STATUS_ERROR;
@@ -499,7 +1173,8 @@ int XspressDetector::startAcquisition()
   }
 
   if (status == XSP_STATUS_OK){
-    if (xsp_trigger_mode_ == TM_SOFTWARE){
+    active_settings_ = settings;
+    if (settings.trigger_mode_ == TM_SOFTWARE){
       // Arm for soft trigger
       status = detector_->histogram_arm(0);
     } else {
@@ -510,25 +1185,191 @@ int XspressDetector::startAcquisition()
 
   if (xsp_mode_ == XSP_MODE_MCA){
     if (status == XSP_STATUS_OK){
-      // If the DAQ object exists prime the DAQ threads with the expected number of frames
+      // If the DAQ object exists prime the DAQ threads with the expected number of frames,
+      // or with no frame limit when streaming continuously
       if (daq_){
-        daq_->startAcquisition(xsp_frames_);
+        daq_->startAcquisition(xsp_continuous_ ? 0 : settings.frames_, !rearm, queue_frame_offset_, queue_segment_);
       }
     }
-  } else {
-    LOG4CXX_INFO(logger_, "Arming for list mode, disabling control DAQ");
+  } else {
+    LOG4CXX_INFO(logger_, "Arming for list mode, disabling control DAQ");
+  }
+
+  if (status == XSP_STATUS_OK){
+    arm_latency_us_ = (boost::posix_time::microsec_clock::universal_time() - arm_start).total_microseconds();
+    arm_latency_hist_.observe(arm_latency_us_ / 1000000.0);
+    LOG4CXX_INFO(logger_, "Arm complete in " << arm_latency_us_ << "us, detector ready for acquisition");
+    acquiring_ = true;
+  }
+  return status;
+}
+
+/**
+ * Queue a list of acquisition segments to be run back to back.
+ *
+ * The first segment is armed immediately. The DAQ control thread flags each
+ * segment as it is read out and the following segment is then armed by
+ * armPendingSegment when the controller's reactor is woken, so that no client
+ * round trip is needed between segments. Frames are numbered continuously
+ * across the segments.
+ *
+ * \param[in] segments - the segments to run, in order.
+ * \return XSP_STATUS_OK if the first segment is armed.
+ */
+int XspressDetector::queueAcquisition(const std::vector<XspressAcqSegment>& segments)
+{
+  if (segments.empty()){
+    setErrorString("Cannot queue an acquisition without any segments");
+    return XSP_STATUS_ERROR;
+  }
+  for (size_t index = 0; index < segments.size(); index++){
+    if (segments[index].frames_ <= 0){
+      std::stringstream err;
+      err << "Cannot queue segment " << index << " with " << segments[index].frames_ << " frames";
+      setErrorString(err.str());
+      return XSP_STATUS_ERROR;
+    }
+  }
+  if (xsp_mode_ != XSP_MODE_MCA || !daq_){
+    setErrorString("Queued acquisitions require the MCA mode DAQ");
+    return XSP_STATUS_ERROR;
+  }
+  if (xsp_continuous_){
+    setErrorString("Cannot queue an acquisition in continuous mode");
+    return XSP_STATUS_ERROR;
+  }
+
+  // Lock the hardware and then the start acquisition mutex
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+  boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+  if (daq_->getAcqRunning() || !acq_queue_.empty()){
+    setErrorString("Cannot queue an acquisition while acquiring");
+    return XSP_STATUS_ERROR;
+  }
+  LOG4CXX_INFO(logger_, "Queueing acquisition of " << segments.size() << " segments");
+  acq_queue_.assign(segments.begin(), segments.end());
+  segment_pending_ = false;
+  queue_segment_ = 0;
+  queue_frame_offset_ = 0;
+  segment_dead_time_us_ = 0;
+  int status = armSegment(false);
+  if (status != XSP_STATUS_OK){
+    acq_queue_.clear();
+  }
+  return status;
+}
+
+/**
+ * Take the next segment from the queue and arm the detector with its
+ * settings, leaving the configured settings unchanged. The start acquisition
+ * mutex must be held by the caller.
+ *
+ * \param[in] rearm - skip the trigger setup if it is unchanged.
+ * \return XSP_STATUS_OK if the segment is armed.
+ */
+int XspressDetector::armSegment(bool rearm)
+{
+  XspressAcqSegment segment = acq_queue_.front();
+  acq_queue_.pop_front();
+  queue_acq_id_ = segment.acq_id_;
+  LOG4CXX_INFO(logger_, "Arming segment " << queue_segment_ << " [" << queue_acq_id_ << "] of " << segment.frames_ <<
+                        " frames from frame " << queue_frame_offset_);
+  return armDetector(rearm, segment);
+}
+
+/**
+ * Called from the DAQ control thread at the end of each acquisition. If more
+ * segments are queued the completion is recorded for armPendingSegment, no
+ * hardware or configuration is touched from the DAQ thread.
+ *
+ * \param[in] completed - true if every frame of the acquisition was read.
+ */
+void XspressDetector::segmentComplete(bool completed)
+{
+  boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+  if (acq_queue_.empty()){
+    return;
+  }
+  segment_pending_ = true;
+  segment_completed_ = completed;
+  segment_end_ = boost::posix_time::microsec_clock::universal_time();
+  // Wake the owner so the next segment is armed without waiting for a status refresh
+  if (segment_notify_){
+    segment_notify_();
+  }
+}
+
+/**
+ * Set the function called from the DAQ control thread when a queued segment
+ * has been read out and the next is waiting to be armed. The function must
+ * not block or call back into the detector; it is expected to wake the
+ * thread that calls armPendingSegment. Pass an empty function to remove it.
+ *
+ * \param[in] notify - function to call.
+ */
+void XspressDetector::setSegmentNotify(boost::function<void()> notify)
+{
+  boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+  segment_notify_ = notify;
+}
+
+/**
+ * Arm the next queued segment once the DAQ control thread has reported the
+ * previous segment as read out. Called from the controller's reactor thread,
+ * woken by the segment notify function, so that arming is serialised with
+ * configuration and other commands.
+ */
+void XspressDetector::armPendingSegment()
+{
+  // This is also called on every status refresh as a fallback, so return
+  // without taking the hardware lock unless a segment is waiting
+  {
+    boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+    if (!segment_pending_){
+      return;
+    }
   }
-
+  // Lock the hardware and then the start acquisition mutex
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+  boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+  if (!segment_pending_){
+    return;
+  }
+  segment_pending_ = false;
+  if (acq_queue_.empty()){
+    return;
+  }
+  if (!segment_completed_){
+    LOG4CXX_WARN(logger_, "Segment " << queue_segment_ << " did not complete, discarding " <<
+                          acq_queue_.size() << " queued segments");
+    acq_queue_.clear();
+    return;
+  }
+  queue_frame_offset_ += active_settings_.frames_;
+  queue_segment_++;
+  int status = armSegment(true);
   if (status == XSP_STATUS_OK){
-    LOG4CXX_INFO(logger_, "Arm complete, detector ready for acquisition");
-    acquiring_ = true;
+    segment_dead_time_us_ = (boost::posix_time::microsec_clock::universal_time() - segment_end_).total_microseconds();
+    segment_dead_time_hist_.observe(segment_dead_time_us_ / 1000000.0);
+    LOG4CXX_INFO(logger_, "Segment " << queue_segment_ << " armed " << segment_dead_time_us_ << "us after the previous segment");
+  } else {
+    std::stringstream err;
+    err << "Acquisition Failed: could not arm segment " << queue_segment_ << ": " << getErrorString();
+    setErrorString(err.str());
+    acq_failed_ = true;
+    acq_queue_.clear();
   }
-  return status;
 }
 
 int XspressDetector::stopAcquisition()
 {
   int status = XSP_STATUS_OK;
+  {
+    // Prevent any further queued segments from being armed
+    boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+    acq_queue_.clear();
+    segment_pending_ = false;
+  }
   if (acquiring_){
     if (xsp_mode_ == XSP_MODE_MCA){
       // If the DAQ object exists then stop any acquisition loop
@@ -536,6 +1377,7 @@ int XspressDetector::stopAcquisition()
         daq_->stopAcquisition();
       }
     }
+    boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
     status = detector_->histogram_stop(-1);
   }
   return status;
@@ -545,7 +1387,8 @@ int XspressDetector::sendSoftwareTrigger()
 {
   int status = XSP_STATUS_OK;
   if (acquiring_){
-    if (xsp_trigger_mode_ == TM_SOFTWARE){
+    if (active_settings_.trigger_mode_ == TM_SOFTWARE){
+      boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
       status = detector_->histogram_continue(0);
       status |= detector_->histogram_pause(0);
     } else {
@@ -576,6 +1419,7 @@ bool XspressDetector::getReconnectStatus()
 
 void XspressDetector::setXspNumCards(int num_cards)
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   if (num_cards != xsp_num_cards_){
     xsp_num_cards_ = num_cards;
 
@@ -658,6 +1502,7 @@ int XspressDetector::getXspMaxChannels()
 
 void XspressDetector::setXspMcaChannels(int mca_channels)
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   if (mca_channels != xsp_mca_channels_){
     xsp_mca_channels_ = mca_channels;
 
@@ -806,6 +1651,44 @@ int XspressDetector::getXspRunFlags()
   return xsp_run_flags_;
 }
 
+/**
+ * Enable or disable setting up the channels of each card concurrently.
+ *
+ * \param[in] parallel - true to set up each card from its own thread.
+ */
+void XspressDetector::setXspParallelSetup(bool parallel)
+{
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+  detector_->set_parallel_setup(parallel);
+}
+
+bool XspressDetector::getXspParallelSetup()
+{
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
+  return detector_->get_parallel_setup();
+}
+
+/**
+ * Enable or disable the settings cache used to skip reading back the SCA and
+ * DTC parameters when neither the settings nor the firmware have changed.
+ *
+ * \param[in] enable - true to use the settings cache.
+ */
+void XspressDetector::setXspSettingsCache(bool enable)
+{
+  xsp_settings_cache_ = enable;
+}
+
+bool XspressDetector::getXspSettingsCache()
+{
+  return xsp_settings_cache_;
+}
+
+bool XspressDetector::getXspSettingsCacheHit()
+{
+  return settings_cache_hit_;
+}
+
 void XspressDetector::setXspDTCEnergy(double energy)
 {
   int status = XSP_STATUS_OK;
@@ -813,6 +1696,7 @@ void XspressDetector::setXspDTCEnergy(double energy)
     xsp_dtc_energy_ = energy;
   }
   // If we are connected then set the DTC energy
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
   if (checkConnected()){
     status = detector_->set_dtc_energy(xsp_dtc_energy_);
     if (status != XSP_STATUS_OK){
@@ -886,6 +1770,25 @@ int XspressDetector::getXspFrames()
   return xsp_frames_;
 }
 
+/**
+ * Set continuous mode. A continuous acquisition reads frames from the
+ * circular buffer until it is stopped, rather than stopping after the
+ * configured number of frames. The number of frames still bounds the
+ * internal trigger generator, so continuous runs are normally driven by
+ * external triggers.
+ *
+ * \param[in] continuous - true to stream frames until stopped.
+ */
+void XspressDetector::setXspContinuous(bool continuous)
+{
+  xsp_continuous_ = continuous;
+}
+
+bool XspressDetector::getXspContinuous()
+{
+  return xsp_continuous_;
+}
+
 void XspressDetector::setXspMode(const std::string& mode)
 {
   if (mode != xsp_mode_){
@@ -911,37 +1814,328 @@ std::vector<std::string> XspressDetector::getXspDAQEndpoints()
   return xsp_daq_endpoints_;
 }
 
-int XspressDetector::setSca5LowLimits(std::vector<uint32_t> sca5_low_limit)
+void XspressDetector::setXspDAQSparseThreshold(double threshold)
+{
+  xsp_daq_sparse_threshold_ = threshold;
+  if (daq_){
+    daq_->set_sparse_threshold(xsp_daq_sparse_threshold_);
+  }
+}
+
+double XspressDetector::getXspDAQSparseThreshold()
+{
+  return xsp_daq_sparse_threshold_;
+}
+
+uint32_t XspressDetector::getXspDAQSparseFrames()
+{
+  uint32_t frames = 0;
+  if (daq_){
+    frames = daq_->get_sparse_frames();
+  }
+  return frames;
+}
+
+uint32_t XspressDetector::getXspDAQBacklogFrames()
+{
+  uint32_t frames = 0;
+  if (daq_){
+    frames = daq_->get_backlog_frames();
+  }
+  return frames;
+}
+
+uint32_t XspressDetector::getXspDAQBatchLatency()
+{
+  uint32_t latency = 0;
+  if (daq_){
+    latency = daq_->get_batch_latency_us();
+  }
+  return latency;
+}
+
+uint32_t XspressDetector::getXspDAQMaxBatchLatency()
+{
+  uint32_t latency = 0;
+  if (daq_){
+    latency = daq_->get_max_batch_latency_us();
+  }
+  return latency;
+}
+
+uint64_t XspressDetector::getXspDAQBytesSent()
+{
+  uint64_t bytes = 0;
+  if (daq_){
+    bytes = daq_->get_bytes_sent();
+  }
+  return bytes;
+}
+
+double XspressDetector::getXspDAQFrameRate()
+{
+  double rate = 0.0;
+  if (daq_){
+    rate = daq_->get_frame_rate();
+  }
+  return rate;
+}
+
+double XspressDetector::getXspDAQDataRate()
+{
+  double rate = 0.0;
+  if (daq_){
+    rate = daq_->get_data_rate();
+  }
+  return rate;
+}
+
+double XspressDetector::getXspDAQBufferHeadroom()
+{
+  double headroom = 1.0;
+  if (daq_){
+    headroom = daq_->get_buffer_headroom();
+  }
+  return headroom;
+}
+
+double XspressDetector::getXspDAQMinBufferHeadroom()
+{
+  double headroom = 1.0;
+  if (daq_){
+    headroom = daq_->get_min_buffer_headroom();
+  }
+  return headroom;
+}
+
+XspressMetricsHistogram XspressDetector::getXspDAQBatchLatencyHistogram()
+{
+  if (daq_){
+    return daq_->get_batch_latency_histogram();
+  }
+  return XspressMetricsHistogram();
+}
+
+/**
+ * Get the number of per-channel hardware writes issued by configuration.
+ *
+ * \return number of writes.
+ */
+uint64_t XspressDetector::getXspHwWrites()
+{
+  return hw_writes_;
+}
+
+/**
+ * Get the number of per-channel hardware writes skipped as unchanged.
+ *
+ * \return number of skipped writes.
+ */
+uint64_t XspressDetector::getXspHwWritesSkipped()
+{
+  return hw_writes_skipped_;
+}
+
+/**
+ * Get the time taken by the last arm or re-arm.
+ *
+ * \return arm time in us.
+ */
+uint32_t XspressDetector::getXspArmLatency()
+{
+  return arm_latency_us_;
+}
+
+/**
+ * Get the number of arms that re-used the prepared trigger settings.
+ *
+ * \return number of fast re-arms.
+ */
+uint64_t XspressDetector::getXspRearms()
+{
+  return rearms_;
+}
+
+/**
+ * Check whether the next re-arm can skip writing the trigger settings.
+ *
+ * \return true if the hardware holds the configured trigger settings.
+ */
+bool XspressDetector::getXspArmPrepared()
+{
+  return checkConnected() && triggerModePrepared(configuredSettings());
+}
+
+XspressMetricsHistogram XspressDetector::getXspArmLatencyHistogram()
+{
+  return arm_latency_hist_;
+}
+
+uint32_t XspressDetector::getXspQueueSegment()
+{
+  boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+  return queue_segment_;
+}
+
+uint32_t XspressDetector::getXspQueuePending()
+{
+  boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+  return acq_queue_.size();
+}
+
+std::string XspressDetector::getXspSegmentAcqId()
+{
+  boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+  return queue_acq_id_;
+}
+
+uint32_t XspressDetector::getXspSegmentDeadTime()
+{
+  boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+  return segment_dead_time_us_;
+}
+
+XspressMetricsHistogram XspressDetector::getXspSegmentDeadTimeHistogram()
+{
+  boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
+  return segment_dead_time_hist_;
+}
+
+void XspressDetector::setXspFramesSamplePeriod(int period_ms)
+{
+  frames_sample_period_ms_ = std::max(period_ms, MIN_SAMPLE_PERIOD_MS);
+}
+
+int XspressDetector::getXspFramesSamplePeriod()
+{
+  return frames_sample_period_ms_;
+}
+
+void XspressDetector::setXspTemperatureSamplePeriod(int period_ms)
+{
+  temperature_sample_period_ms_ = std::max(period_ms, MIN_SAMPLE_PERIOD_MS);
+}
+
+int XspressDetector::getXspTemperatureSamplePeriod()
+{
+  return temperature_sample_period_ms_;
+}
+
+/**
+ * Write the SCA window limits (for SCA 5 and 6) and SCA 4 thresholds.
+ *
+ * Any of the vectors may be empty to leave that parameter unchanged. The
+ * values are compared with those last read back from the hardware and only
+ * the channels that differ are written, with the low and high limits of a
+ * window written in a single call. The limits are read back once at the end
+ * if anything was written.
+ *
+ * \param[in] sca5_low_limit - SCA 5 window low limits, one per channel.
+ * \param[in] sca5_high_limit - SCA 5 window high limits, one per channel.
+ * \param[in] sca6_low_limit - SCA 6 window low limits, one per channel.
+ * \param[in] sca6_high_limit - SCA 6 window high limits, one per channel.
+ * \param[in] sca4_thresholds - SCA 4 thresholds, one per channel.
+ * \return XSP_STATUS_OK if all writes succeeded.
+ */
+int XspressDetector::setScaParams(const std::vector<uint32_t>& sca5_low_limit,
+                                  const std::vector<uint32_t>& sca5_high_limit,
+                                  const std::vector<uint32_t>& sca6_low_limit,
+                                  const std::vector<uint32_t>& sca6_high_limit,
+                                  const std::vector<uint32_t>& sca4_thresholds)
 {
   int status = XSP_STATUS_OK;
+  boost::lock_guard<boost::recursive_mutex> hw_lock(hw_mutex_);
   // Verify we are connected
-  if (checkConnected()){
-    // Verify we have been passed the correct size vector
-    if (sca5_low_limit.size() == xsp_chan_sca5_low_lim_.size()){
-      // Loop over the values calling the appropriate set window
-      for (int chan = 0; chan < sca5_low_limit.size(); chan++){
-        status |= detector_->set_window(chan, XSP_SCA5_LIM, sca5_low_limit[chan], xsp_chan_sca5_high_lim_[chan]);
-      }
-      // Once updated read back the limits from the detector
-      if (status == XSP_STATUS_OK){
-        status = this->readSCAParams();
-      } else {
-        setErrorString(detector_->getErrorString());
-      }
+  if (!checkConnected()){
+    setErrorString("Cannot set scalar limits, not connected");
+    return XSP_STATUS_ERROR;
+  }
+
+  // Verify we have been passed the correct size vectors
+  status |= checkScaDimension(sca5_low_limit, xsp_chan_sca5_low_lim_, "scalar 5 low limits");
+  status |= checkScaDimension(sca5_high_limit, xsp_chan_sca5_high_lim_, "scalar 5 high limits");
+  status |= checkScaDimension(sca6_low_limit, xsp_chan_sca6_low_lim_, "scalar 6 low limits");
+  status |= checkScaDimension(sca6_high_limit, xsp_chan_sca6_high_lim_, "scalar 6 high limits");
+  status |= checkScaDimension(sca4_thresholds, xsp_chan_sca4_threshold_, "scalar 4 thresholds");
+  if (status != XSP_STATUS_OK){
+    return status;
+  }
+
+  // Merge the requested values over those currently held by the hardware
+  std::vector<uint32_t> sca5_low = sca5_low_limit.empty() ? xsp_chan_sca5_low_lim_ : sca5_low_limit;
+  std::vector<uint32_t> sca5_high = sca5_high_limit.empty() ? xsp_chan_sca5_high_lim_ : sca5_high_limit;
+  std::vector<uint32_t> sca6_low = sca6_low_limit.empty() ? xsp_chan_sca6_low_lim_ : sca6_low_limit;
+  std::vector<uint32_t> sca6_high = sca6_high_limit.empty() ? xsp_chan_sca6_high_lim_ : sca6_high_limit;
+  std::vector<uint32_t> sca4 = sca4_thresholds.empty() ? xsp_chan_sca4_threshold_ : sca4_thresholds;
+
+  int writes = 0;
+  int skipped = 0;
+  for (int chan = 0; chan < xsp_chan_sca5_low_lim_.size(); chan++){
+    if (sca5_low[chan] != xsp_chan_sca5_low_lim_[chan] || sca5_high[chan] != xsp_chan_sca5_high_lim_[chan]){
+      status |= detector_->set_window(chan, XSP_SCA5_LIM, sca5_low[chan], sca5_high[chan]);
+      writes++;
     } else {
-      std::stringstream ss;
-      ss << "Cannot set scalar 5 low limits, input array dimension " << sca5_low_limit.size() <<
-            " current array dimension " << xsp_chan_sca5_low_lim_.size();
-      setErrorString(ss.str());
-      status = XSP_STATUS_ERROR;
+      skipped++;
+    }
+    if (sca6_low[chan] != xsp_chan_sca6_low_lim_[chan] || sca6_high[chan] != xsp_chan_sca6_high_lim_[chan]){
+      status |= detector_->set_window(chan, XSP_SCA6_LIM, sca6_low[chan], sca6_high[chan]);
+      writes++;
+    } else {
+      skipped++;
+    }
+    if (sca4[chan] != xsp_chan_sca4_threshold_[chan]){
+      status |= detector_->set_sca_thresh(chan, sca4[chan]);
+      writes++;
+    } else {
+      skipped++;
+    }
+  }
+  hw_writes_ += writes;
+  hw_writes_skipped_ += skipped;
+  LOG4CXX_DEBUG_LEVEL(1, logger_, "SCA configuration issued " << writes << " writes, skipped " << skipped);
+
+  // Once updated read back the limits from the detector
+  if (status == XSP_STATUS_OK){
+    if (writes > 0){
+      status = this->readSCAParams();
     }
   } else {
-    setErrorString("Cannot set scalar 5 low limits, not connected");
+    setErrorString(detector_->getErrorString());
+    // Read back whatever the hardware now holds so the next comparison is valid
+    this->readSCAParams();
+  }
+  return status;
+}
+
+/**
+ * Check that an SCA parameter vector matches the number of channels.
+ *
+ * \param[in] values - requested values, empty if the parameter is not being set.
+ * \param[in] current - values currently held for the parameter.
+ * \param[in] name - description of the parameter for the error message.
+ * \return XSP_STATUS_OK if the vector is empty or of the correct size.
+ */
+int XspressDetector::checkScaDimension(const std::vector<uint32_t>& values,
+                                       const std::vector<uint32_t>& current,
+                                       const std::string& name)
+{
+  int status = XSP_STATUS_OK;
+  if (!values.empty() && values.size() != current.size()){
+    std::stringstream ss;
+    ss << "Cannot set " << name << ", input array dimension " << values.size() <<
+          " current array dimension " << current.size();
+    setErrorString(ss.str());
     status = XSP_STATUS_ERROR;
   }
   return status;
 }
 
+int XspressDetector::setSca5LowLimits(std::vector<uint32_t> sca5_low_limit)
+{
+  std::vector<uint32_t> unchanged;
+  return setScaParams(sca5_low_limit, unchanged, unchanged, unchanged, unchanged);
+}
+
 std::vector<uint32_t> XspressDetector::getSca5LowLimits()
 {
   return xsp_chan_sca5_low_lim_;
@@ -949,33 +2143,8 @@ std::vector<uint32_t> XspressDetector::getSca5LowLimits()
 
 int XspressDetector::setSca5HighLimits(std::vector<uint32_t> sca5_high_limit)
 {
-  int status = XSP_STATUS_OK;
-  // Verify we are connected
-  if (checkConnected()){
-    // Verify we have been passed the correct size vector
-    if (sca5_high_limit.size() == xsp_chan_sca5_high_lim_.size()){
-      // Loop over the values calling the appropriate set window
-      for (int chan = 0; chan < sca5_high_limit.size(); chan++){
-        status |= detector_->set_window(chan, XSP_SCA5_LIM, xsp_chan_sca5_low_lim_[chan], sca5_high_limit[chan]);
-      }
-      // Once updated read back the limits from the detector
-      if (status == XSP_STATUS_OK){
-        status = this->readSCAParams();
-      } else {
-        setErrorString(detector_->getErrorString());
-      }
-    } else {
-      std::stringstream ss;
-      ss << "Cannot set scalar 5 high limits, input array dimension " << sca5_high_limit.size() <<
-            " current array dimension " << xsp_chan_sca5_high_lim_.size();
-      setErrorString(ss.str());
-      status = XSP_STATUS_ERROR;
-    }
-  } else {
-    setErrorString("Cannot set scalar 5 high limits, not connected");
-    status = XSP_STATUS_ERROR;
-  }
-  return status;
+  std::vector<uint32_t> unchanged;
+  return setScaParams(unchanged, sca5_high_limit, unchanged, unchanged, unchanged);
 }
 
 std::vector<uint32_t> XspressDetector::getSca5HighLimits()
@@ -985,33 +2154,8 @@ std::vector<uint32_t> XspressDetector::getSca5HighLimits()
 
 int XspressDetector::setSca6LowLimits(std::vector<uint32_t> sca6_low_limit)
 {
-  int status = XSP_STATUS_OK;
-  // Verify we are connected
-  if (checkConnected()){
-    // Verify we have been passed the correct size vector
-    if (sca6_low_limit.size() == xsp_chan_sca6_low_lim_.size()){
-      // Loop over the values calling the appropriate set window
-      for (int chan = 0; chan < sca6_low_limit.size(); chan++){
-        status |= detector_->set_window(chan, XSP_SCA6_LIM, sca6_low_limit[chan], xsp_chan_sca6_high_lim_[chan]);
-      }
-      // Once updated read back the limits from the detector
-      if (status == XSP_STATUS_OK){
-        status = this->readSCAParams();
-      } else {
-        setErrorString(detector_->getErrorString());
-      }
-    } else {
-      std::stringstream ss;
-      ss << "Cannot set scalar 6 low limits, input array dimension " << sca6_low_limit.size() <<
-            " current array dimension " << xsp_chan_sca6_low_lim_.size();
-      setErrorString(ss.str());
-      status = XSP_STATUS_ERROR;
-    }
-  } else {
-    setErrorString("Cannot set scalar 6 low limits, not connected");
-    status = XSP_STATUS_ERROR;
-  }
-  return status;
+  std::vector<uint32_t> unchanged;
+  return setScaParams(unchanged, unchanged, sca6_low_limit, unchanged, unchanged);
 }
 
 std::vector<uint32_t> XspressDetector::getSca6LowLimits()
@@ -1021,33 +2165,8 @@ std::vector<uint32_t> XspressDetector::getSca6LowLimits()
 
 int XspressDetector::setSca6HighLimits(std::vector<uint32_t> sca6_high_limit)
 {
-  int status = XSP_STATUS_OK;
-  // Verify we are connected
-  if (checkConnected()){
-    // Verify we have been passed the correct size vector
-    if (sca6_high_limit.size() == xsp_chan_sca6_high_lim_.size()){
-      // Loop over the values calling the appropriate set window
-      for (int chan = 0; chan < sca6_high_limit.size(); chan++){
-        status |= detector_->set_window(chan, XSP_SCA6_LIM, xsp_chan_sca6_low_lim_[chan], sca6_high_limit[chan]);
-      }
-      // Once updated read back the limits from the detector
-      if (status == XSP_STATUS_OK){
-        status = this->readSCAParams();
-      } else {
-        setErrorString(detector_->getErrorString());
-      }
-    } else {
-      std::stringstream ss;
-      ss << "Cannot set scalar 6 high limits, input array dimension " << sca6_high_limit.size() <<
-            " current array dimension " << xsp_chan_sca6_high_lim_.size();
-      setErrorString(ss.str());
-      status = XSP_STATUS_ERROR;
-    }
-  } else {
-    setErrorString("Cannot set scalar 6 high limits, not connected");
-    status = XSP_STATUS_ERROR;
-  }
-  return status;
+  std::vector<uint32_t> unchanged;
+  return setScaParams(unchanged, unchanged, unchanged, sca6_high_limit, unchanged);
 }
 
 std::vector<uint32_t> XspressDetector::getSca6HighLimits()
@@ -1057,33 +2176,8 @@ std::vector<uint32_t> XspressDetector::getSca6HighLimits()
 
 int XspressDetector::setSca4Thresholds(std::vector<uint32_t> sca4_thresholds)
 {
-  int status = XSP_STATUS_OK;
-  // Verify we are connected
-  if (checkConnected()){
-    // Verify we have been passed the correct size vector
-    if (sca4_thresholds.size() == xsp_chan_sca4_threshold_.size()){
-      // Loop over the values calling the appropriate set window
-      for (int chan = 0; chan < sca4_thresholds.size(); chan++){
-        status |= detector_->set_sca_thresh(chan, sca4_thresholds[chan]);
-      }
-      // Once updated read back the limits from the detector
-      if (status == XSP_STATUS_OK){
-        status = this->readSCAParams();
-      } else {
-        setErrorString(detector_->getErrorString());
-      }
-    } else {
-      std::stringstream ss;
-      ss << "Cannot set scalar 4 thresholds, input array dimension " << sca4_thresholds.size() <<
-            " current array dimension " << xsp_chan_sca4_threshold_.size();
-      setErrorString(ss.str());
-      status = XSP_STATUS_ERROR;
-    }
-  } else {
-    setErrorString("Cannot set scalar 4 thresholds, not connected");
-    status = XSP_STATUS_ERROR;
-  }
-  return status;
+  std::vector<uint32_t> unchanged;
+  return setScaParams(unchanged, unchanged, unchanged, unchanged, sca4_thresholds);
 }
 
 std::vector<uint32_t> XspressDetector::getSca4Thresholds()
@@ -1176,13 +2270,16 @@ bool XspressDetector::getXspAcquiring()
   // because our class acquiring flag is latched and can
   // only be reset once we know that the DAQ has completed.
 
-  // Lock the start acquisition mutex
+  // This is called on every status refresh, telemetry publish and metrics
+  // render, so the hardware lock is not taken. The library error string has
+  // its own lock and the DAQ state is read from the DAQ object.
   boost::lock_guard<boost::mutex> lock(start_acq_mutex_);
 
   if (acquiring_){
     if (daq_){
-      // Check the DAQ flag.  If it is false then reset our flag
-      if (!daq_->getAcqRunning()){
+      // Check the DAQ flag.  If it is false then reset our flag, unless
+      // the next segment of a queued acquisition is about to be armed
+      if (!daq_->getAcqRunning() && acq_queue_.empty()){
         acquiring_ = false;
         // Check to see if the acquisition failed
         if (daq_->getAcqFailed()){
@@ -1219,41 +2316,49 @@ uint32_t XspressDetector::getXspFramesRead()
 
 std::vector<float> XspressDetector::getTemperature0()
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   return xsp_status_temperature_0_;
 }
 
 std::vector<float> XspressDetector::getTemperature1()
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   return xsp_status_temperature_1_;
 }
 
 std::vector<float> XspressDetector::getTemperature2()
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   return xsp_status_temperature_2_;
 }
 
 std::vector<float> XspressDetector::getTemperature3()
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   return xsp_status_temperature_3_;
 }
 
 std::vector<float> XspressDetector::getTemperature4()
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   return xsp_status_temperature_4_;
 }
 
 std::vector<float> XspressDetector::getTemperature5()
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   return xsp_status_temperature_5_;
 }
 
 std::vector<int32_t> XspressDetector::getXspFEMFramesRead()
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   return xsp_status_frames_;
 }
 
 std::vector<int32_t> XspressDetector::getXspFEMDroppedFrames()
 {
+  boost::lock_guard<boost::mutex> lock(status_mutex_);
   return xsp_status_dropped_frames_;
 }
 
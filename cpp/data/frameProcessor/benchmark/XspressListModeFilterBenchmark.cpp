@@ -0,0 +1,122 @@
+/*
+ * XspressListModeFilterBenchmark.cpp
+ *
+ * Compares blosc compression of raw list mode blocks against blocks passed
+ * through XspressListModeFilter first. Blocks of synthetic HGT64 event words
+ * are generated with increasing time stamps, a peaked energy distribution and
+ * a single channel, in the same layout the list mode plugin writes.
+ *
+ * Usage: xspressListModeFilterBenchmark [block_bytes] [iterations] [compressor]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <blosc.h>
+
+#include "XspressListModeFilter.h"
+
+using namespace FrameProcessor;
+
+#define DEFAULT_BLOCK_BYTES 4194304
+#define DEFAULT_ITERATIONS  20
+#define PACKET_WORDS        1100  // XSPRESS_RX_BUFF_LWORDS
+#define COMPRESSION_LEVEL   1
+
+/**
+ * Fill a block with packets of synthetic event words, each packet preceded
+ * by its word count and a header word as stored by the list mode plugin.
+ */
+static void generate_block(std::vector<uint64_t>& block, uint32_t seed)
+{
+  srand(seed);
+  uint64_t time = 0;
+  uint32_t frame = 0;
+  size_t index = 0;
+  while (index < block.size()){
+    block[index++] = PACKET_WORDS;
+    if (index < block.size()){
+      uint64_t prev_time = time & 0xFFFFFFFF;
+      block[index++] = (uint64_t)frame | (prev_time << 24) | ((uint64_t)3 << 60);
+      frame++;
+    }
+    for (int word = 1; word < PACKET_WORDS && index < block.size(); word++){
+      time += rand() % 200;
+      // Sum of uniform values gives a peaked energy distribution
+      uint64_t energy = ((rand() % 4096) + (rand() % 4096) + (rand() % 4096) + (rand() % 4096)) / 4;
+      uint64_t flags = (rand() % 64 == 0) ? 1 : 0;
+      block[index++] = energy | ((time & 0xFFFFFFFFFFULL) << 16) | (flags << 56) | ((uint64_t)3 << 60);
+    }
+  }
+}
+
+/**
+ * Compress a block a number of times and report ratio and throughput.
+ */
+static void run(const std::string& name, const std::vector<uint64_t>& block, bool filter, int shuffle,
+                size_t typesize, int iterations)
+{
+  size_t bytes = block.size() * sizeof(uint64_t);
+  std::vector<uint8_t> filtered(bytes);
+  std::vector<uint8_t> compressed(bytes + BLOSC_MAX_OVERHEAD);
+  std::vector<uint8_t> restored(bytes);
+  std::vector<uint64_t> words(block.size());
+  int compressed_size = 0;
+
+  boost::posix_time::ptime start = boost::posix_time::microsec_clock::local_time();
+  for (int iteration = 0; iteration < iterations; iteration++){
+    const void *src = &block[0];
+    if (filter){
+      XspressListModeFilter::encode(&block[0], &filtered[0], block.size());
+      src = &filtered[0];
+    }
+    compressed_size = blosc_compress(COMPRESSION_LEVEL, shuffle, typesize, bytes, src, &compressed[0], compressed.size());
+  }
+  boost::posix_time::ptime end = boost::posix_time::microsec_clock::local_time();
+  double seconds = (end - start).total_microseconds() / 1.0e6;
+
+  // Check that the data round trips
+  blosc_decompress(&compressed[0], &restored[0], bytes);
+  bool valid;
+  if (filter){
+    XspressListModeFilter::decode(&restored[0], &words[0], block.size());
+    valid = memcmp(&words[0], &block[0], bytes) == 0;
+  } else {
+    valid = memcmp(&restored[0], &block[0], bytes) == 0;
+  }
+
+  std::cout << std::left << std::setw(32) << name
+            << " ratio " << std::setw(8) << std::setprecision(3) << (compressed_size > 0 ? (double)bytes / compressed_size : 0.0)
+            << " throughput " << std::setw(10) << std::setprecision(4) << (bytes * (double)iterations / seconds / 1.0e6) << " MB/s"
+            << (valid ? "" : "  ROUND TRIP FAILED") << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  size_t block_bytes = argc > 1 ? strtoul(argv[1], NULL, 0) : DEFAULT_BLOCK_BYTES;
+  int iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+  const char *compressor = argc > 3 ? argv[3] : "lz4";
+
+  blosc_init();
+  if (blosc_set_compressor(compressor) < 0){
+    std::cerr << "Unknown blosc compressor " << compressor << std::endl;
+    return 1;
+  }
+
+  std::vector<uint64_t> block(block_bytes / sizeof(uint64_t));
+  generate_block(block, 1);
+  std::cout << "Block of " << block.size() << " words, " << iterations << " iterations, " << compressor << std::endl;
+
+  run("raw, no shuffle", block, false, BLOSC_NOSHUFFLE, sizeof(uint64_t), iterations);
+  run("raw, byte shuffle", block, false, BLOSC_SHUFFLE, sizeof(uint64_t), iterations);
+  run("raw, bit shuffle", block, false, BLOSC_BITSHUFFLE, sizeof(uint64_t), iterations);
+  run("filtered, no shuffle", block, true, BLOSC_NOSHUFFLE, 1, iterations);
+  run("filtered, bit shuffle", block, true, BLOSC_BITSHUFFLE, 1, iterations);
+
+  blosc_destroy();
+  return 0;
+}
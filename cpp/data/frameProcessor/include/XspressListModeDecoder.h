@@ -0,0 +1,100 @@
+#ifndef SRC_XSPRESSLISTMODEDECODER_H
+#define SRC_XSPRESSLISTMODEDECODER_H
+
+#include <vector>
+
+#include <log4cxx/logger.h>
+
+using namespace log4cxx;
+
+#include "Frame.h"
+#include "XspressDefinitions.h"
+
+namespace FrameProcessor
+{
+
+  /**
+   * A single typed column of decoded list mode data.
+   *
+   * Values are written straight into the data area of the DataBlockFrame that
+   * is eventually pushed, a full column is handed off without a further copy.
+   */
+  class XspressListModeColumn
+  {
+  public:
+    XspressListModeColumn(const std::string& name, DataType data_type, size_t element_size);
+    void allocate(uint32_t capacity);
+    void reset_frame_count();
+    void *data_ptr();
+    boost::shared_ptr <Frame> to_frame(uint32_t count);
+
+  private:
+    boost::shared_ptr <Frame> frame_;
+    std::string name_;
+    DataType data_type_;
+    size_t element_size_;
+    uint32_t capacity_;
+    uint32_t frame_count_;
+  };
+
+  /**
+   * Decoder for HGT64 list mode packets.
+   *
+   * Event words are split into columnar time, energy, channel and flags
+   * datasets. The header word of each packet starts a new entry in a set of
+   * index datasets whenever the time frame changes for that channel, so the
+   * events of a given time frame can be located without a decode pass.
+   */
+  class XspressListModeDecoder
+  {
+  public:
+    XspressListModeDecoder();
+    virtual ~XspressListModeDecoder();
+    void set_events_per_frame(uint32_t events);
+    uint32_t get_events_per_frame();
+    void reset();
+    void decode_packet(const uint64_t *words, uint32_t num_words, std::vector<boost::shared_ptr<Frame> >& frames);
+    void flush(std::vector<boost::shared_ptr<Frame> >& frames);
+    uint64_t get_events_decoded();
+    uint64_t get_index_entries();
+
+    static const std::string EVENT_TIME_DATASET;
+    static const std::string EVENT_ENERGY_DATASET;
+    static const std::string EVENT_CHANNEL_DATASET;
+    static const std::string EVENT_FLAGS_DATASET;
+    static const std::string INDEX_CHANNEL_DATASET;
+    static const std::string INDEX_FRAME_DATASET;
+    static const std::string INDEX_TIME_DATASET;
+    static const std::string INDEX_OFFSET_DATASET;
+
+  private:
+    void allocate();
+    void push_events(uint32_t count, std::vector<boost::shared_ptr<Frame> >& frames);
+    void push_index(std::vector<boost::shared_ptr<Frame> >& frames);
+
+    uint32_t events_per_frame_;
+    uint32_t filled_events_;
+    uint64_t events_decoded_;
+    uint64_t index_entries_;
+
+    XspressListModeColumn time_;
+    XspressListModeColumn energy_;
+    XspressListModeColumn channel_;
+    XspressListModeColumn flags_;
+
+    /** Last time frame seen per header channel, used to detect time frame boundaries */
+    int64_t last_frame_[XSP_HGT64_MAX_CHANNELS];
+
+    std::vector<uint8_t> index_channel_;
+    std::vector<uint32_t> index_frame_;
+    std::vector<uint32_t> index_time_;
+    std::vector<uint64_t> index_offset_;
+    uint32_t index_frame_count_;
+
+    /** Pointer to logger */
+    LoggerPtr logger_;
+  };
+
+}
+
+#endif //SRC_XSPRESSLISTMODEDECODER_H
@@ -0,0 +1,30 @@
+#ifndef SRC_XSPRESSLISTMODEFILTER_H
+#define SRC_XSPRESSLISTMODEFILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace FrameProcessor
+{
+
+  /**
+   * Reversible pre-compression filter for blocks of list mode words.
+   *
+   * The 40 bit time stamp field of every word is replaced by its difference
+   * from the time stamp of the previous word, then the words are split into
+   * byte planes. The byte planes line up with the event fields (energy in
+   * planes 0-1, time in planes 2-6, flags and channel in plane 7), so each
+   * field is presented to the downstream compressor as a contiguous, slowly
+   * varying stream. The filter does not depend on word type, so packet
+   * count and header words within a block round trip unchanged.
+   */
+  class XspressListModeFilter
+  {
+  public:
+    static void encode(const uint64_t *words, uint8_t *planes, size_t num_words);
+    static void decode(const uint8_t *planes, uint64_t *words, size_t num_words);
+  };
+
+}
+
+#endif //SRC_XSPRESSLISTMODEFILTER_H
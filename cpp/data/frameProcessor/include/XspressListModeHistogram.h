@@ -0,0 +1,50 @@
+#ifndef SRC_XSPRESSLISTMODEHISTOGRAM_H
+#define SRC_XSPRESSLISTMODEHISTOGRAM_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "XspressDefinitions.h"
+
+#define XSP_HISTOGRAM_BINS  4096
+#define XSP_HISTOGRAM_LANES 4
+
+namespace FrameProcessor
+{
+
+  /**
+   * Energy histogram of the list mode events for a single channel.
+   *
+   * Each channel owns its histogram so no bins are shared between channels.
+   * Within a channel the events are spread over several private sub
+   * histograms, which are only summed when the spectrum is read out, so that
+   * runs of events in the same bin do not serialise on a single counter.
+   */
+  class XspressListModeHistogram
+  {
+  public:
+    XspressListModeHistogram();
+    virtual ~XspressListModeHistogram();
+    void set_shift(uint32_t shift);
+    void reset();
+    void clear();
+    void add_events(const uint64_t *words, uint32_t num_words);
+    void merge(uint32_t *spectrum);
+    uint64_t get_events();
+    int64_t get_time_frame();
+    void set_time_frame(int64_t time_frame);
+
+  private:
+    /** Sub histograms, XSP_HISTOGRAM_LANES blocks of XSP_HISTOGRAM_BINS bins */
+    std::vector<uint32_t> bins_;
+    /** Right shift applied to the event energy to obtain the bin */
+    uint32_t shift_;
+    /** Number of events binned since the last clear */
+    uint64_t events_;
+    /** Time frame currently being binned, -1 if none */
+    int64_t time_frame_;
+  };
+
+}
+
+#endif //SRC_XSPRESSLISTMODEHISTOGRAM_H
@@ -6,42 +6,130 @@
 #include <log4cxx/basicconfigurator.h>
 #include <log4cxx/propertyconfigurator.h>
 #include <log4cxx/helpers/exception.h>
+#include <boost/thread.hpp>
 
 using namespace log4cxx;
 using namespace log4cxx::helpers;
 
 #include "FrameProcessorPlugin.h"
 #include "XspressDefinitions.h"
+#include "XspressListModeDecoder.h"
+#include "XspressListModeHistogram.h"
+#include "XspressListModeFilter.h"
+#include "XspressMetrics.h"
 #include "gettime.h"
 
+#define XSP_CACHE_LINE_SIZE 64
+
 namespace FrameProcessor
 {
 
+  /**
+   * Per channel list mode accumulator.
+   *
+   * Packets are copied straight into the data area of the DataBlockFrame that
+   * will be pushed to the writer, so each event word is copied exactly once.
+   * Two frames are kept per channel: the one being filled and the one most
+   * recently handed downstream, which is reused as soon as the rest of the
+   * pipeline has released it.
+   *
+   * When the time frame chunking policy is selected, output frames are cut at
+   * time frame boundaries and an index of (time frame, byte offset, length)
+   * rows is kept for the channel.
+   *
+   * When the prefilter is enabled, every output frame is filtered on its own
+   * and the byte length of each is kept in a raw_N_frames dataset so that a
+   * reader can split raw_N back into the filtered frames.
+   */
   class XspressListModeMemoryBlock
   {
   public:
-    XspressListModeMemoryBlock(const std::string& name);
+    XspressListModeMemoryBlock(const std::string& name, const std::string& index_name);
     virtual ~XspressListModeMemoryBlock();
     void set_size(uint32_t bytes);
+    void set_time_frame_chunking(bool enable);
+    void set_prefilter(bool enable);
     void reallocate();
     void reset();
     void reset_frame_count();
+    boost::shared_ptr <Frame> start_time_frame(uint32_t time_frame);
+    boost::shared_ptr <Frame> end_time_frame();
     boost::shared_ptr <Frame> add_block(uint32_t bytes, void *ptr);
     boost::shared_ptr <Frame> to_frame();
     boost::shared_ptr <Frame> flush();
+    boost::shared_ptr <Frame> index_to_frame(bool force);
+    boost::shared_ptr <Frame> lengths_to_frame(bool force);
+    uint32_t get_filled_size();
+    int64_t get_age_ms(boost::posix_time::ptime now);
 
   private:
-    void *ptr_;
+    void next_frame();
+    boost::shared_ptr <Frame> output_frame(uint32_t bytes);
+    void filtered(boost::shared_ptr <Frame> frame, uint32_t bytes);
+
+    /** Frame currently being filled */
+    boost::shared_ptr <Frame> frame_;
+    /** Frame most recently pushed downstream, reused once released */
+    boost::shared_ptr <Frame> spare_;
+    char *ptr_;
     std::string name_;
     uint32_t num_bytes_;
     uint32_t num_words_;
     uint32_t filled_size_;
     uint32_t frame_count_;
+    /** Bytes handed off for the current acquisition, the offset of the block in raw_N */
+    uint64_t bytes_written_;
+    /** Time the first packet was copied into the current block */
+    boost::posix_time::ptime fill_start_;
+
+    /** Pass handed off blocks through XspressListModeFilter */
+    bool prefilter_;
+    /** Byte length of each filtered frame not yet pushed to raw_N_frames */
+    std::string lengths_name_;
+    std::vector<uint64_t> frame_lengths_;
+    uint32_t lengths_block_count_;
+
+    /** Time frame chunking and index state */
+    bool time_frame_chunking_;
+    int64_t time_frame_;
+    std::string index_name_;
+    std::vector<uint64_t> index_rows_;
+    uint32_t index_block_count_;
 
     /** Pointer to logger */
     LoggerPtr logger_;
   };
 
+  /** Fields decoded from the first (header) word of the most recent packet */
+  typedef struct
+  {
+    uint32_t frame;
+    uint32_t prev_time;
+    uint32_t chan;
+  } XspressListModeHeader;
+
+  /**
+   * Per channel state, stored in a flat table indexed by channel number.
+   * Entries are aligned to a cache line so that neighbouring channels never
+   * share one.
+   */
+  struct XspressListModeChannel
+  {
+    XspressListModeChannel() : active(false), position(0)
+    {
+      header.frame = 0;
+      header.prev_time = 0;
+      header.chan = 0;
+    }
+
+    bool active;
+    /** Position of the channel within the configured channel list */
+    uint32_t position;
+    XspressListModeHeader header;
+    boost::shared_ptr<XspressListModeMemoryBlock> block;
+    boost::shared_ptr<XspressListModeHistogram> histogram;
+  } __attribute__((aligned(XSP_CACHE_LINE_SIZE)));
+
   class XspressListModeProcessPlugin : public FrameProcessorPlugin 
   {
   public:
@@ -50,6 +138,7 @@ namespace FrameProcessor
     virtual ~XspressListModeProcessPlugin();
 
     void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void requestConfiguration(OdinData::IpcMessage& reply);
 
     // version related functions
     int get_version_major();
@@ -69,6 +158,13 @@ namespace FrameProcessor
     void set_channels(std::vector<uint32_t> channels);
     void set_frame_size(uint32_t num_bytes);
     void setup_memory_allocation();
+    void push_decoded(std::vector<boost::shared_ptr<Frame> >& frames);
+    void emit_histogram(uint32_t channel, uint32_t frame_number);
+    void emit_all_histograms(uint32_t frame_number);
+    void push_histogram_live_view(uint32_t frame_number);
+    void flush_loop();
+    void flush_aged_blocks(boost::posix_time::ptime now);
+    std::string render_metrics();
         
     // Plugin interface
     void status(OdinData::IpcMessage& status);
@@ -79,16 +175,69 @@ namespace FrameProcessor
     std::vector<uint32_t> channels_;
     uint32_t num_channels_;
 
-    std::map<uint32_t, boost::shared_ptr<XspressListModeMemoryBlock> > memory_ptrs_;
-    std::map<uint32_t, std::vector<uint32_t> > packet_headers_;
+    /** Channel state indexed by channel number, inactive entries are not configured */
+    std::vector<XspressListModeChannel> channel_table_;
+
+    /** Decoder for the optional columnar event datasets */
+    XspressListModeDecoder decoder_;
+    bool decode_enabled_;
+    std::vector<boost::shared_ptr<Frame> > decoded_frames_;
+
+    /** Output chunking policy, by byte size or by time frame */
+    std::string chunking_policy_;
+
+    /** Filter raw_N blocks ahead of compression */
+    bool prefilter_;
+
+    /** Timed flushing of partially filled blocks */
+    uint32_t flush_timeout_ms_;
+    uint64_t timed_flushes_;
+    bool flush_running_;
+    boost::shared_ptr<boost::thread> flush_thread_;
+    /** Serialises frame processing, configuration and the flush timer */
+    boost::mutex channel_mutex_;
+
+    /** Histogramming of events into live spectra */
+    std::string histogram_mode_;
+    uint32_t histogram_interval_ms_;
+    uint32_t histogram_shift_;
+    bool histogram_write_;
+    std::string histogram_live_view_;
+    boost::posix_time::ptime last_histogram_time_;
+    uint32_t histogram_interval_count_;
+    uint64_t histograms_emitted_;
+    /** Most recently completed spectrum of every channel, in channel list order */
+    std::vector<uint32_t> histogram_live_;
+
+    /** Number of list mode frames processed since the plugin was loaded */
+    uint64_t frames_processed_;
+    /** Time taken to process each list mode frame */
+    Xspress::XspressMetricsHistogram process_latency_;
+    /** Address the OpenMetrics endpoint listens on */
+    std::string metrics_address_;
 
     static const std::string CONFIG_CHANNELS;
     static const std::string CONFIG_RESET_ACQUISITION;
     static const std::string CONFIG_FLUSH_ACQUISITION;
     static const std::string CONFIG_FRAME_SIZE;
+    static const std::string CONFIG_DECODE_ENABLE;
+    static const std::string CONFIG_DECODE_EVENTS;
+    static const std::string CONFIG_CHUNKING;
+    static const std::string CONFIG_FLUSH_TIMEOUT;
+    static const std::string CONFIG_PREFILTER;
+    static const std::string CONFIG_HISTOGRAM_MODE;
+    static const std::string CONFIG_HISTOGRAM_INTERVAL;
+    static const std::string CONFIG_HISTOGRAM_SHIFT;
+    static const std::string CONFIG_HISTOGRAM_WRITE;
+    static const std::string CONFIG_HISTOGRAM_LIVE_VIEW;
+    static const std::string CONFIG_METRICS_PORT;
+    static const std::string CONFIG_METRICS_ADDRESS;
 
     /** Pointer to logger */
     LoggerPtr logger_;
+
+    /** OpenMetrics endpoint, declared last so it stops before the plugin state goes */
+    Xspress::XspressMetricsServer metrics_server_;
   };
 
 }
@@ -12,6 +12,10 @@ using namespace log4cxx::helpers;
 
 #include "FrameProcessorPlugin.h"
 #include "XspressDefinitions.h"
+#include "XspressMetrics.h"
+
+#include <map>
+#include <set>
 
 namespace FrameProcessor {
 
@@ -29,6 +33,7 @@ public:
   uint32_t frames();
   uint32_t size();
   uint32_t current_byte_size();
+  uint32_t frame_size();
   char *get_data_ptr();
 
 private:
@@ -43,6 +48,52 @@ private:
   LoggerPtr logger_;
 };
 
+/**
+ * All of the data held for one block of frames: a memory block for each
+ * channel, the channel sum and the packed meta data, together with a
+ * completeness bitmap so that frames can arrive in any order.
+ */
+class XspressBlockSet
+{
+public:
+
+  XspressBlockSet();
+  virtual ~XspressBlockSet();
+  void set_size(uint32_t num_channels, uint32_t frame_size, uint32_t max_frames);
+  void reset(uint32_t block_index, uint32_t first_frame, uint32_t expected_frames);
+  bool add_frame(uint32_t frame_id);
+  bool complete();
+  uint32_t block_index();
+  uint32_t first_frame();
+  uint32_t expected_frames();
+  uint32_t frames_received();
+  boost::posix_time::ptime last_update();
+  boost::shared_ptr<XspressMemoryBlock> channel(uint32_t index);
+  boost::shared_ptr<XspressMemoryBlock> sum();
+  MetaBlockHeader *meta_header();
+  uint32_t *scalars();
+  double *dtc();
+  double *inp_est();
+  uint8_t *fill_mask();
+  uint32_t meta_size();
+
+private:
+  uint32_t block_index_;
+  uint32_t first_frame_;
+  uint32_t expected_frames_;
+  uint32_t frames_received_;
+  uint32_t max_frames_;
+  uint32_t num_channels_;
+  boost::posix_time::ptime last_update_;
+  /** One bit per frame of the block, set once the frame has been received */
+  std::vector<uint64_t> bitmap_;
+  std::vector<boost::shared_ptr<XspressMemoryBlock> > channels_;
+  boost::shared_ptr<XspressMemoryBlock> sum_;
+  /** Packed meta data (header, dtc, input estimates, scalars and fill mask) */
+  char *meta_block_;
+  uint32_t meta_size_;
+};
+
     class XspressProcessPlugin : public FrameProcessorPlugin {
     public:
         XspressProcessPlugin();
@@ -53,6 +104,10 @@ private:
 
         void requestConfiguration(OdinData::IpcMessage& reply);
 
+        void status(OdinData::IpcMessage& status);
+
+        void process_end_of_acquisition();
+
         void configureProcess(OdinData::IpcMessage& config, OdinData::IpcMessage& reply);
 
         // version related functions
@@ -71,11 +126,39 @@ private:
         void set_number_of_channels(uint32_t num_channels);
         void set_number_of_aux(uint32_t num_aux);
         void setup_memory_allocation();
+        void update_meta_json_header();
         
         // Plugin interface
         void process_frame(boost::shared_ptr <Frame> frame);
 
-        void send_scalars(uint32_t last_frame_id, uint32_t num_scalars, uint32_t first_channel, uint32_t num_channels);
+        void send_scalars(boost::shared_ptr<XspressBlockSet> block, uint32_t num_scalars, uint32_t first_channel);
+
+        boost::shared_ptr<XspressBlockSet> get_block(uint32_t block_index);
+        void flush_block(uint32_t block_index);
+        void flush_expired_blocks(boost::posix_time::ptime now);
+        void discard_blocks();
+        void reset_acquisition();
+        std::string render_metrics();
+
+        char *expand_sparse(const FrameHeader *header, const char *mca_ptr, uint32_t mca_size);
+        void sum_channels(const char *mca_ptr, const double *dtc_ptr, uint32_t mca_size);
+        void accumulate_scan(uint32_t frame_id, const uint32_t *spectra);
+        void reset_scan_summary();
+        void push_scan_summary();
+        bool scan_summary_due() const;
+        void start_roll(uint32_t roll);
+        bool live_view_due(uint32_t frame_id, boost::posix_time::ptime now);
+        void push_live_view(uint32_t frame_id, const char *mca_ptr, uint32_t num_aux, uint32_t num_energy_bins, bool publish);
+        boost::shared_ptr<Frame> create_block_frame(boost::shared_ptr<XspressMemoryBlock> block,
+                                                    const std::string& dataset,
+                                                    DataType data_type,
+                                                    uint32_t block_index,
+                                                    uint32_t num_frames);
+        boost::shared_ptr<Frame> create_packed_frame(boost::shared_ptr<XspressMemoryBlock> block,
+                                                     const std::string& dataset,
+                                                     uint32_t block_index,
+                                                     uint32_t num_frames,
+                                                     boost::shared_ptr<Frame>& overflow_frame);
 
         uint32_t num_frames_;
         uint32_t num_energy_bins_;
@@ -90,15 +173,104 @@ private:
 
         /** Time the last scalar message was sent */
         boost::posix_time::ptime last_scalar_send_time_;
-        /** Memory block for scalars */
-        void *scalar_memblock_;
-        void *dtc_memblock_;
-        void *inp_est_memblock_;
-        /** Number of scalars recorded */
-        uint32_t num_scalars_recorded_;
-
-
-        std::vector<boost::shared_ptr<XspressMemoryBlock> > memory_ptrs_;
+        /** Cached JSON header sent with every packed meta data message */
+        std::string meta_json_header_;
+        /** Number of scalars for each channel in the current acquisition */
+        uint32_t num_scalars_;
+        /** First channel index of the current acquisition */
+        uint32_t first_channel_;
+
+        /** Blocks currently being filled, keyed by block index */
+        std::map<uint32_t, boost::shared_ptr<XspressBlockSet> > open_blocks_;
+        /** Allocated blocks available for reuse */
+        std::vector<boost::shared_ptr<XspressBlockSet> > free_blocks_;
+        /** Indexes of recently flushed blocks, used to reject late frames */
+        std::set<uint32_t> flushed_blocks_;
+        /** Highest block index seen in the current acquisition */
+        uint32_t highest_block_;
+        /** Set at the end of an acquisition, the next frame resets the per acquisition state */
+        bool new_acquisition_;
+        /** Number of blocks that may be filled concurrently */
+        uint32_t reorder_window_;
+        /** Time after the last update at which an incomplete block is flushed (0 to disable) */
+        uint32_t block_timeout_ms_;
+        /** Number of blocks flushed before all of their frames arrived */
+        uint64_t incomplete_blocks_;
+        /** Number of frames dropped because they were received twice */
+        uint64_t duplicate_frames_;
+        /** Number of frames dropped because their block had already been flushed */
+        uint64_t late_frames_;
+        /** Number of frames received with sparse encoded spectra */
+        uint64_t sparse_frames_;
+        /** Number of sparse entries dropped because their bin index was out of range */
+        uint64_t sparse_invalid_entries_;
+        /** Dense spectra expanded from the current sparse encoded frame */
+        std::vector<uint32_t> sparse_spectra_;
+
+        /** Requested MCA dataset type (uint32, uint16 or uint8) */
+        std::string packing_type_;
+        /** Bits per MCA value for the current acquisition, latched from packing_type_ on the first frame */
+        uint32_t packing_bits_;
+        /** Number of MCA blocks in the current acquisition that fitted the narrow type */
+        uint64_t packed_blocks_;
+        /** Number of MCA blocks in the current acquisition written to the 32 bit overflow datasets */
+        uint64_t overflow_blocks_;
+        /** Number of MCA values too large for the narrow type */
+        uint64_t overflow_bins_;
+
+        /** Spectra of each channel summed over every frame of the acquisition */
+        std::vector<uint64_t> scan_spectra_;
+        /** Total counts of each channel for every frame, indexed by frame then channel */
+        std::vector<uint64_t> scan_frame_counts_;
+        /** Smallest, largest and summed frame total counts of each channel */
+        std::vector<uint64_t> scan_count_min_;
+        std::vector<uint64_t> scan_count_max_;
+        std::vector<uint64_t> scan_count_total_;
+        /** Number of frames accumulated into the scan summary */
+        uint32_t scan_frames_;
+        /** Has the scan summary been pushed for the current acquisition */
+        bool scan_summary_written_;
+        /** Segment of a queued acquisition the last frame belonged to */
+        uint32_t segment_;
+        /** Frame ID of the first frame of the current segment */
+        uint32_t segment_offset_;
+        /** Requested number of frames in each roll of the output (0 to disable) */
+        uint32_t roll_frames_;
+        /** Frames in each roll of the current acquisition, latched from roll_frames_ on the first frame */
+        uint32_t roll_length_;
+        /** Roll of the output the current frames belong to */
+        uint32_t current_roll_;
+        /** Number of rolls closed in the current acquisition */
+        uint32_t rolls_completed_;
+        /** Protects the open blocks, which are also flushed from the status thread */
+        boost::mutex block_mutex_;
+
+        /** Live view publishing policy (all, every, rate or accumulate) */
+        std::string live_mode_;
+        /** Publish every Nth frame when the live view mode is every */
+        uint32_t live_every_;
+        /** Maximum live view frames per second (0 for unlimited) */
+        double live_rate_;
+        /** Number of energy bins to combine into one bin of the live view */
+        uint32_t live_rebin_;
+        /** Sum the aux (resgrade) values of each channel for the live view */
+        bool live_sum_aux_;
+        /** Time the last live view frame was published */
+        boost::posix_time::ptime last_live_time_;
+        /** Live view spectra accumulated since the last publish */
+        std::vector<uint32_t> live_accumulator_;
+        /** Number of frames held in the live view accumulator */
+        uint32_t live_accumulated_frames_;
+
+        /** Produce a spectrum summed over all channels owned by this process */
+        bool sum_enabled_;
+        /** Weight each channel by its dead time correction factor when summing */
+        bool sum_dtc_;
+        /** Name of the plugin to receive the live channel sum (empty to disable) */
+        std::string sum_live_view_name_;
+        /** Scratch buffers holding the channel sum of the current frame */
+        std::vector<uint32_t> sum_counts_;
+        std::vector<float> sum_corrected_;
 
         /** Configuration constant for the acquisition ID used for meta data writing */
         static const std::string CONFIG_ACQ_ID;
@@ -108,6 +280,11 @@ private:
         static const std::string CONFIG_PROCESS_RANK;
 
         static const std::string CONFIG_LIVE_VIEW_NAME;
+        static const std::string CONFIG_LIVE_MODE;
+        static const std::string CONFIG_LIVE_EVERY;
+        static const std::string CONFIG_LIVE_RATE;
+        static const std::string CONFIG_LIVE_REBIN;
+        static const std::string CONFIG_LIVE_SUM_AUX;
 
         static const std::string CONFIG_FRAMES;
 
@@ -116,8 +293,36 @@ private:
         
         static const std::string CONFIG_CHUNK;
 
+        static const std::string CONFIG_SUM_ENABLE;
+        static const std::string CONFIG_SUM_DTC;
+        static const std::string CONFIG_SUM_LIVE_VIEW;
+
+        static const std::string CONFIG_REORDER_WINDOW;
+        static const std::string CONFIG_BLOCK_TIMEOUT;
+
+        static const std::string CONFIG_PACKING_TYPE;
+
+        static const std::string CONFIG_ROLL_FRAMES;
+
+        static const std::string CONFIG_METRICS_PORT;
+        static const std::string CONFIG_METRICS_ADDRESS;
+
+        /** Number of frames processed since the plugin was loaded */
+        uint64_t frames_processed_;
+        /** Number of blocks pushed since the plugin was loaded */
+        uint64_t blocks_pushed_;
+        /** Time taken to process each frame, including any block pushed by it */
+        Xspress::XspressMetricsHistogram process_latency_;
+        /** Time taken to push each block */
+        Xspress::XspressMetricsHistogram flush_latency_;
+        /** Address the OpenMetrics endpoint listens on */
+        std::string metrics_address_;
+
         /** Pointer to logger */
         LoggerPtr logger_;
+
+        /** OpenMetrics endpoint, declared last so it stops before the plugin state goes */
+        Xspress::XspressMetricsServer metrics_server_;
     };
 
 }
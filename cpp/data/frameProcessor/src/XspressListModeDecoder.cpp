@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <string.h>
+#include "DataBlockFrame.h"
+#include "XspressListModeDecoder.h"
+#include "FrameProcessorDefinitions.h"
+#include "DebugLevelLogger.h"
+
+namespace FrameProcessor {
+
+const std::string XspressListModeDecoder::EVENT_TIME_DATASET =    "event_time";
+const std::string XspressListModeDecoder::EVENT_ENERGY_DATASET =  "event_energy";
+const std::string XspressListModeDecoder::EVENT_CHANNEL_DATASET = "event_channel";
+const std::string XspressListModeDecoder::EVENT_FLAGS_DATASET =   "event_flags";
+const std::string XspressListModeDecoder::INDEX_CHANNEL_DATASET = "event_index_channel";
+const std::string XspressListModeDecoder::INDEX_FRAME_DATASET =   "event_index_frame";
+const std::string XspressListModeDecoder::INDEX_TIME_DATASET =    "event_index_time";
+const std::string XspressListModeDecoder::INDEX_OFFSET_DATASET =  "event_index_offset";
+
+#define DEFAULT_EVENTS_PER_FRAME 524288
+
+/**
+ * Push one index column as a frame of its own.
+ *
+ * \param[in] name - dataset name of the column.
+ * \param[in] data_type - type of the column elements.
+ * \param[in] values - column values.
+ * \param[in] frame_number - frame number for the index dataset.
+ * \param[out] frames - vector to append the frame to.
+ */
+template<typename T>
+static void index_column_frame(const std::string& name, DataType data_type, const std::vector<T>& values,
+                               uint32_t frame_number, std::vector<boost::shared_ptr<Frame> >& frames)
+{
+  dimensions_t dims;
+  FrameMetaData index_metadata(frame_number, name, data_type, "", dims);
+  frames.push_back(boost::shared_ptr<Frame>(
+    new DataBlockFrame(index_metadata, &values[0], values.size() * sizeof(T))
+  ));
+}
+
+XspressListModeColumn::XspressListModeColumn(const std::string& name, DataType data_type, size_t element_size) :
+  name_(name),
+  data_type_(data_type),
+  element_size_(element_size),
+  capacity_(0),
+  frame_count_(0)
+{
+}
+
+void XspressListModeColumn::allocate(uint32_t capacity)
+{
+  capacity_ = capacity;
+  dimensions_t dims;
+  FrameMetaData column_metadata(frame_count_, name_, data_type_, "", dims);
+  frame_ = boost::shared_ptr<Frame>(new DataBlockFrame(column_metadata, capacity_ * element_size_));
+}
+
+void XspressListModeColumn::reset_frame_count()
+{
+  frame_count_ = 0;
+}
+
+void *XspressListModeColumn::data_ptr()
+{
+  return frame_->get_data_ptr();
+}
+
+/**
+ * Hand off the column frame and start a new one.
+ *
+ * A full column is pushed as is, a partial column is copied into a frame of
+ * the filled size so that no padding is written.
+ *
+ * \param[in] count - number of values filled in the column.
+ * \return frame containing the column values.
+ */
+boost::shared_ptr <Frame> XspressListModeColumn::to_frame(uint32_t count)
+{
+  boost::shared_ptr <Frame> frame;
+  if (count == capacity_){
+    frame = frame_;
+    frame->set_frame_number(frame_count_);
+    this->allocate(capacity_);
+  } else {
+    dimensions_t dims;
+    FrameMetaData column_metadata(frame_count_, name_, data_type_, "", dims);
+    frame = boost::shared_ptr<Frame>(new DataBlockFrame(column_metadata, frame_->get_data_ptr(), count * element_size_));
+  }
+  frame_count_++;
+  return frame;
+}
+
+XspressListModeDecoder::XspressListModeDecoder() :
+  events_per_frame_(DEFAULT_EVENTS_PER_FRAME),
+  filled_events_(0),
+  events_decoded_(0),
+  index_entries_(0),
+  time_(EVENT_TIME_DATASET, raw_64bit, sizeof(uint64_t)),
+  energy_(EVENT_ENERGY_DATASET, raw_16bit, sizeof(uint16_t)),
+  channel_(EVENT_CHANNEL_DATASET, raw_8bit, sizeof(uint8_t)),
+  flags_(EVENT_FLAGS_DATASET, raw_8bit, sizeof(uint8_t)),
+  index_frame_count_(0)
+{
+  logger_ = Logger::getLogger("FP.XspressListModeProcessPlugin");
+  this->allocate();
+  this->reset();
+}
+
+XspressListModeDecoder::~XspressListModeDecoder()
+{
+}
+
+void XspressListModeDecoder::set_events_per_frame(uint32_t events)
+{
+  LOG4CXX_INFO(logger_, "Setting decoded events per frame to " << events);
+  events_per_frame_ = events;
+  this->allocate();
+}
+
+uint32_t XspressListModeDecoder::get_events_per_frame()
+{
+  return events_per_frame_;
+}
+
+void XspressListModeDecoder::allocate()
+{
+  time_.allocate(events_per_frame_);
+  energy_.allocate(events_per_frame_);
+  channel_.allocate(events_per_frame_);
+  flags_.allocate(events_per_frame_);
+  filled_events_ = 0;
+}
+
+/**
+ * Reset the decoder ready for a new acquisition.
+ */
+void XspressListModeDecoder::reset()
+{
+  filled_events_ = 0;
+  events_decoded_ = 0;
+  index_entries_ = 0;
+  index_frame_count_ = 0;
+  time_.reset_frame_count();
+  energy_.reset_frame_count();
+  channel_.reset_frame_count();
+  flags_.reset_frame_count();
+  for (int index = 0; index < XSP_HGT64_MAX_CHANNELS; index++){
+    last_frame_[index] = -1;
+  }
+  index_channel_.clear();
+  index_frame_.clear();
+  index_time_.clear();
+  index_offset_.clear();
+}
+
+/**
+ * Decode a single list mode packet.
+ *
+ * The first word of the packet is the header word, the remaining words are
+ * events. The inner loop has no branches so that the compiler can vectorise
+ * the field extraction across events.
+ *
+ * \param[in] words - pointer to the packet words.
+ * \param[in] num_words - number of words in the packet, including the header.
+ * \param[out] frames - vector to append any completed frames to.
+ */
+void XspressListModeDecoder::decode_packet(const uint64_t *words, uint32_t num_words,
+                                           std::vector<boost::shared_ptr<Frame> >& frames)
+{
+  if (num_words == 0){
+    return;
+  }
+
+  // Record a new index entry whenever the time frame changes for a channel
+  uint32_t hdr_chan = XSP_SOF_GET_CHAN(words[0]);
+  int64_t hdr_frame = XSP_SOF_GET_FRAME(words[0]);
+  if (last_frame_[hdr_chan] != hdr_frame){
+    last_frame_[hdr_chan] = hdr_frame;
+    index_channel_.push_back(hdr_chan);
+    index_frame_.push_back(hdr_frame);
+    index_time_.push_back(XSP_SOF_GET_PREV_TIME(words[0]));
+    index_offset_.push_back(events_decoded_);
+    index_entries_++;
+  }
+
+  const uint64_t *src = words + 1;
+  uint32_t remaining = num_words - 1;
+  while (remaining > 0){
+    uint32_t count = std::min(remaining, events_per_frame_ - filled_events_);
+
+    uint64_t *time = static_cast<uint64_t *>(time_.data_ptr()) + filled_events_;
+    uint16_t *energy = static_cast<uint16_t *>(energy_.data_ptr()) + filled_events_;
+    uint8_t *channel = static_cast<uint8_t *>(channel_.data_ptr()) + filled_events_;
+    uint8_t *flags = static_cast<uint8_t *>(flags_.data_ptr()) + filled_events_;
+    for (uint32_t index = 0; index < count; index++){
+      uint64_t word = src[index];
+      time[index] = XSP_HGT64_EVENT_GET_TIME(word);
+      energy[index] = XSP_HGT64_EVENT_GET_ENERGY(word);
+      channel[index] = XSP_HGT64_EVENT_GET_CHAN(word);
+      flags[index] = XSP_HGT64_EVENT_GET_FLAGS(word);
+    }
+
+    src += count;
+    remaining -= count;
+    filled_events_ += count;
+    events_decoded_ += count;
+
+    if (filled_events_ == events_per_frame_){
+      this->push_events(filled_events_, frames);
+    }
+  }
+}
+
+/**
+ * Push out any partially filled event columns and the outstanding index.
+ *
+ * \param[out] frames - vector to append the frames to.
+ */
+void XspressListModeDecoder::flush(std::vector<boost::shared_ptr<Frame> >& frames)
+{
+  if (filled_events_ > 0){
+    this->push_events(filled_events_, frames);
+  }
+  this->push_index(frames);
+}
+
+void XspressListModeDecoder::push_events(uint32_t count, std::vector<boost::shared_ptr<Frame> >& frames)
+{
+  LOG4CXX_DEBUG_LEVEL(1, logger_, "Pushing " << count << " decoded events");
+  frames.push_back(time_.to_frame(count));
+  frames.push_back(energy_.to_frame(count));
+  frames.push_back(channel_.to_frame(count));
+  frames.push_back(flags_.to_frame(count));
+  filled_events_ = 0;
+
+  // Send the index alongside each block of events so that it stays current
+  this->push_index(frames);
+}
+
+void XspressListModeDecoder::push_index(std::vector<boost::shared_ptr<Frame> >& frames)
+{
+  if (index_frame_.empty()){
+    return;
+  }
+  index_column_frame(INDEX_CHANNEL_DATASET, raw_8bit, index_channel_, index_frame_count_, frames);
+  index_column_frame(INDEX_FRAME_DATASET, raw_32bit, index_frame_, index_frame_count_, frames);
+  index_column_frame(INDEX_TIME_DATASET, raw_32bit, index_time_, index_frame_count_, frames);
+  index_column_frame(INDEX_OFFSET_DATASET, raw_64bit, index_offset_, index_frame_count_, frames);
+  index_frame_count_++;
+  index_channel_.clear();
+  index_frame_.clear();
+  index_time_.clear();
+  index_offset_.clear();
+}
+
+uint64_t XspressListModeDecoder::get_events_decoded()
+{
+  return events_decoded_;
+}
+
+uint64_t XspressListModeDecoder::get_index_entries()
+{
+  return index_entries_;
+}
+
+}
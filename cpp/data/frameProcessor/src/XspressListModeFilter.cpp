@@ -0,0 +1,53 @@
+#include "XspressListModeFilter.h"
+
+namespace FrameProcessor {
+
+#define XSP_FILTER_TIME_SHIFT 16
+#define XSP_FILTER_TIME_MASK  0xFFFFFFFFFFULL
+#define XSP_FILTER_PLANES     8
+
+/**
+ * Filter a block of list mode words into byte planes.
+ *
+ * \param[in] words - pointer to the words to filter.
+ * \param[out] planes - destination, must hold num_words * 8 bytes.
+ * \param[in] num_words - number of words in the block.
+ */
+void XspressListModeFilter::encode(const uint64_t *words, uint8_t *planes, size_t num_words)
+{
+  uint64_t prev_time = 0;
+  for (size_t index = 0; index < num_words; index++){
+    uint64_t word = words[index];
+    uint64_t time = (word >> XSP_FILTER_TIME_SHIFT) & XSP_FILTER_TIME_MASK;
+    uint64_t delta = (time - prev_time) & XSP_FILTER_TIME_MASK;
+    prev_time = time;
+    word = (word & ~(XSP_FILTER_TIME_MASK << XSP_FILTER_TIME_SHIFT)) | (delta << XSP_FILTER_TIME_SHIFT);
+    for (size_t plane = 0; plane < XSP_FILTER_PLANES; plane++){
+      planes[(plane * num_words) + index] = (uint8_t)(word >> (plane * 8));
+    }
+  }
+}
+
+/**
+ * Reverse XspressListModeFilter::encode.
+ *
+ * \param[in] planes - byte planes produced by encode.
+ * \param[out] words - destination for the restored words.
+ * \param[in] num_words - number of words in the block.
+ */
+void XspressListModeFilter::decode(const uint8_t *planes, uint64_t *words, size_t num_words)
+{
+  uint64_t prev_time = 0;
+  for (size_t index = 0; index < num_words; index++){
+    uint64_t word = 0;
+    for (size_t plane = 0; plane < XSP_FILTER_PLANES; plane++){
+      word |= ((uint64_t)planes[(plane * num_words) + index]) << (plane * 8);
+    }
+    uint64_t delta = (word >> XSP_FILTER_TIME_SHIFT) & XSP_FILTER_TIME_MASK;
+    uint64_t time = (prev_time + delta) & XSP_FILTER_TIME_MASK;
+    prev_time = time;
+    words[index] = (word & ~(XSP_FILTER_TIME_MASK << XSP_FILTER_TIME_SHIFT)) | (time << XSP_FILTER_TIME_SHIFT);
+  }
+}
+
+}
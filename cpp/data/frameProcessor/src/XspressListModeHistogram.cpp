@@ -0,0 +1,110 @@
+#include <string.h>
+#include "XspressListModeHistogram.h"
+
+namespace FrameProcessor {
+
+#define DEFAULT_HISTOGRAM_SHIFT 4
+
+/**
+ * Obtain the histogram bin of an event word, clamping to the last bin.
+ */
+static inline uint32_t energy_bin(uint64_t word, uint32_t shift)
+{
+  uint32_t bin = (uint32_t)(XSP_HGT64_EVENT_GET_ENERGY(word) >> shift);
+  return bin < XSP_HISTOGRAM_BINS ? bin : XSP_HISTOGRAM_BINS - 1;
+}
+
+XspressListModeHistogram::XspressListModeHistogram() :
+  bins_(XSP_HISTOGRAM_LANES * XSP_HISTOGRAM_BINS, 0),
+  shift_(DEFAULT_HISTOGRAM_SHIFT),
+  events_(0),
+  time_frame_(-1)
+{
+}
+
+XspressListModeHistogram::~XspressListModeHistogram()
+{
+}
+
+void XspressListModeHistogram::set_shift(uint32_t shift)
+{
+  shift_ = shift;
+}
+
+/**
+ * Reset the histogram ready for a new acquisition.
+ */
+void XspressListModeHistogram::reset()
+{
+  this->clear();
+  time_frame_ = -1;
+}
+
+/**
+ * Zero the bins, keeping the current time frame.
+ */
+void XspressListModeHistogram::clear()
+{
+  memset(&bins_[0], 0, bins_.size() * sizeof(uint32_t));
+  events_ = 0;
+}
+
+/**
+ * Bin a run of event words.
+ *
+ * Consecutive events are assigned to different sub histograms in turn.
+ *
+ * \param[in] words - pointer to the event words.
+ * \param[in] num_words - number of event words.
+ */
+void XspressListModeHistogram::add_events(const uint64_t *words, uint32_t num_words)
+{
+  uint32_t *lane0 = &bins_[0];
+  uint32_t *lane1 = lane0 + XSP_HISTOGRAM_BINS;
+  uint32_t *lane2 = lane1 + XSP_HISTOGRAM_BINS;
+  uint32_t *lane3 = lane2 + XSP_HISTOGRAM_BINS;
+  uint32_t index = 0;
+  for (; index + XSP_HISTOGRAM_LANES <= num_words; index += XSP_HISTOGRAM_LANES){
+    lane0[energy_bin(words[index], shift_)]++;
+    lane1[energy_bin(words[index + 1], shift_)]++;
+    lane2[energy_bin(words[index + 2], shift_)]++;
+    lane3[energy_bin(words[index + 3], shift_)]++;
+  }
+  for (; index < num_words; index++){
+    lane0[energy_bin(words[index], shift_)]++;
+  }
+  events_ += num_words;
+}
+
+/**
+ * Sum the sub histograms into a single spectrum.
+ *
+ * \param[out] spectrum - XSP_HISTOGRAM_BINS values to write the spectrum to.
+ */
+void XspressListModeHistogram::merge(uint32_t *spectrum)
+{
+  const uint32_t *lane0 = &bins_[0];
+  const uint32_t *lane1 = lane0 + XSP_HISTOGRAM_BINS;
+  const uint32_t *lane2 = lane1 + XSP_HISTOGRAM_BINS;
+  const uint32_t *lane3 = lane2 + XSP_HISTOGRAM_BINS;
+  for (uint32_t bin = 0; bin < XSP_HISTOGRAM_BINS; bin++){
+    spectrum[bin] = lane0[bin] + lane1[bin] + lane2[bin] + lane3[bin];
+  }
+}
+
+uint64_t XspressListModeHistogram::get_events()
+{
+  return events_;
+}
+
+int64_t XspressListModeHistogram::get_time_frame()
+{
+  return time_frame_;
+}
+
+void XspressListModeHistogram::set_time_frame(int64_t time_frame)
+{
+  time_frame_ = time_frame;
+}
+
+}
@@ -2,6 +2,7 @@
 // Created by hir12111 on 03/11/18.
 //
 #include <iostream>
+#include <algorithm>
 #include "DataBlockFrame.h"
 #include "XspressListModeProcessPlugin.h"
 #include "FrameProcessorDefinitions.h"
@@ -14,6 +15,31 @@ const std::string XspressListModeProcessPlugin::CONFIG_CHANNELS =           "cha
 const std::string XspressListModeProcessPlugin::CONFIG_RESET_ACQUISITION =  "reset";
 const std::string XspressListModeProcessPlugin::CONFIG_FLUSH_ACQUISITION =  "flush";
 const std::string XspressListModeProcessPlugin::CONFIG_FRAME_SIZE =         "frame_size";
+const std::string XspressListModeProcessPlugin::CONFIG_DECODE_ENABLE =      "decode/enable";
+const std::string XspressListModeProcessPlugin::CONFIG_DECODE_EVENTS =      "decode/events_per_frame";
+const std::string XspressListModeProcessPlugin::CONFIG_CHUNKING =           "chunking";
+const std::string XspressListModeProcessPlugin::CONFIG_FLUSH_TIMEOUT =      "flush_timeout";
+const std::string XspressListModeProcessPlugin::CONFIG_PREFILTER =          "prefilter";
+const std::string XspressListModeProcessPlugin::CONFIG_HISTOGRAM_MODE =     "histogram/mode";
+const std::string XspressListModeProcessPlugin::CONFIG_HISTOGRAM_INTERVAL = "histogram/interval";
+const std::string XspressListModeProcessPlugin::CONFIG_HISTOGRAM_SHIFT =    "histogram/shift";
+const std::string XspressListModeProcessPlugin::CONFIG_HISTOGRAM_WRITE =    "histogram/write";
+const std::string XspressListModeProcessPlugin::CONFIG_HISTOGRAM_LIVE_VIEW = "histogram/live_view";
+const std::string XspressListModeProcessPlugin::CONFIG_METRICS_PORT =       "metrics/port";
+const std::string XspressListModeProcessPlugin::CONFIG_METRICS_ADDRESS =    "metrics/address";
+
+const std::string CHUNKING_SIZE =           "size";
+const std::string CHUNKING_TIME_FRAME =     "time_frame";
+
+const std::string HISTOGRAM_MODE_OFF =      "off";
+const std::string HISTOGRAM_MODE_FRAME =    "frame";
+const std::string HISTOGRAM_MODE_INTERVAL = "interval";
+
+#define DEFAULT_HISTOGRAM_INTERVAL_MS 1000
+#define DEFAULT_HISTOGRAM_SHIFT 4
+
+// Interval at which the flush timer checks the age of partially filled blocks
+#define FLUSH_POLL_MS 100
 
 #define XSP3_10GTX_SOF 0x80000000
 #define XSP3_10GTX_EOF 0x40000000
@@ -27,25 +53,40 @@ const std::string XspressListModeProcessPlugin::CONFIG_FRAME_SIZE =         "fra
 
 #define XSP3_HGT64_MASK_END_OF_FRAME			(1L<<59)
 
-XspressListModeMemoryBlock::XspressListModeMemoryBlock(const std::string& name) :
+// Number of rows in each block of the time frame index, each row is (time frame, byte offset, length)
+#define XSP_LIST_INDEX_ROWS 256
+#define XSP_LIST_INDEX_ROW_ITEMS 3
+
+// Suffix of the dataset holding the byte length of each prefiltered raw_N frame
+#define XSP_LIST_LENGTHS_SUFFIX "_frames"
+// Frame parameter marking a raw_N frame as prefiltered
+#define XSP_LIST_PREFILTERED_PARAM "prefiltered"
+
+XspressListModeMemoryBlock::XspressListModeMemoryBlock(const std::string& name, const std::string& index_name) :
   ptr_(0),
   num_bytes_(0),
   num_words_(0),
   filled_size_(0),
-  frame_count_(0)
+  frame_count_(0),
+  bytes_written_(0),
+  fill_start_(boost::posix_time::not_a_date_time),
+  prefilter_(false),
+  lengths_block_count_(0),
+  time_frame_chunking_(false),
+  time_frame_(-1),
+  index_block_count_(0)
 {
   // Setup logging for the class
   logger_ = Logger::getLogger("FP.XspressListModeProcessPlugin");
   LOG4CXX_INFO(logger_, "Created XspressListModeMemoryBlock");
 
   name_ = name;
+  index_name_ = index_name;
+  lengths_name_ = name + XSP_LIST_LENGTHS_SUFFIX;
 }
 
 XspressListModeMemoryBlock::~XspressListModeMemoryBlock()
 {
-  if (ptr_){
-    free(ptr_);
-  }
 }
 
 void XspressListModeMemoryBlock::set_size(uint32_t bytes)
@@ -55,42 +96,188 @@ void XspressListModeMemoryBlock::set_size(uint32_t bytes)
   reallocate();
 }
 
+void XspressListModeMemoryBlock::set_time_frame_chunking(bool enable)
+{
+  time_frame_chunking_ = enable;
+}
+
+void XspressListModeMemoryBlock::set_prefilter(bool enable)
+{
+  prefilter_ = enable;
+}
+
 void XspressListModeMemoryBlock::reallocate()
 {
   LOG4CXX_INFO(logger_, "Reallocating XspressListModeMemoryBlock to [" << num_bytes_ << "] bytes");
-  if (ptr_){
-    free(ptr_);
+  frame_.reset();
+  spare_.reset();
+  next_frame();
+}
+
+/**
+ * Select the frame that subsequent packets are copied into.
+ *
+ * The spare frame is moved back into use if nothing downstream still holds a
+ * reference to it, otherwise it is left in place and a new frame is
+ * allocated. The contents are not cleared here, any unfilled tail is zeroed
+ * when the frame is handed off.
+ */
+void XspressListModeMemoryBlock::next_frame()
+{
+  if (spare_ && spare_.use_count() == 1){
+    frame_ = spare_;
+    spare_.reset();
+  } else {
+    dimensions_t dims;
+    FrameMetaData list_metadata(frame_count_, name_, raw_64bit, "", dims);
+    frame_ = boost::shared_ptr<Frame>(new DataBlockFrame(list_metadata, num_bytes_));
+  }
+  ptr_ = static_cast<char *>(frame_->get_data_ptr());
+  filled_size_ = 0;
+  fill_start_ = boost::posix_time::not_a_date_time;
+}
+
+/**
+ * Obtain a frame for the filtered output of a block.
+ *
+ * With the prefilter enabled the accumulation frame is never handed off,
+ * instead the filter writes into this frame. The spare frame is reused if it
+ * has the right size and has been released downstream.
+ *
+ * \param[in] bytes - size of the output frame.
+ * \return the output frame.
+ */
+boost::shared_ptr <Frame> XspressListModeMemoryBlock::output_frame(uint32_t bytes)
+{
+  boost::shared_ptr <Frame> frame;
+  if (spare_ && spare_.use_count() == 1 && spare_->get_data_size() == bytes){
+    frame = spare_;
+    frame->set_frame_number(frame_count_);
+  } else {
+    dimensions_t dims;
+    FrameMetaData list_metadata(frame_count_, name_, raw_64bit, "", dims);
+    frame = boost::shared_ptr<Frame>(new DataBlockFrame(list_metadata, bytes));
   }
-  ptr_ = (char *)malloc(num_bytes_);
-  reset();
+  return frame;
+}
+
+/**
+ * Record a frame produced by the prefilter.
+ *
+ * Each frame is filtered independently and timed flushes or time frame cuts
+ * make the frame sizes arbitrary, so the length of every frame is kept for
+ * raw_N_frames and the frame is marked as prefiltered.
+ *
+ * \param[in] frame - the filtered frame.
+ * \param[in] bytes - number of bytes in the frame.
+ */
+void XspressListModeMemoryBlock::filtered(boost::shared_ptr <Frame> frame, uint32_t bytes)
+{
+  frame->meta_data().set_parameter<uint32_t>(XSP_LIST_PREFILTERED_PARAM, 1);
+  frame_lengths_.push_back(bytes);
 }
 
 void XspressListModeMemoryBlock::reset()
 {
-  memset(ptr_, 0, num_bytes_);
   filled_size_ = 0;
+  fill_start_ = boost::posix_time::not_a_date_time;
+  time_frame_ = -1;
+  index_rows_.clear();
+  frame_lengths_.clear();
 }
 
 void XspressListModeMemoryBlock::reset_frame_count()
 {
   frame_count_ = 0;
+  bytes_written_ = 0;
+  index_block_count_ = 0;
+  lengths_block_count_ = 0;
+}
+
+uint32_t XspressListModeMemoryBlock::get_filled_size()
+{
+  return filled_size_;
+}
+
+/**
+ * Age of the data in the current block.
+ *
+ * \param[in] now - the current time.
+ * \return milliseconds since the first packet was copied in, or 0 if the block is empty.
+ */
+int64_t XspressListModeMemoryBlock::get_age_ms(boost::posix_time::ptime now)
+{
+  if (filled_size_ == 0 || fill_start_.is_special()){
+    return 0;
+  }
+  return (now - fill_start_).total_milliseconds();
+}
+
+/**
+ * Notify the block of the time frame of the next packet.
+ *
+ * With time frame chunking, a change of time frame cuts the current output
+ * frame (if it holds any data) and starts a new index row at the offset
+ * the next packet will be written to. The cut frame holds only the bytes
+ * received, so short time frames are not padded out to a full block.
+ *
+ * \param[in] time_frame - time frame from the header word of the packet.
+ * \return the completed frame if one was cut, otherwise an empty pointer.
+ */
+boost::shared_ptr <Frame> XspressListModeMemoryBlock::start_time_frame(uint32_t time_frame)
+{
+  boost::shared_ptr <Frame> frame;
+  if (!time_frame_chunking_ || time_frame_ == time_frame){
+    return frame;
+  }
+  if (filled_size_ > 0){
+    frame = this->flush();
+  }
+  time_frame_ = time_frame;
+  index_rows_.push_back(time_frame);
+  index_rows_.push_back(bytes_written_ + filled_size_);
+  index_rows_.push_back(0);
+  return frame;
+}
+
+/**
+ * Notify the block that the current time frame has ended (EOF marker).
+ *
+ * With time frame chunking the output frame is cut straight away rather than
+ * waiting for the first packet of the next time frame.
+ *
+ * \return the completed frame if one was cut, otherwise an empty pointer.
+ */
+boost::shared_ptr <Frame> XspressListModeMemoryBlock::end_time_frame()
+{
+  boost::shared_ptr <Frame> frame;
+  if (time_frame_chunking_ && filled_size_ > 0){
+    frame = this->flush();
+  }
+  time_frame_ = -1;
+  return frame;
 }
 
 boost::shared_ptr <Frame> XspressListModeMemoryBlock::add_block(uint32_t bytes, void *ptr)
 {
   boost::shared_ptr <Frame> frame;
 
-  // Calculate the current end of data pointer location
-  char *dest = (char *)ptr_;
-  dest += filled_size_;
   // Set the number of packet words as a 64bit variable
   uint64_t pkt_words = (uint64_t)(bytes / sizeof(uint64_t));
 
+  // Extend the index row of the current time frame by the bytes written
+  if (time_frame_chunking_ && !index_rows_.empty()){
+    index_rows_.back() += sizeof(uint64_t) + bytes;
+  }
+
   if (filled_size_ == num_bytes_){
     // Buffer is already full (this shouldn't really be possible but best to check)
     frame = this->to_frame();
   }
 
+  // Calculate the current end of data pointer location
+  char *dest = ptr_ + filled_size_;
+
   // Copy the number of words into the dataset
   memcpy(dest, &pkt_words, sizeof(uint64_t));
   dest += sizeof(uint64_t);
@@ -107,6 +294,7 @@ boost::shared_ptr <Frame> XspressListModeMemoryBlock::add_block(uint32_t bytes,
     uint32_t bytes_to_full = num_bytes_ - filled_size_;
     if (bytes_to_full > 0){
       memcpy(dest, ptr, bytes_to_full);
+      filled_size_ += bytes_to_full;
     }
 
     frame = this->to_frame();
@@ -114,10 +302,9 @@ boost::shared_ptr <Frame> XspressListModeMemoryBlock::add_block(uint32_t bytes,
     // Copy any remaining data
     uint32_t remaining_bytes = bytes - bytes_to_full;
     if (remaining_bytes > 0){
-      dest = (char *)ptr_;
       char *src = (char *)ptr;
       src += bytes_to_full;
-      memcpy(dest, src, remaining_bytes);
+      memcpy(ptr_, src, remaining_bytes);
       filled_size_ += remaining_bytes;
     }
   }
@@ -127,56 +314,182 @@ boost::shared_ptr <Frame> XspressListModeMemoryBlock::add_block(uint32_t bytes,
     frame = this->to_frame();
   }
 
+  // Start the age of the block from the first data copied into it
+  if (filled_size_ > 0 && fill_start_.is_special()){
+    fill_start_ = boost::posix_time::microsec_clock::local_time();
+  }
+
   return frame;
 }
 
 boost::shared_ptr <Frame> XspressListModeMemoryBlock::to_frame()
 {
-  boost::shared_ptr <Frame> frame;
+  boost::shared_ptr <Frame> frame = frame_;
 
-  // Create the frame around the current (partial) block
-  dimensions_t dims;
-  FrameMetaData list_metadata(frame_count_, name_, raw_64bit, "", dims);
-  frame = boost::shared_ptr<Frame>(new DataBlockFrame(list_metadata, num_bytes_));
-  memcpy(frame->get_data_ptr(), ptr_, num_bytes_);
+  // Zero any unfilled tail so a partial block is written out as before
+  if (filled_size_ < num_bytes_){
+    memset(ptr_ + filled_size_, 0, num_bytes_ - filled_size_);
+  }
+  frame->set_frame_number(frame_count_);
 
-  // Reset the block
-  reset();
+  if (prefilter_){
+    // Filter into a separate output frame and keep filling the same buffer
+    frame = this->output_frame(num_bytes_);
+    XspressListModeFilter::encode((const uint64_t *)ptr_, (uint8_t *)frame->get_data_ptr(), num_words_);
+    this->filtered(frame, num_bytes_);
+    spare_ = frame;
+    filled_size_ = 0;
+    fill_start_ = boost::posix_time::not_a_date_time;
+  } else {
+    // Switch to the other buffer, reusing the previously pushed frame if it
+    // has been released, then keep a reference to this frame so that it can
+    // be reused once it has been written
+    frame_.reset();
+    next_frame();
+    spare_ = frame;
+  }
 
   // Add 1 to the frame count
   frame_count_++;
+  bytes_written_ += num_bytes_;
+
+  return frame;
+}
+
+/**
+ * Create a frame from the accumulated time frame index rows.
+ *
+ * Rows are pushed in blocks of XSP_LIST_INDEX_ROWS with the outer chunk set
+ * to the number of rows, a partial block is only pushed when forced.
+ *
+ * \param[in] force - push any outstanding rows even if the block is not full.
+ * \return the index frame, or an empty pointer if there is nothing to push.
+ */
+boost::shared_ptr <Frame> XspressListModeMemoryBlock::index_to_frame(bool force)
+{
+  boost::shared_ptr <Frame> frame;
+  uint32_t num_rows = index_rows_.size() / XSP_LIST_INDEX_ROW_ITEMS;
+  // The last row may still be growing, so only complete rows are sent unless forced
+  uint32_t complete_rows = force ? num_rows : (num_rows > 0 ? num_rows - 1 : 0);
+  if (complete_rows == 0 || (!force && complete_rows < XSP_LIST_INDEX_ROWS)){
+    return frame;
+  }
+  uint32_t push_rows = std::min(complete_rows, (uint32_t)XSP_LIST_INDEX_ROWS);
 
+  dimensions_t dims;
+  dims.push_back(XSP_LIST_INDEX_ROW_ITEMS);
+  FrameMetaData index_metadata(index_block_count_, index_name_, raw_64bit, "", dims);
+  uint32_t push_items = push_rows * XSP_LIST_INDEX_ROW_ITEMS;
+  frame = boost::shared_ptr<Frame>(new DataBlockFrame(index_metadata, &index_rows_[0], push_items * sizeof(uint64_t)));
+  frame->set_outer_chunk_size(push_rows);
+  index_rows_.erase(index_rows_.begin(), index_rows_.begin() + push_items);
+  index_block_count_++;
   return frame;
 }
 
+/**
+ * Create a frame from the recorded lengths of the prefiltered frames.
+ *
+ * Lengths are pushed to raw_N_frames in blocks of XSP_LIST_INDEX_ROWS, a
+ * partial block is only pushed when forced.
+ *
+ * \param[in] force - push any outstanding lengths even if the block is not full.
+ * \return the lengths frame, or an empty pointer if there is nothing to push.
+ */
+boost::shared_ptr <Frame> XspressListModeMemoryBlock::lengths_to_frame(bool force)
+{
+  boost::shared_ptr <Frame> frame;
+  uint32_t num_rows = frame_lengths_.size();
+  if (num_rows == 0 || (!force && num_rows < XSP_LIST_INDEX_ROWS)){
+    return frame;
+  }
+  uint32_t push_rows = std::min(num_rows, (uint32_t)XSP_LIST_INDEX_ROWS);
+
+  dimensions_t dims;
+  FrameMetaData lengths_metadata(lengths_block_count_, lengths_name_, raw_64bit, "", dims);
+  frame = boost::shared_ptr<Frame>(new DataBlockFrame(lengths_metadata, &frame_lengths_[0], push_rows * sizeof(uint64_t)));
+  frame->set_outer_chunk_size(push_rows);
+  frame_lengths_.erase(frame_lengths_.begin(), frame_lengths_.begin() + push_rows);
+  lengths_block_count_++;
+  return frame;
+}
+
+/**
+ * Hand off the filled part of the current block and restart it.
+ *
+ * Only the filled bytes are copied out, so the frame has the size of the
+ * data actually received. The block then starts again from empty.
+ *
+ * \return the partial frame, or an empty pointer if the block is empty.
+ */
 boost::shared_ptr <Frame> XspressListModeMemoryBlock::flush()
 {
   boost::shared_ptr <Frame> frame;
+  if (filled_size_ == 0){
+    return frame;
+  }
 
   // Create the frame around the current (partial) block
   dimensions_t dims;
   FrameMetaData list_metadata(frame_count_, name_, raw_64bit, "", dims);
-  frame = boost::shared_ptr<Frame>(new DataBlockFrame(list_metadata, filled_size_));
-  memcpy(frame->get_data_ptr(), ptr_, filled_size_);
+  if (prefilter_){
+    frame = boost::shared_ptr<Frame>(new DataBlockFrame(list_metadata, filled_size_));
+    XspressListModeFilter::encode((const uint64_t *)ptr_, (uint8_t *)frame->get_data_ptr(),
+                                  filled_size_ / sizeof(uint64_t));
+    this->filtered(frame, filled_size_);
+  } else {
+    frame = boost::shared_ptr<Frame>(new DataBlockFrame(list_metadata, ptr_, filled_size_));
+  }
+
+  frame_count_++;
+  bytes_written_ += filled_size_;
+  filled_size_ = 0;
+  fill_start_ = boost::posix_time::not_a_date_time;
 
   return frame;
 }
 
 XspressListModeProcessPlugin::XspressListModeProcessPlugin() :
-  num_channels_(0)
+  num_channels_(0),
+  decode_enabled_(false),
+  chunking_policy_(CHUNKING_SIZE),
+  prefilter_(false),
+  flush_timeout_ms_(0),
+  timed_flushes_(0),
+  flush_running_(true),
+  histogram_mode_(HISTOGRAM_MODE_OFF),
+  histogram_interval_ms_(DEFAULT_HISTOGRAM_INTERVAL_MS),
+  histogram_shift_(DEFAULT_HISTOGRAM_SHIFT),
+  histogram_write_(false),
+  histogram_live_view_(""),
+  last_histogram_time_(boost::posix_time::min_date_time),
+  histogram_interval_count_(0),
+  histograms_emitted_(0),
+  frames_processed_(0),
+  metrics_address_(XSP_METRICS_DEFAULT_ADDRESS)
 {
   // Setup logging for the class
   logger_ = Logger::getLogger("FP.XspressListModeProcessPlugin");
   LOG4CXX_INFO(logger_, "XspressListModeProcessPlugin version " << this->get_version_long() << " loaded");
+
+  // Start the thread that pushes out blocks which have been partially filled for too long
+  flush_thread_ = boost::shared_ptr<boost::thread>(
+    new boost::thread(boost::bind(&XspressListModeProcessPlugin::flush_loop, this))
+  );
 }
 
 XspressListModeProcessPlugin::~XspressListModeProcessPlugin()
 {
   LOG4CXX_TRACE(logger_, "XspressListModeProcessPlugin destructor.");
+  flush_running_ = false;
+  flush_thread_->interrupt();
+  flush_thread_->join();
 }
 
 void XspressListModeProcessPlugin::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply) 
 {
+  boost::lock_guard<boost::mutex> lock(channel_mutex_);
+
   if (config.has_param(XspressListModeProcessPlugin::CONFIG_CHANNELS)){
     std::stringstream ss;
     ss << "Configure process plugin for channels [";
@@ -208,6 +521,129 @@ void XspressListModeProcessPlugin::configure(OdinData::IpcMessage& config, OdinD
     unsigned int frame_size = config.get_param<unsigned int>(XspressListModeProcessPlugin::CONFIG_FRAME_SIZE);
     this->set_frame_size(frame_size);
   }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_CHUNKING)){
+    std::string policy = config.get_param<std::string>(XspressListModeProcessPlugin::CONFIG_CHUNKING);
+    if (policy == CHUNKING_SIZE || policy == CHUNKING_TIME_FRAME){
+      chunking_policy_ = policy;
+      LOG4CXX_INFO(logger_, "Chunking policy set to " << chunking_policy_);
+      for (uint32_t channel = 0; channel < channel_table_.size(); channel++){
+        if (channel_table_[channel].active){
+          channel_table_[channel].block->set_time_frame_chunking(chunking_policy_ == CHUNKING_TIME_FRAME);
+        }
+      }
+    } else {
+      LOG4CXX_ERROR(logger_, "Invalid chunking policy requested: " << policy);
+    }
+  }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_PREFILTER)){
+    prefilter_ = config.get_param<bool>(XspressListModeProcessPlugin::CONFIG_PREFILTER);
+    LOG4CXX_INFO(logger_, "List mode prefilter " << (prefilter_ ? "enabled" : "disabled"));
+    for (uint32_t channel = 0; channel < channel_table_.size(); channel++){
+      if (channel_table_[channel].active){
+        channel_table_[channel].block->set_prefilter(prefilter_);
+      }
+    }
+  }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_FLUSH_TIMEOUT)){
+    flush_timeout_ms_ = config.get_param<uint32_t>(XspressListModeProcessPlugin::CONFIG_FLUSH_TIMEOUT);
+    LOG4CXX_INFO(logger_, "Partial block flush timeout set to " << flush_timeout_ms_ << " ms");
+  }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_DECODE_ENABLE)){
+    decode_enabled_ = config.get_param<bool>(XspressListModeProcessPlugin::CONFIG_DECODE_ENABLE);
+    LOG4CXX_INFO(logger_, "Event decoding " << (decode_enabled_ ? "enabled" : "disabled"));
+  }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_DECODE_EVENTS)){
+    uint32_t events = config.get_param<uint32_t>(XspressListModeProcessPlugin::CONFIG_DECODE_EVENTS);
+    if (events > 0){
+      decoder_.set_events_per_frame(events);
+    } else {
+      LOG4CXX_ERROR(logger_, "Decoded events per frame must be greater than zero");
+    }
+  }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_MODE)){
+    std::string mode = config.get_param<std::string>(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_MODE);
+    if (mode == HISTOGRAM_MODE_OFF || mode == HISTOGRAM_MODE_FRAME || mode == HISTOGRAM_MODE_INTERVAL){
+      histogram_mode_ = mode;
+      LOG4CXX_INFO(logger_, "Histogram mode set to " << histogram_mode_);
+    } else {
+      LOG4CXX_ERROR(logger_, "Invalid histogram mode requested: " << mode);
+    }
+  }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_INTERVAL)){
+    histogram_interval_ms_ = config.get_param<uint32_t>(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_INTERVAL);
+    LOG4CXX_INFO(logger_, "Histogram interval set to " << histogram_interval_ms_ << " ms");
+  }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_SHIFT)){
+    histogram_shift_ = config.get_param<uint32_t>(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_SHIFT);
+    for (uint32_t channel = 0; channel < channel_table_.size(); channel++){
+      if (channel_table_[channel].active){
+        channel_table_[channel].histogram->set_shift(histogram_shift_);
+      }
+    }
+  }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_WRITE)){
+    histogram_write_ = config.get_param<bool>(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_WRITE);
+  }
+
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_LIVE_VIEW)){
+    histogram_live_view_ = config.get_param<std::string>(XspressListModeProcessPlugin::CONFIG_HISTOGRAM_LIVE_VIEW);
+    LOG4CXX_INFO(logger_, "Histogram Live View destination name set to " << histogram_live_view_);
+  }
+
+  // Check for the OpenMetrics address, a change of address restarts the
+  // server on its current port
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_METRICS_ADDRESS)){
+    metrics_address_ = config.get_param<std::string>(XspressListModeProcessPlugin::CONFIG_METRICS_ADDRESS);
+  }
+
+  // Check for the OpenMetrics port, 0 stops serving metrics
+  if (config.has_param(XspressListModeProcessPlugin::CONFIG_METRICS_PORT) ||
+      config.has_param(XspressListModeProcessPlugin::CONFIG_METRICS_ADDRESS)){
+    int port = metrics_server_.get_port();
+    if (config.has_param(XspressListModeProcessPlugin::CONFIG_METRICS_PORT)){
+      port = config.get_param<int>(XspressListModeProcessPlugin::CONFIG_METRICS_PORT);
+    }
+    if (port > 0){
+      if (!metrics_server_.start(port, boost::bind(&XspressListModeProcessPlugin::render_metrics, this), metrics_address_)){
+        std::stringstream ss;
+        ss << "Could not serve metrics on " << metrics_address_ << ":" << port;
+        reply.set_nack(ss.str());
+      }
+    } else {
+      metrics_server_.stop();
+    }
+  }
+}
+
+/**
+ * Get the configuration values for this Plugin.
+ *
+ * \param[out] reply - Response IpcMessage.
+ */
+void XspressListModeProcessPlugin::requestConfiguration(OdinData::IpcMessage& reply)
+{
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_FRAME_SIZE, frame_size_bytes_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_CHUNKING, chunking_policy_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_FLUSH_TIMEOUT, flush_timeout_ms_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_PREFILTER, prefilter_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_DECODE_ENABLE, decode_enabled_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_DECODE_EVENTS, decoder_.get_events_per_frame());
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_HISTOGRAM_MODE, histogram_mode_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_HISTOGRAM_INTERVAL, histogram_interval_ms_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_HISTOGRAM_SHIFT, histogram_shift_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_HISTOGRAM_WRITE, histogram_write_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_HISTOGRAM_LIVE_VIEW, histogram_live_view_);
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_METRICS_PORT, metrics_server_.get_port());
+  reply.set_param(get_name() + "/" + XspressListModeProcessPlugin::CONFIG_METRICS_ADDRESS, metrics_address_);
 }
 
 // Version functions
@@ -247,24 +683,58 @@ void XspressListModeProcessPlugin::set_channels(std::vector<uint32_t> channels)
 void XspressListModeProcessPlugin::reset_acquisition()
 {
   LOG4CXX_INFO(logger_, "Resetting acquisition");
-  std::map<uint32_t, boost::shared_ptr<XspressListModeMemoryBlock> >::iterator iter;
-  for (iter = memory_ptrs_.begin(); iter != memory_ptrs_.end(); ++iter){
-    iter->second->reset_frame_count();
-    iter->second->reset();
+  std::vector<XspressListModeChannel>::iterator iter;
+  for (iter = channel_table_.begin(); iter != channel_table_.end(); ++iter){
+    if (iter->active){
+      iter->block->reset_frame_count();
+      iter->block->reset();
+      iter->histogram->reset();
+    }
   }
+  decoder_.reset();
+  histogram_interval_count_ = 0;
+  last_histogram_time_ = boost::posix_time::microsec_clock::local_time();
+  std::fill(histogram_live_.begin(), histogram_live_.end(), 0);
 }
 
 void XspressListModeProcessPlugin::flush_close_acquisition()
 {
   LOG4CXX_INFO(logger_, "Flushing and closing acquisition");
-  std::map<uint32_t, boost::shared_ptr<XspressListModeMemoryBlock> >::iterator iter;
-  for (iter = memory_ptrs_.begin(); iter != memory_ptrs_.end(); ++iter){
-    LOG4CXX_DEBUG_LEVEL(0, logger_, "Flushing frame for channel " << iter->first);
-    boost::shared_ptr <Frame> list_frame = iter->second->to_frame();
-    if (list_frame){
-      this->push(list_frame);
+  for (uint32_t channel = 0; channel < channel_table_.size(); channel++){
+    if (channel_table_[channel].active){
+      LOG4CXX_DEBUG_LEVEL(0, logger_, "Flushing frame for channel " << channel);
+      boost::shared_ptr <Frame> list_frame = channel_table_[channel].block->to_frame();
+      if (list_frame){
+        this->push(list_frame);
+      }
+      boost::shared_ptr <Frame> index_frame = channel_table_[channel].block->index_to_frame(true);
+      if (index_frame){
+        this->push(index_frame);
+      }
+      // Push every outstanding length, a forced push sends at most one block
+      boost::shared_ptr <Frame> lengths_frame = channel_table_[channel].block->lengths_to_frame(true);
+      while (lengths_frame){
+        this->push(lengths_frame);
+        lengths_frame = channel_table_[channel].block->lengths_to_frame(true);
+      }
     }
   }
+  if (decode_enabled_){
+    decoder_.flush(decoded_frames_);
+    this->push_decoded(decoded_frames_);
+  }
+  // Send out the spectra of the final, partially binned time frame or interval
+  if (histogram_mode_ == HISTOGRAM_MODE_FRAME){
+    for (uint32_t channel = 0; channel < channel_table_.size(); channel++){
+      XspressListModeChannel& chan_state = channel_table_[channel];
+      if (chan_state.active && chan_state.histogram->get_time_frame() >= 0){
+        this->emit_histogram(channel, chan_state.histogram->get_time_frame());
+      }
+    }
+    this->push_histogram_live_view(0);
+  } else if (histogram_mode_ == HISTOGRAM_MODE_INTERVAL){
+    this->emit_all_histograms(histogram_interval_count_++);
+  }
   this->notify_end_of_acquisition();
 }
 
@@ -278,21 +748,161 @@ void XspressListModeProcessPlugin::set_frame_size(uint32_t num_bytes)
 
 void XspressListModeProcessPlugin::setup_memory_allocation()
 {
-  // First clear out the memory vector emptying any blocks
-  memory_ptrs_.clear();
+  // First clear out the channel table emptying any blocks
+  channel_table_.clear();
+
+  // Size the table so that it can be indexed directly by the highest channel
+  std::vector<uint32_t>::iterator iter;
+  uint32_t table_size = 0;
+  for (iter = channels_.begin(); iter != channels_.end(); ++iter){
+    table_size = std::max(table_size, *iter + 1);
+  }
+  channel_table_.resize(table_size);
 
   // Allocate large enough blocks of memory to hold list mode frames
   // Allocate one block of memory for each channel
-  std::vector<uint32_t>::iterator iter;
   for (iter = channels_.begin(); iter != channels_.end(); ++iter){
     std::stringstream ss;
     ss << "raw_" << *iter;
-    boost::shared_ptr<XspressListModeMemoryBlock> ptr = boost::shared_ptr<XspressListModeMemoryBlock>(new XspressListModeMemoryBlock(ss.str()));
+    std::stringstream index_ss;
+    index_ss << "index_" << *iter;
+    boost::shared_ptr<XspressListModeMemoryBlock> ptr = boost::shared_ptr<XspressListModeMemoryBlock>(
+      new XspressListModeMemoryBlock(ss.str(), index_ss.str())
+    );
     ptr->set_size(frame_size_bytes_);
-    memory_ptrs_[*iter] = ptr;
-    // Setup the storage vectors for the packet header information
-    std::vector<uint32_t> hdr(3, 0);
-    packet_headers_[*iter] = hdr;
+    ptr->set_time_frame_chunking(chunking_policy_ == CHUNKING_TIME_FRAME);
+    ptr->set_prefilter(prefilter_);
+    channel_table_[*iter].block = ptr;
+    channel_table_[*iter].histogram = boost::shared_ptr<XspressListModeHistogram>(new XspressListModeHistogram());
+    channel_table_[*iter].histogram->set_shift(histogram_shift_);
+    channel_table_[*iter].position = iter - channels_.begin();
+    channel_table_[*iter].active = true;
+  }
+  histogram_live_.assign(channels_.size() * XSP_HISTOGRAM_BINS, 0);
+}
+
+/**
+ * Push any frames produced by the event decoder and clear the vector.
+ *
+ * \param[in] frames - decoded frames to push.
+ */
+void XspressListModeProcessPlugin::push_decoded(std::vector<boost::shared_ptr<Frame> >& frames)
+{
+  std::vector<boost::shared_ptr<Frame> >::iterator iter;
+  for (iter = frames.begin(); iter != frames.end(); ++iter){
+    this->push(*iter);
+  }
+  frames.clear();
+}
+
+/**
+ * Read out the spectrum of a channel, then clear it for the next time frame
+ * or interval.
+ *
+ * The spectrum is written as an mca_N frame if enabled and is kept as the
+ * latest spectrum of the channel for the live view.
+ *
+ * \param[in] channel - channel number.
+ * \param[in] frame_number - frame number of the spectrum.
+ */
+void XspressListModeProcessPlugin::emit_histogram(uint32_t channel, uint32_t frame_number)
+{
+  XspressListModeChannel& chan_state = channel_table_[channel];
+  uint32_t *spectrum = &histogram_live_[chan_state.position * XSP_HISTOGRAM_BINS];
+  chan_state.histogram->merge(spectrum);
+  LOG4CXX_DEBUG_LEVEL(2, logger_, "Histogram for channel " << channel << " frame " << frame_number
+                      << " contains " << chan_state.histogram->get_events() << " events");
+  chan_state.histogram->clear();
+  histograms_emitted_++;
+
+  if (histogram_write_){
+    std::stringstream ss;
+    ss << "mca_" << channel;
+    dimensions_t dims;
+    dims.push_back(1);
+    dims.push_back(XSP_HISTOGRAM_BINS);
+    FrameMetaData mca_metadata(frame_number, ss.str(), raw_32bit, "", dims);
+    boost::shared_ptr<Frame> mca_frame(
+      new DataBlockFrame(mca_metadata, spectrum, XSP_HISTOGRAM_BINS * sizeof(uint32_t))
+    );
+    this->push(mca_frame);
+  }
+}
+
+/**
+ * Read out the spectra of all channels for the current interval.
+ *
+ * \param[in] frame_number - frame number of the spectra.
+ */
+void XspressListModeProcessPlugin::emit_all_histograms(uint32_t frame_number)
+{
+  for (uint32_t channel = 0; channel < channel_table_.size(); channel++){
+    if (channel_table_[channel].active){
+      this->emit_histogram(channel, frame_number);
+    }
+  }
+  this->push_histogram_live_view(frame_number);
+}
+
+/**
+ * Publish the latest spectrum of every channel to the live view.
+ *
+ * \param[in] frame_number - frame number of the live view frame.
+ */
+void XspressListModeProcessPlugin::push_histogram_live_view(uint32_t frame_number)
+{
+  if (histogram_live_view_ == "" || histogram_live_.empty()){
+    return;
+  }
+  dimensions_t live_dims;
+  live_dims.push_back(num_channels_);
+  live_dims.push_back(1);
+  live_dims.push_back(XSP_HISTOGRAM_BINS);
+  FrameMetaData live_metadata(frame_number, "live", raw_32bit, "", live_dims);
+  boost::shared_ptr<Frame> live_frame(
+    new DataBlockFrame(live_metadata, &histogram_live_[0], histogram_live_.size() * sizeof(uint32_t))
+  );
+  this->push(histogram_live_view_, live_frame);
+}
+
+/**
+ * Flush timer thread, periodically pushes out aged partial blocks.
+ */
+void XspressListModeProcessPlugin::flush_loop()
+{
+  while (flush_running_){
+    try {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(FLUSH_POLL_MS));
+    } catch (boost::thread_interrupted&){
+      break;
+    }
+    boost::lock_guard<boost::mutex> lock(channel_mutex_);
+    if (flush_timeout_ms_ > 0){
+      this->flush_aged_blocks(boost::posix_time::microsec_clock::local_time());
+    }
+  }
+}
+
+/**
+ * Push out any block holding data older than the flush timeout.
+ *
+ * Must be called with the channel mutex held.
+ *
+ * \param[in] now - the current time.
+ */
+void XspressListModeProcessPlugin::flush_aged_blocks(boost::posix_time::ptime now)
+{
+  for (uint32_t channel = 0; channel < channel_table_.size(); channel++){
+    XspressListModeChannel& chan_state = channel_table_[channel];
+    if (chan_state.active && chan_state.block->get_age_ms(now) >= flush_timeout_ms_){
+      boost::shared_ptr <Frame> list_frame = chan_state.block->flush();
+      if (list_frame){
+        LOG4CXX_DEBUG_LEVEL(1, logger_, "Flushing partial block of " << list_frame->get_data_size()
+                            << " bytes for channel " << channel);
+        this->push(list_frame);
+        timed_flushes_++;
+      }
+    }
   }
 }
 
@@ -303,19 +913,37 @@ void XspressListModeProcessPlugin::setup_memory_allocation()
  */
 void XspressListModeProcessPlugin::status(OdinData::IpcMessage& status)
 {
-  std::map<uint32_t, std::vector<uint32_t> >::iterator iter;
-  for (iter = packet_headers_.begin(); iter != packet_headers_.end(); ++iter){
-    std::stringstream ss;
-    ss << "channel_" << iter->first;
-    std::vector<uint32_t> hdr = iter->second;
-    for (int index = 0; index < hdr.size(); index++){
-      status.set_param(get_name() + "/" + ss.str() + "[]", hdr[index]);
+  boost::lock_guard<boost::mutex> lock(channel_mutex_);
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
+  for (uint32_t channel = 0; channel < channel_table_.size(); channel++){
+    if (channel_table_[channel].active){
+      std::stringstream ss;
+      ss << get_name() << "/channel_" << channel << "[]";
+      const XspressListModeHeader& hdr = channel_table_[channel].header;
+      status.set_param(ss.str(), hdr.frame);
+      status.set_param(ss.str(), hdr.prev_time);
+      status.set_param(ss.str(), hdr.chan);
+    }
+  }
+  status.set_param(get_name() + "/decode/events", decoder_.get_events_decoded());
+  status.set_param(get_name() + "/decode/index_entries", decoder_.get_index_entries());
+  status.set_param(get_name() + "/histogram/emitted", histograms_emitted_);
+
+  // Report how full and how old each partially filled block is
+  for (uint32_t channel = 0; channel < channel_table_.size(); channel++){
+    if (channel_table_[channel].active){
+      status.set_param(get_name() + "/flush/fill[]", channel_table_[channel].block->get_filled_size());
+      status.set_param(get_name() + "/flush/age_ms[]", channel_table_[channel].block->get_age_ms(now));
     }
   }
+  status.set_param(get_name() + "/flush/timed_flushes", timed_flushes_);
 }
 
 void XspressListModeProcessPlugin::process_frame(boost::shared_ptr <Frame> frame) 
 {
+  boost::lock_guard<boost::mutex> lock(channel_mutex_);
+  boost::posix_time::ptime process_start = boost::posix_time::microsec_clock::local_time();
+
   char* frame_bytes = static_cast<char *>(frame->get_data_ptr());	
   Xspress::ListFrameHeader *header = reinterpret_cast<Xspress::ListFrameHeader *>(frame_bytes);
 
@@ -327,7 +955,7 @@ void XspressListModeProcessPlugin::process_frame(boost::shared_ptr <Frame> frame
 
     // Obtain the packet size and the channel number
     uint32_t pkt_size = header->packet_headers[packet_index].packet_size;
-    uint32_t channel = header->packet_headers[packet_index].channel;
+    uint64_t channel = header->packet_headers[packet_index].channel;
 
     LOG4CXX_DEBUG_LEVEL(3, logger_, "Received " << pkt_size << " bytes from channel " << channel);
 
@@ -339,14 +967,21 @@ void XspressListModeProcessPlugin::process_frame(boost::shared_ptr <Frame> frame
     << " PREV_TIME: " << std::dec << XSP3_HGT64_SOF_GET_PREV_TIME(peek_ptr[0])
     << " CHAN: " << std::dec << XSP3_HGT64_SOF_GET_CHAN(peek_ptr[0]));
 
-    if (packet_headers_.count(channel) > 0){
-      packet_headers_[channel].clear();
-      packet_headers_[channel].push_back(XSP3_HGT64_SOF_GET_FRAME(peek_ptr[0]));
-      packet_headers_[channel].push_back(XSP3_HGT64_SOF_GET_PREV_TIME(peek_ptr[0]));
-      packet_headers_[channel].push_back(XSP3_HGT64_SOF_GET_CHAN(peek_ptr[0]));
+    if (channel < channel_table_.size() && channel_table_[channel].active){
+      XspressListModeChannel& chan_state = channel_table_[channel];
+      chan_state.header.frame = XSP3_HGT64_SOF_GET_FRAME(peek_ptr[0]);
+      chan_state.header.prev_time = XSP3_HGT64_SOF_GET_PREV_TIME(peek_ptr[0]);
+      chan_state.header.chan = XSP3_HGT64_SOF_GET_CHAN(peek_ptr[0]);
+
+      // Cut the output at time frame boundaries if required
+      boost::shared_ptr <Frame> list_frame = chan_state.block->start_time_frame(chan_state.header.frame);
+      if (list_frame){
+        LOG4CXX_DEBUG_LEVEL(1, logger_, "Time frame boundary for channel " << channel << ", pushing");
+        this->push(list_frame);
+      }
 
       // Place the bytes into the store
-      boost::shared_ptr <Frame> list_frame = (memory_ptrs_[channel])->add_block(pkt_size, data_ptr);
+      list_frame = chan_state.block->add_block(pkt_size, data_ptr);
 
       if (list_frame){
         LOG4CXX_DEBUG_LEVEL(1, logger_, "Completed frame for channel " << channel << ", pushing");
@@ -354,14 +989,84 @@ void XspressListModeProcessPlugin::process_frame(boost::shared_ptr <Frame> frame
         this->push(list_frame);
       }
 
+      if (decode_enabled_){
+        decoder_.decode_packet(peek_ptr, pkt_size / sizeof(uint64_t), decoded_frames_);
+        if (!decoded_frames_.empty()){
+          this->push_decoded(decoded_frames_);
+        }
+      }
+
+      if (histogram_mode_ != HISTOGRAM_MODE_OFF && pkt_size >= sizeof(uint64_t)){
+        XspressListModeHistogram& histogram = *chan_state.histogram;
+        if (histogram_mode_ == HISTOGRAM_MODE_FRAME && histogram.get_time_frame() != chan_state.header.frame){
+          // A new time frame has started on this channel, send out the previous one
+          if (histogram.get_time_frame() >= 0){
+            this->emit_histogram(channel, histogram.get_time_frame());
+            if (chan_state.position == 0){
+              this->push_histogram_live_view(histogram.get_time_frame());
+            }
+          }
+          histogram.set_time_frame(chan_state.header.frame);
+        }
+        histogram.add_events(peek_ptr + 1, (pkt_size / sizeof(uint64_t)) - 1);
+      }
+
       if ((XSP3_HGT64_MASK_END_OF_FRAME&peek_ptr[0]) == XSP3_HGT64_MASK_END_OF_FRAME){
         LOG4CXX_DEBUG_LEVEL(1, logger_, " Ch: " << channel << " EOF marker registered");
+        list_frame = chan_state.block->end_time_frame();
+        if (list_frame){
+          this->push(list_frame);
+        }
+      }
+
+      // Send out any completed blocks of the time frame index
+      boost::shared_ptr <Frame> index_frame = chan_state.block->index_to_frame(false);
+      if (index_frame){
+        this->push(index_frame);
+      }
+
+      // Send out any completed blocks of prefiltered frame lengths
+      boost::shared_ptr <Frame> lengths_frame = chan_state.block->lengths_to_frame(false);
+      if (lengths_frame){
+        this->push(lengths_frame);
       }
 
     } else {
       LOG4CXX_ERROR(logger_, "Bad channel, this plugin is not set up for channel " << channel);
     }
   }
+
+  if (histogram_mode_ == HISTOGRAM_MODE_INTERVAL){
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
+    if ((now - last_histogram_time_).total_milliseconds() >= histogram_interval_ms_){
+      this->emit_all_histograms(histogram_interval_count_++);
+      last_histogram_time_ = now;
+    }
+  }
+
+  frames_processed_++;
+  process_latency_.observe((boost::posix_time::microsec_clock::local_time() - process_start).total_microseconds() / 1000000.0);
+}
+
+/**
+ * Render the OpenMetrics text for this plugin.
+ *
+ * Called from the metrics server thread, the channel lock is held so that the
+ * counters are consistent with each other.
+ *
+ * \return OpenMetrics text exposition.
+ */
+std::string XspressListModeProcessPlugin::render_metrics()
+{
+  boost::lock_guard<boost::mutex> lock(channel_mutex_);
+  Xspress::XspressMetricsWriter writer("xspress_fp_list_");
+  writer.counter("frames_processed", "List mode frames processed", frames_processed_);
+  writer.counter("events_decoded", "Events decoded into columnar datasets", decoder_.get_events_decoded());
+  writer.counter("index_entries", "Time frame index entries written by the decoder", decoder_.get_index_entries());
+  writer.counter("histograms_emitted", "Histogram frames pushed", histograms_emitted_);
+  writer.counter("timed_flushes", "Blocks pushed by the flush timeout", timed_flushes_);
+  writer.histogram("process_seconds", "Time taken to process each list mode frame", process_latency_);
+  return writer.str();
 }
 
 }
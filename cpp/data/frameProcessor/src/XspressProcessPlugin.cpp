@@ -3,6 +3,8 @@
 //
 #include <iostream>
 #include <string>
+#include <algorithm>
+#include <limits>
 #include "DataBlockFrame.h"
 #include "XspressProcessPlugin.h"
 #include "FrameProcessorDefinitions.h"
@@ -12,6 +14,8 @@
 #define MAX_SCALAR_MEM_BLOCK_SIZE 4096
 #define DEFAULT_SCALAR_QTY 9
 #define SCALAR_POST_TIME_MS 1000
+#define DEFAULT_REORDER_WINDOW 2
+#define DEFAULT_BLOCK_TIMEOUT_MS 0
 
 namespace FrameProcessor {
 
@@ -22,6 +26,11 @@ const std::string XspressProcessPlugin::CONFIG_PROCESS_NUMBER       = "number";
 const std::string XspressProcessPlugin::CONFIG_PROCESS_RANK         = "rank";
 
 const std::string XspressProcessPlugin::CONFIG_LIVE_VIEW_NAME       = "live_view";
+const std::string XspressProcessPlugin::CONFIG_LIVE_MODE            = "live/mode";
+const std::string XspressProcessPlugin::CONFIG_LIVE_EVERY           = "live/every";
+const std::string XspressProcessPlugin::CONFIG_LIVE_RATE            = "live/rate";
+const std::string XspressProcessPlugin::CONFIG_LIVE_REBIN           = "live/rebin";
+const std::string XspressProcessPlugin::CONFIG_LIVE_SUM_AUX         = "live/sum_aux";
 
 const std::string XspressProcessPlugin::CONFIG_FRAMES               = "frames";
 const std::string XspressProcessPlugin::CONFIG_DTC_FLAGS            = "dtc/flags";
@@ -29,11 +38,188 @@ const std::string XspressProcessPlugin::CONFIG_DTC_PARAMS           = "dtc/param
 
 const std::string XspressProcessPlugin::CONFIG_CHUNK                = "chunks";
 
+const std::string XspressProcessPlugin::CONFIG_SUM_ENABLE           = "sum/enable";
+const std::string XspressProcessPlugin::CONFIG_SUM_DTC              = "sum/dtc";
+const std::string XspressProcessPlugin::CONFIG_SUM_LIVE_VIEW        = "sum/live_view";
+
+const std::string XspressProcessPlugin::CONFIG_REORDER_WINDOW       = "reorder/window";
+const std::string XspressProcessPlugin::CONFIG_BLOCK_TIMEOUT        = "reorder/timeout";
+
+const std::string XspressProcessPlugin::CONFIG_PACKING_TYPE         = "packing/type";
+
+const std::string XspressProcessPlugin::CONFIG_ROLL_FRAMES          = "roll/frames";
+
+const std::string XspressProcessPlugin::CONFIG_METRICS_PORT         = "metrics/port";
+const std::string XspressProcessPlugin::CONFIG_METRICS_ADDRESS      = "metrics/address";
+
 const std::string META_NAME = "xspress";
 const std::string META_XSPRESS_CHUNK = "xspress_meta_chunk";
-const std::string META_XSPRESS_SCALARS = "xspress_scalars";
-const std::string META_XSPRESS_DTC = "xspress_dtc";
-const std::string META_XSPRESS_INP_EST = "xspress_inp_est";
+const std::string META_XSPRESS_BLOCK = "xspress_meta_block";
+
+const std::string LIVE_MODE_ALL = "all";
+const std::string LIVE_MODE_EVERY = "every";
+const std::string LIVE_MODE_RATE = "rate";
+const std::string LIVE_MODE_ACCUMULATE = "accumulate";
+
+const std::string SUM_DATASET_NAME = "mca_sum";
+const std::string OVERFLOW_DATASET_SUFFIX = "_overflow";
+const std::string SUM_LIVE_DATASET_NAME = "live_sum";
+
+const std::string SCAN_SPECTRA_DATASET_NAME = "scan_spectra";
+const std::string SCAN_FRAME_COUNTS_DATASET_NAME = "scan_frame_counts";
+const std::string SCAN_COUNT_MIN_DATASET_NAME = "scan_count_min";
+const std::string SCAN_COUNT_MAX_DATASET_NAME = "scan_count_max";
+const std::string SCAN_COUNT_MEAN_DATASET_NAME = "scan_count_mean";
+
+const std::string PACKING_TYPE_UINT32 = "uint32";
+const std::string PACKING_TYPE_UINT16 = "uint16";
+const std::string PACKING_TYPE_UINT8 = "uint8";
+
+/**
+ * Add spectra into a reduced live view spectrum, combining rebin adjacent
+ * energy bins and optionally summing all aux values of each channel.
+ *
+ * \param[in] src - pointer to num_channels * num_aux spectra.
+ * \param[in] num_channels - number of channels.
+ * \param[in] num_aux - number of aux values for each channel.
+ * \param[in] num_energy_bins - number of energy bins in each spectrum.
+ * \param[in] rebin - number of energy bins to combine.
+ * \param[in] sum_aux - sum all aux values of a channel together.
+ * \param[in,out] dest - reduced spectra, values are added to the existing contents.
+ */
+static void reduce_live_spectra(const uint32_t *src, uint32_t num_channels, uint32_t num_aux, uint32_t num_energy_bins,
+                                uint32_t rebin, bool sum_aux, uint32_t *dest)
+{
+  uint32_t out_aux = sum_aux ? 1 : num_aux;
+  uint32_t out_bins = (num_energy_bins + rebin - 1) / rebin;
+  for (uint32_t channel = 0; channel < num_channels; channel++){
+    for (uint32_t aux = 0; aux < num_aux; aux++){
+      const uint32_t *spectrum = src + (((channel * num_aux) + aux) * num_energy_bins);
+      uint32_t *out = dest + (((channel * out_aux) + (sum_aux ? 0 : aux)) * out_bins);
+      if (rebin == 1){
+        for (uint32_t bin = 0; bin < num_energy_bins; bin++){
+          out[bin] += spectrum[bin];
+        }
+      } else {
+        for (uint32_t bin = 0; bin < num_energy_bins; bin++){
+          out[bin / rebin] += spectrum[bin];
+        }
+      }
+    }
+  }
+}
+
+/**
+ * Sum the spectra of consecutive channels into a single spectrum.
+ *
+ * The inner loop is kept free of branches and aliasing so that the compiler
+ * vectorises the reduction.
+ *
+ * \param[in] src - pointer to num_channels spectra, each of length values.
+ * \param[in] num_channels - number of spectra to sum.
+ * \param[in] length - number of values in each spectrum.
+ * \param[out] dest - the summed spectrum.
+ */
+static void reduce_channels(const uint32_t *src, uint32_t num_channels, uint32_t length, uint32_t * __restrict__ dest)
+{
+  memset(dest, 0, length * sizeof(uint32_t));
+  for (uint32_t channel = 0; channel < num_channels; channel++){
+    const uint32_t * __restrict__ spectrum = src + (channel * length);
+    for (uint32_t index = 0; index < length; index++){
+      dest[index] += spectrum[index];
+    }
+  }
+}
+
+/**
+ * Sum the spectra of consecutive channels into a single spectrum, weighting
+ * each channel by its dead time correction factor.
+ *
+ * \param[in] src - pointer to num_channels spectra, each of length values.
+ * \param[in] dtc - dead time correction factor for each channel.
+ * \param[in] num_channels - number of spectra to sum.
+ * \param[in] length - number of values in each spectrum.
+ * \param[out] dest - the corrected summed spectrum.
+ */
+static void reduce_channels_dtc(const uint32_t *src, const double *dtc, uint32_t num_channels, uint32_t length, float * __restrict__ dest)
+{
+  memset(dest, 0, length * sizeof(float));
+  for (uint32_t channel = 0; channel < num_channels; channel++){
+    const uint32_t * __restrict__ spectrum = src + (channel * length);
+    const float factor = (float)dtc[channel];
+    for (uint32_t index = 0; index < length; index++){
+      dest[index] += factor * (float)spectrum[index];
+    }
+  }
+}
+
+/**
+ * Add a spectrum into a running total and return the sum of its values.
+ *
+ * \param[in] src - pointer to the spectrum.
+ * \param[in] length - number of values in the spectrum.
+ * \param[in,out] total - running total spectrum, values are added to the existing contents.
+ * \return the sum of the spectrum values.
+ */
+static uint64_t accumulate_spectrum(const uint32_t *src, uint32_t length, uint64_t * __restrict__ total)
+{
+  uint64_t counts = 0;
+  for (uint32_t index = 0; index < length; index++){
+    total[index] += src[index];
+    counts += src[index];
+  }
+  return counts;
+}
+
+/**
+ * Find the largest value in an array.
+ *
+ * Written as a plain max-reduction so that the compiler vectorises it.
+ *
+ * \param[in] src - pointer to the values.
+ * \param[in] length - number of values.
+ * \return the largest value.
+ */
+static uint32_t max_value(const uint32_t *src, uint32_t length)
+{
+  uint32_t result = 0;
+  for (uint32_t index = 0; index < length; index++){
+    result = src[index] > result ? src[index] : result;
+  }
+  return result;
+}
+
+/**
+ * Narrow values into a smaller unsigned type. Every value must fit the type.
+ *
+ * \param[in] src - pointer to the values.
+ * \param[in] length - number of values.
+ * \param[out] dest - the narrowed values.
+ */
+template<typename T>
+static void narrow_values(const uint32_t *src, uint32_t length, T * __restrict__ dest)
+{
+  for (uint32_t index = 0; index < length; index++){
+    dest[index] = (T)src[index];
+  }
+}
+
+/**
+ * Count the values that are larger than a limit.
+ *
+ * \param[in] src - pointer to the values.
+ * \param[in] length - number of values.
+ * \param[in] limit - largest value that is not counted.
+ * \return the number of values above the limit.
+ */
+static uint32_t count_above(const uint32_t *src, uint32_t length, uint32_t limit)
+{
+  uint32_t count = 0;
+  for (uint32_t index = 0; index < length; index++){
+    count += src[index] > limit;
+  }
+  return count;
+}
 
 XspressMemoryBlock::XspressMemoryBlock() :
   ptr_(0),
@@ -89,7 +275,7 @@ void XspressMemoryBlock::add_frame(uint32_t frame_id, char *ptr)
   dest += (frame_offset * frame_size_);
   memcpy(dest, ptr, frame_size_);
   frames_ += 1;
-  filled_size_ = (frame_offset+1) * frame_size_;
+  filled_size_ = std::max(filled_size_, (frame_offset+1) * frame_size_);
 //  LOG4CXX_INFO(logger_, "Frames [" << frames_ << " / " << max_frames_ << "]");
 }
 
@@ -118,11 +304,187 @@ uint32_t XspressMemoryBlock::current_byte_size()
   return filled_size_;
 }
 
+uint32_t XspressMemoryBlock::frame_size()
+{
+  return frame_size_;
+}
+
 char *XspressMemoryBlock::get_data_ptr()
 {
   return ptr_;
 }
 
+XspressBlockSet::XspressBlockSet() :
+  block_index_(0),
+  first_frame_(0),
+  expected_frames_(0),
+  frames_received_(0),
+  max_frames_(0),
+  num_channels_(0),
+  last_update_(boost::posix_time::min_date_time),
+  meta_block_(0),
+  meta_size_(0)
+{
+}
+
+XspressBlockSet::~XspressBlockSet()
+{
+  if (meta_block_){
+    free(meta_block_);
+  }
+}
+
+/**
+ * Allocate the memory for a block of frames.
+ *
+ * \param[in] num_channels - number of channels in each frame.
+ * \param[in] frame_size - size in bytes of a single channel spectrum.
+ * \param[in] max_frames - number of frames held by the block.
+ */
+void XspressBlockSet::set_size(uint32_t num_channels, uint32_t frame_size, uint32_t max_frames)
+{
+  num_channels_ = num_channels;
+  max_frames_ = max_frames;
+  channels_.clear();
+  for (uint32_t index = 0; index < num_channels; index++){
+    boost::shared_ptr<XspressMemoryBlock> ptr = boost::shared_ptr<XspressMemoryBlock>(new XspressMemoryBlock());
+    ptr->set_size(frame_size, max_frames);
+    channels_.push_back(ptr);
+  }
+  // Summed values are either uint32 counts or float32 corrected counts, both of which are 4 bytes
+  sum_ = boost::shared_ptr<XspressMemoryBlock>(new XspressMemoryBlock());
+  sum_->set_size(frame_size, max_frames);
+
+  // The packed meta data holds the header followed by the dtc factors, input
+  // estimates, scalars and fill mask for a full block of frames
+  if (meta_block_){
+    free(meta_block_);
+  }
+  uint32_t num_values = max_frames * num_channels;
+  meta_size_ = sizeof(MetaBlockHeader) +
+               (sizeof(double) * num_values * 2) +
+               (sizeof(uint32_t) * num_values * DEFAULT_SCALAR_QTY) +
+               (sizeof(uint8_t) * max_frames);
+  meta_block_ = (char *)malloc(meta_size_);
+  bitmap_.resize((max_frames + 63) / 64);
+  reset(0, 0, max_frames);
+}
+
+/**
+ * Clear the block ready to receive a new set of frames.
+ *
+ * \param[in] block_index - index of the block within the acquisition.
+ * \param[in] first_frame - ID of the first frame of the block.
+ * \param[in] expected_frames - number of frames required to complete the block.
+ */
+void XspressBlockSet::reset(uint32_t block_index, uint32_t first_frame, uint32_t expected_frames)
+{
+  block_index_ = block_index;
+  first_frame_ = first_frame;
+  expected_frames_ = std::min(expected_frames, max_frames_);
+  frames_received_ = 0;
+  std::fill(bitmap_.begin(), bitmap_.end(), 0);
+  for (uint32_t index = 0; index < channels_.size(); index++){
+    channels_[index]->reset();
+  }
+  sum_->reset();
+  memset(meta_block_, 0, meta_size_);
+  last_update_ = boost::posix_time::microsec_clock::local_time();
+}
+
+/**
+ * Mark a frame as received.
+ *
+ * \param[in] frame_id - ID of the frame.
+ * \return false if the frame does not belong to this block or has already been received.
+ */
+bool XspressBlockSet::add_frame(uint32_t frame_id)
+{
+  uint32_t offset = frame_id - first_frame_;
+  if (frame_id < first_frame_ || offset >= max_frames_){
+    return false;
+  }
+  uint64_t mask = (uint64_t)1 << (offset % 64);
+  if (bitmap_[offset / 64] & mask){
+    return false;
+  }
+  bitmap_[offset / 64] |= mask;
+  fill_mask()[offset] = 1;
+  frames_received_++;
+  last_update_ = boost::posix_time::microsec_clock::local_time();
+  return true;
+}
+
+bool XspressBlockSet::complete()
+{
+  return frames_received_ >= expected_frames_;
+}
+
+uint32_t XspressBlockSet::block_index()
+{
+  return block_index_;
+}
+
+uint32_t XspressBlockSet::first_frame()
+{
+  return first_frame_;
+}
+
+uint32_t XspressBlockSet::expected_frames()
+{
+  return expected_frames_;
+}
+
+uint32_t XspressBlockSet::frames_received()
+{
+  return frames_received_;
+}
+
+boost::posix_time::ptime XspressBlockSet::last_update()
+{
+  return last_update_;
+}
+
+boost::shared_ptr<XspressMemoryBlock> XspressBlockSet::channel(uint32_t index)
+{
+  return channels_[index];
+}
+
+boost::shared_ptr<XspressMemoryBlock> XspressBlockSet::sum()
+{
+  return sum_;
+}
+
+MetaBlockHeader *XspressBlockSet::meta_header()
+{
+  return (MetaBlockHeader *)meta_block_;
+}
+
+double *XspressBlockSet::dtc()
+{
+  return (double *)(meta_block_ + sizeof(MetaBlockHeader));
+}
+
+double *XspressBlockSet::inp_est()
+{
+  return dtc() + (max_frames_ * num_channels_);
+}
+
+uint32_t *XspressBlockSet::scalars()
+{
+  return (uint32_t *)(inp_est() + (max_frames_ * num_channels_));
+}
+
+uint8_t *XspressBlockSet::fill_mask()
+{
+  return (uint8_t *)(scalars() + (max_frames_ * num_channels_ * DEFAULT_SCALAR_QTY));
+}
+
+uint32_t XspressBlockSet::meta_size()
+{
+  return meta_size_;
+}
+
 XspressProcessPlugin::XspressProcessPlugin() :
   num_frames_(1),
   num_energy_bins_(4096),
@@ -135,14 +497,49 @@ XspressProcessPlugin::XspressProcessPlugin() :
   acq_id_(""),
   live_view_name_(""),
   last_scalar_send_time_(boost::posix_time::min_date_time),
-  scalar_memblock_(0),
-  dtc_memblock_(0),
-  inp_est_memblock_(0),
-  num_scalars_recorded_(0)
+  meta_json_header_(""),
+  num_scalars_(DEFAULT_SCALAR_QTY),
+  first_channel_(0),
+  highest_block_(0),
+  new_acquisition_(true),
+  reorder_window_(DEFAULT_REORDER_WINDOW),
+  block_timeout_ms_(DEFAULT_BLOCK_TIMEOUT_MS),
+  incomplete_blocks_(0),
+  duplicate_frames_(0),
+  late_frames_(0),
+  sparse_frames_(0),
+  sparse_invalid_entries_(0),
+  packing_type_(PACKING_TYPE_UINT32),
+  packing_bits_(32),
+  packed_blocks_(0),
+  overflow_blocks_(0),
+  overflow_bins_(0),
+  scan_frames_(0),
+  scan_summary_written_(false),
+  segment_(0),
+  segment_offset_(0),
+  roll_frames_(0),
+  roll_length_(0),
+  current_roll_(0),
+  rolls_completed_(0),
+  live_mode_(LIVE_MODE_ALL),
+  live_every_(1),
+  live_rate_(0.0),
+  live_rebin_(1),
+  live_sum_aux_(false),
+  last_live_time_(boost::posix_time::min_date_time),
+  live_accumulated_frames_(0),
+  sum_enabled_(false),
+  sum_dtc_(false),
+  sum_live_view_name_(""),
+  frames_processed_(0),
+  blocks_pushed_(0),
+  metrics_address_(XSP_METRICS_DEFAULT_ADDRESS)
 {
   // Setup logging for the class
   logger_ = Logger::getLogger("FP.XspressProcessPlugin");
   LOG4CXX_INFO(logger_, "XspressProcessPlugin version " << this->get_version_long() << " loaded");
+  update_meta_json_header();
 }
 
 XspressProcessPlugin::~XspressProcessPlugin()
@@ -169,10 +566,20 @@ void XspressProcessPlugin::configure(OdinData::IpcMessage& config, OdinData::Ipc
     LOG4CXX_INFO(logger_, "Acquisition ID set to " << this->acq_id_);
   }
 
+  // The meta data header only depends upon the acquisition ID and rank
+  update_meta_json_header();
+
+  // The number of frames and acquisition ID are sent ahead of each acquisition
+  if (config.has_param(XspressProcessPlugin::CONFIG_FRAMES) || config.has_param(XspressProcessPlugin::CONFIG_ACQ_ID)){
+    boost::lock_guard<boost::mutex> lock(block_mutex_);
+    reset_acquisition();
+  }
+
   /**
    *  If we receive the configuration with a chunk size different from the previous value we have to relocate the memory buffer
    */
   if (config.has_param(XspressProcessPlugin::CONFIG_CHUNK)){
+    boost::lock_guard<boost::mutex> lock(block_mutex_);
     if (this->frames_per_block_ != config.get_param<uint32_t>(XspressProcessPlugin::CONFIG_CHUNK))
     {
       if (config.get_param<uint32_t>(XspressProcessPlugin::CONFIG_CHUNK) > MAX_SCALAR_MEM_BLOCK_SIZE)
@@ -228,6 +635,115 @@ void XspressProcessPlugin::configure(OdinData::IpcMessage& config, OdinData::Ipc
     this->live_view_name_ = config.get_param<std::string>(XspressProcessPlugin::CONFIG_LIVE_VIEW_NAME);
     LOG4CXX_INFO(logger_, "Live View destination name set to " << this->live_view_name_);
   }
+
+  // Check for the live view policy options
+  std::string old_live_mode = this->live_mode_;
+  uint32_t old_live_every = this->live_every_;
+  double old_live_rate = this->live_rate_;
+  uint32_t old_live_rebin = this->live_rebin_;
+  bool old_live_sum_aux = this->live_sum_aux_;
+  if (config.has_param(XspressProcessPlugin::CONFIG_LIVE_MODE)) {
+    std::string mode = config.get_param<std::string>(XspressProcessPlugin::CONFIG_LIVE_MODE);
+    if (mode == LIVE_MODE_ALL || mode == LIVE_MODE_EVERY || mode == LIVE_MODE_RATE || mode == LIVE_MODE_ACCUMULATE){
+      this->live_mode_ = mode;
+      LOG4CXX_INFO(logger_, "Live view mode set to " << this->live_mode_);
+    } else {
+      LOG4CXX_ERROR(logger_, "Invalid live view mode requested: " << mode);
+      reply.set_nack("Invalid live view mode: " + mode);
+    }
+  }
+  if (config.has_param(XspressProcessPlugin::CONFIG_LIVE_EVERY)) {
+    this->live_every_ = std::max(config.get_param<uint32_t>(XspressProcessPlugin::CONFIG_LIVE_EVERY), (uint32_t)1);
+    LOG4CXX_INFO(logger_, "Live view will publish every " << this->live_every_ << " frames");
+  }
+  if (config.has_param(XspressProcessPlugin::CONFIG_LIVE_RATE)) {
+    this->live_rate_ = config.get_param<double>(XspressProcessPlugin::CONFIG_LIVE_RATE);
+    LOG4CXX_INFO(logger_, "Live view maximum rate set to " << this->live_rate_ << " frames/s");
+  }
+  if (config.has_param(XspressProcessPlugin::CONFIG_LIVE_REBIN)) {
+    this->live_rebin_ = std::max(config.get_param<uint32_t>(XspressProcessPlugin::CONFIG_LIVE_REBIN), (uint32_t)1);
+    LOG4CXX_INFO(logger_, "Live view rebin factor set to " << this->live_rebin_);
+  }
+  if (config.has_param(XspressProcessPlugin::CONFIG_LIVE_SUM_AUX)) {
+    this->live_sum_aux_ = config.get_param<bool>(XspressProcessPlugin::CONFIG_LIVE_SUM_AUX);
+    LOG4CXX_INFO(logger_, "Live view sum over aux values set to " << this->live_sum_aux_);
+  }
+  // Any accumulated live view spectra no longer match a changed policy
+  if (this->live_mode_ != old_live_mode || this->live_every_ != old_live_every ||
+      this->live_rate_ != old_live_rate || this->live_rebin_ != old_live_rebin ||
+      this->live_sum_aux_ != old_live_sum_aux){
+    boost::lock_guard<boost::mutex> lock(block_mutex_);
+    live_accumulator_.clear();
+    live_accumulated_frames_ = 0;
+  }
+
+  // Check for the channel sum options
+  if (config.has_param(XspressProcessPlugin::CONFIG_SUM_ENABLE)) {
+    this->sum_enabled_ = config.get_param<bool>(XspressProcessPlugin::CONFIG_SUM_ENABLE);
+    LOG4CXX_INFO(logger_, "Channel sum enabled set to " << this->sum_enabled_);
+  }
+  if (config.has_param(XspressProcessPlugin::CONFIG_SUM_DTC)) {
+    this->sum_dtc_ = config.get_param<bool>(XspressProcessPlugin::CONFIG_SUM_DTC);
+    LOG4CXX_INFO(logger_, "Channel sum dead time correction set to " << this->sum_dtc_);
+  }
+  if (config.has_param(XspressProcessPlugin::CONFIG_SUM_LIVE_VIEW)) {
+    this->sum_live_view_name_ = config.get_param<std::string>(XspressProcessPlugin::CONFIG_SUM_LIVE_VIEW);
+    LOG4CXX_INFO(logger_, "Channel sum Live View destination name set to " << this->sum_live_view_name_);
+  }
+
+  // Check for the frame reordering options
+  if (config.has_param(XspressProcessPlugin::CONFIG_REORDER_WINDOW)) {
+    boost::lock_guard<boost::mutex> lock(block_mutex_);
+    this->reorder_window_ = std::max(config.get_param<uint32_t>(XspressProcessPlugin::CONFIG_REORDER_WINDOW), (uint32_t)1);
+    LOG4CXX_INFO(logger_, "Reorder window set to " << this->reorder_window_ << " blocks");
+  }
+  if (config.has_param(XspressProcessPlugin::CONFIG_BLOCK_TIMEOUT)) {
+    this->block_timeout_ms_ = config.get_param<uint32_t>(XspressProcessPlugin::CONFIG_BLOCK_TIMEOUT);
+    LOG4CXX_INFO(logger_, "Incomplete block timeout set to " << this->block_timeout_ms_ << "ms");
+  }
+
+  // Check for the MCA dataset type, this takes effect from the next acquisition
+  if (config.has_param(XspressProcessPlugin::CONFIG_PACKING_TYPE)) {
+    std::string type = config.get_param<std::string>(XspressProcessPlugin::CONFIG_PACKING_TYPE);
+    if (type == PACKING_TYPE_UINT32 || type == PACKING_TYPE_UINT16 || type == PACKING_TYPE_UINT8){
+      this->packing_type_ = type;
+      LOG4CXX_INFO(logger_, "MCA packing type set to " << this->packing_type_);
+    } else {
+      LOG4CXX_ERROR(logger_, "Invalid MCA packing type requested: " << type);
+      reply.set_nack("Invalid MCA packing type: " + type);
+    }
+  }
+
+  // Check for the output roll length, this takes effect from the next acquisition
+  if (config.has_param(XspressProcessPlugin::CONFIG_ROLL_FRAMES)) {
+    boost::lock_guard<boost::mutex> lock(block_mutex_);
+    this->roll_frames_ = config.get_param<uint32_t>(XspressProcessPlugin::CONFIG_ROLL_FRAMES);
+    LOG4CXX_INFO(logger_, "Output roll length set to " << this->roll_frames_ << " frames");
+  }
+
+  // Check for the OpenMetrics address, a change of address restarts the
+  // server on its current port
+  if (config.has_param(XspressProcessPlugin::CONFIG_METRICS_ADDRESS)) {
+    metrics_address_ = config.get_param<std::string>(XspressProcessPlugin::CONFIG_METRICS_ADDRESS);
+  }
+
+  // Check for the OpenMetrics port, 0 stops serving metrics
+  if (config.has_param(XspressProcessPlugin::CONFIG_METRICS_PORT) ||
+      config.has_param(XspressProcessPlugin::CONFIG_METRICS_ADDRESS)) {
+    int port = metrics_server_.get_port();
+    if (config.has_param(XspressProcessPlugin::CONFIG_METRICS_PORT)) {
+      port = config.get_param<int>(XspressProcessPlugin::CONFIG_METRICS_PORT);
+    }
+    if (port > 0){
+      if (!metrics_server_.start(port, boost::bind(&XspressProcessPlugin::render_metrics, this), metrics_address_)){
+        std::stringstream ss;
+        ss << "Could not serve metrics on " << metrics_address_ << ":" << port;
+        reply.set_nack(ss.str());
+      }
+    } else {
+      metrics_server_.stop();
+    }
+  }
 }
 
 void XspressProcessPlugin::requestConfiguration(OdinData::IpcMessage& reply)
@@ -241,6 +757,82 @@ void XspressProcessPlugin::requestConfiguration(OdinData::IpcMessage& reply)
                   XspressProcessPlugin::CONFIG_PROCESS_RANK, this->concurrent_rank_);
   reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_ACQ_ID, this->acq_id_);
   reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_LIVE_VIEW_NAME, this->live_view_name_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_LIVE_MODE, this->live_mode_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_LIVE_EVERY, this->live_every_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_LIVE_RATE, this->live_rate_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_LIVE_REBIN, this->live_rebin_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_LIVE_SUM_AUX, this->live_sum_aux_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_SUM_ENABLE, this->sum_enabled_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_SUM_DTC, this->sum_dtc_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_SUM_LIVE_VIEW, this->sum_live_view_name_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_REORDER_WINDOW, this->reorder_window_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_BLOCK_TIMEOUT, this->block_timeout_ms_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_PACKING_TYPE, this->packing_type_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_ROLL_FRAMES, this->roll_frames_);
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_METRICS_PORT, metrics_server_.get_port());
+  reply.set_param(get_name() + "/" + XspressProcessPlugin::CONFIG_METRICS_ADDRESS, metrics_address_);
+}
+
+/**
+ * Collate status information for the plugin.
+ *
+ * Incomplete blocks that have timed out are also flushed here, as no further
+ * frames may arrive to trigger the check from process_frame.
+ *
+ * \param[out] status - Reference to an IpcMessage value to store the status.
+ */
+void XspressProcessPlugin::status(OdinData::IpcMessage& status)
+{
+  boost::lock_guard<boost::mutex> lock(block_mutex_);
+  flush_expired_blocks(boost::posix_time::microsec_clock::local_time());
+  status.set_param(get_name() + "/open_blocks", (uint32_t)open_blocks_.size());
+  status.set_param(get_name() + "/incomplete_blocks", incomplete_blocks_);
+  status.set_param(get_name() + "/duplicate_frames", duplicate_frames_);
+  status.set_param(get_name() + "/late_frames", late_frames_);
+  status.set_param(get_name() + "/sparse_frames", sparse_frames_);
+  status.set_param(get_name() + "/sparse_invalid_entries", sparse_invalid_entries_);
+  status.set_param(get_name() + "/packing/bits", packing_bits_);
+  status.set_param(get_name() + "/packing/packed_blocks", packed_blocks_);
+  status.set_param(get_name() + "/packing/overflow_blocks", overflow_blocks_);
+  status.set_param(get_name() + "/packing/overflow_bins", overflow_bins_);
+  status.set_param(get_name() + "/scan/frames", scan_frames_);
+  status.set_param(get_name() + "/segment/index", segment_);
+  status.set_param(get_name() + "/segment/offset", segment_offset_);
+  status.set_param(get_name() + "/roll/length", roll_length_);
+  status.set_param(get_name() + "/roll/index", current_roll_);
+  status.set_param(get_name() + "/roll/completed", rolls_completed_);
+  for (uint32_t index = 0; index < scan_count_total_.size(); index++){
+    double mean = scan_frames_ > 0 ? (double)scan_count_total_[index] / scan_frames_ : 0.0;
+    status.set_param(get_name() + "/scan/total_counts[]", scan_count_total_[index]);
+    status.set_param(get_name() + "/scan/count_min[]", scan_count_min_[index]);
+    status.set_param(get_name() + "/scan/count_max[]", scan_count_max_[index]);
+    status.set_param(get_name() + "/scan/count_mean[]", mean);
+  }
+}
+
+/**
+ * Flush all remaining blocks, complete or not, at the end of an acquisition.
+ * The reorder state is then cleared and the next frame received starts a new
+ * acquisition.
+ *
+ * The scan summary is written here if it has not been already, which covers
+ * continuous acquisitions, a partial final roll and acquisitions whose final
+ * frames were lost.
+ */
+void XspressProcessPlugin::process_end_of_acquisition()
+{
+  boost::lock_guard<boost::mutex> lock(block_mutex_);
+  LOG4CXX_INFO(logger_, "End of acquisition, flushing " << open_blocks_.size() << " open blocks");
+  while (!open_blocks_.empty()){
+    flush_block(open_blocks_.begin()->first);
+  }
+  if (!scan_summary_written_){
+    push_scan_summary();
+  }
+  // Forget the reorder state so that frames of the next acquisition are not
+  // checked against the blocks of this one
+  discard_blocks();
+  new_acquisition_ = true;
 }
 
 /**
@@ -307,38 +899,240 @@ void XspressProcessPlugin::set_number_of_aux(uint32_t num_aux)
   setup_memory_allocation();
 }
 
+/**
+ * Discard the open and free blocks after a change to the frame layout. The
+ * block mutex must be held by the caller, as blocks are also flushed from
+ * the status thread.
+ */
 void XspressProcessPlugin::setup_memory_allocation()
 {
-  // First clear out the memory vector emptying any blocks
-  memory_ptrs_.clear();
-
-  // Allocate large enough blocks of memory to hold frames_per_block spectra
-  // Allocate one block of memory for each channel
-  uint32_t frame_size = num_energy_bins_ * num_aux_ * sizeof(uint32_t);
+  // Any open blocks no longer match the frame layout, discard them and the
+  // pool of free blocks so that new blocks are allocated on demand
   LOG4CXX_DEBUG_LEVEL(3, logger_, "frames_per_block_ inside the setup_memory_allocation method: " << frames_per_block_);
-  for (int index = 0; index <= num_channels_; index++){
-    boost::shared_ptr<XspressMemoryBlock> ptr = boost::shared_ptr<XspressMemoryBlock>(new XspressMemoryBlock());
-    ptr->set_size(frame_size, frames_per_block_);
-    memory_ptrs_.push_back(ptr);
+  if (!open_blocks_.empty()){
+    LOG4CXX_WARN(logger_, "Discarding " << open_blocks_.size() << " open blocks due to reallocation");
   }
+  open_blocks_.clear();
+  free_blocks_.clear();
 
-  // Init the scalar memory allocation
-  if (scalar_memblock_){
-    free(scalar_memblock_);
+  // Allocate the scratch buffers for the channel sum
+  sum_counts_.resize(num_energy_bins_ * num_aux_);
+  sum_corrected_.resize(num_energy_bins_ * num_aux_);
+}
+
+/**
+ * Return the block for a block index, taking a block from the free pool (or
+ * allocating a new one) if the block is not already open.
+ *
+ * \param[in] block_index - index of the block within the acquisition.
+ * \return the block.
+ */
+boost::shared_ptr<XspressBlockSet> XspressProcessPlugin::get_block(uint32_t block_index)
+{
+  std::map<uint32_t, boost::shared_ptr<XspressBlockSet> >::iterator iter = open_blocks_.find(block_index);
+  if (iter != open_blocks_.end()){
+    return iter->second;
+  }
+  boost::shared_ptr<XspressBlockSet> block;
+  if (!free_blocks_.empty()){
+    block = free_blocks_.back();
+    free_blocks_.pop_back();
+  } else {
+    block = boost::shared_ptr<XspressBlockSet>(new XspressBlockSet());
+    block->set_size(num_channels_, num_energy_bins_ * num_aux_ * sizeof(uint32_t), frames_per_block_);
   }
-  scalar_memblock_ = malloc(sizeof(uint32_t) * this->frames_per_block_ * num_channels_ * DEFAULT_SCALAR_QTY);
-  if (dtc_memblock_){
-    free(dtc_memblock_);
+  uint32_t first_frame = block_index * frames_per_block_;
+  uint32_t expected_frames = frames_per_block_;
+  if (num_frames_ > first_frame){
+    expected_frames = std::min(frames_per_block_, num_frames_ - first_frame);
   }
-  dtc_memblock_ = malloc(sizeof(double) * this->frames_per_block_ * num_channels_);
-  if (inp_est_memblock_){
-    free(inp_est_memblock_);
+  block->reset(block_index, first_frame, expected_frames);
+  open_blocks_[block_index] = block;
+  return block;
+}
+
+/**
+ * Push out all of the data held in an open block and return the block to the
+ * free pool. Frames that were not received are left zeroed and are marked in
+ * the fill mask published with the meta data.
+ *
+ * \param[in] block_index - index of the block within the acquisition.
+ */
+void XspressProcessPlugin::flush_block(uint32_t block_index)
+{
+  std::map<uint32_t, boost::shared_ptr<XspressBlockSet> >::iterator iter = open_blocks_.find(block_index);
+  if (iter == open_blocks_.end()){
+    return;
+  }
+  boost::posix_time::ptime flush_start = boost::posix_time::microsec_clock::local_time();
+  boost::shared_ptr<XspressBlockSet> block = iter->second;
+  open_blocks_.erase(iter);
+  flushed_blocks_.insert(block_index);
+
+  if (!block->complete()){
+    incomplete_blocks_++;
+    LOG4CXX_WARN(logger_, "Flushing incomplete block " << block_index << " with "
+                          << block->frames_received() << " of " << block->expected_frames() << " frames");
+  }
+
+  uint32_t num_frames = block->expected_frames();
+  send_scalars(block, num_scalars_, first_channel_);
+  for (uint32_t index = 0; index < num_channels_; index++){
+    std::stringstream ss;
+    ss << "mca_" << index + first_channel_;
+    boost::shared_ptr<Frame> mca_frame;
+    boost::shared_ptr<Frame> overflow_frame;
+    if (packing_bits_ < 32){
+      mca_frame = create_packed_frame(block->channel(index), ss.str(), block_index, num_frames, overflow_frame);
+    } else {
+      mca_frame = create_block_frame(block->channel(index), ss.str(), raw_32bit, block_index, num_frames);
+    }
+    // Push out the MCA data
+    this->push(mca_frame);
+    if (overflow_frame){
+      this->push(overflow_frame);
+    }
+  }
+
+  // Push out the channel sum block alongside the channel blocks
+  if (sum_enabled_){
+    boost::shared_ptr<Frame> sum_frame = create_block_frame(block->sum(), SUM_DATASET_NAME,
+                                                            sum_dtc_ ? raw_float : raw_32bit,
+                                                            block_index, num_frames);
+    // Record which channels contributed so that partial sums can be combined across processes
+    sum_frame->meta_data().set_parameter<uint32_t>("rank", concurrent_rank_);
+    sum_frame->meta_data().set_parameter<uint32_t>("first_channel", first_channel_);
+    sum_frame->meta_data().set_parameter<uint32_t>("num_channels", num_channels_);
+    this->push(sum_frame);
+  }
+  LOG4CXX_DEBUG_LEVEL(3, logger_, "Pushed block " << block_index << " containing " << num_frames << " frames");
+
+  free_blocks_.push_back(block);
+  blocks_pushed_++;
+
+  // The scan summary is written once the final block of the acquisition, or
+  // of the current roll, has been pushed so that it includes late frames
+  if (!scan_summary_written_ && scan_summary_due()){
+    push_scan_summary();
   }
-  inp_est_memblock_ = malloc(sizeof(double) * this->frames_per_block_ * num_channels_);
+  flush_latency_.observe((boost::posix_time::microsec_clock::local_time() - flush_start).total_microseconds() / 1000000.0);
+}
+
+/**
+ * Flush any open blocks that have fallen outside of the reorder window or
+ * that have not been updated within the timeout.
+ *
+ * \param[in] now - the current time.
+ */
+void XspressProcessPlugin::flush_expired_blocks(boost::posix_time::ptime now)
+{
+  std::vector<uint32_t> expired;
+  std::map<uint32_t, boost::shared_ptr<XspressBlockSet> >::iterator iter;
+  for (iter = open_blocks_.begin(); iter != open_blocks_.end(); ++iter){
+    bool outside_window = (iter->first + reorder_window_) <= highest_block_;
+    bool timed_out = block_timeout_ms_ > 0 &&
+                     (now - iter->second->last_update()).total_milliseconds() >= block_timeout_ms_;
+    if (outside_window || timed_out){
+      expired.push_back(iter->first);
+    }
+  }
+  for (uint32_t index = 0; index < expired.size(); index++){
+    flush_block(expired[index]);
+  }
+
+  // Forget flushed blocks that are old enough for their frames to be rejected by the window
+  while (!flushed_blocks_.empty() && (*flushed_blocks_.begin() + reorder_window_) <= highest_block_){
+    flushed_blocks_.erase(flushed_blocks_.begin());
+  }
+}
+
+/**
+ * Reset the per acquisition state: the reorder window, the live view
+ * accumulator, the packing type, the scan summary and the output rolls. This
+ * is called when an acquisition is configured, or by the first frame after
+ * the end of an acquisition if no configuration was received in between. The
+ * block mutex must be held by the caller.
+ */
+void XspressProcessPlugin::reset_acquisition()
+{
+  // Discard any blocks left open from a previous acquisition
+  discard_blocks();
+
+  // Discard any live view spectra left from the previous acquisition
+  live_accumulator_.clear();
+  live_accumulated_frames_ = 0;
+
+  // The MCA datasets keep one type for the whole acquisition
+  if (packing_type_ == PACKING_TYPE_UINT8){
+    packing_bits_ = 8;
+  } else if (packing_type_ == PACKING_TYPE_UINT16){
+    packing_bits_ = 16;
+  } else {
+    packing_bits_ = 32;
+  }
+  packed_blocks_ = 0;
+  overflow_blocks_ = 0;
+  overflow_bins_ = 0;
+
+  // Start a new scan summary, the accumulators are sized on the first accumulation
+  reset_scan_summary();
+
+  // Rolls are a whole number of blocks so that no block spans two rolls
+  roll_length_ = ((roll_frames_ + frames_per_block_ - 1) / frames_per_block_) * frames_per_block_;
+  current_roll_ = 0;
+  rolls_completed_ = 0;
+  segment_ = 0;
+  segment_offset_ = 0;
+  new_acquisition_ = false;
+  LOG4CXX_INFO(logger_, "Reset for a new acquisition, MCA value bits: " << packing_bits_);
+}
+
+/**
+ * Return all open blocks to the free pool without pushing them, ready for a
+ * new acquisition.
+ */
+void XspressProcessPlugin::discard_blocks()
+{
+  std::map<uint32_t, boost::shared_ptr<XspressBlockSet> >::iterator iter;
+  for (iter = open_blocks_.begin(); iter != open_blocks_.end(); ++iter){
+    free_blocks_.push_back(iter->second);
+  }
+  open_blocks_.clear();
+  flushed_blocks_.clear();
+  highest_block_ = 0;
+}
+
+/**
+ * Build the JSON header sent with each packed meta data message.
+ *
+ * The header is cached as it only changes when the acquisition ID or rank is
+ * reconfigured, all per block information is held in the binary MetaBlockHeader.
+ */
+void XspressProcessPlugin::update_meta_json_header()
+{
+  rapidjson::Document meta_document;
+  meta_document.SetObject();
+  // Add Acquisition ID
+  rapidjson::Value key_acq_id("acqID", meta_document.GetAllocator());
+  rapidjson::Value value_acq_id;
+  value_acq_id.SetString(acq_id_.c_str(), acq_id_.size(), meta_document.GetAllocator());
+  meta_document.AddMember(key_acq_id, value_acq_id, meta_document.GetAllocator());
+  // Add rank
+  rapidjson::Value key_rank("rank", meta_document.GetAllocator());
+  rapidjson::Value value_rank;
+  value_rank.SetInt(concurrent_rank_);
+  meta_document.AddMember(key_rank, value_rank, meta_document.GetAllocator());
+
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  meta_document.Accept(writer);
+  meta_json_header_ = buffer.GetString();
 }
 
 void XspressProcessPlugin::process_frame(boost::shared_ptr <Frame> frame)
 {
+  boost::lock_guard<boost::mutex> lock(block_mutex_);
+  boost::posix_time::ptime process_start = boost::posix_time::microsec_clock::local_time();
   char* frame_bytes = static_cast<char *>(frame->get_data_ptr());
   FrameHeader *header = reinterpret_cast<FrameHeader *>(frame_bytes);
 
@@ -351,14 +1145,20 @@ void XspressProcessPlugin::process_frame(boost::shared_ptr <Frame> frame)
     LOG4CXX_INFO(logger_, "  Number of channels: " << header->num_channels);
     LOG4CXX_INFO(logger_, "  Number of scalars: " << header->num_scalars);
     LOG4CXX_INFO(logger_, "  Number of resgrades: " << header->num_aux);
+  }
 
-    // Reset all memory blocks holding mca data
-    for (int index = 0; index < num_channels_; index++){
-      memory_ptrs_[index]->reset();
-    }
+  // The first frame to arrive after the end of an acquisition starts the next
+  // one, whichever frame it is, so a late frame 0 cannot discard earlier frames
+  if (new_acquisition_){
+    reset_acquisition();
+  }
 
-    // Reset the number of scalars recorded to zero
-    num_scalars_recorded_ = 0;
+  // Frames of a queued acquisition are numbered continuously, so the blocks
+  // and scan summary carry straight on into the next segment
+  if (header->segment != segment_){
+    segment_ = header->segment;
+    segment_offset_ = header->segment_offset;
+    LOG4CXX_INFO(logger_, "Segment " << segment_ << " started at frame " << segment_offset_);
   }
 
   // Check the number of channels.  If the number of channels is different
@@ -373,17 +1173,14 @@ void XspressProcessPlugin::process_frame(boost::shared_ptr <Frame> frame)
     set_number_of_aux(header->num_aux);
   }
 
-  // If the frame number is greater than the current memory allocation clear out the memory
-  // and update the starting block
-
   // Split out the frame data into channels and update the memory blocks.
-  // If any memory blocks are full then create the frame object and push (this should happen
-  // to all of the memory blocks at once).
   uint32_t mca_size = header->num_energy_bins * header->num_aux * sizeof(uint32_t);
   uint32_t num_scalar_values = header->num_scalars * header->num_channels;
   uint32_t num_dtc_factors = header->num_channels;
   uint32_t num_inp_est = header->num_channels;
   uint32_t first_channel_index = header->first_channel;
+  num_scalars_ = std::min(header->num_scalars, (uint32_t)DEFAULT_SCALAR_QTY);
+  first_channel_ = first_channel_index;
 
   char *raw_sca_ptr = frame_bytes;
   raw_sca_ptr += sizeof(FrameHeader);
@@ -395,30 +1192,6 @@ void XspressProcessPlugin::process_frame(boost::shared_ptr <Frame> frame)
   raw_inp_est_ptr += (sizeof(FrameHeader) + (num_scalar_values*sizeof(uint32_t)) + (num_dtc_factors*sizeof(double)));
   double *inp_est_ptr = (double *)raw_inp_est_ptr;
 
-  // Memcpy the scalars into the correct memory location
-  uint32_t *dest_ptr = (uint32_t *)scalar_memblock_;
-  dest_ptr += (num_scalar_values * num_scalars_recorded_);
-  memcpy(dest_ptr, sca_ptr, num_scalar_values * sizeof(uint32_t));
-  double *dest_dtc_ptr = (double *)dtc_memblock_;
-  dest_dtc_ptr += (num_dtc_factors * num_scalars_recorded_);
-  memcpy(dest_dtc_ptr, dtc_ptr, num_dtc_factors * sizeof(double));
-  double *dest_inp_est_ptr = (double *)inp_est_memblock_;
-  dest_inp_est_ptr += (num_inp_est * num_scalars_recorded_);
-  memcpy(dest_inp_est_ptr, inp_est_ptr, num_inp_est * sizeof(double));
-  num_scalars_recorded_ += 1;
-
-  // Calculate the elapsed time since we last posted meta data
-  boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
-  int32_t elapsed_time = (now - last_scalar_send_time_).total_milliseconds();
-
-  // Send scalars to be writen once we reach the desired number of frames.
-  // Number has to be the same as the number of MCA frames for live processing reasons
-  if ((num_scalars_recorded_ == this->frames_per_block_))
-  {
-    send_scalars(frame_id, header->num_scalars, header->first_channel, header->num_channels);
-    last_scalar_send_time_ = now;
-  }
-
   char *mca_ptr = frame_bytes;
   mca_ptr += (sizeof(FrameHeader) +
              (num_scalar_values*sizeof(uint32_t)) +
@@ -426,149 +1199,578 @@ void XspressProcessPlugin::process_frame(boost::shared_ptr <Frame> frame)
              (num_inp_est*sizeof(double))
              );
 
+  // Low count frames may arrive as (index, value) pairs, expand these so the
+  // rest of the processing sees dense spectra
+  if (header->mca_encoding == XSP_MCA_ENCODING_SPARSE){
+    mca_ptr = expand_sparse(header, mca_ptr, mca_size);
+  }
+
+  boost::posix_time::ptime now = boost::posix_time::microsec_clock::local_time();
+
+  // Decide once whether this frame is published to the live view, so that
+  // frames which will not be shown are never allocated or copied
+  bool live_due = live_view_due(frame_id, now);
+
+  // Sum the channels owned by this process if requested
+  if (sum_enabled_){
+    sum_channels(mca_ptr, dtc_ptr, mca_size);
+    char *sum_ptr = sum_dtc_ ? (char *)&sum_corrected_[0] : (char *)&sum_counts_[0];
+    if (sum_live_view_name_ != "" && live_due){
+      dimensions_t sum_dims;
+      sum_dims.push_back(header->num_aux);
+      sum_dims.push_back(header->num_energy_bins);
+      FrameMetaData sum_metadata(frame_id, SUM_LIVE_DATASET_NAME, sum_dtc_ ? raw_float : raw_32bit, "", sum_dims);
+      sum_metadata.set_parameter<uint32_t>("rank", concurrent_rank_);
+      sum_metadata.set_parameter<uint32_t>("first_channel", first_channel_index);
+      sum_metadata.set_parameter<uint32_t>("num_channels", num_channels_);
+      boost::shared_ptr<Frame> sum_frame(new DataBlockFrame(sum_metadata, mca_size));
+      memcpy(sum_frame->get_data_ptr(), sum_ptr, mca_size);
+      sum_frame->set_outer_chunk_size(1);
+      this->push(sum_live_view_name_, sum_frame);
+    }
+  }
+
   // Create the live view frame and push it
+  if (live_view_name_ != ""){
+    push_live_view(frame_id, mca_ptr, header->num_aux, header->num_energy_bins, live_due);
+  }
+  LOG4CXX_DEBUG_LEVEL(1, logger_, "FrameId = " << frame_id);
+
+  // When rolling, the first frame of a new roll closes the previous roll, and
+  // frames from a roll that has already been closed are rejected
+  uint32_t roll_frames = roll_length_;
+  if (roll_frames > 0){
+    uint32_t roll = frame_id / roll_frames;
+    if (roll < current_roll_){
+      late_frames_++;
+      LOG4CXX_WARN(logger_, "Dropping frame " << frame_id << " as roll " << roll << " has already been closed");
+      return;
+    }
+    if (roll > current_roll_){
+      start_roll(roll);
+    }
+  }
+
+  // Find the block this frame belongs to, rejecting frames whose block has
+  // already been pushed out
+  uint32_t block_index = frame_id / frames_per_block_;
+  if ((block_index + reorder_window_) <= highest_block_ || flushed_blocks_.count(block_index) > 0){
+    late_frames_++;
+    LOG4CXX_WARN(logger_, "Dropping frame " << frame_id << " as block " << block_index << " has already been pushed");
+    return;
+  }
+  highest_block_ = std::max(highest_block_, block_index);
+  boost::shared_ptr<XspressBlockSet> block = get_block(block_index);
+  if (!block->add_frame(frame_id)){
+    duplicate_frames_++;
+    LOG4CXX_WARN(logger_, "Dropping duplicate frame " << frame_id);
+    return;
+  }
+
+  // Copy the scalars, dtc factors and input estimates into the slot for this frame
+  uint32_t offset = frame_id - block->first_frame();
+  // The block holds at most DEFAULT_SCALAR_QTY scalars for each channel, so
+  // any further scalars reported by the detector are dropped
+  uint32_t *block_sca_ptr = block->scalars() + (num_scalars_ * num_channels_ * offset);
+  for (int index = 0; index < num_channels_; index++){
+    memcpy(block_sca_ptr + (num_scalars_ * index), sca_ptr + (header->num_scalars * index), num_scalars_ * sizeof(uint32_t));
+  }
+  memcpy(block->dtc() + (num_dtc_factors * offset), dtc_ptr, num_dtc_factors * sizeof(double));
+  memcpy(block->inp_est() + (num_inp_est * offset), inp_est_ptr, num_inp_est * sizeof(double));
+
+  if (sum_enabled_){
+    block->sum()->add_frame(frame_id, sum_dtc_ ? (char *)&sum_corrected_[0] : (char *)&sum_counts_[0]);
+  }
+  accumulate_scan(frame_id, (const uint32_t *)mca_ptr);
+  for (int index = 0; index < num_channels_; index++){
+    block->channel(index)->add_frame(frame_id, mca_ptr);
+    mca_ptr += mca_size;
+  }
+
+  // Push out the block once every frame has arrived, then check for blocks
+  // that have fallen out of the reorder window or timed out
+  if (block->complete()){
+    flush_block(block_index);
+    last_scalar_send_time_ = now;
+  }
+  flush_expired_blocks(now);
+  frames_processed_++;
+  process_latency_.observe((boost::posix_time::microsec_clock::local_time() - process_start).total_microseconds() / 1000000.0);
+}
+
+/**
+ * Render the OpenMetrics text for this plugin.
+ *
+ * Called from the metrics server thread, the block lock is held so that the
+ * counters are consistent with each other.
+ *
+ * \return OpenMetrics text exposition.
+ */
+std::string XspressProcessPlugin::render_metrics()
+{
+  boost::lock_guard<boost::mutex> lock(block_mutex_);
+  Xspress::XspressMetricsWriter writer("xspress_fp_");
+  writer.counter("frames_processed", "Frames added to a block", frames_processed_);
+  writer.counter("blocks_pushed", "Blocks pushed to the next plugin", blocks_pushed_);
+  writer.counter("incomplete_blocks", "Blocks pushed before all of their frames arrived", incomplete_blocks_);
+  writer.counter("duplicate_frames", "Frames dropped as duplicates", duplicate_frames_);
+  writer.counter("late_frames", "Frames dropped as their block was already pushed", late_frames_);
+  writer.counter("sparse_frames", "Frames received sparse encoded", sparse_frames_);
+  writer.gauge("overflow_blocks", "Blocks written at 32 bit because they did not fit the packing type", overflow_blocks_);
+  writer.gauge("blocks_open", "Blocks currently being filled", open_blocks_.size());
+  writer.gauge("blocks_free", "Allocated blocks available for reuse", free_blocks_.size());
+  writer.histogram("process_seconds", "Time taken to process each frame", process_latency_);
+  writer.histogram("flush_seconds", "Time taken to push each block", flush_latency_);
+  return writer.str();
+}
+
+/**
+ * Check whether the live view policy requires a frame to be published.
+ *
+ * \param[in] frame_id - ID of the frame being processed.
+ * \param[in] now - time the frame is being processed.
+ * \return true if the live view should be published for this frame.
+ */
+bool XspressProcessPlugin::live_view_due(uint32_t frame_id, boost::posix_time::ptime now)
+{
+  bool due = true;
+  if (live_mode_ == LIVE_MODE_EVERY){
+    due = (frame_id % live_every_) == 0;
+  } else if (live_mode_ == LIVE_MODE_RATE || live_mode_ == LIVE_MODE_ACCUMULATE){
+    if (live_rate_ > 0.0){
+      due = (now - last_live_time_).total_microseconds() >= (int64_t)(1000000.0 / live_rate_);
+    }
+    // Always publish the accumulated spectra at the end of an acquisition
+    if (live_mode_ == LIVE_MODE_ACCUMULATE && frame_id == (num_frames_ - 1)){
+      due = true;
+    }
+  }
+  if (due){
+    last_live_time_ = now;
+  }
+  return due;
+}
+
+/**
+ * Publish the live view spectra according to the live view policy.
+ *
+ * In accumulate mode every frame is added into the accumulator and the sum
+ * since the last publish is sent when due. In all other modes the spectra
+ * are only copied when the frame is to be published. Spectra are reduced
+ * by rebinning or summing aux values when requested.
+ *
+ * \param[in] frame_id - ID of the frame being processed.
+ * \param[in] mca_ptr - pointer to the first channel spectrum.
+ * \param[in] num_aux - number of aux values in each spectrum.
+ * \param[in] num_energy_bins - number of energy bins in each spectrum.
+ * \param[in] publish - true if the live view is due to be published.
+ */
+void XspressProcessPlugin::push_live_view(uint32_t frame_id, const char *mca_ptr, uint32_t num_aux,
+                                          uint32_t num_energy_bins, bool publish)
+{
+  bool accumulate = (live_mode_ == LIVE_MODE_ACCUMULATE);
+  bool reduce = (live_rebin_ > 1 || live_sum_aux_);
+  if (!accumulate && !publish){
+    return;
+  }
+
+  uint32_t out_aux = live_sum_aux_ ? 1 : num_aux;
+  uint32_t out_bins = (num_energy_bins + live_rebin_ - 1) / live_rebin_;
+  uint32_t live_values = num_channels_ * out_aux * out_bins;
+  uint32_t live_size = live_values * sizeof(uint32_t);
+
+  if (accumulate){
+    if (live_accumulator_.size() != live_values){
+      live_accumulator_.assign(live_values, 0);
+      live_accumulated_frames_ = 0;
+    }
+    reduce_live_spectra((const uint32_t *)mca_ptr, num_channels_, num_aux, num_energy_bins,
+                        live_rebin_, live_sum_aux_, &live_accumulator_[0]);
+    live_accumulated_frames_++;
+    if (!publish){
+      return;
+    }
+  }
+
   dimensions_t live_dims;
   live_dims.push_back(num_channels_);
-  live_dims.push_back(header->num_aux);
-  live_dims.push_back(header->num_energy_bins);
+  live_dims.push_back(out_aux);
+  live_dims.push_back(out_bins);
   FrameMetaData live_metadata(frame_id, "live", raw_32bit, "", live_dims);
-  boost::shared_ptr<Frame> live_frame(new DataBlockFrame(live_metadata, (mca_size*num_channels_)));
-  memcpy(live_frame->get_data_ptr(), mca_ptr, (mca_size*num_channels_));
+  if (accumulate){
+    live_metadata.set_parameter<uint32_t>("accumulated_frames", live_accumulated_frames_);
+  }
+  boost::shared_ptr<Frame> live_frame(new DataBlockFrame(live_metadata, live_size));
+  if (accumulate){
+    memcpy(live_frame->get_data_ptr(), &live_accumulator_[0], live_size);
+    std::fill(live_accumulator_.begin(), live_accumulator_.end(), 0);
+    live_accumulated_frames_ = 0;
+  } else if (reduce){
+    memset(live_frame->get_data_ptr(), 0, live_size);
+    reduce_live_spectra((const uint32_t *)mca_ptr, num_channels_, num_aux, num_energy_bins,
+                        live_rebin_, live_sum_aux_, (uint32_t *)live_frame->get_data_ptr());
+  } else {
+    memcpy(live_frame->get_data_ptr(), mca_ptr, live_size);
+  }
   // Set the chunking size to dimension of 1
   live_frame->set_outer_chunk_size(1);
   // Push out the live MCA data to the live view plugin only
   this->push(live_view_name_, live_frame);
-  LOG4CXX_DEBUG_LEVEL(1, logger_, "FrameId = " << frame_id);
-  for (int index = 0; index < num_channels_; index++){
-    memory_ptrs_[index]->add_frame(frame_id, mca_ptr);
-    mca_ptr += mca_size;
+}
 
-    // Check if the buffer is full
-    if (memory_ptrs_[index]->check_full())
-    {
-      if (frame_id == (num_frames_ - 1))
-      {
-        LOG4CXX_DEBUG_LEVEL(1, logger_, "Sending the metadata as the last frame when the queue is full");
-        send_scalars(frame_id, header->num_scalars, header->first_channel, header->num_channels);
-      }
-      // Create the frame and push it
-      dimensions_t mca_dims;
-      mca_dims.push_back(header->num_aux);
-      mca_dims.push_back(header->num_energy_bins);
-      std::stringstream ss;
-      ss << "mca_" << index + first_channel_index;
-      // Calculate the ID of the frame we need to push
-      // This must be offset according to the rank and number of processes
-      uint32_t push_frame_id = ((frame_id / frames_per_block_) * concurrent_processes_) + concurrent_rank_;
-      FrameMetaData mca_metadata(push_frame_id, ss.str(), raw_32bit, "", mca_dims);
-      boost::shared_ptr<Frame> mca_frame(new DataBlockFrame(mca_metadata, memory_ptrs_[index]->size()));
-      memcpy(mca_frame->get_data_ptr(), memory_ptrs_[index]->get_data_ptr(), memory_ptrs_[index]->size());
-      // Set the chunking size
-      mca_frame->set_outer_chunk_size(frames_per_block_);
-      // Push out the MCA data
-      this->push(mca_frame);
-      // Reset the memory block
-      memory_ptrs_[index]->reset();
+/**
+ * Expand the sparse encoded spectra of a frame into dense spectra.
+ *
+ * Each entry is a (bin index, value) pair where the index is the position of
+ * the bin within the dense num_channels x num_aux x num_energy_bins array.
+ * Entries with an out of range index are counted and dropped.
+ *
+ * \param[in] header - header of the frame.
+ * \param[in] mca_ptr - pointer to the first sparse entry.
+ * \param[in] mca_size - size in bytes of a single dense channel spectrum.
+ * \return pointer to the first dense channel spectrum.
+ */
+char *XspressProcessPlugin::expand_sparse(const FrameHeader *header, const char *mca_ptr, uint32_t mca_size)
+{
+  uint32_t num_bins = (mca_size / sizeof(uint32_t)) * header->num_channels;
+  sparse_spectra_.assign(num_bins, 0);
+  // The DAQ never sends more pairs than would fit in the dense spectra
+  uint32_t num_entries = std::min(header->mca_entries, num_bins / 2);
+  const uint32_t *entry = (const uint32_t *)mca_ptr;
+  for (uint32_t index = 0; index < num_entries; index++){
+    uint32_t bin = entry[index * 2];
+    if (bin < num_bins){
+      sparse_spectra_[bin] = entry[(index * 2) + 1];
+    } else {
+      sparse_invalid_entries_++;
     }
-    else
-    {
-      // Check if we are writing out the last block which is not full size
-      if (frame_id == (num_frames_ - 1)){
-        LOG4CXX_DEBUG_LEVEL(1, logger_, "Sending the metadata as the last frame when the queue is not full");
-        // As this is the last frame block to send, post the scalar buffer as well
-        send_scalars(frame_id, header->num_scalars, header->first_channel, header->num_channels);
-
-        dimensions_t mca_dims;
-        mca_dims.push_back(header->num_aux);
-        mca_dims.push_back(header->num_energy_bins);
-        std::stringstream ss;
-        ss << "mca_" << index + first_channel_index;
-        // Calculate the ID of the frame we need to push
-        // This must be offset according to the rank and number of processes
-        uint32_t push_frame_id = ((frame_id / frames_per_block_) * concurrent_processes_) + concurrent_rank_;
-        FrameMetaData mca_metadata(push_frame_id, ss.str(), raw_32bit, "", mca_dims);
-        boost::shared_ptr<Frame> mca_frame(new DataBlockFrame(mca_metadata, memory_ptrs_[index]->current_byte_size()));
-        memcpy(mca_frame->get_data_ptr(), memory_ptrs_[index]->get_data_ptr(), memory_ptrs_[index]->current_byte_size());
-        // Set the chunking size
-        mca_frame->set_outer_chunk_size((int)memory_ptrs_[index]->frames());
-        // Push out the MCA data
-        this->push(mca_frame);
-        // Reset the memory block
-        memory_ptrs_[index]->reset();
-        LOG4CXX_DEBUG_LEVEL(3, logger_, "Pushed partially full frame as required frame count reached");
-      }
+  }
+  sparse_frames_++;
+  LOG4CXX_DEBUG_LEVEL(3, logger_, "Expanded " << num_entries << " sparse entries for frame "
+                      << header->frame_number);
+  return (char *)&sparse_spectra_[0];
+}
+
+/**
+ * Add the spectra of a frame into the scan summary accumulators.
+ *
+ * \param[in] frame_id - frame number within the acquisition.
+ * \param[in] spectra - pointer to the first channel spectrum.
+ */
+void XspressProcessPlugin::accumulate_scan(uint32_t frame_id, const uint32_t *spectra)
+{
+  uint32_t length = num_energy_bins_ * num_aux_;
+  if (scan_spectra_.size() != num_channels_ * length){
+    scan_spectra_.assign(num_channels_ * length, 0);
+    scan_frame_counts_.clear();
+    scan_count_min_.assign(num_channels_, std::numeric_limits<uint64_t>::max());
+    scan_count_max_.assign(num_channels_, 0);
+    scan_count_total_.assign(num_channels_, 0);
+    scan_frames_ = 0;
+  }
+
+  // Rows of frame totals are relative to the start of the current roll. A
+  // continuous acquisition that is not rolling has no bound on its length,
+  // so no per frame totals are kept for it.
+  uint32_t roll_frames = roll_length_;
+  uint32_t roll_start = current_roll_ * roll_frames;
+  uint32_t row = frame_id - roll_start;
+  uint32_t rows = 0;
+  if (num_frames_ > roll_start){
+    rows = num_frames_ - roll_start;
+  }
+  if (roll_frames > 0 && (rows == 0 || rows > roll_frames)){
+    rows = roll_frames;
+  }
+  bool per_frame = rows > 0;
+  rows = std::max(rows, row + 1);
+  if (per_frame && scan_frame_counts_.size() < rows * num_channels_){
+    scan_frame_counts_.resize(rows * num_channels_, 0);
+  }
+
+  for (uint32_t index = 0; index < num_channels_; index++){
+    uint64_t counts = accumulate_spectrum(spectra + (index * length), length, &scan_spectra_[index * length]);
+    if (per_frame){
+      scan_frame_counts_[(row * num_channels_) + index] = counts;
     }
+    scan_count_min_[index] = std::min(scan_count_min_[index], counts);
+    scan_count_max_[index] = std::max(scan_count_max_[index], counts);
+    scan_count_total_[index] += counts;
   }
+  scan_frames_++;
 }
 
-void XspressProcessPlugin::send_scalars(uint32_t last_frame_id, uint32_t num_scalars, uint32_t first_channel, uint32_t num_channels)
+/**
+ * Clear the scan summary accumulators, which are sized again on the next
+ * accumulation.
+ */
+void XspressProcessPlugin::reset_scan_summary()
 {
-  uint32_t num_scalar_values = num_scalars * num_channels;
-  uint32_t num_dtc_factors = num_channels;
-  uint32_t num_inp_est = num_channels;
-  uint32_t frame_id = last_frame_id - num_scalars_recorded_ + 1;
+  scan_spectra_.clear();
+  scan_frame_counts_.clear();
+  scan_count_min_.clear();
+  scan_count_max_.clear();
+  scan_count_total_.clear();
+  scan_frames_ = 0;
+  scan_summary_written_ = false;
+}
 
-  rapidjson::Document meta_document;
-  meta_document.SetObject();
+/**
+ * Push the scan summary datasets: the summed spectra of each channel, the
+ * total counts of each channel for every frame and the smallest, largest and
+ * mean frame total counts of each channel.
+ *
+ * When rolling, the summary covers the current roll and is pushed with the
+ * frame ID of the first block of the roll, so that it is written to the same
+ * file as the roll's blocks.
+ */
+void XspressProcessPlugin::push_scan_summary()
+{
+  if (scan_frames_ == 0){
+    return;
+  }
+  uint32_t first_block = (current_roll_ * roll_length_) / frames_per_block_;
+  uint32_t push_frame_id = (first_block * concurrent_processes_) + concurrent_rank_;
+
+  dimensions_t spectra_dims;
+  spectra_dims.push_back(num_channels_);
+  spectra_dims.push_back(num_aux_);
+  spectra_dims.push_back(num_energy_bins_);
+  FrameMetaData spectra_metadata(push_frame_id, SCAN_SPECTRA_DATASET_NAME, raw_64bit, "", spectra_dims);
+  boost::shared_ptr<Frame> spectra_frame(new DataBlockFrame(spectra_metadata, &scan_spectra_[0],
+                                                            scan_spectra_.size() * sizeof(uint64_t)));
+  spectra_frame->set_outer_chunk_size(1);
+
+  // One row of channel totals for every frame of the acquisition or roll
+  uint32_t rows = scan_frame_counts_.size() / num_channels_;
+  dimensions_t channel_dims;
+  channel_dims.push_back(num_channels_);
+  boost::shared_ptr<Frame> counts_frame;
+  if (rows > 0){
+    FrameMetaData counts_metadata(push_frame_id, SCAN_FRAME_COUNTS_DATASET_NAME, raw_64bit, "", channel_dims);
+    counts_frame = boost::shared_ptr<Frame>(new DataBlockFrame(counts_metadata, &scan_frame_counts_[0],
+                                                               scan_frame_counts_.size() * sizeof(uint64_t)));
+    counts_frame->set_outer_chunk_size(rows);
+  }
 
-  // Add Acquisition ID
-  rapidjson::Value key_acq_id("acqID", meta_document.GetAllocator());
-  rapidjson::Value value_acq_id;
-  value_acq_id.SetString(acq_id_.c_str(), acq_id_.size(), meta_document.GetAllocator());
-  meta_document.AddMember(key_acq_id, value_acq_id, meta_document.GetAllocator());
-  // Add rank
-  rapidjson::Value key_rank("rank", meta_document.GetAllocator());
-  rapidjson::Value value_rank;
-  value_rank.SetInt(concurrent_rank_);
-  meta_document.AddMember(key_rank, value_rank, meta_document.GetAllocator());
-  // Add frame_id
-  rapidjson::Value key_frame_id("frame_id", meta_document.GetAllocator());
-  rapidjson::Value value_frame_id;
-  value_frame_id.SetInt(frame_id);
-  meta_document.AddMember(key_frame_id, value_frame_id, meta_document.GetAllocator());
-  // Add number of data points
-  rapidjson::Value key_qty("qty_scalars", meta_document.GetAllocator());
-  rapidjson::Value value_qty;
-  value_qty.SetInt(num_scalar_values);
-  meta_document.AddMember(key_qty, value_qty, meta_document.GetAllocator());
-  // Add channel index
-  rapidjson::Value key_index("channel_index", meta_document.GetAllocator());
-  rapidjson::Value value_index;
-  value_index.SetInt(first_channel);
-  meta_document.AddMember(key_index, value_index, meta_document.GetAllocator());
-  // Add number of channels
-  rapidjson::Value key_num("number_of_channels", meta_document.GetAllocator());
-  rapidjson::Value value_num;
-  value_num.SetInt(num_channels);
-  meta_document.AddMember(key_num, value_num, meta_document.GetAllocator());
-  rapidjson::Value key_num_frames("number_of_frames", meta_document.GetAllocator());
-  rapidjson::Value value_num_frames;
-  value_num_frames.SetInt(num_scalars_recorded_);
-  meta_document.AddMember(key_num_frames, value_num_frames, meta_document.GetAllocator());
+  std::vector<float> mean(num_channels_);
+  for (uint32_t index = 0; index < num_channels_; index++){
+    mean[index] = (float)((double)scan_count_total_[index] / scan_frames_);
+  }
+  FrameMetaData min_metadata(push_frame_id, SCAN_COUNT_MIN_DATASET_NAME, raw_64bit, "", channel_dims);
+  boost::shared_ptr<Frame> min_frame(new DataBlockFrame(min_metadata, &scan_count_min_[0],
+                                                        num_channels_ * sizeof(uint64_t)));
+  FrameMetaData max_metadata(push_frame_id, SCAN_COUNT_MAX_DATASET_NAME, raw_64bit, "", channel_dims);
+  boost::shared_ptr<Frame> max_frame(new DataBlockFrame(max_metadata, &scan_count_max_[0],
+                                                        num_channels_ * sizeof(uint64_t)));
+  FrameMetaData mean_metadata(push_frame_id, SCAN_COUNT_MEAN_DATASET_NAME, raw_float, "", channel_dims);
+  boost::shared_ptr<Frame> mean_frame(new DataBlockFrame(mean_metadata, &mean[0], num_channels_ * sizeof(float)));
+
+  boost::shared_ptr<Frame> frames[] = {spectra_frame, counts_frame, min_frame, max_frame, mean_frame};
+  for (uint32_t index = 0; index < 5; index++){
+    // Per frame totals are not kept for a continuous acquisition that is not rolling
+    if (!frames[index]){
+      continue;
+    }
+    // Record which channels the summary covers so files from each process can be combined
+    frames[index]->meta_data().set_parameter<uint32_t>("first_channel", first_channel_);
+    frames[index]->meta_data().set_parameter<uint32_t>("num_channels", num_channels_);
+    frames[index]->meta_data().set_parameter<uint32_t>("frames", scan_frames_);
+    this->push(frames[index]);
+  }
+  scan_summary_written_ = true;
+  LOG4CXX_INFO(logger_, "Pushed scan summary of " << scan_frames_ << " frames for " << num_channels_ << " channels");
+}
 
-  rapidjson::StringBuffer buffer;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-  meta_document.Accept(writer);
+/**
+ * Check whether every block of the acquisition, or of the current roll when
+ * rolling, has been pushed so that the scan summary is complete.
+ *
+ * \return true if the final block has been started and no open block remains
+ * at or before it.
+ */
+bool XspressProcessPlugin::scan_summary_due() const
+{
+  uint32_t end_frame = num_frames_;
+  if (roll_length_ > 0){
+    uint32_t roll_end = (current_roll_ + 1) * roll_length_;
+    if (end_frame == 0 || roll_end < end_frame){
+      end_frame = roll_end;
+    }
+  }
+  if (end_frame == 0){
+    return false;
+  }
+  uint32_t final_block = (end_frame - 1) / frames_per_block_;
+  if (highest_block_ < final_block){
+    return false;
+  }
+  return open_blocks_.empty() || open_blocks_.begin()->first > final_block;
+}
 
-  LOG4CXX_DEBUG_LEVEL(3, logger_, "Publishing MCA scalars: " << buffer.GetString());
-  this->publish_meta(META_NAME,
-                      META_XSPRESS_SCALARS,
-                      scalar_memblock_,
-                      num_scalar_values * num_scalars_recorded_ * sizeof(uint32_t),
-                      buffer.GetString());
+/**
+ * Close the current roll of the output and start a new one. The open blocks
+ * of earlier rolls are pushed, the scan summary of the closed roll is written
+ * if it has not been already and the scan accumulators are reset.
+ *
+ * \param[in] roll - index of the roll to start.
+ */
+void XspressProcessPlugin::start_roll(uint32_t roll)
+{
+  uint32_t first_block = (roll * roll_length_) / frames_per_block_;
+  LOG4CXX_INFO(logger_, "Rolling output from roll " << current_roll_ << " to roll " << roll <<
+                        " starting at block " << first_block);
+  while (!open_blocks_.empty() && open_blocks_.begin()->first < first_block){
+    flush_block(open_blocks_.begin()->first);
+  }
+  if (!scan_summary_written_){
+    push_scan_summary();
+  }
+  reset_scan_summary();
+  current_roll_ = roll;
+  rolls_completed_++;
+}
 
-  this->publish_meta(META_NAME,
-                      META_XSPRESS_DTC,
-                      dtc_memblock_,
-                      num_dtc_factors * num_scalars_recorded_ * sizeof(double),
-                      buffer.GetString());
+/**
+ * Sum the MCA spectra of all channels held in this frame into the scratch
+ * channel sum buffer, optionally applying the dead time correction factors.
+ *
+ * \param[in] mca_ptr - pointer to the first channel spectrum.
+ * \param[in] dtc_ptr - pointer to the dead time correction factors.
+ * \param[in] mca_size - size in bytes of a single channel spectrum.
+ */
+void XspressProcessPlugin::sum_channels(const char *mca_ptr, const double *dtc_ptr, uint32_t mca_size)
+{
+  uint32_t length = mca_size / sizeof(uint32_t);
+  if (sum_dtc_){
+    reduce_channels_dtc((const uint32_t *)mca_ptr, dtc_ptr, num_channels_, length, &sum_corrected_[0]);
+  } else {
+    reduce_channels((const uint32_t *)mca_ptr, num_channels_, length, &sum_counts_[0]);
+  }
+}
 
-  this->publish_meta(META_NAME,
-                      META_XSPRESS_INP_EST,
-                      inp_est_memblock_,
-                      num_inp_est * num_scalars_recorded_ * sizeof(double),
-                      buffer.GetString());
+/**
+ * Create a frame from the contents of a memory block ready to be pushed.
+ *
+ * The frame ID is offset according to the rank and number of processes.
+ *
+ * \param[in] block - memory block to copy.
+ * \param[in] dataset - name of the dataset for the frame.
+ * \param[in] data_type - data type of the values held in the block.
+ * \param[in] block_index - index of the block within the acquisition.
+ * \param[in] num_frames - number of frames to include from the block.
+ * \return the frame.
+ */
+boost::shared_ptr<Frame> XspressProcessPlugin::create_block_frame(boost::shared_ptr<XspressMemoryBlock> block,
+                                                                  const std::string& dataset,
+                                                                  DataType data_type,
+                                                                  uint32_t block_index,
+                                                                  uint32_t num_frames)
+{
+  dimensions_t dims;
+  dims.push_back(num_aux_);
+  dims.push_back(num_energy_bins_);
+  // Calculate the ID of the frame we need to push
+  // This must be offset according to the rank and number of processes
+  uint32_t push_frame_id = (block_index * concurrent_processes_) + concurrent_rank_;
+  FrameMetaData metadata(push_frame_id, dataset, data_type, "", dims);
+  uint32_t bytes = num_frames * block->frame_size();
+  boost::shared_ptr<Frame> frame(new DataBlockFrame(metadata, bytes));
+  memcpy(frame->get_data_ptr(), block->get_data_ptr(), bytes);
+  // Set the chunking size
+  frame->set_outer_chunk_size(num_frames);
+  return frame;
+}
 
-  num_scalars_recorded_ = 0;
+/**
+ * Create a frame from the contents of a memory block with the values narrowed
+ * to the packing type of the acquisition.
+ *
+ * The largest value in the block is found first. If every value fits, the
+ * values are narrowed directly. Otherwise the block is written unchanged at
+ * 32 bit to the overflow dataset for the channel, and the narrow frame is
+ * zero filled and marked with the number of values that did not fit, so that
+ * packing never loses counts and the narrow dataset still receives a frame for
+ * every block.
+ *
+ * \param[in] block - the block to create the frame from.
+ * \param[in] dataset - name of the dataset for the frame.
+ * \param[in] block_index - index of the block within the acquisition.
+ * \param[in] num_frames - number of frames to include from the block.
+ * \param[out] overflow_frame - set to the 32 bit frame if the block did not fit.
+ * \return the frame.
+ */
+boost::shared_ptr<Frame> XspressProcessPlugin::create_packed_frame(boost::shared_ptr<XspressMemoryBlock> block,
+                                                                   const std::string& dataset,
+                                                                   uint32_t block_index,
+                                                                   uint32_t num_frames,
+                                                                   boost::shared_ptr<Frame>& overflow_frame)
+{
+  dimensions_t dims;
+  dims.push_back(num_aux_);
+  dims.push_back(num_energy_bins_);
+  uint32_t push_frame_id = (block_index * concurrent_processes_) + concurrent_rank_;
+  DataType data_type = packing_bits_ == 8 ? raw_8bit : raw_16bit;
+  FrameMetaData metadata(push_frame_id, dataset, data_type, "", dims);
+
+  const uint32_t *src = (const uint32_t *)block->get_data_ptr();
+  uint32_t length = num_frames * (block->frame_size() / sizeof(uint32_t));
+  boost::shared_ptr<Frame> frame(new DataBlockFrame(metadata, length * (packing_bits_ / 8)));
+  uint32_t limit = packing_bits_ == 8 ? std::numeric_limits<uint8_t>::max() : std::numeric_limits<uint16_t>::max();
+  uint32_t largest = max_value(src, length);
+  if (largest <= limit){
+    if (packing_bits_ == 8){
+      narrow_values(src, length, (uint8_t *)frame->get_data_ptr());
+    } else {
+      narrow_values(src, length, (uint16_t *)frame->get_data_ptr());
+    }
+    packed_blocks_++;
+  } else {
+    uint32_t overflowed = count_above(src, length, limit);
+    // Only warn for the first overflow of an acquisition, the counters record the rest
+    if (overflow_blocks_ == 0){
+      LOG4CXX_WARN(logger_, "MCA values in block " << block_index << " of " << dataset << " reach " << largest
+                            << ", writing the block to " << dataset << OVERFLOW_DATASET_SUFFIX << " at 32 bit");
+    }
+    overflow_blocks_++;
+    overflow_bins_ += overflowed;
+    memset(frame->get_data_ptr(), 0, length * (packing_bits_ / 8));
+    frame->meta_data().set_parameter<uint32_t>("overflow", overflowed);
+    overflow_frame = create_block_frame(block, dataset + OVERFLOW_DATASET_SUFFIX, raw_32bit, block_index, num_frames);
+  }
+  frame->set_outer_chunk_size(num_frames);
+  return frame;
+}
+
+/**
+ * Publish the scalars, dtc factors, input estimates and fill mask of a block
+ * as a single packed binary meta data message.
+ *
+ * The values are already held in the packed block, so only the binary header
+ * needs filling in before publishing.
+ *
+ * \param[in] block - the block to publish.
+ * \param[in] num_scalars - number of scalars for each channel.
+ * \param[in] first_channel - index of the first channel.
+ */
+void XspressProcessPlugin::send_scalars(boost::shared_ptr<XspressBlockSet> block, uint32_t num_scalars, uint32_t first_channel)
+{
+  MetaBlockHeader *meta_header = block->meta_header();
+  meta_header->version = XSP_META_BLOCK_VERSION;
+  meta_header->rank = concurrent_rank_;
+  meta_header->frame_id = block->first_frame();
+  meta_header->num_frames = block->expected_frames();
+  meta_header->frame_capacity = frames_per_block_;
+  meta_header->first_channel = first_channel;
+  meta_header->num_channels = num_channels_;
+  meta_header->num_scalars = num_scalars;
+
+  LOG4CXX_DEBUG_LEVEL(3, logger_, "Publishing MCA scalars for frame " << block->first_frame()
+                                  << " number of frames " << block->expected_frames());
+  this->publish_meta(META_NAME,
+                     META_XSPRESS_BLOCK,
+                     block->meta_header(),
+                     block->meta_size(),
+                     meta_json_header_);
 }
 }
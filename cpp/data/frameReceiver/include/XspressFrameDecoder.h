@@ -11,6 +11,7 @@ using namespace log4cxx::helpers;
 
 #include "FrameDecoderZMQ.h"
 #include "XspressDefinitions.h"
+#include "XspressMetrics.h"
 #include "IpcMessage.h"
 
 namespace FrameReceiver {
@@ -52,6 +53,8 @@ namespace FrameReceiver {
     void get_status(const std::string param_prefix, OdinData::IpcMessage &status_msg);
 
   private:
+    std::string render_metrics(void);
+
     void *current_frame_buffer_;
     void *dropped_frame_buffer_;
     int32_t current_frame_buffer_id_;
@@ -59,10 +62,16 @@ namespace FrameReceiver {
     enum XspressState current_state;
     // statistics
     unsigned int frames_dropped_;
+    uint64_t frames_received_;
+    uint64_t bytes_received_;
+    size_t empty_buffers_;
+    size_t total_buffers_;
     size_t numChannels;
     uint32_t numEnergy;
     uint32_t numAux;
     size_t currentChannel;
+    // metrics endpoint, declared last so it stops before the statistics go
+    Xspress::XspressMetricsServer metrics_server_;
 
   };
 
@@ -11,6 +11,7 @@ using namespace log4cxx::helpers;
 
 #include "FrameDecoderUDP.h"
 #include "XspressDefinitions.h"
+#include "XspressMetrics.h"
 #include "IpcMessage.h"
 #include "gettime.h"
 
@@ -62,6 +63,8 @@ class XspressListModeFrameDecoder : public FrameDecoderUDP {
 
 
   private:
+    std::string render_metrics(void);
+
     boost::shared_ptr<void> current_raw_packet_header_;
     boost::shared_ptr<void> dropped_frame_buffer_;
     void *current_frame_buffer_;
@@ -74,6 +77,12 @@ class XspressListModeFrameDecoder : public FrameDecoderUDP {
     enum XspressState current_state;
     // statistics
     unsigned int frames_dropped_;
+    uint64_t packets_received_;
+    uint64_t packets_dropped_;
+    uint64_t bytes_received_;
+    uint64_t frames_completed_;
+    size_t empty_buffers_;
+    size_t total_buffers_;
     std::map<std::string, uint32_t> channel_map_;
     struct sockaddr_in server_address_;
     int server_socket_;
@@ -81,6 +90,8 @@ class XspressListModeFrameDecoder : public FrameDecoderUDP {
     struct timespec init_time_;
     // Initialising flag
     bool initialising_;
+    // metrics endpoint, declared last so it stops before the statistics go
+    Xspress::XspressMetricsServer metrics_server_;
   };
 
 }
@@ -1,11 +1,16 @@
 #include <iostream>
 #include "XspressFrameDecoder.h"
 
+#define CONFIG_METRICS_PORT "metrics_port"
+#define CONFIG_METRICS_ADDRESS "metrics_address"
+
 namespace FrameReceiver {
 
     XspressFrameDecoder::XspressFrameDecoder() : FrameDecoderZMQ(), current_frame_buffer_(NULL), current_frame_number_(0),
                                          current_frame_buffer_id_(-1), current_state(WAITING_FOR_HEADER),
-                                         frames_dropped_(0), numChannels(8), numEnergy(4096), numAux(1), currentChannel(0) 
+                                         frames_dropped_(0), frames_received_(0), bytes_received_(0),
+                                         empty_buffers_(0), total_buffers_(0),
+                                         numChannels(8), numEnergy(4096), numAux(1), currentChannel(0) 
     {
       // Allocate memory for the dropped frames buffer
       dropped_frame_buffer_ = malloc(get_frame_buffer_size());
@@ -18,6 +23,14 @@ namespace FrameReceiver {
         this->logger_ = Logger::getLogger("FR.XspressFrameDecoder");
         this->logger_->setLevel(Level::getAll());
         FrameDecoder::init(logger, config_msg);
+        if (config_msg.has_param(CONFIG_METRICS_PORT)) {
+          int port = config_msg.get_param<int>(CONFIG_METRICS_PORT);
+          std::string address = XSP_METRICS_DEFAULT_ADDRESS;
+          if (config_msg.has_param(CONFIG_METRICS_ADDRESS)) {
+            address = config_msg.get_param<std::string>(CONFIG_METRICS_ADDRESS);
+          }
+          metrics_server_.start(port, boost::bind(&XspressFrameDecoder::render_metrics, this), address);
+        }
         LOG4CXX_INFO(logger_, "Xspress frame decoder init complete");
     }
 
@@ -40,6 +53,8 @@ namespace FrameReceiver {
     {
         FrameHeader *header_ = reinterpret_cast<FrameHeader*> (current_frame_buffer_);
         current_frame_number_ = header_->frame_number;
+        frames_received_++;
+        bytes_received_ += bytes_received;
         if (current_frame_buffer_id_ != -1){
           ready_callback_(current_frame_buffer_id_, current_frame_number_);
         }
@@ -56,6 +71,21 @@ namespace FrameReceiver {
 
     void XspressFrameDecoder::monitor_buffers(void) {
       LOG4CXX_DEBUG_LEVEL(1, logger_, "Empty: " << empty_buffer_queue_.size() << " Dropped: " << frames_dropped_);
+      // Snapshot the buffer pool for the metrics thread
+      empty_buffers_ = empty_buffer_queue_.size();
+      if (buffer_manager_){
+        total_buffers_ = buffer_manager_->get_num_buffers();
+      }
+    }
+
+    std::string XspressFrameDecoder::render_metrics(void) {
+      Xspress::XspressMetricsWriter writer("xspress_fr_");
+      writer.counter("frames_received", "Frames received from the DAQ", frames_received_);
+      writer.counter("bytes_received", "Bytes received from the DAQ", bytes_received_);
+      writer.counter("frames_dropped", "Frames dropped for lack of a free buffer", frames_dropped_);
+      writer.gauge("buffers_empty", "Empty frame buffers at the last buffer check", empty_buffers_);
+      writer.gauge("buffers_total", "Frame buffers in the shared memory pool", total_buffers_);
+      return writer.str();
     }
 
     void XspressFrameDecoder::get_status(const std::string param_prefix, OdinData::IpcMessage &status_msg) {
@@ -10,6 +10,10 @@
 #define XSPRESS_ACK_SIZE 6
 // Initialisation time (us).  For this duration after init packets will be ignored
 #define XSPRESS_INIT_TIME 1000000
+// Decoder configuration item for the OpenMetrics port
+#define CONFIG_METRICS_PORT "metrics_port"
+// Decoder configuration item for the OpenMetrics listen address
+#define CONFIG_METRICS_ADDRESS "metrics_address"
 
 namespace FrameReceiver {
 
@@ -20,6 +24,12 @@ namespace FrameReceiver {
       current_frame_buffer_id_(-1),
       current_state(WAITING_FOR_HEADER),
       frames_dropped_(0),
+      packets_received_(0),
+      packets_dropped_(0),
+      bytes_received_(0),
+      frames_completed_(0),
+      empty_buffers_(0),
+      total_buffers_(0),
       server_socket_(0),
       initialising_(true)
     {
@@ -62,6 +72,14 @@ namespace FrameReceiver {
         this->logger_ = Logger::getLogger("FR.XspressListModeFrameDecoder");
         this->logger_->setLevel(Level::getAll());
         FrameDecoder::init(logger, config_msg);
+        if (config_msg.has_param(CONFIG_METRICS_PORT)) {
+          int port = config_msg.get_param<int>(CONFIG_METRICS_PORT);
+          std::string address = XSP_METRICS_DEFAULT_ADDRESS;
+          if (config_msg.has_param(CONFIG_METRICS_ADDRESS)) {
+            address = config_msg.get_param<std::string>(CONFIG_METRICS_ADDRESS);
+          }
+          metrics_server_.start(port, boost::bind(&XspressListModeFrameDecoder::render_metrics, this), address);
+        }
         LOG4CXX_INFO(logger_, "Xspress list mode frame decoder init complete");
         gettime(&init_time_);
   }
@@ -194,6 +212,12 @@ namespace FrameReceiver {
       // Set the channel number in the frame header
       current_frame_header_->packet_headers[current_frame_header_->packets_received].channel = channel;
 
+      packets_received_++;
+      bytes_received_ += bytes_received;
+      if (dropping_frame_data_) {
+        packets_dropped_++;
+      }
+
       // Increment the number of packets received for this frame
       if (!dropping_frame_data_) {
         current_frame_header_->packets_received++;
@@ -206,6 +230,7 @@ namespace FrameReceiver {
           // Notify main thread that frame is ready
           ready_callback_(current_frame_buffer_id_, current_frame_number_);
           current_frame_number_++;
+          frames_completed_++;
           current_frame_buffer_id_ = -1;
           // Set frame state accordingly
           frame_state = FrameDecoder::FrameReceiveStateComplete;
@@ -216,7 +241,23 @@ namespace FrameReceiver {
 
     void XspressListModeFrameDecoder::monitor_buffers(void)
     {
+      // Snapshot the buffer pool for the metrics thread
+      empty_buffers_ = empty_buffer_queue_.size();
+      if (buffer_manager_){
+        total_buffers_ = buffer_manager_->get_num_buffers();
+      }
+    }
 
+    std::string XspressListModeFrameDecoder::render_metrics(void)
+    {
+      Xspress::XspressMetricsWriter writer("xspress_fr_list_");
+      writer.counter("packets_received", "List mode packets received", packets_received_);
+      writer.counter("packets_dropped", "List mode packets dropped for lack of a free buffer", packets_dropped_);
+      writer.counter("bytes_received", "List mode bytes received", bytes_received_);
+      writer.counter("frames_completed", "Frame buffers completed and passed on", frames_completed_);
+      writer.gauge("buffers_empty", "Empty frame buffers at the last buffer check", empty_buffers_);
+      writer.gauge("buffers_total", "Frame buffers in the shared memory pool", total_buffers_);
+      return writer.str();
     }
 
     void XspressListModeFrameDecoder::get_status(const std::string param_prefix, OdinData::IpcMessage& status_msg)
@@ -196,6 +196,21 @@ class XspressDetectorStr:
     STATUS_MODEL = "model"
     STATUS_ACQ_COMPLETE = "acquisition_complete"
     STATUS_FRAMES = "frames_acquired"
+    STATUS_SPARSE_FRAMES = "sparse_frames"
+    STATUS_ARM_LATENCY = "arm_latency"
+    STATUS_ARM_PREPARED = "arm_prepared"
+    STATUS_CONFIGURE_LATENCY = "configure_latency"
+    STATUS_CONNECT_TIME_COLD = "connect_time_cold"
+    STATUS_CONNECT_TIME_WARM = "connect_time_warm"
+    STATUS_QUEUE_SEGMENT = "queue_segment"
+    STATUS_QUEUE_PENDING = "queue_pending"
+    STATUS_SEGMENT_ACQ_ID = "segment_acq_id"
+    STATUS_SEGMENT_DEAD_TIME = "segment_dead_time"
+    STATUS_FRAME_RATE = "frame_rate"
+    STATUS_DATA_RATE = "data_rate"
+    STATUS_BUFFER_HEADROOM = "buffer_headroom"
+    STATUS_MIN_BUFFER_HEADROOM = "min_buffer_headroom"
+    STATUS_GENERATION = "generation"
     STATUS_SCALAR_0 = "scalar_0"
     STATUS_SCALAR_1 = "scalar_1"
     STATUS_SCALAR_2 = "scalar_2"
@@ -233,6 +248,11 @@ class XspressDetectorStr:
     APP_SHUTDOWN = "shutdow"
     APP_DEBUG = "debug_level"
     APP_CTRL_ENDPOINT = "ctrl_endpoint"
+    APP_STATUS_REFRESH = "status_refresh"
+    APP_TELEMETRY_ENDPOINT = "telemetry_endpoint"
+    APP_TELEMETRY_PERIOD = "telemetry_period"
+    APP_METRICS_PORT = "metrics_port"
+    APP_METRICS_ADDRESS = "metrics_address"
     CONFIG_REQUEST = "request_configuration"
 
     CONFIG = "config"
@@ -254,8 +274,13 @@ class XspressDetectorStr:
     CONFIG_DEBOUNCE = "debounce"
     CONFIG_EXPOSURE_TIME = "exposure_time"
     CONFIG_NUM_IMAGES = "num_images"  # so only "num_images" is used
+    CONFIG_CONTINUOUS = "continuous"
 
     CONFIG_MODE = "mode"
+    CONFIG_FRAMES_SAMPLE_PERIOD = "frames_sample_period"
+    CONFIG_TEMP_SAMPLE_PERIOD = "temperature_sample_period"
+    CONFIG_PARALLEL_SETUP = "parallel_setup"
+    CONFIG_SETTINGS_CACHE = "settings_cache"
     CONFIG_MODE_CONTROL = "mode_control"
     CONFIG_SCA5_LOW = "sca5_low_lim"
     CONFIG_SCA5_HIGH = "sca5_high_lim"
@@ -276,6 +301,7 @@ class XspressDetectorStr:
     CONFIG_DAQ = "daq"
     CONFIG_DAQ_ENABLED = "enabled"
     CONFIG_DAQ_ZMQ_ENDPOINTS = "endpoints"
+    CONFIG_DAQ_SPARSE_THRESHOLD = "sparse_threshold"
 
     CMD = "command"
     CMD_RECONFIGURE = "reconfigure"
@@ -286,6 +312,8 @@ class XspressDetectorStr:
     CMD_START = "start"
     CMD_STOP = "stop"
     CMD_TRIGGER = "trigger"
+    CMD_REARM = "rearm"
+    CMD_QUEUE = "queue"
     CMD_START_ACQUISITION = "start_acquisition"
     CMD_STOP_ACQUISITION = "stop_acquisition"
 
@@ -371,6 +399,49 @@ class XspressDetector(object):
                         self._put, MessageType.APP, XspressDetectorStr.APP_SHUTDOWN
                     ),
                 ),
+                XspressDetectorStr.APP_STATUS_REFRESH: ValueParameter(
+                    int,
+                    100,
+                    partial(
+                        self._put, MessageType.APP, XspressDetectorStr.APP_STATUS_REFRESH
+                    ),
+                ),
+                XspressDetectorStr.APP_TELEMETRY_ENDPOINT: ValueParameter(
+                    str,
+                    "",
+                    partial(
+                        self._put,
+                        MessageType.APP,
+                        XspressDetectorStr.APP_TELEMETRY_ENDPOINT,
+                    ),
+                ),
+                XspressDetectorStr.APP_TELEMETRY_PERIOD: ValueParameter(
+                    int,
+                    100,
+                    partial(
+                        self._put,
+                        MessageType.APP,
+                        XspressDetectorStr.APP_TELEMETRY_PERIOD,
+                    ),
+                ),
+                XspressDetectorStr.APP_METRICS_PORT: ValueParameter(
+                    int,
+                    0,
+                    partial(
+                        self._put,
+                        MessageType.APP,
+                        XspressDetectorStr.APP_METRICS_PORT,
+                    ),
+                ),
+                XspressDetectorStr.APP_METRICS_ADDRESS: ValueParameter(
+                    str,
+                    "127.0.0.1",
+                    partial(
+                        self._put,
+                        MessageType.APP,
+                        XspressDetectorStr.APP_METRICS_ADDRESS,
+                    ),
+                ),
             },
             XspressDetectorStr.CONFIG_DAQ: {
                 XspressDetectorStr.CONFIG_DAQ_ENABLED: ValueParameter(
@@ -383,6 +454,15 @@ class XspressDetector(object):
                     ),
                 ),
                 XspressDetectorStr.CONFIG_DAQ_ZMQ_ENDPOINTS: ListParameter(),
+                XspressDetectorStr.CONFIG_DAQ_SPARSE_THRESHOLD: ValueParameter(
+                    float,
+                    0.0,
+                    partial(
+                        self._put,
+                        MessageType.DAQ,
+                        XspressDetectorStr.CONFIG_DAQ_SPARSE_THRESHOLD,
+                    ),
+                ),
             },
             XspressDetectorStr.CONFIG_REQUEST: WriteOnlyVirtualParameter(
                 int, self.read_config
@@ -440,6 +520,49 @@ class XspressDetector(object):
                     partial(self._set, "acquisition_complete"),
                 ),
                 XspressDetectorStr.STATUS_FRAMES: TransparentValueParameter(int, 0),
+                XspressDetectorStr.STATUS_SPARSE_FRAMES: TransparentValueParameter(
+                    int, 0
+                ),
+                XspressDetectorStr.STATUS_ARM_LATENCY: TransparentValueParameter(
+                    int, 0
+                ),
+                XspressDetectorStr.STATUS_ARM_PREPARED: TransparentValueParameter(
+                    bool, False
+                ),
+                XspressDetectorStr.STATUS_CONFIGURE_LATENCY: TransparentValueParameter(
+                    int, 0
+                ),
+                XspressDetectorStr.STATUS_CONNECT_TIME_COLD: TransparentValueParameter(
+                    int, 0
+                ),
+                XspressDetectorStr.STATUS_CONNECT_TIME_WARM: TransparentValueParameter(
+                    int, 0
+                ),
+                XspressDetectorStr.STATUS_QUEUE_SEGMENT: TransparentValueParameter(
+                    int, 0
+                ),
+                XspressDetectorStr.STATUS_QUEUE_PENDING: TransparentValueParameter(
+                    int, 0
+                ),
+                XspressDetectorStr.STATUS_SEGMENT_ACQ_ID: TransparentValueParameter(
+                    str, ""
+                ),
+                XspressDetectorStr.STATUS_SEGMENT_DEAD_TIME: TransparentValueParameter(
+                    int, 0
+                ),
+                XspressDetectorStr.STATUS_FRAME_RATE: TransparentValueParameter(
+                    float, 0.0
+                ),
+                XspressDetectorStr.STATUS_DATA_RATE: TransparentValueParameter(
+                    float, 0.0
+                ),
+                XspressDetectorStr.STATUS_BUFFER_HEADROOM: TransparentValueParameter(
+                    float, 1.0
+                ),
+                XspressDetectorStr.STATUS_MIN_BUFFER_HEADROOM: TransparentValueParameter(
+                    float, 1.0
+                ),
+                XspressDetectorStr.STATUS_GENERATION: TransparentValueParameter(int, 0),
                 XspressDetectorStr.STATUS_SCALAR_0: ListParameter(),
                 XspressDetectorStr.STATUS_SCALAR_1: ListParameter(),
                 XspressDetectorStr.STATUS_SCALAR_2: ListParameter(),
@@ -640,6 +763,51 @@ class XspressDetector(object):
                         XspressDetectorStr.CONFIG_NUM_IMAGES,
                     ),
                 ),
+                XspressDetectorStr.CONFIG_CONTINUOUS: ValueParameter(
+                    bool,
+                    False,
+                    partial(
+                        self._put,
+                        MessageType.CONFIG,
+                        XspressDetectorStr.CONFIG_CONTINUOUS,
+                    ),
+                ),
+                XspressDetectorStr.CONFIG_FRAMES_SAMPLE_PERIOD: ValueParameter(
+                    int,
+                    200,
+                    partial(
+                        self._put,
+                        MessageType.CONFIG,
+                        XspressDetectorStr.CONFIG_FRAMES_SAMPLE_PERIOD,
+                    ),
+                ),
+                XspressDetectorStr.CONFIG_TEMP_SAMPLE_PERIOD: ValueParameter(
+                    int,
+                    5000,
+                    partial(
+                        self._put,
+                        MessageType.CONFIG,
+                        XspressDetectorStr.CONFIG_TEMP_SAMPLE_PERIOD,
+                    ),
+                ),
+                XspressDetectorStr.CONFIG_PARALLEL_SETUP: ValueParameter(
+                    bool,
+                    False,
+                    partial(
+                        self._put,
+                        MessageType.CONFIG,
+                        XspressDetectorStr.CONFIG_PARALLEL_SETUP,
+                    ),
+                ),
+                XspressDetectorStr.CONFIG_SETTINGS_CACHE: ValueParameter(
+                    bool,
+                    True,
+                    partial(
+                        self._put,
+                        MessageType.CONFIG,
+                        XspressDetectorStr.CONFIG_SETTINGS_CACHE,
+                    ),
+                ),
                 XspressDetectorStr.CONFIG_SCA5_LOW: ListParameter(
                     partial(
                         self._put,
@@ -715,6 +883,13 @@ class XspressDetector(object):
                     int,
                     partial(self._put, MessageType.CMD, XspressDetectorStr.CMD_TRIGGER),
                 ),
+                XspressDetectorStr.CMD_REARM: WriteOnlyVirtualParameter(
+                    int,
+                    partial(self._put, MessageType.CMD, XspressDetectorStr.CMD_REARM),
+                ),
+                XspressDetectorStr.CMD_QUEUE: WriteOnlyVirtualParameter(
+                    list, self.queue_acquisition
+                ),
                 XspressDetectorStr.CMD_START_ACQUISITION: WriteOnlyVirtualParameter(
                     int, partial(self.acquire, 1), validate=False
                 ),
@@ -816,6 +991,31 @@ class XspressDetector(object):
             for i in range(self.mca_channels):
                 fp_index = i // self.num_chan_per_process_mca
                 configs[fp_index]["hdf"]["dataset"][f"mca_{i}"] = dataset_values
+                # Blocks that do not fit the packing type are written here at 32 bit
+                configs[fp_index]["hdf"]["dataset"][f"mca_{i}_overflow"] = {
+                    "datatype": "uint32",
+                    "dims": [1, 4096],
+                    "chunks": [1, 1, 4096],
+                }
+            # Channel sum of each process, float when the sum is dead time corrected
+            sum_values = {"datatype": "uint32", "dims": [1, 4096], "chunks": [1, 1, 4096]}
+            for config in configs:
+                config["hdf"]["dataset"]["mca_sum"] = copy.deepcopy(sum_values)
+            # Scan summary datasets, written once at the end of each acquisition
+            chans = self.num_chan_per_process_mca
+            summary_values = {
+                "scan_spectra": {
+                    "datatype": "uint64",
+                    "dims": [chans, 1, 4096],
+                    "chunks": [1, chans, 1, 4096],
+                },
+                "scan_frame_counts": {"datatype": "uint64", "dims": [chans]},
+                "scan_count_min": {"datatype": "uint64", "dims": [chans]},
+                "scan_count_max": {"datatype": "uint64", "dims": [chans]},
+                "scan_count_mean": {"datatype": "float", "dims": [chans]},
+            }
+            for config in configs:
+                config["hdf"]["dataset"].update(copy.deepcopy(summary_values))
 
         tasks = ()
         for client, config in zip(self.fp_clients, configs):
@@ -902,6 +1102,19 @@ class XspressDetector(object):
         else:
             return await self._put(MessageType.CMD, XspressDetectorStr.CMD_STOP, 1)
 
+    async def queue_acquisition(self, segments, *unused):
+        """
+        Run a list of acquisition segments back to back.
+
+        Each segment is a dict which may set num_images, exposure_time,
+        trigger_mode and acq_id. Frames are numbered continuously across the
+        segments, so the file writer should be configured for the total
+        number of frames of all of the segments.
+        """
+        reply = await self._put(MessageType.CMD, XspressDetectorStr.CMD_QUEUE, segments)
+        self.acquisition_complete = False
+        return reply
+
     async def set_mode(self, value):
         if value == 0:
             return await self._put(
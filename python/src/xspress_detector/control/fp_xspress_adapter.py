@@ -54,6 +54,9 @@ class FPXspressAdapter(FPCompressionAdapter):
         self._num_process = 1
         self._mca_per_client = 0
         self._batch_size = 0
+        self._mca_datatype = "uint32"
+        self._roll_frames = 0
+        self._sum_dtc = False
         super(FPXspressAdapter, self).__init__(**kwargs)
 
     def initialize(self, adapters):
@@ -81,6 +84,10 @@ class FPXspressAdapter(FPCompressionAdapter):
     def put(self, path, request):  # pylint: disable=W0613
         if path.startswith("config/hdf/dataset/data"):
             self.configure_data_datasets(path,request)
+        if path.startswith("config/xspress/roll"):
+            self.configure_roll(request)
+        if path.startswith("config/xspress/sum"):
+            self.configure_sum(path, request)
         if path == self._command:
             # Check the mode we are running in (mca or list)
             mode = self._xsp_adapter.detector.mode
@@ -154,6 +161,11 @@ class FPXspressAdapter(FPCompressionAdapter):
 
 
     def setup_rank(self):
+        # Roll the files at the same frames as the XspressProcessPlugin rolls
+        # its output, which pushes one frame per block of chunks frames
+        blocks_per_file = 0
+        if self._roll_frames > 0 and self._batch_size > 0:
+            blocks_per_file = (self._roll_frames + self._batch_size - 1) // self._batch_size
         for client in self._clients:
             # First send a message to XspressProcessPlugin, to update how many MCA are going send per batch.
             try:
@@ -162,25 +174,53 @@ class FPXspressAdapter(FPCompressionAdapter):
                         "process": {
                             "number": 1,
                             "rank": 0,
+                            "blocks_per_file": int(blocks_per_file),
                         },
                     },
                     "xspress": {
                         "frames": self._param["config/hdf/frames"],
                         "acq_id": self._param["config/hdf/acquisition_id"],
                         "chunks": int(self._batch_size),
+                        "packing": {"type": self._mca_datatype},
+                        "roll": {"frames": int(self._roll_frames)},
                     },
                     "xspress-list": {"reset": True},
                 }
+                # The channel sum dataset type follows the dead time correction setting
+                parameters["hdf"]["dataset"] = {
+                    "mca_sum": {"datatype": "float" if self._sum_dtc else "uint32"}
+                }
                 logging.warning("Sending: {}".format(parameters))
                 client.send_configuration(parameters)
             except Exception as err:
                 logging.debug(OdinDataAdapter.ERROR_FAILED_TO_SEND)
                 logging.error("Error: %s", err)
 
+    def configure_roll(self, request):
+        # The roll length is sent either as {"frames": N} or as the bare value
+        value = json_decode(request.body)
+        if isinstance(value, dict):
+            value = value.get("frames", self._roll_frames)
+        self._roll_frames = max(int(value), 0)
+
+    def configure_sum(self, path, request):
+        # The dead time correction flag is sent either as {"dtc": flag} or as the bare value
+        value = json_decode(request.body)
+        if isinstance(value, dict):
+            if "dtc" in value:
+                self._sum_dtc = bool_from_string(str(value["dtc"]))
+        elif path.endswith("/dtc"):
+            self._sum_dtc = bool_from_string(str(value))
+
     def configure_data_datasets(self, path, request):
         if "chunks" in str(escape.url_unescape(request.body)):
             value = json_decode(request.body)
             self._batch_size = value["chunks"][0]
+        if "datatype" in str(escape.url_unescape(request.body)):
+            # The MCA values are packed to match the dataset type for the next acquisition
+            value = json_decode(request.body)
+            if value["datatype"] in ("uint8", "uint16", "uint32"):
+                self._mca_datatype = value["datatype"]
         for client in range(self._num_process):
             for dataset in self.data_datasets[
                 client * self._mca_per_client : (client + 1) * self._mca_per_client
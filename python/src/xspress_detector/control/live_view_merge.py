@@ -36,13 +36,24 @@ class LiveViewCombiner(object):
             frame[port] = None
         return frame
 
+    def combine_sum(self, header, frame):
+        """Add the partial channel sums published by each FP into one spectrum."""
+        dtype = np.float32 if header["dtype"] == "float" else np.dtype(header["dtype"])
+        total = None
+        for index in frame:
+            partial = np.frombuffer(frame[index], dtype=dtype)
+            total = partial.copy() if total is None else total + partial
+        data = total.tobytes()
+        header["dsize"] = len(data)
+        return header, data
+
     def listen(self):
         poller = zmq.Poller()
         for socket in self._subscribers:
             poller.register(socket, zmq.POLLIN)
 
-        current_frame = self.new_frame()
-        current_index = 0
+        # Frames are collected separately for each dataset (e.g. live, live_sum)
+        current_frames = {}
         while True:
             socks = dict(poller.poll())
             for socket in self._subscribers:
@@ -51,6 +62,10 @@ class LiveViewCombiner(object):
                     header = json.loads(message[0].decode('utf-8'))
                     data = message[1]
 
+                    dataset = header.get("dataset", "live")
+                    if dataset not in current_frames:
+                        current_frames[dataset] = self.new_frame()
+                    current_frame = current_frames[dataset]
                     current_frame[self._subscribers[socket]] = data
                     publish = True
                     for port in current_frame:
@@ -58,19 +73,22 @@ class LiveViewCombiner(object):
                             publish = False
                     
                     if publish:
-                        header['shape'] = [str(int(header['shape'][0])*int(header['shape'][1])*len(self._subscribers)), header['shape'][2]]
-                        new_data = None
-                        for index in current_frame:
-                            if new_data is None:
-                                new_data = current_frame[index]
-                            else:
-                                new_data = new_data + current_frame[index]
-                        header['dsize'] = len(new_data)
+                        if dataset == "live_sum":
+                            header, new_data = self.combine_sum(header, current_frame)
+                        else:
+                            header['shape'] = [str(int(header['shape'][0])*int(header['shape'][1])*len(self._subscribers)), header['shape'][2]]
+                            new_data = None
+                            for index in current_frame:
+                                if new_data is None:
+                                    new_data = current_frame[index]
+                                else:
+                                    new_data = new_data + current_frame[index]
+                            header['dsize'] = len(new_data)
 
                         self._publisher.send_json(header, zmq.SNDMORE)
                         self._publisher.send(new_data)
 
-                        current_frame = self.new_frame()
+                        current_frames[dataset] = self.new_frame()
 
 def options():
     parser = argparse.ArgumentParser()
@@ -0,0 +1,55 @@
+"""Reader side of the list mode prefilter
+
+Blocks written to raw_N with the XspressListModeProcessPlugin prefilter
+enabled hold byte planes of the words with the 40 bit time stamp field delta
+encoded, see XspressListModeFilter.h. Each written frame is filtered
+independently, so a frame must be decoded as a whole. The byte length of
+every filtered frame is written to raw_N_frames, whose presence marks raw_N
+as prefiltered, and decode_dataset uses it to split raw_N back into frames.
+"""
+
+import numpy
+
+TIME_SHIFT = 16
+TIME_MASK = numpy.uint64(0xFFFFFFFFFF)
+FIELD_MASK = ~(TIME_MASK << numpy.uint64(TIME_SHIFT))
+
+
+def encode(words):
+    """Filter a block of uint64 words, returning the filtered block as uint64"""
+    words = numpy.ascontiguousarray(words, dtype=numpy.uint64)
+    shift = numpy.uint64(TIME_SHIFT)
+    time = (words >> shift) & TIME_MASK
+    delta = numpy.diff(time, prepend=numpy.uint64(0)) & TIME_MASK
+    filtered = (words & FIELD_MASK) | (delta << shift)
+    planes = filtered.view(numpy.uint8).reshape(-1, 8).T
+    return numpy.ascontiguousarray(planes).view(numpy.uint64).reshape(-1)
+
+
+def decode(block):
+    """Restore the original uint64 words of a filtered block"""
+    block = numpy.ascontiguousarray(block)
+    planes = block.view(numpy.uint8).reshape(8, -1)
+    filtered = numpy.ascontiguousarray(planes.T).view(numpy.uint64).reshape(-1)
+    shift = numpy.uint64(TIME_SHIFT)
+    delta = (filtered >> shift) & TIME_MASK
+    time = numpy.cumsum(delta, dtype=numpy.uint64) & TIME_MASK
+    return (filtered & FIELD_MASK) | (time << shift)
+
+
+def decode_dataset(raw, frame_lengths):
+    """Restore the words of a prefiltered raw_N dataset
+
+    raw is the flat uint64 raw_N dataset and frame_lengths the matching
+    raw_N_frames dataset of filtered frame lengths in bytes.
+    """
+    raw = numpy.ascontiguousarray(raw, dtype=numpy.uint64)
+    words = [decode(numpy.zeros(0, dtype=numpy.uint64))]
+    start = 0
+    for length in frame_lengths:
+        end = start + int(length) // 8
+        if end > len(raw):
+            raise ValueError("raw_N_frames describes more data than raw_N holds")
+        words.append(decode(raw[start:end]))
+        start = end
+    return numpy.concatenate(words)
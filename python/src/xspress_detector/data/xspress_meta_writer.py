@@ -6,7 +6,6 @@ specific meta messages, writing them to disk.
 Alan Greer, Diamond Light Source
 """
 
-import struct
 from datetime import datetime
 import numpy
 
@@ -24,6 +23,21 @@ XSPRESS_SCALARS = "xspress_scalars"
 XSPRESS_DTC = "xspress_dtc"
 XSPRESS_INP_EST = "xspress_inp_est"
 XSPRESS_CHUNK = "xspress_meta_chunk"
+XSPRESS_META_BLOCK = "xspress_meta_block"
+
+# Packed meta block header, matches MetaBlockHeader in xspress3Definitions.h
+XSPRESS_META_BLOCK_HEADER = numpy.dtype(
+    [
+        ("version", "<u4"),
+        ("rank", "<u4"),
+        ("frame_id", "<u4"),
+        ("num_frames", "<u4"),
+        ("frame_capacity", "<u4"),
+        ("first_channel", "<u4"),
+        ("num_channels", "<u4"),
+        ("num_scalars", "<u4"),
+    ]
+)
 
 # Number of scalars per channel
 XSPRESS_SCALARS_PER_CHANNEL = 9
@@ -32,9 +46,155 @@ XSPRESS_SCALARS_PER_CHANNEL = 9
 DATASET_SCALAR = "scalar_"
 DATASET_DTC = "dtc"
 DATASET_INP_EST = "inp_est"
+DATASET_FILL_MASK = "fill_mask"
 DATASET_DAQ_VERSION = "data_version"
 DATASET_META_VERSION = "meta_version"
 
+# Minimum number of frames held by an assembly buffer
+ASSEMBLY_MIN_FRAMES = 1024
+# Maximum number of incomplete frames held before the oldest are evicted
+ASSEMBLY_MAX_FRAMES = 65536
+
+
+class FrameAssembler(object):
+    """Assemble (frames, channels) rows of one dataset from per-process slabs.
+
+    Rows are held in a preallocated ring buffer indexed by frame number. Each
+    process contributes a slab covering a range of frames and a subset of the
+    channels; once every channel of a frame has arrived the frame is complete.
+    Channels of a frame that have already been filled are not overwritten.
+    The buffer grows if frames arrive further ahead than it can hold, up to
+    max_frames. Beyond that the oldest incomplete frames, for example those
+    waiting on a process that never sends, are evicted with the channels that
+    did arrive and zeros for the rest.
+    """
+
+    def __init__(self, num_channels, dtype, capacity, max_frames=ASSEMBLY_MAX_FRAMES):
+        self._num_channels = num_channels
+        self._max_frames = max(max_frames, capacity)
+        self._values = numpy.zeros((capacity, num_channels), dtype=dtype)
+        self._filled = numpy.zeros((capacity, num_channels), dtype=bool)
+        self._counts = numpy.zeros(capacity, dtype=numpy.int64)
+        # Lowest frame that is not yet complete, and one past the highest frame held
+        self._base = 0
+        self._top = 0
+        # Number of incomplete frames evicted
+        self.evicted = 0
+
+    @property
+    def capacity(self):
+        return self._counts.shape[0]
+
+    def _reserve(self, end_frame):
+        if end_frame - self._base <= self.capacity:
+            return
+        capacity = self.capacity
+        while end_frame - self._base > capacity:
+            capacity *= 2
+        held = numpy.arange(self._base, max(self._top, self._base)) % self.capacity
+        values = numpy.zeros((capacity, self._num_channels), dtype=self._values.dtype)
+        filled = numpy.zeros((capacity, self._num_channels), dtype=bool)
+        counts = numpy.zeros(capacity, dtype=numpy.int64)
+        new_slots = numpy.arange(self._base, self._base + len(held)) % capacity
+        values[new_slots] = self._values[held]
+        filled[new_slots] = self._filled[held]
+        counts[new_slots] = self._counts[held]
+        self._values = values
+        self._filled = filled
+        self._counts = counts
+
+    def _clear(self, slots):
+        self._counts[slots] = 0
+        self._values[slots] = 0
+        self._filled[slots] = False
+
+    def _evict(self, new_base):
+        """Move the base up to new_base, returning the partly filled frames passed over.
+
+        Complete frames above the base have already been returned, so only
+        frames with some but not all channels are returned here.
+        """
+        held = min(self._top, new_base) - self._base
+        runs = []
+        if held > 0:
+            slots = (self._base + numpy.arange(held)) % self.capacity
+            partial = numpy.concatenate(
+                (
+                    [False],
+                    (self._counts[slots] > 0) & (self._counts[slots] < self._num_channels),
+                    [False],
+                )
+            )
+            edges = numpy.flatnonzero(numpy.diff(partial.astype(numpy.int8)))
+            runs = [
+                (self._base + start, self._values[slots[start:end]].copy())
+                for start, end in zip(edges[::2], edges[1::2])
+            ]
+            self.evicted += int(numpy.count_nonzero(self._counts[slots] < self._num_channels))
+            self._clear(slots)
+        self._base = new_base
+        self._top = max(self._top, self._base)
+        return runs
+
+    def _advance(self):
+        held = self._top - self._base
+        if held <= 0:
+            return
+        slots = (self._base + numpy.arange(held)) % self.capacity
+        incomplete = numpy.flatnonzero(self._counts[slots] != self._num_channels)
+        done = incomplete[0] if len(incomplete) else held
+        if done:
+            self._clear(slots[:done])
+            self._base += int(done)
+
+    def add(self, frame_id, channel, slab):
+        """Add a (frames, channels) slab starting at frame_id and channel.
+
+        Returns a list of (first_frame, rows) for each contiguous range of
+        frames completed by this slab, preceded by any incomplete frames
+        evicted to make room for it.
+        """
+        # Ignore channels beyond the row, which would otherwise count towards completion
+        slab = slab[:, : max(self._num_channels - channel, 0)]
+        if slab.shape[1] == 0:
+            return []
+        runs = []
+        end_frame = frame_id + slab.shape[0]
+        if end_frame - self._base > self._max_frames:
+            runs = self._evict(end_frame - self._max_frames)
+        if frame_id < self._base:
+            # Ignore frames which have already been completed
+            skip = self._base - frame_id
+            slab = slab[skip:]
+            frame_id = self._base
+        number_of_frames = slab.shape[0]
+        if number_of_frames == 0:
+            return runs
+        self._reserve(frame_id + number_of_frames)
+        self._top = max(self._top, frame_id + number_of_frames)
+
+        # Only fill channels that have not already arrived, so duplicates cannot complete a frame
+        slots = numpy.arange(frame_id, frame_id + number_of_frames) % self.capacity
+        last = channel + slab.shape[1]
+        fresh = ~self._filled[slots, channel:last]
+        self._values[slots, channel:last] = numpy.where(
+            fresh, slab, self._values[slots, channel:last]
+        )
+        self._filled[slots, channel:last] = True
+        self._counts[slots] = numpy.count_nonzero(self._filled[slots], axis=1)
+
+        # Find the contiguous runs of frames completed by this slab
+        complete = numpy.concatenate(
+            ([False], self._counts[slots] == self._num_channels, [False])
+        )
+        edges = numpy.flatnonzero(numpy.diff(complete.astype(numpy.int8)))
+        runs += [
+            (frame_id + start, self._values[slots[start:end]])
+            for start, end in zip(edges[::2], edges[1::2])
+        ]
+        self._advance()
+        return runs
+
 
 class XspressMetaWriter(MetaWriter):
     """Implementation of MetaWriter that also handles Xspress meta messages"""
@@ -47,19 +207,8 @@ class XspressMetaWriter(MetaWriter):
         self._num_frames = 1
         self._configured = 0
         self._chunk_index = numpy.zeros(len(endpoints), dtype=int)
-        self._scalars = {
-            0: {},
-            1: {},
-            2: {},
-            3: {},
-            4: {},
-            5: {},
-            6: {},
-            7: {},
-            8: {}
-        }
-        self._dtc = {}
-        self._inp = {}
+        # Frame x channel assembly buffers, one for each dataset
+        self._assemblers = {}
         super(XspressMetaWriter, self).__init__(name, directory, endpoints, config)
 
         self._series = None
@@ -71,8 +220,10 @@ class XspressMetaWriter(MetaWriter):
         for index in range(XSPRESS_SCALARS_PER_CHANNEL):
             scalar_name = "{}{}".format(DATASET_SCALAR, index)
             self._logger.info("Adding dataset: {}".format(scalar_name))
+            # The scalars are unsigned 32 bit counts, stored as 64 bit so
+            # that values above 2^31 are not wrapped negative
             dsets.append(
-                Int32HDF5Dataset(
+                Int64HDF5Dataset(
                     scalar_name,
                     shape=(self._num_frames, self._num_channels),
                     maxshape=(None, self._num_channels),
@@ -106,6 +257,18 @@ class XspressMetaWriter(MetaWriter):
                 block_size=self._chunk_size,
             )
         )
+        self._logger.info("Adding dataset: {}".format(DATASET_FILL_MASK))
+        dsets.append(
+            Int32HDF5Dataset(
+                DATASET_FILL_MASK,
+                shape=(self._num_frames, self._num_channels),
+                maxshape=(None, self._num_channels),
+                chunks=(self._chunk_size, self._num_channels),
+                rank=2,
+                cache=True,
+                block_size=self._chunk_size,
+            )
+        )
         dsets.append(Int64HDF5Dataset(DATASET_DAQ_VERSION))
         dsets.append(Int64HDF5Dataset(DATASET_META_VERSION))
         return dsets
@@ -117,133 +280,134 @@ class XspressMetaWriter(MetaWriter):
             XSPRESS_DTC: self.handle_xspress_dtc,
             XSPRESS_INP_EST: self.handle_xspress_inp_est,
             XSPRESS_CHUNK: self.handle_xspress_meta_chunk,
+            XSPRESS_META_BLOCK: self.handle_xspress_meta_block,
         }
 
+    def handle_xspress_meta_block(self, header, _data):
+        """Handle a packed block of scalars, dtc factors and input estimates"""
+        self._logger.debug("%s | Handling xspress meta block message", self._name)
+        block = numpy.frombuffer(_data, dtype=XSPRESS_META_BLOCK_HEADER, count=1)[0]
+        frame_id = int(block["frame_id"])
+        number_of_frames = int(block["num_frames"])
+        channel = int(block["first_channel"])
+        number_of_channels = int(block["num_channels"])
+        number_of_scalars = int(block["num_scalars"])
+        frame_capacity = int(block["frame_capacity"])
+        capacity = frame_capacity * number_of_channels
+
+        # Each array is sized by the block capacity, only number_of_frames rows are valid
+        offset = XSPRESS_META_BLOCK_HEADER.itemsize
+        dtc = numpy.frombuffer(
+            _data, dtype="<f8", count=number_of_frames * number_of_channels, offset=offset
+        ).reshape(number_of_frames, number_of_channels)
+        offset += capacity * 8
+        inp_est = numpy.frombuffer(
+            _data, dtype="<f8", count=number_of_frames * number_of_channels, offset=offset
+        ).reshape(number_of_frames, number_of_channels)
+        offset += capacity * 8
+        # The scalars are published as uint32 by XspressProcessPlugin
+        scalars = numpy.frombuffer(
+            _data,
+            dtype="<u4",
+            count=number_of_frames * number_of_channels * number_of_scalars,
+            offset=offset,
+        ).reshape(number_of_frames, number_of_channels, number_of_scalars)
+        offset += capacity * XSPRESS_SCALARS_PER_CHANNEL * 4
+        fill_mask = numpy.frombuffer(_data, dtype="u1", count=number_of_frames, offset=offset)
+        if not fill_mask.all():
+            self._logger.warning(
+                "%s | Block at frame %d is missing %d frames",
+                self._name,
+                frame_id,
+                number_of_frames - numpy.count_nonzero(fill_mask),
+            )
+
+        self._add_slab(
+            DATASET_FILL_MASK,
+            frame_id,
+            channel,
+            numpy.repeat(fill_mask.astype("<i4")[:, None], number_of_channels, axis=1),
+        )
+        self._add_slab(DATASET_DTC, frame_id, channel, dtc)
+        self._add_slab(DATASET_INP_EST, frame_id, channel, inp_est)
+        for index in range(min(number_of_scalars, XSPRESS_SCALARS_PER_CHANNEL)):
+            self._add_slab(
+                "{}{}".format(DATASET_SCALAR, index), frame_id, channel, scalars[:, :, index]
+            )
+
+        self._flush_if_due()
+
     def handle_xspress_scalars(self, header, _data):
-        """Handle global header message part 1"""
+        """Handle a block of scalars from an older frame processor"""
         self._logger.debug("%s | Handling xspress scalar message", self._name)
         self._logger.debug("{}".format(header))
-        # Extract the channel number from the header
-        channel = header['channel_index']
-
-        format_str = '{}i'.format(header['qty_scalars']*header['number_of_frames'])
-        array = struct.unpack(format_str, _data)
-
-        # Number of channels 
         number_of_channels = header['number_of_channels']
-        # Number of frames
         number_of_frames = header['number_of_frames']
-        # Frame ID
-        frame_id = header['frame_id']
-        for frame in range(number_of_frames):
-            current_frame_id = frame_id + frame
-            frame_index = frame*number_of_channels*XSPRESS_SCALARS_PER_CHANNEL
-            frame_array = array[frame_index:frame_index+(number_of_channels*XSPRESS_SCALARS_PER_CHANNEL)]
-            for index in range(number_of_channels):
-                arr_index = index*XSPRESS_SCALARS_PER_CHANNEL
-                scalars = frame_array[arr_index:arr_index+XSPRESS_SCALARS_PER_CHANNEL]
-                dataset_name = "{}{}".format(DATASET_SCALAR, channel+index)
-                for scalar_index in range(9):
-                    self.add_scalar_value(current_frame_id, channel+index, scalar_index, scalars[scalar_index])
-            
-        if (datetime.now() - self._flush_time).total_seconds() > 1.0:
-            self._flush_datasets()
-            self._flush_time = datetime.now()
-
-    def add_scalar_value(self, frame, channel, scalar, value):
-        # Check if we have an entry for the scalar
-        obj = self._scalars[scalar]
-        if frame not in obj:
-            obj[frame] = {
-                'qty': 0,
-                'values': [0] * self._num_channels
-            }
-
-        obj[frame]['values'][channel] = value
-        obj[frame]['qty'] += 1
-
-        if obj[frame]['qty'] == self._num_channels:
-            dataset_name = "{}{}".format(DATASET_SCALAR, scalar)
-            self._add_value(dataset_name, obj[frame]['values'], offset=frame)
-            del obj[frame]
+        scalars = numpy.frombuffer(_data, dtype="<u4").reshape(
+            number_of_frames, number_of_channels, XSPRESS_SCALARS_PER_CHANNEL
+        )
+        for index in range(XSPRESS_SCALARS_PER_CHANNEL):
+            self._add_slab(
+                "{}{}".format(DATASET_SCALAR, index),
+                header['frame_id'],
+                header['channel_index'],
+                scalars[:, :, index],
+            )
 
-        self._scalars[scalar] = obj
+        self._flush_if_due()
 
     def handle_xspress_dtc(self, header, _data):
-        """Handle global header message part 1"""
+        """Handle a block of dtc factors from an older frame processor"""
         self._logger.debug("%s | Handling xspress dtc message", self._name)
         self._logger.debug("{}".format(header))
-        # Extract the channel number from the header
-        channel = header['channel_index']
-        # Extract Number of channels 
-        number_of_channels = header['number_of_channels']
-        # Number of frames
-        number_of_frames = header['number_of_frames']
-        # Frame ID
-        frame_id = header['frame_id']
-
-        format_str = '{}d'.format(number_of_channels*number_of_frames)
-        array = struct.unpack(format_str, _data)
-
-        for frame in range(number_of_frames):
-            current_frame_id = frame_id + frame
-            frame_index = frame*number_of_channels
-            frame_array = array[frame_index:frame_index+number_of_channels]
-            for index in range(number_of_channels):
-                self.add_dtc_value(current_frame_id, channel+index, frame_array[index])
-
-    def add_dtc_value(self, frame, channel, value):
-        # Check if we need to create an entry for this frame
-        if frame not in self._dtc:
-            self._dtc[frame] = {
-                'qty': 0,
-                'values': [0] * self._num_channels
-            }
-
-        self._dtc[frame]['values'][channel] = value
-        self._dtc[frame]['qty'] += 1
-
-        if self._dtc[frame]['qty'] == self._num_channels:
-            self._add_value(DATASET_DTC, self._dtc[frame]['values'], offset=frame)
-            del self._dtc[frame]
+        dtc = numpy.frombuffer(_data, dtype="<f8").reshape(
+            header['number_of_frames'], header['number_of_channels']
+        )
+        self._add_slab(DATASET_DTC, header['frame_id'], header['channel_index'], dtc)
 
     def handle_xspress_inp_est(self, header, _data):
-        """Handle global header message part 1"""
-        self._logger.debug("%s | Handling xspress dtc message", self._name)
+        """Handle a block of input estimates from an older frame processor"""
+        self._logger.debug("%s | Handling xspress inp_est message", self._name)
         self._logger.debug("{}".format(header))
-        # Extract the channel number from the header
-        channel = header['channel_index']
-        # Extract Number of channels 
-        number_of_channels = header['number_of_channels']
-        # Number of frames
-        number_of_frames = header['number_of_frames']
-        # Frame ID
-        frame_id = header['frame_id']
-
-        format_str = '{}d'.format(number_of_channels*number_of_frames)
-        array = struct.unpack(format_str, _data)
-
-        for frame in range(number_of_frames):
-            current_frame_id = frame_id + frame
-            frame_index = frame*number_of_channels
-            frame_array = array[frame_index:frame_index+number_of_channels]
-            for index in range(number_of_channels):
-                self.add_inp_est_value(current_frame_id, channel+index, frame_array[index])
-
-    def add_inp_est_value(self, frame, channel, value):
-        # Check if we need to create an entry for this frame
-        if frame not in self._inp:
-            self._inp[frame] = {
-                'qty': 0,
-                'values': [0] * self._num_channels
-            }
-
-        self._inp[frame]['values'][channel] = value
-        self._inp[frame]['qty'] += 1
-
-        if self._inp[frame]['qty'] == self._num_channels:
-            self._add_value(DATASET_INP_EST, self._inp[frame]['values'], offset=frame)
-            del self._inp[frame]
+        inp_est = numpy.frombuffer(_data, dtype="<f8").reshape(
+            header['number_of_frames'], header['number_of_channels']
+        )
+        self._add_slab(DATASET_INP_EST, header['frame_id'], header['channel_index'], inp_est)
+
+    def _add_slab(self, dataset_name, frame_id, channel, slab):
+        """Add a (frames, channels) slab and write any completed frame ranges"""
+        if channel == 0 and slab.shape[1] == self._num_channels and dataset_name not in self._assemblers:
+            # This slab holds every channel, so no assembly is required
+            self._write_rows(dataset_name, frame_id, slab)
+            return
+        if dataset_name not in self._assemblers:
+            self._assemblers[dataset_name] = FrameAssembler(
+                self._num_channels,
+                slab.dtype,
+                max(ASSEMBLY_MIN_FRAMES, self._chunk_size * 4),
+            )
+        assembler = self._assemblers[dataset_name]
+        evicted = assembler.evicted
+        for first_frame, rows in assembler.add(frame_id, channel, slab):
+            self._write_rows(dataset_name, first_frame, rows)
+        if assembler.evicted > evicted:
+            self._logger.warning(
+                "%s | Evicted %d incomplete frames of %s waiting on missing channels",
+                self._name,
+                assembler.evicted - evicted,
+                dataset_name,
+            )
+
+    def _write_rows(self, dataset_name, first_frame, rows):
+        """Write a contiguous range of complete frames to a dataset"""
+        for row in range(rows.shape[0]):
+            self._add_value(dataset_name, rows[row], offset=first_frame + row)
+
+    def _flush_if_due(self):
+        if (datetime.now() - self._flush_time).total_seconds() > 1.0:
+            self._flush_datasets()
+            self._flush_time = datetime.now()
+
     def handle_xspress_meta_chunk(self, header, _data):
         self._chunk_size = int(_data)
         if header["frame_id"] == -1 and self._configured == 0: